@@ -36,6 +36,10 @@ static const char	drt_debug_h_id[] =
 #endif
 
 #if DEBUG
+ #include <stdio.h>
+
+ extern int	opt_debug;		/* Enables DL() tracing		*/
+
  #define DL(e)	(opt_debug ? (void)(e) : (void)0)
 #else
  #define DL(e)	((void)0)
@@ -10,7 +10,19 @@
 *	the UNIX command shells.
 *
 *	`DELIM' must be defined to 1 if pathname separators are to be handled
-*	explicitly.
+*	explicitly.  This, and the UNIX or DOS conventions, apply only to
+*	patterns that are not compiled by fpattern_compile_flags().
+*
+*	`FPAT_SIMD' may be defined to 0 to disable the SSE2 and AVX2 versions
+*	of the char scanning kernels.
+*
+*	`FPAT_NOCACHE' may be defined to leave out the cache of compiled
+*	patterns (see fpattern_cache_size()), which needs GCC atomics.
+*
+*	`FPAT_STATS' may be defined to 1 to count the names matched, the work
+*	done matching them, and the use of the lazy DFA caches, in counters
+*	kept by each thread (see fpattern_stats_get()).  This needs GCC
+*	atomics and thread-local storage, and on UNIX, POSIX threads.
 *
 * History
 *	1.0, 1997-01-03, David Tribble.
@@ -68,12 +80,14 @@ static const char	copyright[] =
 /* System includes */
 
 #include <ctype.h>
+#include <limits.h>
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
 #if TEST
  #include <locale.h>
  #include <stdio.h>
- #include <string.h>
 #endif
 
 #if defined(unix) || defined(_unix) || defined(__unix)
@@ -86,6 +100,44 @@ static const char	copyright[] =
  #error Cannot ascertain the O/S from predefined macros
 #endif
 
+#ifndef FPAT_SIMD
+ #define FPAT_SIMD	1
+#endif
+
+#if FPAT_SIMD  &&  defined(__GNUC__)  &&  defined(__SSE2__)  &&  \
+    (defined(__x86_64__) || defined(__i386__))
+ #define SSE2	1
+ #include <immintrin.h>
+#else
+ #define SSE2	0
+#endif
+
+#if SSE2  &&  (__GNUC__ >= 5  ||  defined(__clang__))
+ #define AVX2	1
+#else
+ #define AVX2	0
+#endif
+
+#if defined(__GNUC__)  &&  !defined(FPAT_NOCACHE)
+ #define CACHE	1
+#else
+ #define CACHE	0
+#endif
+
+#ifndef FPAT_STATS
+ #define FPAT_STATS	0
+#endif
+
+#if FPAT_STATS  &&  defined(__GNUC__)
+ #define STATS	1
+#else
+ #define STATS	0
+#endif
+
+#if STATS  &&  UNIX
+ #include <pthread.h>
+#endif
+
 
 /* Local includes */
 
@@ -132,47 +184,555 @@ static const char	copyright[] =
  #define QUOTE		FPAT_QUOTE2
 #endif
 
+#if UNIX
+ #define NATIVE		(DELIM ? FPAT_DELIM : 0)
+#else /*DOS*/
+ #define NATIVE		(FPAT_NOCASE | FPAT_WINSEP | FPAT_BQUOTE | \
+			 (DELIM ? FPAT_DELIM : 0))
+#endif
+
 
 /* Local function macros */
 
 #if UNIX
  #define lowercase(c)	(c)
 #else /*DOS*/
- #define lowercase(c)	tolower(c)
+ #define lowercase(c)	((char) fpat_fold[(unsigned char) (c)])
+#endif
+
+#define quotech(f)	((f) & FPAT_BQUOTE ? FPAT_QUOTE2 : FPAT_QUOTE)
+#define delch2(f)	((f) & FPAT_WINSEP ? FPAT_DEL2 : FPAT_DEL)
+
+#define ONES		(~0UL / 0xFF)	/* 0x01 in every byte		*/
+#define HIGHS		(ONES * 0x80)	/* 0x80 in every byte		*/
+
+#define setbit(s, c)	((s)[(c) >> 3] |= (unsigned char) (1 << ((c) & 7)))
+#define inset(s, c)	((s)[(c) >> 3] & (1 << ((c) & 7)))
+
+#if STATS
+ #define STAT_ADD(f, n)	fpattern_stats_add(&fpattern_mystats()->f, (n))
+ #define STAT_NAME(rc, cost)	fpattern_stats_name((rc), (cost))
+#else
+ #define STAT_ADD(f, n)	((void) (n))
+ #define STAT_NAME(rc, cost)	((void) 0)
+#endif
+
+
+/* Compiled pattern opcodes */
+
+#define FPI_MATCH	0		/* End of pattern		*/
+#define FPI_CHAR	1		/* Match a (folded) char	*/
+#define FPI_ANY		2		/* Match any nondelimiter	*/
+#define FPI_SET		3		/* Match a char set/range	*/
+#define FPI_DEL		4		/* Match a path delimiter	*/
+#define FPI_CLOS	5		/* Zero or more nondelimiters	*/
+#define FPI_SUB		6		/* Zero or more non-dot chars	*/
+#define FPI_NOT		7		/* Negate rest of pattern	*/
+#define FPI_FAIL	8		/* Never matches		*/
+#define FPI_ALL		9		/* Zero or more chars, even '/'	*/
+#define FPI_FORK	10		/* Skip "**" + "/" if no dirs	*/
+#define FPI_ALT		11		/* Start of alternatives	*/
+#define FPI_OR		12		/* Start of next alternative	*/
+#define FPI_JMP		13		/* End of an alternative	*/
+#define FPI_END		14		/* End of alternatives		*/
+
+
+/* Compiled pattern matching engines */
+
+#define FPE_STAR	0		/* Last-star backtracking	*/
+#define FPE_NFA		1		/* Bit-parallel NFA		*/
+#define FPE_NOT		2		/* Backward NFA, per subpattern	*/
+
+#define FPAT_LIT_MAX	16		/* Max prefilter literal chars	*/
+#define NOALT		(UCHAR_MAX+1)	/* Several chars fold to 'ch'	*/
+
+#define FPAT_UCLASS	128		/* Max non-ASCII char classes	*/
+#define FPAT_DEEP	16		/* Max "**" closures remembered	*/
+#define FPAT_CHASH	1024		/* Pattern cache hash chains	*/
+#define FPAT_STRIPES	16		/* Pattern cache reader counters */
+#define UMAX		0x10FFFFL	/* Highest Unicode code point	*/
+#define UBAD		0xDC00L		/* Plus byte, for invalid UTF-8	*/
+
+#define WBITS		((int) (sizeof(fpat_word) * CHAR_BIT))
+#define MAXW		8		/* Max state words on the stack	*/
+
+#define wbit(v, i)	(((v)[(i) / WBITS] >> ((i) % WBITS)) & 1)
+#define wset(v, i)	((v)[(i) / WBITS] |= (fpat_word) 1 << ((i) % WBITS))
+
+
+/* Local types */
+
+typedef unsigned long	fpat_word;	/* NFA state vector word	*/
+
+struct fpat_ins
+{
+    unsigned char	op;		/* Opcode, FPI_XXX		*/
+    unsigned char	ch;		/* Folded char, for FPI_CHAR	*/
+    unsigned int	arg;		/* Set index, for FPI_SET; other
+					   char folding to 'ch', or NOALT,
+					   for FPI_CHAR; jump target, or
+					   0, for FPI_ALT/OR/JMP	*/
+};
+
+struct fpattern_prog
+{
+    int			nins;		/* Instructions, incl FPI_MATCH	*/
+    int			nsets;		/* Char set bitmaps		*/
+    int			engine;		/* Matching engine, FPE_XXX	*/
+    int			flags;		/* Matching flags, FPAT_XXX	*/
+    int			words;		/* NFA state vector words	*/
+    fpat_word *		cons;		/* [256][words] consuming states */
+    fpat_word *		loop;		/* [256][words] closure loops	*/
+    fpat_word *		star;		/* [words] closure states	*/
+    fpat_word *		fork;		/* [words] "**" fork states	*/
+    fpat_word *		init;		/* [words] start states		*/
+    fpat_word *		fin;		/* [words] final states		*/
+    fpat_word *		eps;		/* [words*8][256] closures of each
+					   state vector byte, or null	*/
+    struct fpat_ins *	ins;		/* Instructions			*/
+    int			njumps;		/* Jumps between alternatives	*/
+    int *		jump;		/* [njumps] jumping instructions */
+    unsigned char	(*sets)[32];	/* Char set bitmaps		*/
+    unsigned char	anyset[32];	/* Chars matched by '?', '*'	*/
+    unsigned char	subset[32];	/* Chars matched by SUB		*/
+    unsigned char	delset[32];	/* Path delimiter chars		*/
+    unsigned char	fold[256];	/* Case folding table		*/
+    size_t		minlen;		/* Shortest matching name	*/
+    size_t		maxlen;		/* Longest matching name, or -1	*/
+    int			exact;		/* Literals need no folding	*/
+    int			npre;		/* Literal prefix chars		*/
+    int			nsuf;		/* Literal suffix chars		*/
+    int			nlit;		/* Inner literal chars		*/
+    int			litalt;		/* Other char folding to lit[0], or
+					   NOALT			*/
+    int			ascii;		/* ASCII names fold A-Z only	*/
+    size_t		mindel;		/* Fewest path delimiters	*/
+    size_t		maxdel;		/* Most path delimiters, or -1	*/
+    unsigned char	pre[FPAT_LIT_MAX];	/* Literal prefix (folded) */
+    unsigned char	suf[FPAT_LIT_MAX];	/* Literal suffix (folded) */
+    unsigned char	lit[FPAT_LIT_MAX];	/* Inner literal (folded) */
+    int			ufind;		/* Finding the UTF-8 char classes */
+    int			nucls;		/* Non-ASCII char classes	*/
+    long		ucls[FPAT_UCLASS];	/* First code point of each */
+};
+
+struct fpattern_dfa
+{
+    const fpattern_t *	prog;		/* Compiled pattern		*/
+    int			nclass;		/* Name char classes		*/
+    int			nstates;	/* Cached DFA states		*/
+    int			maxstates;	/* Max states within mem limit	*/
+    int			cap;		/* Allocated DFA states		*/
+    int			hsize;		/* Hash slots, a power of 2	*/
+    int			start;		/* Start state, or -1		*/
+    int			dead;		/* Dead state, or -1		*/
+    int			flushed;	/* Cache flushed for this name	*/
+    int *		next;		/* [cap][nclass] next states	*/
+    fpat_word *		vecs;		/* [cap][words] NFA states	*/
+    int *		hash;		/* [hsize] state+1, or 0	*/
+    fpat_word *		tmp;		/* [2][words] scratch NFA states */
+    unsigned char	cls[256];	/* Name char classes		*/
+};
+
+struct fpat_group
+{
+    int			kind;		/* Key length, plus FPAT_KEY_PRE */
+    unsigned char	key[4];		/* Literal suffix/prefix (folded) */
+    int			n;		/* Patterns in group		*/
+    fpattern_t *	prog;		/* Combined patterns		*/
+    fpattern_dfa_t *	dfa;		/* Lazy DFA of 'prog'		*/
+    int *		pid;		/* [nins] pattern of final state */
+};
+
+struct fpattern_set
+{
+    int			npats;		/* Patterns in set		*/
+    int			ngroups;	/* Pattern groups		*/
+    struct fpat_group *	groups;		/* [ngroups] groups, by key	*/
+    int			hsize;		/* Hash slots, a power of 2	*/
+    int *		hash;		/* [hsize] group+1, or 0	*/
+    int			nempty;		/* Empty patterns		*/
+    int *		empty;		/* [nempty] empty pattern ids	*/
+    int			nslow;		/* Patterns matched one by one	*/
+    fpattern_t **	slow;		/* [nslow] compiled patterns	*/
+    int *		slowid;		/* [nslow] pattern ids		*/
+    unsigned char	fold[256];	/* Case folding table		*/
+};
+
+struct fpattern_walk
+{
+    const fpattern_t *	prog;		/* Compiled pattern		*/
+    int			words;		/* NFA state vector words	*/
+    int			depth;		/* Directory names pushed	*/
+    int			cap;		/* Allocated state vectors	*/
+    fpat_word *		vecs;		/* [cap][words] NFA states at the
+					   end of each directory level	*/
+    fpat_word *		tmp;		/* [words] scratch NFA states	*/
+    size_t *		ends;		/* [cap] path length at each level */
+    char *		path;		/* [size] path chars, for FPE_NOT,
+					   or null			*/
+    size_t		size;		/* Allocated path chars		*/
+};
+
+struct fpat_inode
+{
+    size_t		lab;		/* Label, offset into 'chars'	*/
+    size_t		kids;		/* First child node		*/
+    unsigned int	len;		/* Label chars			*/
+    unsigned int	nkids;		/* Child nodes			*/
+    int			key;		/* A name ends here		*/
+};
+
+struct fpattern_index
+{
+    size_t		nkeys;		/* Names indexed		*/
+    size_t		nnodes;		/* Trie nodes, root first	*/
+    struct fpat_inode *	nodes;		/* [nnodes] trie nodes, with the
+					   children of each together	*/
+    size_t		nchars;		/* Label chars			*/
+    char *		chars;		/* [nchars] node labels		*/
+    size_t		maxlen;		/* Longest name			*/
+    int			height;		/* Most nodes on a path		*/
+};
+
+struct fpat_iquery
+{
+    const fpattern_index_t *	index;	/* Index being queried		*/
+    const fpattern_t *	prog;		/* Query pattern		*/
+    fpattern_glob_f	fn;		/* Match function, or null	*/
+    void *		arg;		/* Match function arg		*/
+    fpat_word *		vecs;		/* [height+1][words] NFA states,
+					   by trie level		*/
+    fpat_word *		tmp;		/* [words] scratch NFA states	*/
+    char *		path;		/* [maxlen+1] name being visited */
+    long		count;		/* Matching names		*/
+    int			stop;		/* Stop the query		*/
+};
+
+struct fpat_sub
+{
+    unsigned long	steps;		/* Steps left			*/
+    const char *	pat;		/* Start of pattern		*/
+    const char *	base;		/* Start of filename		*/
+    fpattern_span_t *	spans;		/* [maxspans] wildcard spans	*/
+    int			maxspans;	/* Size of 'spans'		*/
+    int			nw;		/* Wildcards before subpattern	*/
+    int			alt;		/* Alternatives being matched	*/
+    const char *	deep[FPAT_DEEP];	/* Where each "**" failed */
+};
+
+struct fpat_trie
+{
+    const fpattern_t *	prog;		/* Parsed pattern		*/
+    struct fpat_ins *	out;		/* Factored instructions, or null */
+    int			n;		/* Instructions emitted		*/
+    int *		beg;		/* Start of each alternative	*/
+    int *		end;		/* End of each alternative	*/
+    int			top;		/* Alternatives in use		*/
+};
+
+struct fpat_urun
+{
+    long		first;		/* First code point of the run	*/
+    int			count;		/* Code points in the run	*/
+    int			stride;		/* Distance between them	*/
+    long		delta;		/* Added to fold each of them	*/
+};
+
+struct fpat_hits
+{
+    unsigned char *	bits;		/* Match bitmap, or null	*/
+    int *		ids;		/* Matching pattern ids, or null */
+    int			maxids;		/* Size of 'ids'		*/
+    int			count;		/* Matching patterns		*/
+};
+
+struct fpat_centry
+{
+    struct fpat_centry *	next;	/* Next entry in hash chain	*/
+    struct fpat_centry *	cnext;	/* Next entry in clock ring, or
+					   next retired entry		*/
+    struct fpat_centry *	cprev;	/* Previous entry in clock ring	*/
+    fpattern_t *	prog;		/* Compiled pattern, or null if
+					   the pattern is invalid	*/
+    size_t		size;		/* Memory held			*/
+    unsigned long	hash;		/* Hash of pattern and flags	*/
+    int			flags;		/* Matching flags, FPAT_XXX	*/
+    int			ref;		/* Matched since the clock hand
+					   last passed			*/
+    size_t		len;		/* Pattern length		*/
+    char		pat[1];		/* [len] pattern chars		*/
+};
+
+struct fpat_stripe
+{
+    unsigned long	readers[2];	/* Threads matching, by phase	*/
+    unsigned long	hits;		/* Patterns found in the cache	*/
+    unsigned long	misses;		/* Patterns not found		*/
+    char		pad[64 - 4*sizeof(unsigned long)];
+					/* Own cache line		*/
+};
+
+struct fpat_tstats
+{
+    fpattern_stats_t		s;	/* Counters			*/
+    struct fpat_tstats *	next;	/* Next thread's counters	*/
+    int				free;	/* Thread has exited		*/
+};
+
+
+/* Public variables */
+
+#if DEBUG
+int			opt_debug =	true;	/* Enables DL() tracing	*/
+#endif
+
+
+/* Local variables */
+
+static int		fpat_snap =	false;	/* 'fpat_fold' is loaded */
+static unsigned char	fpat_fold[256];		/* Locale lowercase	*/
+#if defined(__GNUC__)
+static char		fpat_sbusy;		/* Snapshot lock	*/
+#endif
+
+#if CACHE
+/* Compiled pattern cache, whose chains are read without locking */
+static struct fpat_centry *	fpat_chash[FPAT_CHASH];	/* Hash chains	*/
+static struct fpat_centry *	fpat_chand;	/* Clock hand, or null	*/
+static struct fpat_centry *	fpat_cpend;	/* Retired this phase	*/
+static struct fpat_centry *	fpat_cold;	/* Retired last phase	*/
+static size_t		fpat_cmax;		/* Memory limit, or 0	*/
+static size_t		fpat_cused;		/* Memory held		*/
+static size_t		fpat_ccount;		/* Patterns held	*/
+static unsigned long	fpat_cevict;		/* Patterns evicted	*/
+static unsigned long	fpat_cphase;		/* Reader phase		*/
+static char		fpat_cbusy;		/* Writer lock		*/
+static int		fpat_cthreads;		/* Threads seen		*/
+static __thread int	fpat_cthread =	-1;	/* This thread's stripe	*/
+static struct fpat_stripe	fpat_stripe[FPAT_STRIPES];
+						/* Reader counters	*/
 #endif
 
+#if STATS
+/* Matching counters, written only by their own thread, summed when read */
+static struct fpat_tstats *	fpat_stats;		/* All threads	*/
+static __thread struct fpat_tstats *	fpat_tstat;	/* This thread	*/
+static __thread fpattern_stats_t	fpat_nostats;	/* No memory	*/
+#if UNIX
+static pthread_key_t	fpat_skey;		/* Thread exit hook	*/
+static pthread_once_t	fpat_sonce =	PTHREAD_ONCE_INIT;
+#endif
+#endif
+
+/* Unicode 14.0 simple case folding (CaseFolding.txt, status C and S) */
+static const struct fpat_urun	fpat_ucase[] =
+{
+    { 0x00041L, 26, 1,     32L },  { 0x000B5L,  1, 1,    775L },
+    { 0x000C0L, 23, 1,     32L },  { 0x000D8L,  7, 1,     32L },
+    { 0x00100L, 24, 2,      1L },  { 0x00132L,  3, 2,      1L },
+    { 0x00139L,  8, 2,      1L },  { 0x0014AL, 23, 2,      1L },
+    { 0x00178L,  1, 1,   -121L },  { 0x00179L,  3, 2,      1L },
+    { 0x0017FL,  1, 1,   -268L },  { 0x00181L,  1, 1,    210L },
+    { 0x00182L,  2, 2,      1L },  { 0x00186L,  1, 1,    206L },
+    { 0x00187L,  1, 1,      1L },  { 0x00189L,  2, 1,    205L },
+    { 0x0018BL,  1, 1,      1L },  { 0x0018EL,  1, 1,     79L },
+    { 0x0018FL,  1, 1,    202L },  { 0x00190L,  1, 1,    203L },
+    { 0x00191L,  1, 1,      1L },  { 0x00193L,  1, 1,    205L },
+    { 0x00194L,  1, 1,    207L },  { 0x00196L,  1, 1,    211L },
+    { 0x00197L,  1, 1,    209L },  { 0x00198L,  1, 1,      1L },
+    { 0x0019CL,  1, 1,    211L },  { 0x0019DL,  1, 1,    213L },
+    { 0x0019FL,  1, 1,    214L },  { 0x001A0L,  3, 2,      1L },
+    { 0x001A6L,  1, 1,    218L },  { 0x001A7L,  1, 1,      1L },
+    { 0x001A9L,  1, 1,    218L },  { 0x001ACL,  1, 1,      1L },
+    { 0x001AEL,  1, 1,    218L },  { 0x001AFL,  1, 1,      1L },
+    { 0x001B1L,  2, 1,    217L },  { 0x001B3L,  2, 2,      1L },
+    { 0x001B7L,  1, 1,    219L },  { 0x001B8L,  1, 1,      1L },
+    { 0x001BCL,  1, 1,      1L },  { 0x001C4L,  1, 1,      2L },
+    { 0x001C5L,  1, 1,      1L },  { 0x001C7L,  1, 1,      2L },
+    { 0x001C8L,  1, 1,      1L },  { 0x001CAL,  1, 1,      2L },
+    { 0x001CBL,  9, 2,      1L },  { 0x001DEL,  9, 2,      1L },
+    { 0x001F1L,  1, 1,      2L },  { 0x001F2L,  2, 2,      1L },
+    { 0x001F6L,  1, 1,    -97L },  { 0x001F7L,  1, 1,    -56L },
+    { 0x001F8L, 20, 2,      1L },  { 0x00220L,  1, 1,   -130L },
+    { 0x00222L,  9, 2,      1L },  { 0x0023AL,  1, 1,  10795L },
+    { 0x0023BL,  1, 1,      1L },  { 0x0023DL,  1, 1,   -163L },
+    { 0x0023EL,  1, 1,  10792L },  { 0x00241L,  1, 1,      1L },
+    { 0x00243L,  1, 1,   -195L },  { 0x00244L,  1, 1,     69L },
+    { 0x00245L,  1, 1,     71L },  { 0x00246L,  5, 2,      1L },
+    { 0x00345L,  1, 1,    116L },  { 0x00370L,  2, 2,      1L },
+    { 0x00376L,  1, 1,      1L },  { 0x0037FL,  1, 1,    116L },
+    { 0x00386L,  1, 1,     38L },  { 0x00388L,  3, 1,     37L },
+    { 0x0038CL,  1, 1,     64L },  { 0x0038EL,  2, 1,     63L },
+    { 0x00391L, 17, 1,     32L },  { 0x003A3L,  9, 1,     32L },
+    { 0x003C2L,  1, 1,      1L },  { 0x003CFL,  1, 1,      8L },
+    { 0x003D0L,  1, 1,    -30L },  { 0x003D1L,  1, 1,    -25L },
+    { 0x003D5L,  1, 1,    -15L },  { 0x003D6L,  1, 1,    -22L },
+    { 0x003D8L, 12, 2,      1L },  { 0x003F0L,  1, 1,    -54L },
+    { 0x003F1L,  1, 1,    -48L },  { 0x003F4L,  1, 1,    -60L },
+    { 0x003F5L,  1, 1,    -64L },  { 0x003F7L,  1, 1,      1L },
+    { 0x003F9L,  1, 1,     -7L },  { 0x003FAL,  1, 1,      1L },
+    { 0x003FDL,  3, 1,   -130L },  { 0x00400L, 16, 1,     80L },
+    { 0x00410L, 32, 1,     32L },  { 0x00460L, 17, 2,      1L },
+    { 0x0048AL, 27, 2,      1L },  { 0x004C0L,  1, 1,     15L },
+    { 0x004C1L,  7, 2,      1L },  { 0x004D0L, 48, 2,      1L },
+    { 0x00531L, 38, 1,     48L },  { 0x010A0L, 38, 1,   7264L },
+    { 0x010C7L,  1, 1,   7264L },  { 0x010CDL,  1, 1,   7264L },
+    { 0x013F8L,  6, 1,     -8L },  { 0x01C80L,  1, 1,  -6222L },
+    { 0x01C81L,  1, 1,  -6221L },  { 0x01C82L,  1, 1,  -6212L },
+    { 0x01C83L,  2, 1,  -6210L },  { 0x01C85L,  1, 1,  -6211L },
+    { 0x01C86L,  1, 1,  -6204L },  { 0x01C87L,  1, 1,  -6180L },
+    { 0x01C88L,  1, 1,  35267L },  { 0x01C90L, 43, 1,  -3008L },
+    { 0x01CBDL,  3, 1,  -3008L },  { 0x01E00L, 75, 2,      1L },
+    { 0x01E9BL,  1, 1,    -58L },  { 0x01E9EL,  1, 1,  -7615L },
+    { 0x01EA0L, 48, 2,      1L },  { 0x01F08L,  8, 1,     -8L },
+    { 0x01F18L,  6, 1,     -8L },  { 0x01F28L,  8, 1,     -8L },
+    { 0x01F38L,  8, 1,     -8L },  { 0x01F48L,  6, 1,     -8L },
+    { 0x01F59L,  4, 2,     -8L },  { 0x01F68L,  8, 1,     -8L },
+    { 0x01F88L,  8, 1,     -8L },  { 0x01F98L,  8, 1,     -8L },
+    { 0x01FA8L,  8, 1,     -8L },  { 0x01FB8L,  2, 1,     -8L },
+    { 0x01FBAL,  2, 1,    -74L },  { 0x01FBCL,  1, 1,     -9L },
+    { 0x01FBEL,  1, 1,  -7173L },  { 0x01FC8L,  4, 1,    -86L },
+    { 0x01FCCL,  1, 1,     -9L },  { 0x01FD8L,  2, 1,     -8L },
+    { 0x01FDAL,  2, 1,   -100L },  { 0x01FE8L,  2, 1,     -8L },
+    { 0x01FEAL,  2, 1,   -112L },  { 0x01FECL,  1, 1,     -7L },
+    { 0x01FF8L,  2, 1,   -128L },  { 0x01FFAL,  2, 1,   -126L },
+    { 0x01FFCL,  1, 1,     -9L },  { 0x02126L,  1, 1,  -7517L },
+    { 0x0212AL,  1, 1,  -8383L },  { 0x0212BL,  1, 1,  -8262L },
+    { 0x02132L,  1, 1,     28L },  { 0x02160L, 16, 1,     16L },
+    { 0x02183L,  1, 1,      1L },  { 0x024B6L, 26, 1,     26L },
+    { 0x02C00L, 48, 1,     48L },  { 0x02C60L,  1, 1,      1L },
+    { 0x02C62L,  1, 1, -10743L },  { 0x02C63L,  1, 1,  -3814L },
+    { 0x02C64L,  1, 1, -10727L },  { 0x02C67L,  3, 2,      1L },
+    { 0x02C6DL,  1, 1, -10780L },  { 0x02C6EL,  1, 1, -10749L },
+    { 0x02C6FL,  1, 1, -10783L },  { 0x02C70L,  1, 1, -10782L },
+    { 0x02C72L,  1, 1,      1L },  { 0x02C75L,  1, 1,      1L },
+    { 0x02C7EL,  2, 1, -10815L },  { 0x02C80L, 50, 2,      1L },
+    { 0x02CEBL,  2, 2,      1L },  { 0x02CF2L,  1, 1,      1L },
+    { 0x0A640L, 23, 2,      1L },  { 0x0A680L, 14, 2,      1L },
+    { 0x0A722L,  7, 2,      1L },  { 0x0A732L, 31, 2,      1L },
+    { 0x0A779L,  2, 2,      1L },  { 0x0A77DL,  1, 1, -35332L },
+    { 0x0A77EL,  5, 2,      1L },  { 0x0A78BL,  1, 1,      1L },
+    { 0x0A78DL,  1, 1, -42280L },  { 0x0A790L,  2, 2,      1L },
+    { 0x0A796L, 10, 2,      1L },  { 0x0A7AAL,  1, 1, -42308L },
+    { 0x0A7ABL,  1, 1, -42319L },  { 0x0A7ACL,  1, 1, -42315L },
+    { 0x0A7ADL,  1, 1, -42305L },  { 0x0A7AEL,  1, 1, -42308L },
+    { 0x0A7B0L,  1, 1, -42258L },  { 0x0A7B1L,  1, 1, -42282L },
+    { 0x0A7B2L,  1, 1, -42261L },  { 0x0A7B3L,  1, 1,    928L },
+    { 0x0A7B4L,  8, 2,      1L },  { 0x0A7C4L,  1, 1,    -48L },
+    { 0x0A7C5L,  1, 1, -42307L },  { 0x0A7C6L,  1, 1, -35384L },
+    { 0x0A7C7L,  2, 2,      1L },  { 0x0A7D0L,  1, 1,      1L },
+    { 0x0A7D6L,  2, 2,      1L },  { 0x0A7F5L,  1, 1,      1L },
+    { 0x0AB70L, 80, 1, -38864L },  { 0x0FF21L, 26, 1,     32L },
+    { 0x10400L, 40, 1,     40L },  { 0x104B0L, 36, 1,     40L },
+    { 0x10570L, 11, 1,     39L },  { 0x1057CL, 15, 1,     39L },
+    { 0x1058CL,  7, 1,     39L },  { 0x10594L,  2, 1,     39L },
+    { 0x10C80L, 51, 1,     64L },  { 0x118A0L, 32, 1,     32L },
+    { 0x16E40L, 32, 1,     32L },  { 0x1E900L, 34, 1,     34L }
+};
+
 
 /*------------------------------------------------------------------------------
-* fpattern_isvalid()
-*	Checks that filename pattern 'pat' is a well-formed pattern.
-*
-* Returns
-*	True (1) if 'pat' is a valid filename pattern, otherwise false (0).
+* fpattern_locale()
+*	Takes a snapshot of the case folding of the current locale (LC_CTYPE),
+*	which is used by all pattern matching from then on, so that no locale
+*	lookups are made while matching.  This also selects the char scanning
+*	kernels for the CPU.
 *
 * Caveats
-*	If 'pat' is null, false (0) is returned.
+*	This is called automatically the first time a pattern is matched or
+*	compiled, which is safe even if several threads do so at once.  It
+*	must be called again after the locale is changed, but not while other
+*	threads are matching patterns.  Compiled patterns keep the case folding
+*	in effect when they were compiled.
 *
-*	If 'pat' is empty (""), true (1) is returned, and it is considered a
-*	valid (but degenerate) pattern (the only filename it matches is the
-*	empty ("") string).
+*	Case folding is done only for DOS and for patterns compiled with the
+*	FPAT_NOCASE flag, so this does little for other UNIX patterns.
+*
+*	The cache of compiled patterns is emptied, since they were compiled
+*	with the old case folding.
 */
 
-int fpattern_isvalid(const char *pat)
+static void	fpattern_kernels(void);
+static void	fpattern_cache_flush(void);
+
+static void fpattern_load(void)
 {
-    int		len;
+    int		c;
 
-    DL(printf("fpattern_isvalid: pat=%04p:\"%s\"\n", pat, pat ? pat : ""));
+    /* Load the tables, then publish them to the other threads */
+    for (c = 0;  c < 256;  c++)
+        fpat_fold[c] = (unsigned char) tolower(c);
+    fpattern_kernels();
 
-    /* Check args */
-    if (pat == NULL)
-    {
-        DL(printf("Null pattern\n"));
-        return (false);
-    }
+#if defined(__GNUC__)
+    __atomic_store_n(&fpat_snap, true, __ATOMIC_RELEASE);
+#else
+    fpat_snap = true;
+#endif
+}
+
+static void fpattern_snap(void)
+{
+    /* Take the snapshot once, the first time it is needed */
+#if defined(__GNUC__)
+    if (__atomic_load_n(&fpat_snap, __ATOMIC_ACQUIRE))
+        return;
+
+    while (__atomic_test_and_set(&fpat_sbusy, __ATOMIC_ACQUIRE))
+        ;
+    if (!__atomic_load_n(&fpat_snap, __ATOMIC_ACQUIRE))
+        fpattern_load();
+    __atomic_clear(&fpat_sbusy, __ATOMIC_RELEASE);
+#else
+    if (!fpat_snap)
+        fpattern_load();
+#endif
+}
+
+void fpattern_locale(void)
+{
+    fpattern_load();
+    fpattern_cache_flush();
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_check()
+*	Checks that filename pattern 'pat' is a well-formed pattern, in which
+*	'quote' is the quoting char.
+*
+* Returns
+*	True (1) if 'pat' is a valid filename pattern, otherwise false (0), in
+*	which case the offset of the offending pattern char is stored into
+*	'*erroff'.
+*
+* Caveats
+*	This assumes that 'pat' is not null.
+*/
+
+static int fpattern_check(const char *pat, int quote, int *erroff)
+{
+    int		len;
+    int		depth;
 
     /* Verify that the pattern is valid */
+    depth = 0;
     for (len = 0;  pat[len] != '\0';  len++)
     {
+        if (pat[len] == quote)
+        {
+            /* Quoted char */
+            len++;
+            if (pat[len] == '\0')
+            {
+                DL(printf("Missing quoted char\n"));
+                *erroff = len;
+                return (false);		/* Missing quoted char */
+            }
+            continue;
+        }
+
         switch (pat[len])
         {
         case FPAT_SET_L:
@@ -183,11 +743,12 @@ int fpattern_isvalid(const char *pat)
 
             while (pat[len] != FPAT_SET_R)
             {
-                if (pat[len] == QUOTE)
+                if (pat[len] == quote)
                     len++;		/* Quoted char */
                 if (pat[len] == '\0')
                 {
                     DL(printf("Missing '%c'\n", FPAT_SET_R));
+                    *erroff = len;
                     return (false);	/* Missing closing bracket */
                 }
                 len++;
@@ -196,12 +757,13 @@ int fpattern_isvalid(const char *pat)
                 {
                     /* Char range */
                     len++;
-                    if (pat[len] == QUOTE)
+                    if (pat[len] == quote)
                         len++;		/* Quoted char */
                     if (pat[len] == '\0')
                     {
                         DL(printf("Missing '%c%c'\n",
                             FPAT_SET_THRU, FPAT_SET_R));
+                        *erroff = len;
                         return (false);	/* Missing closing bracket */
                     }
                     len++;
@@ -210,29 +772,41 @@ int fpattern_isvalid(const char *pat)
                 if (pat[len] == '\0')
                 {
                     DL(printf("Missing '%c'\n", FPAT_SET_R));
+                    *erroff = len;
                     return (false);	/* Missing closing bracket */
                 }
             }
             break;
 
-        case QUOTE:
-            /* Quoted char */
-            len++;
-            if (pat[len] == '\0')
-            {
-                DL(printf("Missing quoted char\n"));
-                return (false);		/* Missing quoted char */
-            }
-            break;
-
         case FPAT_NOT:
             /* Negated pattern */
-            len++;
-            if (pat[len] == '\0')
+            if (depth > 0)
+            {
+                DL(printf("Negation within alternatives\n"));
+                *erroff = len;
+                return (false);		/* Negated alternative */
+            }
+            if (pat[len+1] == '\0')
             {
                 DL(printf("Missing negated subpattern\n"));
+                *erroff = len+1;
                 return (false);		/* Missing subpattern */
             }
+            if (pat[len+1] == quote  &&  pat[len+2] != '\0')
+                len += 2;		/* Quoted char, as parsed */
+            else if (pat[len+1] != FPAT_ALT_L)
+                len++;			/* Char after it is not checked */
+            break;
+
+        case FPAT_ALT_L:
+            /* Alternatives */
+            depth++;
+            break;
+
+        case FPAT_ALT_R:
+            /* End of alternatives, or a regular char */
+            if (depth > 0)
+                depth--;
             break;
 
         default:
@@ -241,17 +815,74 @@ int fpattern_isvalid(const char *pat)
         }
     }
 
-    DL(printf("fpattern_isvalid: return %d\n", len));
+    if (depth > 0)
+    {
+        DL(printf("Missing '%c'\n", FPAT_ALT_R));
+        *erroff = len;
+        return (false);			/* Missing closing brace */
+    }
+
+    DL(printf("fpattern_check: return %d\n", len));
     return (true);
 }
 
 
+/*------------------------------------------------------------------------------
+* fpattern_isvalid()
+*	Checks that filename pattern 'pat' is a well-formed pattern.
+*
+* Returns
+*	True (1) if 'pat' is a valid filename pattern, otherwise false (0).
+*
+* Caveats
+*	If 'pat' is null, false (0) is returned.
+*
+*	If 'pat' is empty (""), true (1) is returned, and it is considered a
+*	valid (but degenerate) pattern (the only filename it matches is the
+*	empty ("") string).
+*/
+
+int fpattern_isvalid(const char *pat)
+{
+    int		off;
+
+    DL(printf("fpattern_isvalid: pat=%p:\"%s\"\n", pat, pat ? pat : ""));
+
+    /* Check args */
+    if (pat == NULL)
+    {
+        DL(printf("Null pattern\n"));
+        return (false);
+    }
+
+    /* Verify that the pattern is valid */
+    return (fpattern_check(pat, QUOTE, &off));
+}
+
+
 /*------------------------------------------------------------------------------
 * fpattern_submatch()
-*	Attempts to match subpattern 'pat' to subfilename 'fname'.
+*	Attempts to match subpattern 'pat' to subfilename 'fname', taking one
+*	step from 'sub->steps' for each call and for each pattern element
+*	matched.
+*
+*	The chars matched by each wildcard element ('*', '?', '[...]', and the
+*	^Z closure) are stored in 'sub->spans', indexed by the number of
+*	wildcards before it in the pattern, which is 'sub->nw' for the first
+*	one in 'pat'.  Since the spans are stored on the way down, the ones left
+*	when the match succeeds are those of the successful path.
+*
+*	If DELIM is true, a "**" closure is matched by fpattern_deep().
+*
+*	Each alternative of a "{...}" group is matched together with the rest
+*	of the pattern after the group, by skipping over the alternatives that
+*	follow it once its own end is reached.  'sub->alt' is the number of
+*	groups that enclose 'pat', so that ',' and '}' are regular chars
+*	outside of them.
 *
 * Returns
-*	True (1) if the subfilename matches, otherwise false (0).
+*	True (1) if the subfilename matches, otherwise false (0), or
+*	FPAT_EXHAUSTED if 'sub->steps' runs out first.
 *
 * Caveats
 *	This does not assume that 'pat' is well-formed.
@@ -262,24 +893,146 @@ int fpattern_isvalid(const char *pat)
 *	Some non-empty patterns (e.g., "") will match an empty filename ("").
 */
 
-static int fpattern_submatch(const char *pat, const char *fname)
+#if DELIM
+static int	fpattern_deep(const char *pat, const char *fname,
+		    struct fpat_sub *sub);
+#endif
+
+static void fpattern_span(struct fpat_sub *sub, int w, const char *fname,
+    size_t n)
+{
+    /* Record the span of wildcard 'w' */
+    if (w < sub->maxspans)
+    {
+        sub->spans[w].off = fname - sub->base;
+        sub->spans[w].len = n;
+    }
+}
+
+static void fpattern_nospan(struct fpat_sub *sub, int w, int n)
+{
+    /* Note that wildcards 'w' to 'n-1' (of other alternatives) match nothing */
+    for (;  w < n  &&  w < sub->maxspans;  w++)
+    {
+        sub->spans[w].off = FPAT_NOSPAN;
+        sub->spans[w].len = 0;
+    }
+}
+
+static const char *fpattern_alt(const char *pat, int *nw)
+{
+    int		depth;
+
+    /* Find the ',' or '}' ending alternative 'pat', counting its wildcards */
+    for (depth = 0;  *pat != '\0';  pat++)
+    {
+        switch (*pat)
+        {
+        case QUOTE:
+            if (pat[1] != '\0')
+                pat++;
+            break;
+
+        case FPAT_SET_L:
+            /* Skip the set, including any ']' that ends a range */
+            pat++;
+            if (*pat == FPAT_SET_NOT)
+                pat++;
+            while (*pat != FPAT_SET_R  &&  *pat != '\0')
+            {
+                if (*pat == QUOTE  &&  pat[1] != '\0')
+                    pat++;
+                pat++;
+                if (*pat == FPAT_SET_THRU  &&  pat[1] != '\0')
+                {
+                    pat++;
+                    if (*pat == QUOTE  &&  pat[1] != '\0')
+                        pat++;
+                    pat++;
+                }
+            }
+            if (*pat == '\0')
+                return (pat);
+            (*nw)++;
+            break;
+
+        case FPAT_CLOS:
+        #if DELIM
+            if (pat[1] == FPAT_CLOS)
+                pat++;			/* "**" is one wildcard */
+        #endif
+            (*nw)++;
+            break;
+
+        case FPAT_ANY:
+        case SUB:
+            (*nw)++;
+            break;
+
+        case FPAT_ALT_L:
+            depth++;
+            break;
+
+        case FPAT_ALT_SEP:
+            if (depth == 0)
+                return (pat);
+            break;
+
+        case FPAT_ALT_R:
+            if (depth == 0)
+                return (pat);
+            depth--;
+            break;
+        }
+    }
+    return (pat);
+}
+
+static int fpattern_submatch(const char *pat, const char *fname,
+    struct fpat_sub *sub)
 {
     int		fch;
     int		pch;
     int		i;
+    int		w;
+    int		a;
+    int		rc;
     int		yes, match;
     int		lo, hi;
 
     DL(printf("fpattern_submatch: fname=\"%s\", pat=\"%s\"\n", fname, pat));
 
+    if (sub->steps-- == 0)
+        return (FPAT_EXHAUSTED);
+
     /* Attempt to match subpattern against subfilename */
     while (*pat != '\0')
     {
+        if (sub->steps-- == 0)
+            return (FPAT_EXHAUSTED);
+
         fch = *fname;
         pch = *pat;
         pat++;
 
-        switch (pch)
+        if (sub->alt > 0  &&  (pch == FPAT_ALT_SEP  ||  pch == FPAT_ALT_R))
+        {
+            /* End of an alternative, so skip over the ones after it */
+            if (pch == FPAT_ALT_SEP)
+            {
+                w = sub->nw;
+                pat = fpattern_alt(pat, &sub->nw);
+                while (*pat == FPAT_ALT_SEP)
+                    pat = fpattern_alt(pat+1, &sub->nw);
+                if (*pat != '\0')
+                    pat++;
+                fpattern_nospan(sub, w, sub->nw);
+            }
+            sub->alt--;
+            continue;
+        }
+
+        switch (pch)
         {
         case FPAT_ANY:
             /* Match a single char */
@@ -292,10 +1045,16 @@ static int fpattern_submatch(const char *pat, const char *fname)
                 DL(printf("match=F\n"));
                 return (false);
             }
+            fpattern_span(sub, sub->nw++, fname, 1);
             fname++;
             break;
 
         case FPAT_CLOS:
+        #if DELIM
+            if (*pat == FPAT_CLOS)
+                return (fpattern_deep(pat+1, fname, sub));
+        #endif
+
             /* Match zero or more chars */
             i = 0;
         #if DELIM
@@ -306,12 +1065,18 @@ static int fpattern_submatch(const char *pat, const char *fname)
             while (fname[i] != '\0')
                 i++;
         #endif
+            w = sub->nw;
+            a = sub->alt;
             while (i >= 0)
             {
-                if (fpattern_submatch(pat, fname+i))
+                fpattern_span(sub, w, fname, i);
+                sub->nw = w+1;
+                sub->alt = a;
+                rc = fpattern_submatch(pat, fname+i, sub);
+                if (rc != false)
                 {
-                    DL(printf("submatch=T for +%d\n", i));
-                    return (true);
+                    DL(printf("submatch=%d for +%d\n", rc, i));
+                    return (rc);
                 }
                 i--;
             }
@@ -326,14 +1091,40 @@ static int fpattern_submatch(const char *pat, const char *fname)
         #endif
                     fname[i] != '.')
                 i++;
+            w = sub->nw;
+            a = sub->alt;
             while (i >= 0)
             {
-                if (fpattern_submatch(pat, fname+i))
-                    return (true);
+                fpattern_span(sub, w, fname, i);
+                sub->nw = w+1;
+                sub->alt = a;
+                rc = fpattern_submatch(pat, fname+i, sub);
+                if (rc != false)
+                    return (rc);
                 i--;
             }
             return (false);
 
+        case FPAT_ALT_L:
+            /* Match each alternative in turn, with the rest of the pattern */
+            w = sub->nw;
+            a = sub->alt;
+            for (;;)
+            {
+                sub->nw = w;
+                sub->alt = a+1;
+                rc = fpattern_submatch(pat, fname, sub);
+                if (rc != false)
+                    return (rc);
+
+                i = w;
+                pat = fpattern_alt(pat, &w);
+                fpattern_nospan(sub, i, w);
+                if (*pat != FPAT_ALT_SEP)
+                    return (false);
+                pat++;
+            }
+
         case QUOTE:
             /* Match a quoted char */
             pch = *pat;
@@ -345,6 +1136,12 @@ static int fpattern_submatch(const char *pat, const char *fname)
 
         case FPAT_SET_L:
             /* Match char set/range */
+            if (fch == '\0')
+            {
+                DL(printf("match=F\n"));
+                return (false);		/* No char to match */
+            }
+
             yes = true;
             if (*pat == FPAT_SET_NOT)
             {
@@ -352,254 +1149,6943 @@ static int fpattern_submatch(const char *pat, const char *fname)
                yes = false;	/* Set negation */
             }
 
-            /* Look for [s], [-], [abc], [a-c] */
-            match = !yes;
-            while (*pat != FPAT_SET_R  &&  *pat != '\0')
-            {
-                if (*pat == QUOTE)
-                    pat++;	/* Quoted char */
+            /* Look for [s], [-], [abc], [a-c] */
+            match = !yes;
+            while (*pat != FPAT_SET_R  &&  *pat != '\0')
+            {
+                if (*pat == QUOTE)
+                    pat++;	/* Quoted char */
+
+                if (*pat == '\0')
+                    break;
+                lo = *pat++;
+                hi = lo;
+
+                if (*pat == FPAT_SET_THRU)
+                {
+                    /* Range */
+                    pat++;
+
+                    if (*pat == QUOTE)
+                        pat++;	/* Quoted char */
+
+                    if (*pat == '\0')
+                        break;
+                    hi = *pat++;
+                }
+
+                if (*pat == '\0')
+                    break;
+
+                /* Compare character to set range */
+                if (lowercase(fch) >= lowercase(lo)  &&
+                    lowercase(fch) <= lowercase(hi))
+                    match = yes;
+            }
+
+            if (!match)
+            {
+                DL(printf("match=F\n"));
+                return (false);
+            }
+
+            if (*pat == '\0')
+                return (false);		/* Missing closing bracket */
+
+            fpattern_span(sub, sub->nw++, fname, 1);
+            fname++;
+            pat++;
+            break;
+
+        case FPAT_NOT:
+            /* Match only if rest of pattern does not match */
+            if (*pat == '\0')
+                return (false);		/* Missing subpattern */
+            /* Wildcards in the subpattern match nothing to report */
+            w = sub->maxspans;
+            sub->maxspans = 0;
+            rc = fpattern_submatch(pat, fname, sub);
+            sub->maxspans = w;
+            DL(printf("submatch=%d\n", rc));
+            if (rc == FPAT_EXHAUSTED)
+                return (rc);
+            return !rc;
+
+#if DELIM
+        case DEL:
+    #if DEL2 != DEL
+        case DEL2:
+    #endif
+            /* Match path delimiter char */
+            if (fch != DEL  &&  fch != DEL2)
+                return (false);
+            fname++;
+            break;
+#endif
+
+        default:
+            /* Match a (non-null) char exactly */
+            if (lowercase(fch) != lowercase(pch))
+            {
+                DL(printf("fch:'%c' != pch:'%c'\n", fch, pch));
+                return (false);
+            }
+            fname++;
+            break;
+        }
+    }
+
+    /* Check for complete match */
+    if (*fname != '\0')
+        return (false);
+
+    /* Successful match */
+    DL(printf("fpattern_submatch: pass\n"));
+    return (true);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_deep()
+*	Attempts to match subpattern 'pat', which follows a "**" closure, to
+*	subfilename 'fname', as fpattern_submatch() does.
+*
+*	The closure matches zero or more chars, including path delimiters.  If
+*	it is followed by a delimiter, and starts the pattern or follows
+*	another delimiter, the two together match whole directory names, or
+*	none at all, so that a "**" between the delimiters of "a" and "b"
+*	matches "a/b" as well as "a/x/y/b".  Otherwise the closure is just
+*	followed by a literal delimiter, so that "a**" followed by a delimiter
+*	and "b" does not match "ab".
+*
+*	Whether the rest of the pattern matches from a given position does not
+*	depend on how it was reached, so the lowest position from which it has
+*	failed everywhere is remembered in 'sub->deep', and later attempts at
+*	that position or beyond fail at once.  Each "**" thus tries each
+*	position at most once, instead of once for every way of matching the
+*	closures before it.
+*
+* Returns
+*	True (1) if the subfilename matches, otherwise false (0), or
+*	FPAT_EXHAUSTED if 'sub->steps' runs out first.
+*/
+
+#if DELIM
+
+static int fpattern_atdir(const struct fpat_sub *sub, const char *p)
+{
+    const char *	q;
+
+    /* Check whether 'p' starts the pattern or follows a delimiter */
+    if (p == sub->pat)
+        return (true);
+    if (p[-1] != DEL  &&  p[-1] != DEL2)
+        return (false);
+
+    /* The delimiter is quoted by an odd number of quotes before it */
+    for (q = p-1;  q > sub->pat  &&  q[-1] == QUOTE;  q--)
+        ;
+    return ((p-1 - q) % 2 == 0);
+}
+
+static int fpattern_deep(const char *pat, const char *fname,
+    struct fpat_sub *sub)
+{
+    const char *	fail;
+    size_t		i;
+    int			dirs;
+    int			w;
+    int			a;
+    int			rc;
+
+    w = sub->nw;
+    a = sub->alt;
+    dirs = ((*pat == DEL  ||  *pat == DEL2)  &&  fpattern_atdir(sub, pat-2));
+    fail = (w < FPAT_DEEP ? sub->deep[w] : NULL);
+
+    if (fail != NULL  &&  fname >= fail)
+    {
+        /* Already failed here, except for no dirs after a non-delimiter */
+        if (!dirs  ||  fname == fail  ||  fname[-1] == DEL  ||
+            fname[-1] == DEL2)
+            return (false);
+        fpattern_span(sub, w, fname, 0);
+        sub->nw = w+1;
+        return (fpattern_submatch(pat+1, fname, sub));
+    }
+
+    /* Match as many chars as possible, down to the last failure */
+    i = (fail != NULL ? (size_t) (fail - fname) - 1 : strlen(fname));
+    for (i++;  i-- > 0;  )
+    {
+        if (dirs)
+        {
+            /* Match "**" + "/" as whole dirs, or as none at all */
+            if (i > 0  &&  fname[i-1] != DEL  &&  fname[i-1] != DEL2)
+                continue;
+            fpattern_span(sub, w, fname, i > 0 ? i-1 : 0);
+            sub->nw = w+1;
+            sub->alt = a;
+            rc = fpattern_submatch(pat+1, fname+i, sub);
+        }
+        else
+        {
+            fpattern_span(sub, w, fname, i);
+            sub->nw = w+1;
+            sub->alt = a;
+            rc = fpattern_submatch(pat, fname+i, sub);
+        }
+
+        if (rc != false)
+        {
+            DL(printf("deep=%d for +%d\n", rc, (int) i));
+            return (rc);
+        }
+    }
+
+    if (w < FPAT_DEEP)
+        sub->deep[w] = fname;
+    return (false);
+}
+
+#endif /*DELIM*/
+
+
+/*------------------------------------------------------------------------------
+* fpattern_match()
+*	Attempts to match pattern 'pat' to filename 'fname'.
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	If 'fname' is null, false (0) is returned.
+*
+*	If 'pat' is null, false (0) is returned.
+*
+*	If 'pat' is empty (""), the only filename it matches is the empty string
+*	("").
+*
+*	If 'fname' is empty, the only pattern that will match it is the empty
+*	string ("").
+*
+*	If 'pat' is not a well-formed pattern, false (0) is returned.
+*
+*	Upper and lower case letters are treated the same; alphabetic characters
+*	are converted to lower case before matching occurs.  Conversion to lower
+*	case is dependent upon the current locale setting.
+*
+*	If the cache of compiled patterns is enabled, 'pat' is compiled the
+*	first time it is matched, and matched by its compiled form from then
+*	on.
+*
+* See also
+*	fpattern_cache_size().
+*/
+
+static int	fpattern_cached(const char *pat, int flags, const char *fname);
+
+#if STATS
+static fpattern_stats_t *	fpattern_mystats(void);
+static void	fpattern_stats_add(unsigned long *c, unsigned long n);
+static void	fpattern_stats_name(int rc, unsigned long cost);
+#endif
+
+int fpattern_match(const char *pat, const char *fname)
+{
+    struct fpat_sub	sub;
+    int			rc;
+
+    DL(printf("fpattern_match: fname=%p:\"%s\", pat=%p:\"%s\"\n",
+        fname, fname ? fname : "", pat, pat ? pat : ""));
+
+    /* Check args */
+    if (fname == NULL)
+        return (false);
+
+    if (pat == NULL)
+        return (false);
+
+    /* Match the compiled pattern, if it is cached */
+    rc = fpattern_cached(pat, NATIVE, fname);
+    if (rc >= 0)
+    {
+        DL(printf("fpattern_match: cached, return %c\n", "FT"[!!rc]));
+        return (rc);
+    }
+
+    /* Verify that the pattern is valid, and get its length */
+    if (!fpattern_isvalid(pat))
+        return (false);
+
+    fpattern_snap();
+
+    /* Attempt to match pattern against filename */
+    if (fname[0] == '\0')
+        return (pat[0] == '\0');	/* Special case */
+    memset(&sub, 0, sizeof(sub));
+    sub.steps = ULONG_MAX;
+    sub.pat = pat;
+    rc = fpattern_submatch(pat, fname, &sub);
+    STAT_ADD(steps, ULONG_MAX - sub.steps);
+    STAT_NAME(rc, ULONG_MAX - sub.steps);
+
+    DL(printf("fpattern_match: return %c\n", "FT"[!!rc]));
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_matchn()
+*	Attempts to match pattern 'pat' to filename 'fname'.
+*	This operates like fpattern_match() except that it does not verify that
+*	pattern 'pat' is well-formed, assuming that it has been checked by a
+*	prior call to fpattern_isvalid().
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	If 'fname' is null, false (0) is returned.
+*
+*	If 'pat' is null, false (0) is returned.
+*
+*	If 'pat' is empty (""), the only filename it matches is the empty ("")
+*	string.
+*
+*	If 'pat' is not a well-formed pattern, unpredictable results may occur.
+*
+*	Upper and lower case letters are treated the same; alphabetic characters
+*	are converted to lower case before matching occurs.  Conversion to lower
+*	case is dependent upon the current locale setting.
+*
+*	Like fpattern_match(), this matches a compiled form of 'pat' if the
+*	cache of compiled patterns is enabled.
+*
+* See also
+*	fpattern_match(), fpattern_cache_size().
+*/
+
+int fpattern_matchn(const char *pat, const char *fname)
+{
+    struct fpat_sub	sub;
+    int			rc;
+
+    DL(printf("fpattern_matchn: fname=%p:\"%s\", pat=%p:\"%s\"\n",
+        fname, fname ? fname : "", pat, pat ? pat : ""));
+
+    /* Check args */
+    if (fname == NULL)
+        return (false);
+
+    if (pat == NULL)
+        return (false);
+
+    /* Match the compiled pattern, if it is cached */
+    if (fname[0] != '\0')
+    {
+        rc = fpattern_cached(pat, NATIVE, fname);
+        if (rc >= 0)
+            return (rc);
+    }
+
+    /* Assume that pattern is well-formed */
+
+    fpattern_snap();
+
+    /* Attempt to match pattern against filename */
+    memset(&sub, 0, sizeof(sub));
+    sub.steps = ULONG_MAX;
+    sub.pat = pat;
+    rc = fpattern_submatch(pat, fname, &sub);
+    STAT_ADD(steps, ULONG_MAX - sub.steps);
+    STAT_NAME(rc, ULONG_MAX - sub.steps);
+
+    DL(printf("fpattern_matchn: return %c\n", "FT"[!!rc]));
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_match_steps()
+*	Attempts to match pattern 'pat' to filename 'fname', as fpattern_match()
+*	does, but gives up after taking '*steps' steps, where a step is a
+*	pattern element matched or a closure length tried.  The steps not used
+*	are left in '*steps', so that a budget can be shared across calls.
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0), or
+*	FPAT_EXHAUSTED if the budget runs out before the match is decided.
+*
+* Caveats
+*	If 'fname', 'pat' or 'steps' is null, or 'pat' is not well-formed, false
+*	(0) is returned.
+*
+*	The compiled engines (fpattern_exec()) need no budget, taking time that
+*	grows only linearly with the length of the filename.
+*
+* See also
+*	fpattern_match(), fpattern_cost().
+*/
+
+int fpattern_match_steps(const char *pat, const char *fname,
+    unsigned long *steps)
+{
+    struct fpat_sub	sub;
+    int			rc;
+
+    DL(printf("fpattern_match_steps: fname=%p:\"%s\", pat=%p:\"%s\"\n",
+        fname, fname ? fname : "", pat, pat ? pat : ""));
+
+    /* Check args */
+    if (fname == NULL  ||  pat == NULL  ||  steps == NULL)
+        return (false);
+
+    if (!fpattern_isvalid(pat))
+        return (false);
+
+    fpattern_snap();
+
+    /* Attempt to match pattern against filename */
+    if (fname[0] == '\0')
+        return (pat[0] == '\0');	/* Special case */
+    memset(&sub, 0, sizeof(sub));
+    sub.steps = *steps;
+    sub.pat = pat;
+    rc = fpattern_submatch(pat, fname, &sub);
+    if (rc == FPAT_EXHAUSTED)
+        sub.steps = 0;
+    STAT_ADD(steps, *steps - sub.steps);
+    STAT_NAME(rc, *steps - sub.steps);
+    *steps = sub.steps;
+
+    DL(printf("fpattern_match_steps: return %d\n", rc));
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cost()
+*	Estimates the most steps that fpattern_match_steps() can take to match
+*	pattern 'pat' to any filename of up to 'len' chars.
+*
+*	Each closure retries the rest of the pattern at every length up to the
+*	rest of the filename, so a pattern of 'm' elements and 'k' closures
+*	takes at most (m+1)*C(len+k+1, k) steps.  Each group of alternatives
+*	tries the rest of the pattern once per alternative, and so multiplies
+*	this by the number of them.
+*
+* Returns
+*	The estimated number of steps, or ULONG_MAX if it is larger than that.
+*	If 'pat' is null or is not a well-formed pattern, zero is returned.
+*
+* Caveats
+*	This is an upper bound, usually far higher than the steps taken for
+*	ordinary filenames.
+*
+* See also
+*	fpattern_match_steps().
+*/
+
+unsigned long fpattern_cost(const char *pat, size_t len)
+{
+    const char *	p;
+    double		cost;
+    double		alts;
+    int			m, k, i;
+    int			n, w;
+
+    /* Check args */
+    if (pat == NULL  ||  !fpattern_isvalid(pat))
+        return (0);
+
+    /* Count the pattern elements, closures, and alternatives */
+    m = 0;
+    k = 0;
+    alts = 1;
+    for (i = 0;  pat[i] != '\0';  i++)
+    {
+        m++;
+        if (pat[i] == FPAT_CLOS  ||  pat[i] == SUB)
+            k++;
+        else if (pat[i] == FPAT_ALT_L)
+        {
+            w = 0;
+            n = 1;
+            for (p = fpattern_alt(pat+i+1, &w);  *p == FPAT_ALT_SEP;  n++)
+                p = fpattern_alt(p+1, &w);
+            alts *= n;
+        }
+        else if (pat[i] == QUOTE)
+        {
+            if (pat[i+1] != '\0')
+                i++;
+        }
+        else if (pat[i] == FPAT_SET_L)
+        {
+            /* Skip over the whole set, which may be incomplete after '!' */
+            for (i++;  pat[i] != FPAT_SET_R  &&  pat[i] != '\0';  i++)
+            {
+                if (pat[i] == QUOTE  &&  pat[i+1] != '\0')
+                    i++;
+            }
+            if (pat[i] == '\0')
+                break;
+        }
+    }
+
+    /* (m+1) * alts * C(len+k+1, k), computed incrementally */
+    cost = (m+1) * alts;
+    for (i = 1;  i <= k;  i++)
+    {
+        cost = cost * (double) (len + 1 + i) / i;
+        if (cost >= (double) ULONG_MAX)
+            return (ULONG_MAX);
+    }
+    return ((unsigned long) cost + 1);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_match_spans()
+*	Attempts to match pattern 'pat' to filename 'fname', as fpattern_match()
+*	does, and stores the span of filename chars matched by each wildcard
+*	element of the pattern ('*', '?', '[...]', and the ^Z closure) into
+*	'spans[0...maxspans-1]', in the order the wildcards appear in the
+*	pattern.
+*
+*	For example, matching "IMG_0042.jpeg" to "*_*.jp?g" yields the spans
+*	"IMG", "0042", and "e".
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	The spans are only meaningful if the filename matches.  Each closure
+*	matches as many chars as it can, the leftmost ones first.
+*
+*	Wildcards after a negation ('!') have no span, and are given an offset
+*	of FPAT_NOSPAN and a length of zero, as are those of the alternatives
+*	that were not matched, and all of them if the filename is empty.
+*
+*	No memory is allocated, and the spans are found in the same pass as the
+*	match itself.
+*
+* See also
+*	fpattern_match().
+*/
+
+int fpattern_match_spans(const char *pat, const char *fname,
+    fpattern_span_t *spans, int maxspans)
+{
+    struct fpat_sub	sub;
+    int			rc;
+    int			i;
+
+    DL(printf("fpattern_match_spans: fname=%p:\"%s\", pat=%p:\"%s\"\n",
+        fname, fname ? fname : "", pat, pat ? pat : ""));
+
+    /* Check args */
+    if (fname == NULL  ||  pat == NULL)
+        return (false);
+
+    if (!fpattern_isvalid(pat))
+        return (false);
+
+    fpattern_snap();
+
+    if (spans == NULL)
+        maxspans = 0;
+    for (i = 0;  i < maxspans;  i++)
+    {
+        spans[i].off = FPAT_NOSPAN;
+        spans[i].len = 0;
+    }
+
+    /* Attempt to match pattern against filename */
+    if (fname[0] == '\0')
+        return (pat[0] == '\0');	/* Special case */
+
+    memset(&sub, 0, sizeof(sub));
+    sub.steps = ULONG_MAX;
+    sub.pat = pat;
+    sub.base = fname;
+    sub.spans = spans;
+    sub.maxspans = maxspans;
+    rc = fpattern_submatch(pat, fname, &sub);
+    STAT_ADD(steps, ULONG_MAX - sub.steps);
+    STAT_NAME(rc, ULONG_MAX - sub.steps);
+
+    DL(printf("fpattern_match_spans: return %c\n", "FT"[!!rc]));
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_match_len()
+*	Attempts to match pattern 'pat[0...patlen-1]' to filename
+*	'fname[0...len-1]'.  This operates like fpattern_match(), except that
+*	neither the pattern nor the filename need be null-terminated, and the
+*	filename may contain any chars, including nulls.
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	If 'fname' or 'pat' is null, false (0) is returned.
+*
+*	If 'pat' is not a well-formed pattern, or contains a null char, false
+*	(0) is returned.
+*
+*	The pattern is compiled for each call, so a pattern that is matched
+*	repeatedly should be compiled once by fpattern_compile_len() instead.
+*
+* See also
+*	fpattern_match(), fpattern_exec_len().
+*/
+
+int fpattern_match_len(const char *pat, size_t patlen, const char *fname,
+    size_t len)
+{
+    fpattern_t *	prog;
+    int			rc;
+
+    /* Check args */
+    if (fname == NULL)
+        return (false);
+
+    if (pat == NULL)
+        return (false);
+
+    /* Compile the pattern, verifying that it is valid */
+    prog = fpattern_compile_len(pat, patlen, NULL);
+    if (prog == NULL)
+        return (false);
+
+    /* Attempt to match pattern against filename */
+    rc = fpattern_exec_len(prog, fname, len);
+    fpattern_free(prog);
+
+    DL(printf("fpattern_match_len: return %c\n", "FT"[!!rc]));
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_match_flags()
+*	Attempts to match pattern 'pat' to filename 'fname', following the
+*	conventions selected by 'flags' (see fpattern_compile_flags()) rather
+*	than those of the O/S.
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	If 'fname' or 'pat' is null, or 'pat' is not a well-formed pattern,
+*	false (0) is returned.
+*
+*	The pattern is compiled for each call, unless the cache of compiled
+*	patterns is enabled, so a pattern that is matched repeatedly should
+*	otherwise be compiled once by fpattern_compile_flags() instead.
+*
+* See also
+*	fpattern_match(), fpattern_compile_flags(), fpattern_cache_size().
+*/
+
+int fpattern_match_flags(const char *pat, const char *fname, int flags)
+{
+    fpattern_t *	prog;
+    int			rc;
+
+    /* Check args */
+    if (fname == NULL  ||  pat == NULL)
+        return (false);
+
+    /* Match the compiled pattern, if it is cached */
+    rc = fpattern_cached(pat, flags, fname);
+    if (rc >= 0)
+        return (rc);
+
+    /* Compile the pattern, verifying that it is valid */
+    prog = fpattern_compile_flags(pat, strlen(pat), flags, NULL);
+    if (prog == NULL)
+        return (false);
+
+    /* Attempt to match pattern against filename */
+    rc = fpattern_exec(prog, fname);
+    fpattern_free(prog);
+
+    DL(printf("fpattern_match_flags: return %c\n", "FT"[!!rc]));
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_ufold()
+*	Folds Unicode code point 'cp' by simple case folding.
+*
+* Returns
+*	The folded code point, which is 'cp' itself unless it has a fold.
+*/
+
+static long fpattern_ufold(long cp)
+{
+    const struct fpat_urun *	r;
+    int				lo, hi, mid;
+
+    if (cp < 0x80)
+        return (cp >= 'A'  &&  cp <= 'Z' ? cp + ('a'-'A') : cp);
+
+    /* Find the last run starting at or before 'cp' */
+    lo = 0;
+    hi = (int) (sizeof(fpat_ucase) / sizeof(fpat_ucase[0]));
+    while (hi - lo > 1)
+    {
+        mid = (lo + hi) / 2;
+        if (fpat_ucase[mid].first <= cp)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    r = &fpat_ucase[lo];
+    if (cp < r->first + (long) r->count * r->stride  &&
+        (cp - r->first) % r->stride == 0)
+        return (cp + r->delta);
+    return (cp);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_utf8_get()
+*	Decodes the UTF-8 char at '*p', where 'n' chars are available, and
+*	advances '*p' past it.
+*
+* Returns
+*	The code point of the char.  A byte that does not start a well-formed
+*	sequence (including overlong forms and surrogates) is decoded on its
+*	own, as UBAD plus the byte, which no well-formed sequence yields.
+*
+* Caveats
+*	Continuation bytes are examined one at a time, so a null terminator
+*	ends a short sequence even if 'n' overstates the chars available.
+*/
+
+static long fpattern_utf8_get(const unsigned char **p, size_t n)
+{
+    const unsigned char *	s;
+    long			cp, min;
+    int				i, k;
+
+    s = *p;
+    if (s[0] < 0x80)
+    {
+        (*p)++;
+        return (s[0]);
+    }
+
+    /* Decode the lead byte */
+    if (s[0] >= 0xC2  &&  s[0] <= 0xDF)
+        k = 1, cp = s[0] & 0x1F, min = 0x80;
+    else if (s[0] >= 0xE0  &&  s[0] <= 0xEF)
+        k = 2, cp = s[0] & 0x0F, min = 0x800;
+    else if (s[0] >= 0xF0  &&  s[0] <= 0xF4)
+        k = 3, cp = s[0] & 0x07, min = 0x10000L;
+    else
+        goto bad;
+    if ((size_t) k >= n)
+        goto bad;
+
+    /* Decode the continuation bytes */
+    for (i = 1;  i <= k;  i++)
+    {
+        if ((s[i] & 0xC0) != 0x80)
+            goto bad;
+        cp = (cp << 6) | (s[i] & 0x3F);
+    }
+    if (cp < min  ||  cp > UMAX  ||  (cp >= 0xD800  &&  cp <= 0xDFFF))
+        goto bad;
+
+    *p += k+1;
+    return (cp);
+
+bad:
+    /* Ill-formed sequence */
+    (*p)++;
+    return (UBAD + s[0]);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_uclass()
+*	Determines the char class of (folded) code point 'cp' for compiled
+*	UTF-8 pattern 'prog'.  ASCII chars are classes of their own, and the
+*	other code points are divided into the runs 'prog->ucls[]' that the
+*	pattern does not tell apart.
+*
+* Returns
+*	The char class, which is the name char matched by the instructions of
+*	the pattern in place of 'cp'.
+*/
+
+static int fpattern_uclass(const fpattern_t *prog, long cp)
+{
+    int		lo, hi, mid;
+
+    if (cp < 0x80)
+        return ((int) cp);
+
+    lo = 0;
+    hi = prog->nucls;
+    while (hi - lo > 1)
+    {
+        mid = (lo + hi) / 2;
+        if (prog->ucls[mid] <= cp)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return (0x80 + lo);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_ubound()
+*	Notes that code point 'cp' starts a new char class of compiled UTF-8
+*	pattern 'prog', keeping 'prog->ucls[]' in order.
+*
+* Caveats
+*	If there are too many classes, 'prog->nucls' is left greater than
+*	FPAT_UCLASS.
+*/
+
+static void fpattern_ubound(fpattern_t *prog, long cp)
+{
+    int		i;
+
+    if (cp <= 0x80  ||  cp > UMAX  ||  prog->nucls > FPAT_UCLASS)
+        return;
+
+    for (i = prog->nucls;  prog->ucls[i-1] > cp;  i--)
+        ;
+    if (prog->ucls[i-1] == cp)
+        return;				/* Already a class */
+
+    if (prog->nucls == FPAT_UCLASS)
+    {
+        prog->nucls++;
+        return;				/* Too many classes */
+    }
+
+    memmove(&prog->ucls[i+1], &prog->ucls[i],
+        (prog->nucls - i) * sizeof(prog->ucls[0]));
+    prog->ucls[i] = cp;
+    prog->nucls++;
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_getc()
+*	Reads the next pattern char from '*pat', which is a single char unless
+*	compiled pattern 'prog' is a UTF-8 pattern, and advances '*pat' past
+*	it.
+*
+* Returns
+*	The char, or its code point.
+*/
+
+static long fpattern_getc(const fpattern_t *prog, const char **pat)
+{
+    const unsigned char *	p;
+    long			cp;
+
+    if (!(prog->flags & FPAT_UTF8))
+        return (*(*pat)++);
+
+    p = (const unsigned char *) *pat;
+    cp = fpattern_utf8_get(&p, 4);
+    *pat = (const char *) p;
+    return (cp);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_lit()
+*	Determines the folded name char that matches the literal pattern char
+*	'ch' in compiled pattern 'prog'.
+*
+* Returns
+*	The folded char, or the char class of a UTF-8 code point.
+*
+* Caveats
+*	While the char classes of a UTF-8 pattern are being found, this adds
+*	a class for 'ch' and returns zero.
+*/
+
+static unsigned char fpattern_lit(fpattern_t *prog, long ch)
+{
+    if (!(prog->flags & FPAT_UTF8))
+        return (prog->fold[(unsigned char) ch]);
+
+    if (prog->flags & FPAT_NOCASE)
+        ch = fpattern_ufold(ch);
+
+    if (prog->ufind)
+    {
+        fpattern_ubound(prog, ch);
+        fpattern_ubound(prog, ch+1);
+        return (0);
+    }
+    return ((unsigned char) fpattern_uclass(prog, ch));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_uset()
+*	Adds the code points within the range 'lo' to 'hi' to char set 'set'
+*	of compiled UTF-8 pattern 'prog', by setting the bits of the char
+*	classes within the range.
+*
+* Caveats
+*	While the char classes are being found, this adds classes for the
+*	range instead, so that no class lies partly within it.
+*/
+
+static void fpattern_uset(fpattern_t *prog, unsigned char *set, long lo,
+    long hi)
+{
+    int		c;
+
+    if (prog->flags & FPAT_NOCASE)
+    {
+        lo = fpattern_ufold(lo);
+        hi = fpattern_ufold(hi);
+    }
+
+    if (prog->ufind)
+    {
+        fpattern_ubound(prog, lo);
+        fpattern_ubound(prog, hi+1);
+        return;
+    }
+
+    for (c = 0;  c < 0x80;  c++)
+    {
+        if (prog->fold[c] >= lo  &&  prog->fold[c] <= hi)
+            setbit(set, c);
+    }
+
+    for (c = 0;  c < prog->nucls;  c++)
+    {
+        if (prog->ucls[c] >= lo  &&  prog->ucls[c] <= hi)
+            setbit(set, 0x80 + c);
+    }
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_parse()
+*	Translates the well-formed pattern 'pat' into the instructions of
+*	compiled pattern 'prog', using the quoting char and path delimiters
+*	selected by its flags.
+*
+* Caveats
+*	This mirrors the way that fpattern_submatch() decodes the pattern, so
+*	that quirks such as a negated subpattern ending in an incomplete set
+*	behave identically (they compile into an FPI_FAIL instruction).
+*
+*	Sets are resolved into 256-bit bitmaps, using the same comparison of
+*	lowercased chars as fpattern_submatch() does for each range.  For a
+*	UTF-8 pattern, the bits are those of the char classes within each
+*	range of code points.
+*
+*	Each "{...}" group is marked by an FPI_ALT instruction, an FPI_JMP in
+*	place of each ',' that separates its alternatives, and an FPI_END, which
+*	fpattern_trie() then turns into the instructions that match them.
+*/
+
+static void fpattern_parse(fpattern_t *prog, const char *pat)
+{
+    struct fpat_ins *	ip;
+    unsigned char *	set;
+    long		pch;
+    int			quote, del2;
+    int			c;
+    int			yes;
+    int			depth;
+    long		lo, hi;
+
+    quote = quotech(prog->flags);
+    del2 = delch2(prog->flags);
+
+    ip = prog->ins;
+    depth = 0;
+    while (*pat != '\0')
+    {
+        pch = fpattern_getc(prog, &pat);
+        ip->ch = 0;
+        ip->arg = 0;
+
+        if (pch == quote)
+        {
+            /* Match a quoted char */
+            if (*pat == '\0')
+                goto fail;		/* Missing quoted char */
+            ip->op = FPI_CHAR;
+            ip->ch = fpattern_lit(prog, fpattern_getc(prog, &pat));
+            ip++;
+            continue;
+        }
+
+        if ((prog->flags & FPAT_DELIM)  &&  (pch == DEL  ||  pch == del2))
+        {
+            /* Match path delimiter char */
+            ip->op = FPI_DEL;
+            ip++;
+            continue;
+        }
+
+        if (depth > 0  &&  (pch == FPAT_ALT_SEP  ||  pch == FPAT_ALT_R))
+        {
+            /* End of an alternative */
+            ip->op = (pch == FPAT_ALT_SEP ? FPI_JMP : FPI_END);
+            depth -= (pch == FPAT_ALT_R);
+            ip++;
+            continue;
+        }
+
+        switch (pch)
+        {
+        case FPAT_ALT_L:
+            /* Start of alternatives */
+            ip->op = FPI_ALT;
+            depth++;
+            break;
+
+        case FPAT_ANY:
+            /* Match a single char */
+            ip->op = FPI_ANY;
+            break;
+
+        case FPAT_CLOS:
+            /* Match zero or more chars */
+            ip->op = FPI_CLOS;
+            if (!(prog->flags & FPAT_DELIM)  ||  *pat != FPAT_CLOS)
+                break;
+
+            /* Match zero or more chars, including delimiters */
+            pat++;
+            ip->op = FPI_ALL;
+            if (*pat == quote  ||  (*pat != DEL  &&  *pat != del2))
+                break;
+            if (ip > prog->ins  &&  ip[-1].op != FPI_DEL)
+                break;			/* Not a whole dir, "**" + "/" */
+
+            /* Match zero or more whole dirs, as (ALL DEL)? */
+            ip[0].op = FPI_FORK;
+            ip[1].op = FPI_ALL;
+            ip[1].ch = 0;
+            ip[1].arg = 0;
+            ip[2].op = FPI_DEL;
+            ip[2].ch = 0;
+            ip[2].arg = 0;
+            ip += 2;
+            pat++;
+            break;
+
+        case SUB:
+            /* Match zero or more chars */
+            ip->op = FPI_SUB;
+            break;
+
+        case FPAT_SET_L:
+            /* Match char set/range */
+            ip->op = FPI_SET;
+            ip->arg = prog->nsets;
+            set = prog->sets[prog->nsets++];
+            memset(set, 0, sizeof(prog->sets[0]));
+
+            yes = true;
+            if (*pat == FPAT_SET_NOT)
+            {
+               pat++;
+               yes = false;	/* Set negation */
+            }
+
+            /* Look for [s], [-], [abc], [a-c] */
+            while (*pat != FPAT_SET_R  &&  *pat != '\0')
+            {
+                if (*pat == quote)
+                    pat++;	/* Quoted char */
+
+                if (*pat == '\0')
+                    break;
+                lo = fpattern_getc(prog, &pat);
+                hi = lo;
+
+                if (*pat == FPAT_SET_THRU)
+                {
+                    /* Range */
+                    pat++;
+
+                    if (*pat == quote)
+                        pat++;	/* Quoted char */
+
+                    if (*pat == '\0')
+                        break;
+                    hi = fpattern_getc(prog, &pat);
+                }
+
+                if (*pat == '\0')
+                    break;
+
+                /* Add the chars within the set range */
+                if (prog->flags & FPAT_UTF8)
+                {
+                    fpattern_uset(prog, set, lo, hi);
+                    continue;
+                }
+
+                lo = (char) prog->fold[(unsigned char) lo];
+                hi = (char) prog->fold[(unsigned char) hi];
+                for (c = 0;  c < 256;  c++)
+                {
+                    if ((char) prog->fold[c] >= lo  &&
+                        (char) prog->fold[c] <= hi)
+                        setbit(set, c);
+                }
+            }
+
+            if (*pat == '\0')
+                goto fail;		/* Missing closing bracket */
+            pat++;
+
+            if (!yes)
+            {
+                for (c = 0;  c < 32;  c++)
+                    set[c] = (unsigned char) ~set[c];
+            }
+            break;
+
+        case FPAT_NOT:
+            /* Match only if rest of pattern does not match */
+            if (*pat == '\0')
+                goto fail;		/* Missing subpattern */
+            ip->op = FPI_NOT;
+            break;
+
+        default:
+            /* Match a (non-null) char exactly */
+            ip->op = FPI_CHAR;
+            ip->ch = fpattern_lit(prog, pch);
+            break;
+        }
+        ip++;
+    }
+
+    /* End of pattern */
+    ip->op = FPI_MATCH;
+    prog->nins = (int) (ip - prog->ins) + 1;
+    return;
+
+fail:
+    /* Malformed subpattern, which never matches */
+    ip->op = FPI_FAIL;
+    ip++;
+    ip->op = FPI_MATCH;
+    prog->nins = (int) (ip - prog->ins) + 1;
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_alloc()
+*	Allocates a compiled pattern with room for 'nins' instructions and
+*	'nsets' char sets, and initializes its char class tables and case
+*	folding for matching 'flags'.
+*
+* Returns
+*	A pointer to the compiled pattern, or null if there is no memory.
+*/
+
+static fpattern_t *fpattern_alloc(size_t nins, size_t nsets, int flags)
+{
+    fpattern_t *	prog;
+    int			words;
+    int			c;
+
+    words = (int) ((nins + WBITS-1) / WBITS);
+    prog = (fpattern_t *) malloc(sizeof(fpattern_t) +
+        (2*256+4)*words*sizeof(fpat_word) +
+        nins*(sizeof(struct fpat_ins) + sizeof(int)) +
+        nsets*sizeof(prog->sets[0]));
+    if (prog == NULL)
+        return (NULL);
+
+    prog->nins = 0;
+    prog->nsets = 0;
+    prog->flags = flags;
+    prog->words = words;
+    prog->cons = (fpat_word *) (prog + 1);
+    prog->loop = prog->cons + 256*words;
+    prog->star = prog->loop + 256*words;
+    prog->fork = prog->star + words;
+    prog->init = prog->fork + words;
+    prog->fin = prog->init + words;
+    prog->ins = (struct fpat_ins *) (prog->fin + words);
+    prog->eps = NULL;
+    prog->njumps = 0;
+    prog->jump = (int *) (prog->ins + nins);
+    prog->sets = (unsigned char (*)[32]) (prog->jump + nins);
+
+    /* Build the char class tables */
+    memset(prog->anyset, 0xFF, sizeof(prog->anyset));
+    memset(prog->delset, 0, sizeof(prog->delset));
+    if (flags & FPAT_DELIM)
+    {
+        setbit(prog->delset, DEL);
+        setbit(prog->delset, delch2(flags));
+        for (c = 0;  c < 32;  c++)
+            prog->anyset[c] &= (unsigned char) ~prog->delset[c];
+    }
+    memcpy(prog->subset, prog->anyset, sizeof(prog->subset));
+    prog->subset['.' >> 3] &= (unsigned char) ~(1 << ('.' & 7));
+
+    for (c = 0;  c < 256;  c++)
+        prog->fold[c] = (unsigned char) c;
+    if ((flags & FPAT_NOCASE)  &&  (flags & FPAT_UTF8))
+    {
+        /* Names are folded as code points, apart from ASCII chars */
+        for (c = 'A';  c <= 'Z';  c++)
+            prog->fold[c] = (unsigned char) (c + ('a'-'A'));
+    }
+    else if (flags & FPAT_NOCASE)
+        memcpy(prog->fold, fpat_fold, sizeof(prog->fold));
+
+    /* One non-ASCII char class until fpattern_parse() finds the rest */
+    prog->ufind = false;
+    prog->nucls = 1;
+    prog->ucls[0] = 0x80;
+
+    /* No prefilter until fpattern_literals() */
+    prog->minlen = 0;
+    prog->maxlen = (size_t) -1;
+    prog->exact = true;
+    prog->npre = 0;
+    prog->nsuf = 0;
+    prog->nlit = 0;
+    prog->litalt = NOALT;
+    prog->ascii = false;
+    prog->mindel = 0;
+    prog->maxdel = (size_t) -1;
+
+    return (prog);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_trie()
+*	Replaces the "{...}" groups of parsed pattern 'prog' with instructions
+*	that match their alternatives, factored into a trie.  An element that
+*	several alternatives begin with is matched once, ahead of a group of
+*	what follows it in each of them, and an element that all of them end
+*	with is matched once, after the group.  So "{jpg,jpeg,png}" becomes
+*	"{jp{,e},pn}g", and "{a,ba}" becomes "{,b}a".  Alternatives that
+*	are the same are matched only once, and a group left with a single
+*	branch is not marked at all.
+*
+*	A group of 'k' branches becomes the instructions
+*
+*	    ALT b1 JMP OR b2 JMP ... OR bk END
+*
+*	where FPI_ALT and each FPI_OR move on to the branch after them and jump
+*	to the next FPI_OR, if there is one, and each FPI_JMP jumps to the
+*	FPI_END.
+*
+*	A pattern of nothing but empty groups, such as "{}", becomes an
+*	FPI_FAIL, since it matches no name at all.
+*
+*	The instructions are counted in 't->n', and stored into 't->out' unless
+*	it is null.  The alternatives of the groups being factored are kept in
+*	't->beg[]' and 't->end[]'.
+*
+* Returns
+*	A pointer to the compiled pattern holding the factored instructions,
+*	or null if there is no memory.  'prog' is released.
+*/
+
+static void	fpattern_trie_seq(struct fpat_trie *t, int pc, int end);
+
+static int fpattern_trie_next(const struct fpat_ins *ins, int pc)
+{
+    int		depth;
+
+    /* Find the end of the element (or group) starting at 'pc' */
+    if (ins[pc].op == FPI_FORK)
+        return (pc+3);			/* "**" + "/" */
+    if (ins[pc].op != FPI_ALT)
+        return (pc+1);
+
+    for (depth = 0;  ;  pc++)
+    {
+        if (ins[pc].op == FPI_ALT)
+            depth++;
+        else if (ins[pc].op == FPI_END  &&  --depth == 0)
+            return (pc+1);
+    }
+}
+
+static int fpattern_trie_same(const fpattern_t *prog, int a, int b)
+{
+    const struct fpat_ins *	x;
+    const struct fpat_ins *	y;
+
+    /* Determine whether elements 'a' and 'b' match the same chars */
+    x = &prog->ins[a];
+    y = &prog->ins[b];
+    if (x->op != y->op  ||  x->op == FPI_ALT)
+        return (false);
+    if (x->op == FPI_CHAR)
+        return (x->ch == y->ch);
+    if (x->op == FPI_SET)
+        return (memcmp(prog->sets[x->arg], prog->sets[y->arg],
+            sizeof(prog->sets[0])) == 0);
+    return (true);
+}
+
+static int fpattern_trie_eq(const struct fpat_trie *t, int i, int j)
+{
+    /* Determine whether alternatives 'i' and 'j' begin the same way */
+    if (t->beg[i] == t->end[i])
+        return (t->beg[j] == t->end[j]);
+    return (t->beg[j] < t->end[j]  &&
+        fpattern_trie_same(t->prog, t->beg[i], t->beg[j]));
+}
+
+static int fpattern_trie_mark(struct fpat_trie *t, int op, int arg)
+{
+    /* Emit a group instruction */
+    if (t->out != NULL)
+    {
+        t->out[t->n].op = (unsigned char) op;
+        t->out[t->n].ch = 0;
+        t->out[t->n].arg = (unsigned int) arg;
+    }
+    return (t->n++);
+}
+
+static void fpattern_trie_copy(struct fpat_trie *t, int pc, int end)
+{
+    /* Emit the (ungrouped) instructions 'pc' to 'end-1' */
+    if (t->out != NULL)
+        memcpy(t->out + t->n, t->prog->ins + pc,
+            (end - pc)*sizeof(struct fpat_ins));
+    t->n += end - pc;
+}
+
+static void fpattern_trie_alts(struct fpat_trie *t, int lo, int hi)
+{
+    const struct fpat_ins *	ins;
+    int				i, j, m, n;
+    int				pc, tmp;
+    int				suf, end;
+    int				nb, prev, jmp;
+
+    ins = t->prog->ins;
+
+    /* Take off the elements that all of alternatives 'lo...hi-1' end with */
+    end = t->end[lo];
+    for (;;)
+    {
+        for (i = lo;  i < hi;  i++)
+        {
+            pc = t->end[i]-1;
+            if (t->end[i] == t->beg[i]  ||  ins[pc].op == FPI_END  ||
+                (pc-2 >= t->beg[i]  &&  ins[pc-2].op == FPI_FORK)  ||
+                !fpattern_trie_same(t->prog, pc, t->end[lo]-1))
+                break;
+        }
+        if (i < hi)
+            break;
+        for (i = lo;  i < hi;  i++)
+            t->end[i]--;
+    }
+    suf = t->end[lo];
+
+    /* Gather the alternatives that begin the same way */
+    nb = 0;
+    for (i = lo;  i < hi;  i = m, nb++)
+    {
+        for (m = i+1, j = i+1;  j < hi;  j++)
+        {
+            if (fpattern_trie_eq(t, i, j))
+            {
+                tmp = t->beg[j], t->beg[j] = t->beg[m], t->beg[m] = tmp;
+                tmp = t->end[j], t->end[j] = t->end[m], t->end[m] = tmp;
+                m++;
+            }
+        }
+    }
+
+    /* Emit a branch for each set of them */
+    prev = (nb > 1 ? fpattern_trie_mark(t, FPI_ALT, 0) : 0);
+    jmp = 0;
+    for (i = lo;  i < hi;  i = m)
+    {
+        for (m = i+1;  m < hi  &&  fpattern_trie_eq(t, i, m);  m++)
+            ;
+
+        if (i > lo)
+        {
+            /* Next branch */
+            jmp = fpattern_trie_mark(t, FPI_JMP, jmp);
+            pc = fpattern_trie_mark(t, FPI_OR, 0);
+            if (t->out != NULL)
+                t->out[prev].arg = (unsigned int) pc;
+            prev = pc;
+        }
+
+        if (m - i == 1)
+            fpattern_trie_seq(t, t->beg[i], t->end[i]);
+        else if (t->beg[i] < t->end[i])
+        {
+            /* Match the element they begin with, then the rest of them */
+            n = fpattern_trie_next(ins, t->beg[i]) - t->beg[i];
+            fpattern_trie_copy(t, t->beg[i], t->beg[i] + n);
+            for (j = i;  j < m;  j++)
+                t->beg[j] += n;
+            fpattern_trie_alts(t, i, m);
+        }
+    }
+
+    if (nb > 1)
+    {
+        /* End of the group, where each branch jumps to */
+        pc = fpattern_trie_mark(t, FPI_END, 0);
+        for (;  jmp != 0  &&  t->out != NULL;  jmp = prev)
+        {
+            prev = (int) t->out[jmp].arg;
+            t->out[jmp].arg = (unsigned int) pc;
+        }
+    }
+
+    /* Match the elements they all end with */
+    fpattern_trie_copy(t, suf, end);
+}
+
+static void fpattern_trie_seq(struct fpat_trie *t, int pc, int end)
+{
+    const struct fpat_ins *	ins;
+    int				next;
+    int				lo;
+    int				depth;
+
+    /* Emit the instructions 'pc' to 'end-1', factoring each group */
+    ins = t->prog->ins;
+    for (;  pc < end;  pc = next)
+    {
+        next = fpattern_trie_next(ins, pc);
+        if (ins[pc].op != FPI_ALT)
+        {
+            fpattern_trie_copy(t, pc, next);
+            continue;
+        }
+
+        /* Split the group into its alternatives */
+        lo = t->top;
+        t->beg[t->top] = pc+1;
+        depth = 0;
+        for (pc++;  pc < next-1;  pc++)
+        {
+            if (ins[pc].op == FPI_ALT)
+                depth++;
+            else if (ins[pc].op == FPI_END)
+                depth--;
+            else if (ins[pc].op == FPI_JMP  &&  depth == 0)
+            {
+                t->end[t->top++] = pc;
+                t->beg[t->top] = pc+1;
+            }
+        }
+        t->end[t->top++] = next-1;
+
+        fpattern_trie_alts(t, lo, t->top);
+        t->top = lo;
+    }
+}
+
+static fpattern_t *fpattern_trie(fpattern_t *prog)
+{
+    struct fpat_trie	t;
+    fpattern_t *	trie;
+
+    /* Count the instructions of the trie */
+    t.prog = prog;
+    t.out = NULL;
+    t.n = 0;
+    t.top = 0;
+    t.beg = (int *) malloc(2*prog->nins*sizeof(int));
+    t.end = t.beg + prog->nins;
+
+    trie = NULL;
+    if (t.beg != NULL)
+    {
+        fpattern_trie_seq(&t, 0, prog->nins);
+        trie = fpattern_alloc(t.n+1, prog->nsets, prog->flags);
+    }
+
+    if (trie != NULL)
+    {
+        /* Build it */
+        t.out = trie->ins;
+        t.n = 0;
+        fpattern_trie_seq(&t, 0, prog->nins);
+        trie->nins = t.n;
+
+        if (t.n == 1)
+        {
+            /* Only empty groups, which (unlike "") match no empty name */
+            trie->ins[0].op = FPI_FAIL;
+            trie->ins[1].op = FPI_MATCH;
+            trie->nins = 2;
+        }
+
+        trie->nsets = prog->nsets;
+        memcpy(trie->sets, prog->sets, prog->nsets*sizeof(prog->sets[0]));
+        trie->nucls = prog->nucls;
+        memcpy(trie->ucls, prog->ucls, sizeof(trie->ucls));
+    }
+
+    free(t.beg);
+    fpattern_free(prog);
+    return (trie);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_close()
+*	Adds to NFA state vector 'st' the states that follow each closure state
+*	in it (since a closure can match zero chars), and the state three
+*	instructions past each "**" fork state.
+*
+*	The states that each group state jumps to are added as well.
+*
+*	If 'back' is true, the vector holds backward NFA states, where state 'i'
+*	means that instructions 'i' and on have been matched, and the closure,
+*	fork, and group states that precede them are added.
+*/
+
+static void fpattern_close(const fpattern_t *prog, fpat_word *st, int back)
+{
+    fpat_word	x, y, f;
+    fpat_word	carry, carry3;
+    int		w;
+    int		j, a, b;
+    int		more;
+
+    do
+    {
+        more = false;
+        carry = 0;
+        carry3 = 0;
+
+        if (!back)
+        {
+            for (w = 0;  w < prog->words;  w++)
+            {
+                x = st[w] & prog->star[w];
+                f = st[w] & prog->fork[w];
+                y = (x << 1) | carry | (f << 3) | carry3;
+                carry = x >> (WBITS-1);
+                carry3 = f >> (WBITS-3);
+                if (y & ~st[w])
+                {
+                    st[w] |= y;
+                    more = true;
+                }
+            }
+        }
+        else
+        {
+            for (w = prog->words;  w-- > 0;  )
+            {
+                x = st[w];
+                y = (((x >> 1) | carry) & prog->star[w]) |
+                    (((x >> 3) | carry3) & prog->fork[w]);
+                carry = x << (WBITS-1);
+                carry3 = x << (WBITS-3);
+                if (y & ~st[w])
+                {
+                    st[w] |= y;
+                    more = true;
+                }
+            }
+        }
+
+        /* Follow the jumps between the alternatives of each group */
+        for (j = 0;  j < prog->njumps;  j++)
+        {
+            a = prog->jump[j];
+            b = (int) prog->ins[a].arg;
+            if (back)
+                a = b, b = prog->jump[j];
+            if (wbit(st, a)  &&  !wbit(st, b))
+            {
+                wset(st, b);
+                more = true;
+            }
+        }
+    } while (more);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_close1()
+*	Adds to the single word NFA state vector 'x' of compiled pattern 'prog'
+*	the states that follow its closure, fork, and group states, as
+*	fpattern_close() does.
+*
+*	The closure of a vector is the union of the closures of its bytes, so
+*	if 'prog->eps' holds the closure of every byte value, the vector is
+*	closed with a lookup per byte.
+*
+* Returns
+*	The resulting state vector.
+*/
+
+static fpat_word fpattern_close1(const fpattern_t *prog, fpat_word x)
+{
+    fpat_word	y;
+    int		j, pc;
+
+    if (prog->eps != NULL)
+    {
+        for (y = 0, j = 0;  x != 0;  x >>= 8, j += 256)
+            y |= prog->eps[j + (int) (x & 0xFF)];
+        return (y);
+    }
+
+    do
+    {
+        y = x;
+        x |= ((x & prog->star[0]) << 1) | ((x & prog->fork[0]) << 3);
+        for (j = 0;  j < prog->njumps;  j++)
+        {
+            pc = prog->jump[j];
+            x |= ((x >> pc) & 1) << prog->ins[pc].arg;
+        }
+    } while (x != y);
+    return (x);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_build()
+*	Builds the NFA state masks for the instructions of compiled pattern
+*	'prog', and selects the engine used to match it.
+*
+*	NFA state 'i' means that the first 'i' instructions have been matched.
+*	Bit 'i' of 'cons[c]' is set if instruction 'i' consumes char 'c' and
+*	moves on to state 'i+1', and bit 'i' of 'loop[c]' is set if instruction
+*	'i' is a closure that consumes char 'c' and stays in state 'i'.  A "**"
+*	fork state 'i' moves on to state 'i+1' or 'i+3' without consuming any
+*	char, and so do the states of a "{...}" group (see fpattern_trie()),
+*	whose jumps are listed in 'jump[]'.
+*
+*	The instructions may hold several patterns one after another, each one
+*	ending with an FPI_MATCH, in which case the NFA has a start state and a
+*	final state for each of them.
+*
+*	A single word state vector with groups gets a table of its closures
+*	(see fpattern_close1()), unless there is no memory for it.
+*/
+
+static void fpattern_build(fpattern_t *prog)
+{
+    const struct fpat_ins *	ip;
+    const unsigned char *	cls;
+    int				pc;
+    int				c;
+    int				alt, nalt;
+    int				nots, subs, fins;
+    fpat_word *			eps;
+
+    memset(prog->cons, 0, (2*256+4)*prog->words*sizeof(fpat_word));
+    prog->njumps = 0;
+    nots = 0;
+    subs = 0;
+    fins = 0;
+
+    for (pc = 0;  pc < prog->nins;  pc++)
+    {
+        ip = &prog->ins[pc];
+        cls = NULL;
+
+        if (pc == 0  ||  ip[-1].op == FPI_MATCH)
+            wset(prog->init, pc);	/* Start of a pattern */
+
+        switch (ip->op)
+        {
+        case FPI_CHAR:
+            /* Note the other char that folds to it, if only one does */
+            alt = ip->ch;
+            nalt = 0;
+            for (c = 0;  c < 256;  c++)
+            {
+                if (prog->fold[c] == ip->ch)
+                {
+                    wset(prog->cons + c*prog->words, pc);
+                    if (c != ip->ch)
+                    {
+                        alt = c;
+                        nalt++;
+                    }
+                }
+            }
+            prog->ins[pc].arg = (nalt <= 1 ? alt : NOALT);
+            break;
+
+        case FPI_ANY:
+            cls = prog->anyset;
+            break;
+
+        case FPI_SET:
+            cls = prog->sets[ip->arg];
+            break;
+
+        case FPI_DEL:
+            cls = prog->delset;
+            break;
+
+        case FPI_CLOS:
+        case FPI_SUB:
+            /* Closure loops on its own state */
+            cls = (ip->op == FPI_CLOS ? prog->anyset : prog->subset);
+            subs += (ip->op == FPI_SUB);
+            wset(prog->star, pc);
+            for (c = 0;  c < 256;  c++)
+            {
+                if (inset(cls, c))
+                    wset(prog->loop + c*prog->words, pc);
+            }
+            cls = NULL;
+            break;
+
+        case FPI_ALL:
+            /* Closure loops on its own state for every char */
+            wset(prog->star, pc);
+            for (c = 0;  c < 256;  c++)
+                wset(prog->loop + c*prog->words, pc);
+            break;
+
+        case FPI_FORK:
+            /* Skips the closure and delimiter that follow it, or not */
+            wset(prog->star, pc);
+            wset(prog->fork, pc);
+            break;
+
+        case FPI_ALT:
+        case FPI_OR:
+            /* Moves on to its branch, or jumps to the next one */
+            wset(prog->star, pc);
+            if (ip->arg != 0)
+                prog->jump[prog->njumps++] = pc;
+            break;
+
+        case FPI_JMP:
+            /* Jumps to the end of its group */
+            prog->jump[prog->njumps++] = pc;
+            break;
+
+        case FPI_END:
+            wset(prog->star, pc);
+            break;
+
+        case FPI_NOT:
+            nots++;
+            break;
+
+        case FPI_MATCH:
+            fins++;
+            wset(prog->fin, pc);
+            break;
+        }
+
+        if (cls != NULL)
+        {
+            for (c = 0;  c < 256;  c++)
+            {
+                if (inset(cls, c))
+                    wset(prog->cons + c*prog->words, pc);
+            }
+        }
+    }
+
+    fpattern_close(prog, prog->init, false);
+
+    /* Tabulate the closures of each byte of a single word state vector */
+    free(prog->eps);
+    prog->eps = NULL;
+    if (prog->words == 1  &&  prog->njumps > 0)
+    {
+        eps = (fpat_word *) malloc((prog->nins+7)/8*256*sizeof(fpat_word));
+        for (pc = 0;  eps != NULL  &&  pc < prog->nins;  pc += 8)
+        {
+            for (c = 0;  c < 256;  c++)
+                eps[pc/8*256 + c] = fpattern_close1(prog, (fpat_word) c << pc);
+        }
+        prog->eps = eps;
+    }
+
+    /* Select the matching engine */
+    if (nots > 0)
+        prog->engine = FPE_NOT;
+    else if (subs == 0  &&  fins == 1  &&  prog->njumps == 0  &&
+        !(prog->flags & FPAT_DELIM))
+        prog->engine = FPE_STAR;	/* Closures match any char */
+    else
+        prog->engine = FPE_NFA;
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_literals()
+*	Extracts the prefilter of compiled pattern 'prog', made up of the
+*	shortest and longest names it can match, the fewest and most path
+*	delimiters they can contain, its literal prefix and suffix, and the
+*	longest run of literal chars between them.  Every matching name
+*	must contain all of these, so a name that lacks any of them can be
+*	rejected without running the NFA.
+*
+* Caveats
+*	This must be called only for a single pattern, after fpattern_build().
+*	Patterns containing negated subpatterns get no prefilter, since their
+*	literals need not appear in a matching name.
+*
+*	Only the elements outside of "{...}" groups must be matched, so the
+*	others count only toward the longest names.
+*/
+
+static void fpattern_literals(fpattern_t *prog)
+{
+    const struct fpat_ins *	ip;
+    int				end;
+    int				pc, run;
+    int				c;
+    int				deep;
+    int				depth;
+
+    if (prog->engine == FPE_NOT)
+        return;
+
+    /* Count the chars matched by the pattern */
+    prog->minlen = 0;
+    prog->maxlen = 0;
+    depth = 0;
+    for (pc = 0;  pc < prog->nins-1;  pc++)
+    {
+        switch (prog->ins[pc].op)
+        {
+        case FPI_FORK:
+            pc += 2;		/* Skip the optional closure and delimiter */
+            prog->maxlen = (size_t) -1;
+            break;
+
+        case FPI_CLOS:
+        case FPI_SUB:
+        case FPI_ALL:
+            prog->maxlen = (size_t) -1;
+            break;
+
+        case FPI_ALT:
+            depth++;
+            break;
+
+        case FPI_END:
+            depth--;
+            break;
+
+        case FPI_OR:
+        case FPI_JMP:
+            break;
+
+        default:
+            if (depth == 0)
+                prog->minlen++;
+            if (prog->maxlen != (size_t) -1)
+                prog->maxlen++;
+            break;
+        }
+    }
+
+    /* Find the literal prefix */
+    ip = prog->ins;
+    for (pc = 0;  pc < FPAT_LIT_MAX  &&  ip[pc].op == FPI_CHAR;  pc++)
+        prog->pre[prog->npre++] = ip[pc].ch;
+
+    /* Find the literal suffix, not overlapping the prefix */
+    end = prog->nins-1;
+    while (end > prog->npre  &&  prog->nsuf < FPAT_LIT_MAX  &&
+        ip[end-1].op == FPI_CHAR)
+        end--, prog->nsuf++;
+    for (pc = 0;  pc < prog->nsuf;  pc++)
+        prog->suf[pc] = ip[end+pc].ch;
+
+    /* Find the longest inner literal, between the prefix and suffix */
+    run = 0;
+    depth = 0;
+    for (pc = prog->npre;  pc <= end;  pc++)
+    {
+        if (pc < end  &&  ip[pc].op == FPI_CHAR  &&  depth == 0)
+            run++;
+        else
+        {
+            if (run > prog->nlit)
+            {
+                prog->nlit = (run < FPAT_LIT_MAX ? run : FPAT_LIT_MAX);
+                prog->litalt = (int) ip[pc-run].arg;
+                for (c = 0;  c < prog->nlit;  c++)
+                    prog->lit[c] = ip[pc-run + c].ch;
+            }
+            run = 0;
+        }
+
+        if (pc < end)
+            depth += (ip[pc].op == FPI_ALT) - (ip[pc].op == FPI_END);
+    }
+
+    /* Count the instructions that can match a path delimiter */
+    if (prog->flags & FPAT_DELIM)
+    {
+        prog->maxdel = 0;
+        deep = false;
+        depth = 0;
+        for (pc = 0;  pc < prog->nins-1;  pc++)
+        {
+            switch (ip[pc].op)
+            {
+            case FPI_FORK:
+                pc += 2;	/* Skip the optional closure and delimiter */
+                deep = true;
+                break;
+
+            case FPI_ALL:
+                deep = true;
+                break;
+
+            case FPI_ALT:
+                depth++;
+                break;
+
+            case FPI_END:
+                depth--;
+                break;
+
+            case FPI_DEL:
+                if (depth == 0)
+                    prog->mindel++;
+                prog->maxdel++;
+                break;
+
+            case FPI_CHAR:
+                for (c = 0;  c < 256;  c++)
+                {
+                    if (inset(prog->delset, c)  &&  prog->fold[c] == ip[pc].ch)
+                    {
+                        prog->maxdel++;
+                        break;
+                    }
+                }
+                break;
+
+            case FPI_SET:
+                for (c = 0;  c < 32;  c++)
+                {
+                    if (prog->sets[ip[pc].arg][c] & prog->delset[c])
+                    {
+                        prog->maxdel++;
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+        if (deep)
+            prog->maxdel = (size_t) -1;
+    }
+
+    /* Literals can be compared as is unless names are case folded */
+    for (c = 0;  c < 256;  c++)
+    {
+        if (prog->fold[c] != c)
+        {
+            prog->exact = false;
+            break;
+        }
+    }
+
+    /* ASCII names can be folded a word at a time if only A-Z are folded */
+    prog->ascii = true;
+    for (c = 0;  c < 0x80;  c++)
+    {
+        if (prog->fold[c] != (c >= 'A'  &&  c <= 'Z' ? c|0x20 : c))
+            prog->ascii = false;
+    }
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_closed()
+*	Checks that each FPI_ALT instruction of compiled pattern 'prog' is
+*	matched by an FPI_END, before fpattern_trie() relies on it.
+*
+* Returns
+*	True if every group is closed, otherwise false.
+*/
+
+static int fpattern_closed(const fpattern_t *prog)
+{
+    int		depth;
+    int		i;
+
+    depth = 0;
+    for (i = 0;  i < prog->nins;  i++)
+    {
+        if (prog->ins[i].op == FPI_ALT)
+            depth++;
+        else if (prog->ins[i].op == FPI_END  &&  --depth < 0)
+            return (false);
+    }
+    return (depth == 0);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_translate()
+*	Compiles (non-null) pattern 'pat' for matching 'flags'.
+*
+* Returns
+*	A pointer to the compiled pattern, or null on error, as for
+*	fpattern_compile().
+*/
+
+static fpattern_t *fpattern_translate(const char *pat, int flags, int *erroff)
+{
+    fpattern_t *	prog;
+    size_t		len;
+    size_t		nsets;
+    size_t		nalts;
+
+    /* Verify that the pattern is valid */
+    if (!fpattern_check(pat, quotech(flags), erroff))
+        return (NULL);
+
+    /* Size the program; every pattern char yields at most one instruction */
+    nsets = 0;
+    nalts = 0;
+    for (len = 0;  pat[len] != '\0';  len++)
+    {
+        if (pat[len] == FPAT_SET_L)
+            nsets++;
+        else if (pat[len] == FPAT_ALT_L)
+            nalts++;
+    }
+
+    fpattern_snap();
+
+    prog = fpattern_alloc(len+2, nsets, flags);
+    if (prog == NULL)
+        return (NULL);
+
+    /* Find the classes of non-ASCII chars that a UTF-8 pattern tells apart */
+    if (flags & FPAT_UTF8)
+    {
+        prog->ufind = true;
+        fpattern_parse(prog, pat);
+        prog->ufind = false;
+        prog->nsets = 0;
+
+        if (prog->nucls > FPAT_UCLASS)
+        {
+            DL(printf("fpattern_translate: too many UTF-8 char classes\n"));
+            fpattern_free(prog);
+            return (NULL);
+        }
+    }
+
+    /* Translate the pattern */
+    fpattern_parse(prog, pat);
+    if (nalts > 0  &&  !fpattern_closed(prog))
+    {
+        DL(printf("fpattern_translate: unclosed '%c'\n", FPAT_ALT_L));
+        *erroff = (int) len;
+        fpattern_free(prog);
+        return (NULL);
+    }
+
+    if (nalts > 0)
+    {
+        prog = fpattern_trie(prog);
+        if (prog == NULL)
+            return (NULL);
+    }
+    fpattern_build(prog);
+    fpattern_literals(prog);
+
+    DL(printf("fpattern_translate: %d instructions, %d sets, engine %d\n",
+        prog->nins, prog->nsets, prog->engine));
+    return (prog);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_compile()
+*	Compiles pattern 'pat' into a form that can be matched repeatedly
+*	against filenames without being parsed again.
+*
+* Returns
+*	A pointer to the compiled pattern, which must be released by a call to
+*	fpattern_free(), or null on error.
+*
+*	If 'pat' is not a well-formed pattern, null is returned and the offset
+*	of the offending pattern char is stored into '*erroff'.  On any other
+*	error (null 'pat', or no memory), '*erroff' is set to -1.  'erroff' may
+*	be null.
+*
+* See also
+*	fpattern_exec(), fpattern_free().
+*/
+
+fpattern_t *fpattern_compile(const char *pat, int *erroff)
+{
+    int			off;
+
+    DL(printf("fpattern_compile: pat=%p:\"%s\"\n", pat, pat ? pat : ""));
+
+    if (erroff == NULL)
+        erroff = &off;
+    *erroff = -1;
+
+    /* Check args */
+    if (pat == NULL)
+        return (NULL);
+
+    return (fpattern_translate(pat, NATIVE, erroff));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_compile_len()
+*	Compiles pattern 'pat[0...patlen-1]', which need not be null-terminated.
+*	This operates like fpattern_compile().
+*
+* Returns
+*	A pointer to the compiled pattern, which must be released by a call to
+*	fpattern_free(), or null on error.
+*
+*	If the pattern is not well-formed, or contains a null char, null is
+*	returned and the offset of the offending pattern char is stored into
+*	'*erroff'.  On any other error, '*erroff' is set to -1.  'erroff' may be
+*	null.
+*
+* Caveats
+*	The pattern is copied into a null-terminated buffer while it is being
+*	compiled; the compiled pattern does not refer to it afterwards.
+*
+* See also
+*	fpattern_compile(), fpattern_compile_flags(), fpattern_exec_len().
+*/
+
+fpattern_t *fpattern_compile_len(const char *pat, size_t patlen, int *erroff)
+{
+    return (fpattern_compile_flags(pat, patlen, NATIVE, erroff));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_compile_flags()
+*	Compiles pattern 'pat[0...patlen-1]', which need not be null-terminated,
+*	for matching 'flags' instead of the conventions of the O/S that the
+*	library was built for.  This operates like fpattern_compile_len().
+*
+*	'flags' is a combination of:
+*	    FPAT_NOCASE, letters match either case, per the current locale;
+*	    FPAT_WINSEP, '\\' is a path delimiter as well as '/';
+*	    FPAT_BQUOTE, '`' is the quoting char instead of '\\';
+*	    FPAT_DELIM, wildcards do not match path delimiters, which must be
+*	    matched by a delimiter in the pattern;
+*	    FPAT_UTF8, the pattern and names are UTF-8, so that '?' and sets
+*	    match a code point, and FPAT_NOCASE uses Unicode simple case
+*	    folding instead of the locale.
+*
+*	The UNIX conventions are 0, and the DOS conventions are
+*	FPAT_NOCASE|FPAT_WINSEP|FPAT_BQUOTE, plus FPAT_DELIM if `DELIM' is 1.
+*
+* Returns
+*	A pointer to the compiled pattern, which must be released by a call to
+*	fpattern_free(), or null on error, as for fpattern_compile_len().
+*
+* Caveats
+*	The flags are resolved into the char tables of the compiled pattern,
+*	so matching is just as fast for any combination of them.
+*
+*	With FPAT_WINSEP but not FPAT_BQUOTE, a '\\' in the pattern quotes the
+*	char after it; a '/' in the pattern matches either delimiter if
+*	FPAT_DELIM is also given.
+*
+*	With FPAT_UTF8, a byte that is not part of a well-formed UTF-8 char
+*	stands for itself, matching only the same byte.  Names made up only of
+*	ASCII chars are matched as they are; other names are first translated
+*	into the char classes that the pattern distinguishes, so a pattern can
+*	hold only about 60 distinct non-ASCII chars and range ends, beyond
+*	which null is returned and '*erroff' is set to -1.
+*
+* See also
+*	fpattern_compile_len(), fpattern_match_flags().
+*/
+
+fpattern_t *fpattern_compile_flags(const char *pat, size_t patlen, int flags,
+    int *erroff)
+{
+    fpattern_t *	prog;
+    const char *	nul;
+    char *		copy;
+    char		buf[256];
+    int			off;
+
+    if (erroff == NULL)
+        erroff = &off;
+    *erroff = -1;
+
+    /* Check args */
+    if (pat == NULL)
+        return (NULL);
+
+    nul = (const char *) memchr(pat, '\0', patlen);
+    if (nul != NULL)
+    {
+        *erroff = (int) (nul - pat);
+        return (NULL);
+    }
+
+    /* Terminate a copy of the pattern */
+    copy = buf;
+    if (patlen >= sizeof(buf))
+    {
+        copy = (char *) malloc(patlen+1);
+        if (copy == NULL)
+            return (NULL);
+    }
+    memcpy(copy, pat, patlen);
+    copy[patlen] = '\0';
+
+    prog = fpattern_translate(copy, flags, erroff);
+
+    if (copy != buf)
+        free(copy);
+    return (prog);
+}
+
+/*------------------------------------------------------------------------------
+* fpattern_ufrom()
+*	Determines whether any non-ASCII code point folds to ASCII char 'ch'
+*	by simple case folding, as KELVIN SIGN (U+212A) does to 'k'.
+*/
+
+static int fpattern_ufrom(int ch)
+{
+    const struct fpat_urun *	r;
+    long			d;
+    int				i;
+
+    for (i = 0;  i < (int) (sizeof(fpat_ucase) / sizeof(fpat_ucase[0]));  i++)
+    {
+        r = &fpat_ucase[i];
+        d = ch - r->delta - r->first;
+        if (d >= 0  &&  d % r->stride == 0  &&  d / r->stride < r->count  &&
+            r->first + d >= 0x80)
+            return (true);
+    }
+    return (false);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_required()
+*	Finds the runs of literal chars that every name matched by compiled
+*	pattern 'prog' must contain, such as "report", "2024" and ".pdf" for
+*	"*report*2024*.pdf", and stores them into 'buf[0...size-1]', each one
+*	followed by a null char.  These can be looked up in an index of names
+*	to find the only names that could match the pattern.
+*
+* Returns
+*	The number of runs stored, or -1 if they do not fit or 'prog' or 'buf'
+*	is null.
+*
+*	If 'prelen' is not null, the number of chars in the first run, if it is
+*	a prefix that every matching name begins with exactly, otherwise zero,
+*	is stored into '*prelen'.
+*
+* Caveats
+*	A literal char is left out if a name char other than itself and (for a
+*	pattern that ignores case) its other ASCII case can match it, so that
+*	a run is found in a name after folding just the ASCII letters of both.
+*	Letters in the runs of a pattern that ignores case are lowercase.
+*
+*	Alternatives within braces, and the subpatterns following a '!', do
+*	not add any runs, nor does the delimiter after a "**" that may match
+*	no directory at all.
+*
+* See also
+*	fpattern_compile_flags(), fpattern_db_query().
+*/
+
+int fpattern_required(const fpattern_t *prog, char *buf, size_t size,
+    size_t *prelen)
+{
+    const struct fpat_ins *	ip;
+    size_t			n;
+    size_t			run;
+    int				nruns;
+    int				depth;
+    int				pre;
+    int				ch, ok;
+    int				pc;
+
+    if (prelen != NULL)
+        *prelen = 0;
+
+    /* Check args */
+    if (prog == NULL  ||  buf == NULL)
+        return (-1);
+
+    n = 0;
+    run = 0;
+    nruns = 0;
+    depth = 0;
+    pre = !(prog->flags & FPAT_NOCASE);
+
+    for (pc = 0;  pc < prog->nins;  pc++)
+    {
+        ip = &prog->ins[pc];
+        if (ip->op == FPI_MATCH  ||  ip->op == FPI_NOT)
+            break;
+
+        /* Skip alternatives */
+        if (ip->op == FPI_ALT)
+            depth++;
+        else if (ip->op == FPI_END)
+            depth--;
+
+        ch = ip->ch;
+        ok = (ip->op == FPI_CHAR  &&  depth == 0);
+        if (ip->op == FPI_DEL  &&  depth == 0  &&
+            !(prog->flags & FPAT_WINSEP)  &&
+            !(pc >= 2  &&  prog->ins[pc-2].op == FPI_FORK))
+        {
+            /* Delimiter, unless it follows an optional "**" */
+            ch = DEL;
+            ok = true;
+        }
+        else if (ok  &&  (prog->flags & FPAT_UTF8))
+        {
+            /* Non-ASCII chars are char classes */
+            ok = (ch < 0x80  &&
+                !((prog->flags & FPAT_NOCASE)  &&  fpattern_ufrom(ch)));
+        }
+        else if (ok  &&  (int) ip->arg != ch)
+        {
+            ok = (ch >= 'a'  &&  ch <= 'z'  &&
+                (int) ip->arg == ch - ('a'-'A'));
+        }
+
+        if (ok)
+        {
+            /* Add the char to the current run */
+            if (n+1 >= size)
+                return (-1);
+            buf[n++] = (char) ch;
+            run++;
+            continue;
+        }
+
+        /* End the current run */
+        if (run > 0)
+        {
+            buf[n++] = '\0';
+            nruns++;
+            if (pre  &&  prelen != NULL)
+                *prelen = run;
+            run = 0;
+        }
+        pre = false;
+    }
+
+    if (run > 0)
+    {
+        buf[n++] = '\0';
+        nruns++;
+        if (pre  &&  prelen != NULL)
+            *prelen = run;
+    }
+
+    DL(printf("fpattern_required: %d runs\n", nruns));
+    return (nruns);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_find2_c()
+*	Finds the first occurrence of char 'a' or 'b' within the name chars
+*	'name[0...len-1]'.  This is the portable version of fpattern_find2().
+*
+* Returns
+*	The offset of the char, or 'len' if neither occurs.
+*/
+
+static size_t fpattern_find2_c(const unsigned char *name, size_t len,
+    int a, int b)
+{
+    size_t	i;
+
+    for (i = 0;  i < len;  i++)
+    {
+        if (name[i] == a  ||  name[i] == b)
+            break;
+    }
+    return (i);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_count2_c()
+*	Counts the occurrences of chars 'a' and 'b' within the name chars
+*	'name[0...len-1]'.  This is the portable version of fpattern_count2().
+*
+* Returns
+*	The number of occurrences.
+*/
+
+static size_t fpattern_count2_c(const unsigned char *name, size_t len,
+    int a, int b)
+{
+    size_t	i, n;
+
+    n = 0;
+    for (i = 0;  i < len;  i++)
+        n += (name[i] == a  ||  name[i] == b);
+    return (n);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_findlit_c()
+*	Finds the first occurrence of the literal chars 'lit[0...n-1]' within
+*	the name chars 'name[0...len-1]'.  This is the portable version of
+*	fpattern_findlit().
+*
+* Returns
+*	The offset of the literal, or 'len' if it does not occur.
+*
+* Caveats
+*	This assumes that 'n' is at least 1.
+*/
+
+static size_t fpattern_findlit_c(const unsigned char *name, size_t len,
+    const unsigned char *lit, size_t n)
+{
+    const unsigned char *	p;
+    const unsigned char *	end;
+
+    if (len < n)
+        return (len);
+    end = name + len - n + 1;
+
+    /* Skip to each occurrence of the first literal char */
+    for (p = name;  p < end;  p++)
+    {
+        p = (const unsigned char *) memchr(p, lit[0], end - p);
+        if (p == NULL)
+            break;
+        if (memcmp(p+1, lit+1, n-1) == 0)
+            return (p - name);
+    }
+    return (len);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_ascii_c()
+*	Checks whether the name chars 'name[0...len-1]' are all ASCII chars
+*	(below 0x80).  This is the portable version of fpattern_ascii().
+*
+* Returns
+*	True (1) if they are, otherwise false (0).
+*/
+
+static int fpattern_ascii_c(const unsigned char *name, size_t len)
+{
+    unsigned long	w;
+    size_t		i;
+
+    for (i = 0;  i+sizeof(w) <= len;  i += sizeof(w))
+    {
+        memcpy(&w, name + i, sizeof(w));
+        if (w & HIGHS)
+            return (false);
+    }
+
+    for ( ;  i < len;  i++)
+    {
+        if (name[i] & 0x80)
+            return (false);
+    }
+    return (true);
+}
+
+
+#if SSE2
+
+/*------------------------------------------------------------------------------
+* fpattern_find2_sse2()
+*	SSE2 version of fpattern_find2_c(), examining 16 chars at a time.
+*/
+
+static size_t fpattern_find2_sse2(const unsigned char *name, size_t len,
+    int a, int b)
+{
+    __m128i	va, vb, x;
+    size_t	i;
+    int		m;
+
+    va = _mm_set1_epi8((char) a);
+    vb = _mm_set1_epi8((char) b);
+
+    for (i = 0;  i+16 <= len;  i += 16)
+    {
+        x = _mm_loadu_si128((const __m128i *) (name + i));
+        m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, va),
+            _mm_cmpeq_epi8(x, vb)));
+        if (m != 0)
+            return (i + __builtin_ctz(m));
+    }
+    return (i + fpattern_find2_c(name + i, len - i, a, b));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_count2_sse2()
+*	SSE2 version of fpattern_count2_c(), examining 16 chars at a time.
+*/
+
+static size_t fpattern_count2_sse2(const unsigned char *name, size_t len,
+    int a, int b)
+{
+    __m128i	va, vb, x;
+    size_t	i, n;
+
+    va = _mm_set1_epi8((char) a);
+    vb = _mm_set1_epi8((char) b);
+    n = 0;
+
+    for (i = 0;  i+16 <= len;  i += 16)
+    {
+        x = _mm_loadu_si128((const __m128i *) (name + i));
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_or_si128(
+            _mm_cmpeq_epi8(x, va), _mm_cmpeq_epi8(x, vb))));
+    }
+    return (n + fpattern_count2_c(name + i, len - i, a, b));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_findlit_sse2()
+*	SSE2 version of fpattern_findlit_c(), which looks for the first and
+*	last literal chars at 16 positions at a time, and compares the whole
+*	literal only at the positions where both of them occur.
+*/
+
+static size_t fpattern_findlit_sse2(const unsigned char *name, size_t len,
+    const unsigned char *lit, size_t n)
+{
+    __m128i	vf, vl, x, y;
+    size_t	i, end;
+    int		m;
+
+    if (len < n)
+        return (len);
+    end = len - n + 1;
+
+    vf = _mm_set1_epi8((char) lit[0]);
+    vl = _mm_set1_epi8((char) lit[n-1]);
+
+    for (i = 0;  i+16 <= end;  i += 16)
+    {
+        x = _mm_loadu_si128((const __m128i *) (name + i));
+        y = _mm_loadu_si128((const __m128i *) (name + i + n-1));
+        m = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(x, vf),
+            _mm_cmpeq_epi8(y, vl)));
+        for ( ;  m != 0;  m &= m-1)
+        {
+            if (memcmp(name + i + __builtin_ctz(m), lit, n) == 0)
+                return (i + __builtin_ctz(m));
+        }
+    }
+
+    i += fpattern_findlit_c(name + i, len - i, lit, n);
+    return (i < end ? i : len);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_ascii_sse2()
+*	SSE2 version of fpattern_ascii_c(), examining 16 chars at a time.
+*/
+
+static int fpattern_ascii_sse2(const unsigned char *name, size_t len)
+{
+    __m128i	x;
+    size_t	i;
+
+    for (i = 0;  i+16 <= len;  i += 16)
+    {
+        x = _mm_loadu_si128((const __m128i *) (name + i));
+        if (_mm_movemask_epi8(x) != 0)
+            return (false);
+    }
+    return (fpattern_ascii_c(name + i, len - i));
+}
+
+#endif /*SSE2*/
+
+
+#if AVX2
+
+/*------------------------------------------------------------------------------
+* fpattern_find2_avx2()
+*	AVX2 version of fpattern_find2_c(), examining 32 chars at a time.
+*/
+
+__attribute__((target("avx2")))
+static size_t fpattern_find2_avx2(const unsigned char *name, size_t len,
+    int a, int b)
+{
+    __m256i	va, vb, x;
+    size_t	i;
+    unsigned	m;
+
+    va = _mm256_set1_epi8((char) a);
+    vb = _mm256_set1_epi8((char) b);
+
+    for (i = 0;  i+32 <= len;  i += 32)
+    {
+        x = _mm256_loadu_si256((const __m256i *) (name + i));
+        m = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(
+            _mm256_cmpeq_epi8(x, va), _mm256_cmpeq_epi8(x, vb)));
+        if (m != 0)
+            return (i + __builtin_ctz(m));
+    }
+    _mm256_zeroupper();		/* Avoid AVX-SSE transition stalls */
+    return (i + fpattern_find2_sse2(name + i, len - i, a, b));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_count2_avx2()
+*	AVX2 version of fpattern_count2_c(), examining 32 chars at a time.
+*/
+
+__attribute__((target("avx2")))
+static size_t fpattern_count2_avx2(const unsigned char *name, size_t len,
+    int a, int b)
+{
+    __m256i	va, vb, x;
+    size_t	i, n;
+
+    va = _mm256_set1_epi8((char) a);
+    vb = _mm256_set1_epi8((char) b);
+    n = 0;
+
+    for (i = 0;  i+32 <= len;  i += 32)
+    {
+        x = _mm256_loadu_si256((const __m256i *) (name + i));
+        n += __builtin_popcount((unsigned) _mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, va),
+            _mm256_cmpeq_epi8(x, vb))));
+    }
+    _mm256_zeroupper();		/* Avoid AVX-SSE transition stalls */
+    return (n + fpattern_count2_sse2(name + i, len - i, a, b));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_findlit_avx2()
+*	AVX2 version of fpattern_findlit_sse2(), examining 32 positions at a
+*	time.
+*/
+
+__attribute__((target("avx2")))
+static size_t fpattern_findlit_avx2(const unsigned char *name, size_t len,
+    const unsigned char *lit, size_t n)
+{
+    __m256i	vf, vl, x, y;
+    size_t	i, end;
+    unsigned	m;
+
+    if (len < n)
+        return (len);
+    end = len - n + 1;
+
+    vf = _mm256_set1_epi8((char) lit[0]);
+    vl = _mm256_set1_epi8((char) lit[n-1]);
+
+    for (i = 0;  i+32 <= end;  i += 32)
+    {
+        x = _mm256_loadu_si256((const __m256i *) (name + i));
+        y = _mm256_loadu_si256((const __m256i *) (name + i + n-1));
+        m = (unsigned) _mm256_movemask_epi8(_mm256_and_si256(
+            _mm256_cmpeq_epi8(x, vf), _mm256_cmpeq_epi8(y, vl)));
+        for ( ;  m != 0;  m &= m-1)
+        {
+            if (memcmp(name + i + __builtin_ctz(m), lit, n) == 0)
+                return (i + __builtin_ctz(m));
+        }
+    }
+
+    _mm256_zeroupper();		/* Avoid AVX-SSE transition stalls */
+    i += fpattern_findlit_sse2(name + i, len - i, lit, n);
+    return (i < end ? i : len);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_ascii_avx2()
+*	AVX2 version of fpattern_ascii_c(), examining 32 chars at a time.
+*/
+
+__attribute__((target("avx2")))
+static int fpattern_ascii_avx2(const unsigned char *name, size_t len)
+{
+    __m256i	x;
+    size_t	i;
+
+    for (i = 0;  i+32 <= len;  i += 32)
+    {
+        x = _mm256_loadu_si256((const __m256i *) (name + i));
+        if (_mm256_movemask_epi8(x) != 0)
+            return (false);
+    }
+    _mm256_zeroupper();		/* Avoid AVX-SSE transition stalls */
+    return (fpattern_ascii_sse2(name + i, len - i));
+}
+
+#endif /*AVX2*/
+
+
+/*------------------------------------------------------------------------------
+* fpattern_kernels()
+*	Selects the fastest version of each char scanning kernel supported by
+*	the CPU, when the locale snapshot is taken.  A kernel called before
+*	then takes the snapshot itself.
+*/
+
+static size_t	fpattern_find2_init(const unsigned char *name, size_t len,
+		    int a, int b);
+static size_t	fpattern_count2_init(const unsigned char *name, size_t len,
+		    int a, int b);
+static size_t	fpattern_findlit_init(const unsigned char *name, size_t len,
+		    const unsigned char *lit, size_t n);
+static int	fpattern_ascii_init(const unsigned char *name, size_t len);
+
+static size_t	(*fpattern_find2)(const unsigned char *name, size_t len,
+		    int a, int b) = fpattern_find2_init;
+static size_t	(*fpattern_count2)(const unsigned char *name, size_t len,
+		    int a, int b) = fpattern_count2_init;
+static size_t	(*fpattern_findlit)(const unsigned char *name, size_t len,
+		    const unsigned char *lit, size_t n) = fpattern_findlit_init;
+static int	(*fpattern_ascii)(const unsigned char *name, size_t len) =
+		    fpattern_ascii_init;
+
+static void fpattern_kernels(void)
+{
+#if AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        fpattern_find2 = fpattern_find2_avx2;
+        fpattern_count2 = fpattern_count2_avx2;
+        fpattern_findlit = fpattern_findlit_avx2;
+        fpattern_ascii = fpattern_ascii_avx2;
+        return;
+    }
+#endif
+
+#if SSE2
+    fpattern_find2 = fpattern_find2_sse2;
+    fpattern_count2 = fpattern_count2_sse2;
+    fpattern_findlit = fpattern_findlit_sse2;
+    fpattern_ascii = fpattern_ascii_sse2;
+#else
+    fpattern_find2 = fpattern_find2_c;
+    fpattern_count2 = fpattern_count2_c;
+    fpattern_findlit = fpattern_findlit_c;
+    fpattern_ascii = fpattern_ascii_c;
+#endif
+}
+
+static size_t fpattern_find2_init(const unsigned char *name, size_t len,
+    int a, int b)
+{
+    fpattern_snap();
+    return (fpattern_find2(name, len, a, b));
+}
+
+static size_t fpattern_count2_init(const unsigned char *name, size_t len,
+    int a, int b)
+{
+    fpattern_snap();
+    return (fpattern_count2(name, len, a, b));
+}
+
+static size_t fpattern_findlit_init(const unsigned char *name, size_t len,
+    const unsigned char *lit, size_t n)
+{
+    fpattern_snap();
+    return (fpattern_findlit(name, len, lit, n));
+}
+
+static int fpattern_ascii_init(const unsigned char *name, size_t len)
+{
+    fpattern_snap();
+    return (fpattern_ascii(name, len));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_star()
+*	Attempts to match compiled pattern 'prog' against the name chars
+*	'name[0...len-1]', by backtracking only to the most recent closure.
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	This is only correct if every closure in the pattern can match any
+*	char, so that a later closure can always absorb whatever an earlier
+*	one would have matched.  In that case it takes at most O(M*N) steps for
+*	a pattern of M instructions and a name of N chars.
+*
+*	A closure followed by a literal char skips directly to the next name
+*	char that can match the literal, using fpattern_find2().
+*/
+
+static int fpattern_star(const fpattern_t *prog, const unsigned char *name,
+    size_t len)
+{
+    const struct fpat_ins *	ins;
+    int				pc, spc;
+    size_t			pos, spos;
+
+    ins = prog->ins;
+    pc = 0;
+    pos = 0;
+    spc = -1;
+    spos = 0;
+
+    for (;;)
+    {
+        switch (ins[pc].op)
+        {
+        case FPI_CLOS:
+            /* Remember the last closure, matching nothing at first */
+            pc++;
+            if (ins[pc].op == FPI_MATCH)
+                return (true);		/* Trailing closure */
+            spc = pc;
+            spos = pos;
+            goto skip;
+
+        case FPI_MATCH:
+            /* Check for complete match */
+            if (pos == len)
+                return (true);
+            break;
+
+        default:
+            /* Match a single char */
+            if (pos < len  &&  wbit(prog->cons + name[pos]*prog->words, pc))
+            {
+                pc++;
+                pos++;
+                continue;
+            }
+            break;
+        }
+
+        /* Mismatch, so extend the last closure by one char */
+        if (spc < 0  ||  spos == len)
+            return (false);
+        spos++;
+
+    skip:
+        /* Extend the closure up to the next char matching a literal */
+        if (ins[spc].op == FPI_CHAR  &&  ins[spc].arg != NOALT)
+        {
+            spos += fpattern_find2(name + spos, len - spos, ins[spc].ch,
+                (int) ins[spc].arg);
+            if (spos == len)
+                return (false);
+        }
+        pc = spc;
+        pos = spos;
+    }
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_step()
+*	Moves NFA state vector 'st' of compiled pattern 'prog' forward across
+*	name char 'ch', storing the resulting state vector into 'nx'.
+*
+* Returns
+*	True (1) if any NFA state remains, otherwise false (0).
+*/
+
+static int fpattern_step(const fpattern_t *prog, const fpat_word *st,
+    fpat_word *nx, int ch)
+{
+    const fpat_word *	cons;
+    const fpat_word *	loop;
+    fpat_word		x;
+    fpat_word		carry, live;
+    int			words;
+    int			w;
+
+    words = prog->words;
+    cons = prog->cons + ch*words;
+    loop = prog->loop + ch*words;
+    carry = 0;
+    live = 0;
+
+    for (w = 0;  w < words;  w++)
+    {
+        x = st[w] & cons[w];
+        nx[w] = (x << 1) | carry | (st[w] & loop[w]);
+        carry = x >> (WBITS-1);
+        live |= nx[w];
+    }
+
+    if (live == 0)
+        return (false);			/* Dead state */
+
+    fpattern_close(prog, nx, false);
+    return (true);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_final()
+*	Determines whether NFA state vector 'st' of compiled pattern 'prog'
+*	contains a final state.
+*/
+
+static int fpattern_final(const fpattern_t *prog, const fpat_word *st)
+{
+    int		w;
+
+    for (w = 0;  w < prog->words;  w++)
+    {
+        if (st[w] & prog->fin[w])
+            return (true);
+    }
+    return (false);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_advance()
+*	Moves NFA state vector 'st' of compiled pattern 'prog' forward across
+*	the name chars 'name[0...len-1]', one name char at a time, using 'tmp'
+*	as a scratch state vector.
+*
+* Returns
+*	True (1) if any NFA state remains, otherwise false (0), in which case
+*	'st' is undefined.
+*/
+
+static int fpattern_advance(const fpattern_t *prog, fpat_word *st,
+    fpat_word *tmp, const unsigned char *name, size_t len)
+{
+    fpat_word *		nx;
+    fpat_word *		t;
+    fpat_word		x, y, f;
+    size_t		pos;
+    int			words;
+
+    words = prog->words;
+    if (words == 1  &&  prog->njumps > 0)
+    {
+        /* Single word state vector, with alternatives */
+        x = st[0];
+
+        for (pos = 0;  pos < len;  pos++)
+        {
+            x = ((x & prog->cons[name[pos]]) << 1) |
+                (x & prog->loop[name[pos]]);
+            if (x == 0)
+                return (false);		/* Dead state */
+            x = fpattern_close1(prog, x);
+        }
+        st[0] = x;
+        return (true);
+    }
+
+    if (words == 1)
+    {
+        /* Single word state vector */
+        y = prog->star[0];
+        f = prog->fork[0];
+        x = st[0];
+
+        for (pos = 0;  pos < len;  pos++)
+        {
+            x = ((x & prog->cons[name[pos]]) << 1) |
+                (x & prog->loop[name[pos]]);
+            if (x == 0)
+                return (false);		/* Dead state */
+            while ((x | ((x & y) << 1) | ((x & f) << 3)) != x)
+                x |= ((x & y) << 1) | ((x & f) << 3);
+        }
+        st[0] = x;
+        return (true);
+    }
+
+    /* Multiple word state vector */
+    nx = tmp;
+    for (pos = 0;  pos < len;  pos++)
+    {
+        if (!fpattern_step(prog, st, nx, name[pos]))
+            return (false);		/* Dead state */
+        t = st;
+        st = nx;
+        nx = t;
+    }
+
+    if (st == tmp)
+        memcpy(nx, st, words*sizeof(fpat_word));
+    return (true);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_nfa()
+*	Attempts to match compiled pattern 'prog' against the name chars
+*	'name[0...len-1]', by simulating its NFA one name char at a time, with
+*	all of the NFA states packed into a bit vector.
+*
+*	If 'from' is not null, matching resumes from that NFA state vector,
+*	otherwise it begins at the start state.
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	This takes O(M*N/W) steps for a pattern of M instructions and a name of
+*	N chars, where W is the number of bits in a 'fpat_word'.
+*
+*	The pattern must not contain any negated subpatterns.
+*/
+
+static int fpattern_nfa(const fpattern_t *prog, const fpat_word *from,
+    const unsigned char *name, size_t len)
+{
+    fpat_word		buf[2*MAXW];
+    fpat_word *		mem;
+    int			words;
+    int			rc;
+
+    words = prog->words;
+    mem = buf;
+    if (words > MAXW)
+    {
+        mem = (fpat_word *) malloc(2*words*sizeof(fpat_word));
+        if (mem == NULL)
+            return (false);
+    }
+
+    memcpy(mem, from != NULL ? from : prog->init, words*sizeof(fpat_word));
+    rc = (fpattern_advance(prog, mem, mem + words, name, len)  &&
+        fpattern_final(prog, mem));
+
+    if (mem != buf)
+        free(mem);
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_not()
+*	Attempts to match compiled pattern 'prog', which contains negated
+*	subpatterns, against the name chars 'name[0...len-1]'.
+*
+*	A pattern of the form 'P!R' matches a name if 'P' matches some prefix of
+*	it and 'R' does not match the rest.  So the subpatterns are matched
+*	from last to first, each one by running its NFA backward across the
+*	whole name, which yields the set of positions at which the rest of the
+*	pattern matches (or does not) for the subpattern preceding it.
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	This takes O(M*N/W) steps for a pattern of M instructions and a name of
+*	N chars, where W is the number of bits in a 'fpat_word'.
+*
+*	If memory cannot be allocated for a long name, false (0) is returned.
+*/
+
+static int fpattern_not(const fpattern_t *prog, const unsigned char *name,
+    size_t len)
+{
+    unsigned char	vbuf[512];
+    fpat_word		buf[2*MAXW];
+    unsigned char *	vec;
+    fpat_word *		st;
+    fpat_word *		nx;
+    const fpat_word *	cons;
+    const fpat_word *	loop;
+    fpat_word		x, carry;
+    size_t		pos;
+    int			words;
+    int			w;
+    int			a, b;
+    int			r, rc;
+
+    words = prog->words;
+    vec = vbuf;
+    st = buf;
+
+    if (len/8 + 1 > sizeof(vbuf))
+        vec = (unsigned char *) malloc(len/8 + 1);
+    if (words > MAXW)
+        st = (fpat_word *) malloc(2*words*sizeof(fpat_word));
+    nx = st + words;
+
+    rc = false;
+    if (vec == NULL  ||  st == NULL)
+        goto done;
+
+    /* Positions at which the rest of the pattern is matched */
+    memset(vec, 0, len/8 + 1);
+    setbit(vec, len);
+
+    /* Match each subpattern, from last to first */
+    for (b = prog->nins-1;  ;  b = a-1)
+    {
+        for (a = b;  a > 0  &&  prog->ins[a-1].op != FPI_NOT;  a--)
+            ;
+
+        memset(st, 0, words*sizeof(fpat_word));
+        for (pos = len+1;  pos-- > 0;  )
+        {
+            if (pos < len)
+            {
+                /* Move backward across name char */
+                cons = prog->cons + name[pos]*words;
+                loop = prog->loop + name[pos]*words;
+                carry = 0;
+
+                for (w = words;  w-- > 0;  )
+                {
+                    x = st[w];
+                    nx[w] = (((x >> 1) | carry) & cons[w]) | (x & loop[w]);
+                    carry = x << (WBITS-1);
+                }
+                memcpy(st, nx, words*sizeof(fpat_word));
+            }
+
+            if (inset(vec, pos))
+                wset(st, b);		/* Rest of pattern matches here */
+            fpattern_close(prog, st, true);
+
+            r = (int) wbit(st, a);
+            if (a == 0)
+                rc = r;			/* Last result is for position 0 */
+            else if (r)
+                vec[pos >> 3] |= (unsigned char) (1 << (pos & 7));
+            else
+                vec[pos >> 3] &= (unsigned char) ~(1 << (pos & 7));
+        }
+
+        if (a == 0)
+            break;
+
+        /* Preceding subpattern matches where this one does not */
+        for (pos = 0;  pos <= len;  pos++)
+            vec[pos >> 3] ^= (unsigned char) (1 << (pos & 7));
+    }
+
+done:
+    if (vec != vbuf)
+        free(vec);
+    if (st != buf)
+        free(st);
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_swar_fold()
+*	Folds the ASCII chars 'A' through 'Z' to lowercase within all of the
+*	bytes of word 'w' at once.
+*
+* Caveats
+*	This assumes that every byte of 'w' is an ASCII char (below 0x80), so
+*	that adding to them never carries into the next byte.
+*/
+
+static unsigned long fpattern_swar_fold(unsigned long w)
+{
+    unsigned long	upper;
+
+    /* Flag the bytes within 'A'...'Z', then set their 0x20 bit */
+    upper = (w + ONES*(0x80 - 'A')) & ~(w + ONES*(0x7F - 'Z')) & HIGHS;
+    return (w | (upper >> 2));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_lit_eq()
+*	Compares the name chars 'name[0...n-1]' to the folded literal chars
+*	'lit[0...n-1]' of compiled pattern 'prog'.
+*
+* Returns
+*	True (1) if the chars are equal, otherwise false (0).
+*/
+
+static int fpattern_lit_eq(const fpattern_t *prog, const unsigned char *name,
+    const unsigned char *lit, size_t n)
+{
+    unsigned long	w, v;
+    size_t		i;
+
+    if (prog->exact)
+        return (memcmp(name, lit, n) == 0);
+
+    if (prog->ascii)
+    {
+        /* Fold and compare a word of ASCII chars at a time */
+        for ( ;  n >= sizeof(w);  n -= sizeof(w))
+        {
+            memcpy(&w, name, sizeof(w));
+            memcpy(&v, lit, sizeof(v));
+            if (w & HIGHS)
+                break;
+            if (fpattern_swar_fold(w) != v)
+                return (false);
+            name += sizeof(w);
+            lit += sizeof(w);
+        }
+    }
+
+    for (i = 0;  i < n;  i++)
+    {
+        if (prog->fold[name[i]] != lit[i])
+            return (false);
+    }
+    return (true);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_lit_find()
+*	Searches the name chars 'name[0...len-1]' for the folded literal chars
+*	'lit[0...n-1]' of compiled pattern 'prog'.
+*
+* Returns
+*	True (1) if the literal occurs within the name, otherwise false (0).
+*/
+
+static int fpattern_lit_find(const fpattern_t *prog,
+    const unsigned char *name, size_t len, const unsigned char *lit, size_t n)
+{
+    const unsigned char *	p;
+    const unsigned char *	end;
+
+    if (len < n)
+        return (false);
+    end = name + len - n + 1;
+
+    if (prog->exact)
+        return (fpattern_findlit(name, len, lit, n) < len);
+
+    if (lit == prog->lit  &&  prog->litalt != NOALT)
+    {
+        /* Skip to each char that folds to the first literal char */
+        for (p = name;  p < end;  p++)
+        {
+            p += fpattern_find2(p, end - p, lit[0], prog->litalt);
+            if (p == end)
+                break;
+            if (fpattern_lit_eq(prog, p+1, lit+1, n-1))
+                return (true);
+        }
+        return (false);
+    }
+
+    for (p = name;  p < end;  p++)
+    {
+        if (prog->fold[*p] == lit[0]  &&  fpattern_lit_eq(prog, p+1, lit+1, n-1))
+            return (true);
+    }
+    return (false);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_prefilter()
+*	Checks the name chars 'name[0...len-1]' against the prefilter of
+*	compiled pattern 'prog', built by fpattern_literals().
+*
+* Returns
+*	False (0) if the name cannot match the pattern, otherwise true (1), in
+*	which case the pattern must still be run to decide if it matches.
+*/
+
+static int fpattern_prefilter(const fpattern_t *prog,
+    const unsigned char *name, size_t len)
+{
+    size_t	n;
+
+    /* Check the name length */
+    if (len < prog->minlen  ||  len > prog->maxlen)
+        return (false);
+
+    /* Check the number of path delimiters */
+    if (prog->mindel > 0  ||  prog->maxdel < len)
+    {
+        n = fpattern_count2(name, len, DEL, delch2(prog->flags));
+        if (n < prog->mindel  ||  n > prog->maxdel)
+            return (false);
+    }
+
+    /* Check the literal prefix and suffix */
+    if (prog->npre > 0  &&  !fpattern_lit_eq(prog, name, prog->pre, prog->npre))
+        return (false);
+
+    if (prog->nsuf > 0  &&
+        !fpattern_lit_eq(prog, name + len - prog->nsuf, prog->suf, prog->nsuf))
+        return (false);
+
+    /* Look for the inner literal between them */
+    if (prog->nlit > 0  &&
+        !fpattern_lit_find(prog, name + prog->npre,
+            len - prog->npre - prog->nsuf, prog->lit, prog->nlit))
+        return (false);
+
+    return (true);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_utf8_name()
+*	Translates the UTF-8 name chars 'name[0...*len-1]' into the char
+*	classes of compiled pattern 'prog', one per code point, storing them
+*	into 'buf[0...size-1]' if they fit there, or into allocated memory
+*	otherwise, and sets '*len' to the number of code points.
+*
+* Returns
+*	A pointer to the translated name, or null if there is no memory.
+*	Unless it is 'buf', it must be released by free().
+*/
+
+static unsigned char *fpattern_utf8_name(const fpattern_t *prog,
+    const unsigned char *name, size_t *len, unsigned char *buf, size_t size)
+{
+    const unsigned char *	end;
+    unsigned char *		out;
+    long			cp;
+    size_t			n;
+
+    out = buf;
+    if (*len > size)
+    {
+        out = (unsigned char *) malloc(*len);
+        if (out == NULL)
+            return (NULL);
+    }
+
+    end = name + *len;
+    for (n = 0;  name < end;  n++)
+    {
+        cp = fpattern_utf8_get(&name, end - name);
+        if (prog->flags & FPAT_NOCASE)
+            cp = fpattern_ufold(cp);
+        out[n] = (unsigned char) fpattern_uclass(prog, cp);
+    }
+
+    *len = n;
+    return (out);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_engine()
+*	Attempts to match compiled pattern 'prog' against the name chars
+*	'name[0...len-1]', using the engine selected for the pattern.
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*/
+
+static int fpattern_engine(const fpattern_t *prog, const unsigned char *name,
+    size_t len)
+{
+    int		rc;
+
+    if (!fpattern_prefilter(prog, name, len))
+    {
+        STAT_ADD(rejects, 1);
+        STAT_NAME(false, 0);
+        return (false);
+    }
+
+    switch (prog->engine)
+    {
+    case FPE_STAR:
+        rc = fpattern_star(prog, name, len);
+        break;
+
+    case FPE_NFA:
+        rc = fpattern_nfa(prog, NULL, name, len);
+        break;
+
+    default:
+        rc = fpattern_not(prog, name, len);
+        break;
+    }
+
+    STAT_NAME(rc, len);
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_run_utf8()
+*	Attempts to match compiled UTF-8 pattern 'prog' against the non-ASCII
+*	name chars 'name[0...len-1]', by matching their char classes.
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*/
+
+static int fpattern_run_utf8(const fpattern_t *prog, const unsigned char *name,
+    size_t len)
+{
+    unsigned char	buf[256];
+    unsigned char *	cls;
+    int			rc;
+
+    cls = fpattern_utf8_name(prog, name, &len, buf, sizeof(buf));
+    if (cls == NULL)
+        return (false);
+
+    rc = fpattern_engine(prog, cls, len);
+
+    if (cls != buf)
+        free(cls);
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_run()
+*	Attempts to match compiled pattern 'prog' against the name chars
+*	'name[0...len-1]'.
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	A UTF-8 pattern matches an ASCII name as it is, since ASCII chars are
+*	their own char classes, so only other names need to be translated.
+*/
+
+static int fpattern_run(const fpattern_t *prog, const unsigned char *name,
+    size_t len)
+{
+    if ((prog->flags & FPAT_UTF8)  &&  !fpattern_ascii(name, len))
+        return (fpattern_run_utf8(prog, name, len));
+
+    return (fpattern_engine(prog, name, len));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_exec()
+*	Attempts to match compiled pattern 'prog' to filename 'fname'.
+*	This operates like fpattern_match(), except that the pattern has already
+*	been verified and translated by fpattern_compile().
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	If 'fname' is null, false (0) is returned.
+*
+*	If 'prog' is null, false (0) is returned.
+*
+*	If 'fname' is empty, the only pattern that will match it is the empty
+*	string ("").
+*
+* See also
+*	fpattern_compile(), fpattern_match(), fpattern_exec_len().
+*/
+
+int fpattern_exec(const fpattern_t *prog, const char *fname)
+{
+    DL(printf("fpattern_exec: fname=%p:\"%s\", prog=%p\n",
+        fname, fname ? fname : "", prog));
+
+    /* Check args */
+    if (fname == NULL)
+        return (false);
+
+    return (fpattern_exec_len(prog, fname, strlen(fname)));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_exec_len()
+*	Attempts to match compiled pattern 'prog' to filename 'fname[0...len-1]',
+*	which need not be null-terminated, and may contain any chars, including
+*	nulls.  This operates like fpattern_exec().
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	If 'fname' or 'prog' is null, false (0) is returned.
+*
+*	If 'len' is zero, the only pattern that will match it is the empty
+*	string ("").
+*
+* See also
+*	fpattern_compile_len(), fpattern_exec().
+*/
+
+int fpattern_exec_len(const fpattern_t *prog, const char *fname, size_t len)
+{
+    int		rc;
+
+    /* Check args */
+    if (fname == NULL)
+        return (false);
+
+    if (prog == NULL)
+        return (false);
+
+    /* Attempt to match pattern against filename */
+    if (len == 0)
+        return (prog->nins == 1);	/* Special case */
+    rc = fpattern_run(prog, (const unsigned char *) fname, len);
+
+    DL(printf("fpattern_exec_len: return %c\n", "FT"[!!rc]));
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_exec_batch()
+*	Attempts to match compiled pattern 'prog' to each of the 'count'
+*	filenames stored in columnar form in 'data', where filename 'i' is made
+*	up of the chars 'data[offsets[i]...offsets[i+1]-1]', setting bit 'i%8'
+*	of 'bits[i/8]' if it matches, and clearing it otherwise.
+*
+*	The filenames are not copied or terminated.  If the pattern fits in a
+*	single word NFA state vector, the filenames that pass its prefilter are
+*	matched in groups of FPAT_LANES, advancing each of them by one char in
+*	turn so that their memory loads overlap, while the next group is
+*	prefetched.
+*
+* Returns
+*	The number of filenames that match.
+*
+* Caveats
+*	'offsets' must hold 'count+1' entries, and 'bits' must have room for at
+*	least 'count' bits.
+*
+*	If 'prog', 'data', 'offsets', or 'bits' is null, zero is returned.
+*
+*	An empty filename matches only an empty pattern, as in fpattern_exec().
+*
+* See also
+*	fpattern_exec().
+*/
+
+#define FPAT_LANES	4		/* Filenames matched together	*/
+
+#if defined(__GNUC__)
+ #define prefetch(p)	__builtin_prefetch(p)
+#else
+ #define prefetch(p)	((void) 0)
+#endif
+
+size_t fpattern_exec_batch(const fpattern_t *prog, const char *data,
+    const size_t *offsets, size_t count, unsigned char *bits)
+{
+    const unsigned char *	name[FPAT_LANES];
+    size_t			len[FPAT_LANES];
+    fpat_word			x[FPAT_LANES];
+    fpat_word			y, f;
+    size_t			i, j, n, min;
+    size_t			matches;
+    int				asc[FPAT_LANES];
+    int				k, lanes;
+    int				rc;
+
+    /* Check args */
+    if (prog == NULL  ||  data == NULL  ||  offsets == NULL  ||  bits == NULL)
+        return (0);
+
+    memset(bits, 0, (count + 7) / 8);
+    matches = 0;
+    lanes = (prog->words == 1  &&  prog->engine != FPE_NOT ? FPAT_LANES : 1);
+
+    for (i = 0;  i < count;  i += n)
+    {
+        n = (count - i < (size_t) lanes ? count - i : (size_t) lanes);
+
+        /* Prefetch the next group of filenames */
+        for (j = i+n;  j < i+2*n  &&  j < count;  j++)
+            prefetch(data + offsets[j]);
+
+        min = (size_t) -1;
+        for (k = 0;  k < (int) n;  k++)
+        {
+            name[k] = (const unsigned char *) data + offsets[i+k];
+            len[k] = offsets[i+k+1] - offsets[i+k];
+            if (len[k] < min)
+                min = len[k];
+        }
+
+        if (lanes == 1)
+        {
+            /* Match a single filename */
+            if (len[0] == 0)
+                rc = (prog->nins == 1);		/* Special case */
+            else
+                rc = fpattern_run(prog, name[0], len[0]);
+            if (rc)
+            {
+                bits[i >> 3] |= (unsigned char) (1 << (i & 7));
+                matches++;
+            }
+            continue;
+        }
+
+        /* Advance the NFA of each filename together, up to the shortest */
+        y = prog->star[0];
+        f = prog->fork[0];
+        for (k = 0;  k < (int) n;  k++)
+        {
+            asc[k] = (!(prog->flags & FPAT_UTF8)  ||
+                fpattern_ascii(name[k], len[k]));
+            if (asc[k]  &&  fpattern_prefilter(prog, name[k], len[k]))
+                x[k] = prog->init[0];
+            else
+                x[k] = 0;		/* Dead state */
+
+            if (asc[k]  &&  x[k] == 0  &&  len[k] > 0)
+            {
+                STAT_ADD(rejects, 1);
+                STAT_NAME(false, 0);
+                asc[k] = -1;		/* Rejected, and counted */
+            }
+        }
+
+        for (j = 0;  j < min;  j++)
+        {
+            for (k = 0;  k < (int) n;  k++)
+            {
+                x[k] = ((x[k] & prog->cons[name[k][j]]) << 1) |
+                    (x[k] & prog->loop[name[k][j]]);
+                if (prog->njumps > 0)
+                    x[k] = fpattern_close1(prog, x[k]);
+                while ((x[k] | ((x[k] & y) << 1) |
+                    ((x[k] & f) << 3)) != x[k])
+                    x[k] |= ((x[k] & y) << 1) | ((x[k] & f) << 3);
+            }
+        }
+
+        /* Finish each filename on its own */
+        for (k = 0;  k < (int) n;  k++)
+        {
+            if (len[k] == 0)
+                rc = (prog->nins == 1);		/* Special case */
+            else if (!asc[k])
+                rc = fpattern_run_utf8(prog, name[k], len[k]);
+            else if (x[k] == 0)
+                rc = false;			/* Dead state */
+            else
+                rc = fpattern_nfa(prog, &x[k], name[k] + min, len[k] - min);
+
+            if (asc[k] > 0  &&  len[k] > 0)
+                STAT_NAME(rc, len[k]);
+
+            if (rc)
+            {
+                bits[(i+k) >> 3] |= (unsigned char) (1 << ((i+k) & 7));
+                matches++;
+            }
+        }
+    }
+
+    return (matches);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_free()
+*	Releases compiled pattern 'prog'.
+*
+* Caveats
+*	If 'prog' is null, nothing is done.
+*/
+
+void fpattern_free(fpattern_t *prog)
+{
+    if (prog != NULL)
+        free(prog->eps);
+    free(prog);
+}
+
+
+#if CACHE
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_mem()
+*	Determines the memory held by compiled pattern 'prog'.
+*
+* Returns
+*	The size of the pattern, in bytes, or zero if 'prog' is null.
+*/
+
+static size_t fpattern_cache_mem(const fpattern_t *prog)
+{
+    size_t	n;
+
+    if (prog == NULL)
+        return (0);
+
+    n = sizeof(fpattern_t) + (2*256+4)*prog->words*sizeof(fpat_word) +
+        prog->nins*(sizeof(struct fpat_ins) + sizeof(int)) +
+        prog->nsets*sizeof(prog->sets[0]);
+    if (prog->eps != NULL)
+        n += (prog->nins+7)/8*256*sizeof(fpat_word);
+    return (n);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_lock()
+*	Waits for and takes the lock held while the cache is modified.
+*
+* Caveats
+*	Nothing slow, such as compiling a pattern, is done while it is held.
+*/
+
+static void fpattern_cache_lock(void)
+{
+    while (__atomic_test_and_set(&fpat_cbusy, __ATOMIC_ACQUIRE))
+    {
+        while (__atomic_load_n(&fpat_cbusy, __ATOMIC_RELAXED))
+            ;
+    }
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_unlock()
+*	Releases the lock taken by fpattern_cache_lock().
+*/
+
+static void fpattern_cache_unlock(void)
+{
+    __atomic_clear(&fpat_cbusy, __ATOMIC_RELEASE);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_hash()
+*	Hashes pattern 'pat' of 'len' chars, compiled for matching 'flags'.
+*
+* Returns
+*	The hash (FNV-1a) of the pattern.
+*/
+
+static unsigned long fpattern_cache_hash(const char *pat, size_t len,
+    int flags)
+{
+    unsigned long	h;
+    size_t		i;
+
+    h = 2166136261UL ^ (unsigned long) flags;
+    for (i = 0;  i < len;  i++)
+        h = ((h ^ (unsigned char) pat[i]) * 16777619UL) & 0xFFFFFFFFUL;
+    return (h);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_find()
+*	Looks up pattern 'pat' of 'len' chars, compiled for matching 'flags',
+*	whose hash is 'h'.
+*
+* Returns
+*	The cache entry of the pattern, or null if it is not cached.
+*
+* Caveats
+*	The caller must hold the lock, or be counted as a reader of the
+*	current phase, so that the entries are not released under it.
+*/
+
+static struct fpat_centry *fpattern_cache_find(const char *pat, size_t len,
+    int flags, unsigned long h)
+{
+    struct fpat_centry *	ep;
+
+    ep = __atomic_load_n(&fpat_chash[h % FPAT_CHASH], __ATOMIC_ACQUIRE);
+    while (ep != NULL)
+    {
+        if (ep->hash == h  &&  ep->flags == flags  &&  ep->len == len  &&
+            memcmp(ep->pat, pat, len) == 0)
+            return (ep);
+        ep = __atomic_load_n(&ep->next, __ATOMIC_ACQUIRE);
+    }
+    return (NULL);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_drop()
+*	Removes entry 'ep' from the cache, retiring it until no reader can be
+*	using it.
+*
+* Caveats
+*	The caller must hold the lock.
+*/
+
+static void fpattern_cache_drop(struct fpat_centry *ep)
+{
+    struct fpat_centry **	pp;
+
+    /* Unlink it from its hash chain, which readers may be following */
+    pp = &fpat_chash[ep->hash % FPAT_CHASH];
+    while (*pp != ep)
+        pp = &(*pp)->next;
+    __atomic_store_n(pp, ep->next, __ATOMIC_RELEASE);
+
+    /* Unlink it from the clock ring */
+    if (ep->cnext == ep)
+        fpat_chand = NULL;
+    else
+    {
+        ep->cprev->cnext = ep->cnext;
+        ep->cnext->cprev = ep->cprev;
+        if (fpat_chand == ep)
+            fpat_chand = ep->cnext;
+    }
+
+    /* Retire it */
+    ep->cnext = fpat_cpend;
+    fpat_cpend = ep;
+    fpat_cused -= ep->size;
+    fpat_ccount--;
+    fpat_cevict++;
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_evict()
+*	Evicts cached patterns until they hold no more than 'max' bytes.  The
+*	clock hand sweeps the entries in the order they were added, sparing
+*	(once) each entry matched since the hand last passed it.
+*
+* Caveats
+*	The caller must hold the lock.
+*/
+
+static void fpattern_cache_evict(size_t max)
+{
+    struct fpat_centry *	ep;
+
+    while (fpat_cused > max)
+    {
+        ep = fpat_chand;
+        if (max > 0  &&  __atomic_load_n(&ep->ref, __ATOMIC_RELAXED))
+        {
+            /* Matched recently, so give it another round */
+            __atomic_store_n(&ep->ref, 0, __ATOMIC_RELAXED);
+            fpat_chand = ep->cnext;
+        }
+        else
+            fpattern_cache_drop(ep);
+    }
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_reclaim()
+*	Collects the retired cache entries that no reader can still be using.
+*
+*	Entries retired in one phase are kept until the phase is changed, and
+*	then until every reader that entered the cache in that phase has left
+*	it.  Readers entering after the change cannot find them.
+*
+* Returns
+*	A list of the entries to be released (linked by 'cnext'), or null.
+*
+* Caveats
+*	The caller must hold the lock, and releases the entries after
+*	releasing it.  This never waits for readers.
+*/
+
+static struct fpat_centry *fpattern_cache_reclaim(void)
+{
+    struct fpat_centry *	list;
+    int				p;
+    int				i;
+
+    list = NULL;
+    if (fpat_cold != NULL)
+    {
+        /* Release the entries retired before the last phase change */
+        p = (int) ((fpat_cphase - 1) & 1);
+        for (i = 0;  i < FPAT_STRIPES;  i++)
+        {
+            if (__atomic_load_n(&fpat_stripe[i].readers[p],
+                    __ATOMIC_SEQ_CST) != 0)
+                return (NULL);		/* Still in use */
+        }
+        list = fpat_cold;
+        fpat_cold = NULL;
+    }
+
+    if (fpat_cpend != NULL)
+    {
+        /* Start a new phase for the entries retired since */
+        fpat_cold = fpat_cpend;
+        fpat_cpend = NULL;
+        __atomic_store_n(&fpat_cphase, fpat_cphase+1, __ATOMIC_SEQ_CST);
+    }
+    return (list);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_release()
+*	Releases the list of cache entries 'list' (linked by 'cnext').
+*/
+
+static void fpattern_cache_release(struct fpat_centry *list)
+{
+    struct fpat_centry *	ep;
+
+    while (list != NULL)
+    {
+        ep = list;
+        list = ep->cnext;
+        fpattern_free(ep->prog);
+        free(ep);
+    }
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_add()
+*	Compiles pattern 'pat' of 'len' chars for matching 'flags', and adds
+*	it to the cache under hash 'h', evicting other patterns to make room.
+*
+* Returns
+*	The cache entry of the pattern, or null if it could not be cached.
+*
+* Caveats
+*	The caller must be counted as a reader of the current phase.  Another
+*	thread may add the same pattern meanwhile, in which case its entry is
+*	returned instead.
+*/
+
+static struct fpat_centry *fpattern_cache_add(const char *pat, size_t len,
+    int flags, unsigned long h)
+{
+    struct fpat_centry *	ep;
+    struct fpat_centry *	xp;
+    struct fpat_centry *	list;
+
+    /* Compile the pattern, outside of the lock */
+    ep = (struct fpat_centry *) malloc(sizeof(struct fpat_centry) + len);
+    if (ep == NULL)
+        return (NULL);
+
+    ep->prog = fpattern_compile_flags(pat, len, flags, NULL);
+    ep->size = sizeof(struct fpat_centry) + len + fpattern_cache_mem(ep->prog);
+    ep->hash = h;
+    ep->flags = flags;
+    ep->ref = false;
+    ep->len = len;
+    memcpy(ep->pat, pat, len);
+    ep->pat[len] = '\0';
+
+    fpattern_cache_lock();
+
+    xp = fpattern_cache_find(pat, len, flags, h);
+    if (xp == NULL  &&  ep->size <= fpat_cmax)
+    {
+        /* Make room for it */
+        fpattern_cache_evict(fpat_cmax - ep->size);
+
+        /* Add it behind the clock hand */
+        if (fpat_chand == NULL)
+        {
+            ep->cnext = ep;
+            ep->cprev = ep;
+            fpat_chand = ep;
+        }
+        else
+        {
+            ep->cnext = fpat_chand;
+            ep->cprev = fpat_chand->cprev;
+            ep->cprev->cnext = ep;
+            fpat_chand->cprev = ep;
+        }
+
+        /* Publish it to readers */
+        ep->next = fpat_chash[h % FPAT_CHASH];
+        __atomic_store_n(&fpat_chash[h % FPAT_CHASH], ep, __ATOMIC_RELEASE);
+        fpat_cused += ep->size;
+        fpat_ccount++;
+
+        xp = ep;
+        ep = NULL;
+    }
+
+    list = fpattern_cache_reclaim();
+    fpattern_cache_unlock();
+
+    /* Discard the pattern if it was not added */
+    if (ep != NULL)
+    {
+        fpattern_free(ep->prog);
+        free(ep);
+    }
+    fpattern_cache_release(list);
+    return (xp);
+}
+
+#endif /* CACHE */
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cached()
+*	Attempts to match pattern 'pat', compiled for matching 'flags', to
+*	filename 'fname', through the cache of compiled patterns.
+*
+*	A reader does not lock the cache, but counts itself in the current
+*	phase while it uses a cache entry, so that the entry is not released
+*	(see fpattern_cache_reclaim()).
+*
+* Returns
+*	True (1) if the filename matches, false (0) if it does not, or -1 if
+*	the pattern is not matched through the cache, because the cache is
+*	disabled, the pattern is invalid, or there is no memory.  Patterns
+*	with a negated subpattern (FPE_NOT) are not matched through the cache
+*	either, since the backtracking matcher is faster for them.
+*
+* Caveats
+*	This assumes that 'pat' and 'fname' are not null.
+*/
+
+static int fpattern_cached(const char *pat, int flags, const char *fname)
+{
+#if CACHE
+    struct fpat_stripe *	sp;
+    struct fpat_centry *	ep;
+    unsigned long		h;
+    unsigned long		ph;
+    size_t			len;
+    int				rc;
+
+    if (__atomic_load_n(&fpat_cmax, __ATOMIC_RELAXED) == 0)
+        return (-1);			/* Cache is disabled */
+
+    /* Spread the threads over the reader counters */
+    if (fpat_cthread < 0)
+        fpat_cthread = (int) ((unsigned) __atomic_fetch_add(&fpat_cthreads,
+            1, __ATOMIC_RELAXED) % FPAT_STRIPES);
+    sp = &fpat_stripe[fpat_cthread];
+
+    len = strlen(pat);
+    h = fpattern_cache_hash(pat, len, flags);
+
+    /* Enter the current phase */
+    for (;;)
+    {
+        ph = __atomic_load_n(&fpat_cphase, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&sp->readers[ph & 1], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&fpat_cphase, __ATOMIC_SEQ_CST) == ph)
+            break;
+        __atomic_sub_fetch(&sp->readers[ph & 1], 1, __ATOMIC_RELEASE);
+    }
+
+    /* Look up the pattern, compiling it if it is not cached */
+    ep = fpattern_cache_find(pat, len, flags, h);
+    if (ep != NULL)
+    {
+        __atomic_add_fetch(&sp->hits, 1, __ATOMIC_RELAXED);
+        if (!__atomic_load_n(&ep->ref, __ATOMIC_RELAXED))
+            __atomic_store_n(&ep->ref, true, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        __atomic_add_fetch(&sp->misses, 1, __ATOMIC_RELAXED);
+        ep = fpattern_cache_add(pat, len, flags, h);
+    }
+
+    /* Attempt to match the compiled pattern against filename */
+    rc = -1;
+    if (ep != NULL  &&  ep->prog != NULL  &&  ep->prog->engine != FPE_NOT)
+        rc = fpattern_exec(ep->prog, fname);
+
+    /* Leave the phase */
+    __atomic_sub_fetch(&sp->readers[ph & 1], 1, __ATOMIC_RELEASE);
+    return (rc);
+#else
+    (void) pat;
+    (void) flags;
+    (void) fname;
+    return (-1);
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_size()
+*	Sets the size of the process-wide cache of compiled patterns used by
+*	fpattern_match(), fpattern_matchn() and fpattern_match_flags() to
+*	'maxmem' bytes, evicting cached patterns to fit.
+*
+*	Patterns are cached by their chars and matching flags, each the first
+*	time it is matched, and are matched by their compiled form from then
+*	on.  Invalid patterns are cached too.  When the cache is full, the
+*	patterns matched least recently are evicted (approximately, by a
+*	CLOCK sweep).
+*
+* Returns
+*	True (1) on success, or false (0) if this build has no cache.
+*
+* Caveats
+*	The cache is disabled (the default) if 'maxmem' is zero, in which case
+*	all of its memory is released once the matches in progress end.
+*	FPAT_CACHE_MEM is a reasonable size.
+*
+*	Any number of threads may match patterns through the cache at once.
+*	Lookups take no locks; adding a pattern takes a short spin lock, after
+*	it is compiled.  Evicted patterns are released once no thread can
+*	still be matching them, by whichever thread next adds a pattern.
+*
+*	The cache needs GCC atomics, and is left out if `FPAT_NOCACHE' is
+*	defined.
+*
+* See also
+*	fpattern_cache_stats(), fpattern_match().
+*/
+
+int fpattern_cache_size(size_t maxmem)
+{
+#if CACHE
+    struct fpat_centry *	list;
+    int				done;
+
+    fpattern_cache_lock();
+    __atomic_store_n(&fpat_cmax, maxmem, __ATOMIC_RELAXED);
+    fpattern_cache_evict(maxmem);
+    list = fpattern_cache_reclaim();
+    done = (fpat_cold == NULL  &&  fpat_cpend == NULL);
+    fpattern_cache_unlock();
+    fpattern_cache_release(list);
+
+    /* Wait for the matches in progress to release the cache */
+    while (maxmem == 0  &&  !done)
+    {
+        fpattern_cache_lock();
+        list = fpattern_cache_reclaim();
+        done = (fpat_cold == NULL  &&  fpat_cpend == NULL);
+        fpattern_cache_unlock();
+        fpattern_cache_release(list);
+    }
+    return (true);
+#else
+    (void) maxmem;
+    return (false);
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_flush()
+*	Evicts all of the patterns in the cache of compiled patterns, leaving
+*	it enabled.
+*/
+
+static void fpattern_cache_flush(void)
+{
+#if CACHE
+    struct fpat_centry *	list;
+
+    fpattern_cache_lock();
+    fpattern_cache_evict(0);
+    list = fpattern_cache_reclaim();
+    fpattern_cache_unlock();
+    fpattern_cache_release(list);
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_cache_stats()
+*	Retrieves the counters of the cache of compiled patterns into
+*	'*stats'.
+*
+* Caveats
+*	The counters are sampled while other threads may be updating them, so
+*	they may be slightly inconsistent with each other.  If this build has
+*	no cache, they are all zero.
+*
+* See also
+*	fpattern_cache_size().
+*/
+
+void fpattern_cache_stats(fpattern_cache_stats_t *stats)
+{
+#if CACHE
+    int		i;
+#endif
+
+    if (stats == NULL)
+        return;
+
+    memset(stats, 0, sizeof(*stats));
+#if CACHE
+    for (i = 0;  i < FPAT_STRIPES;  i++)
+    {
+        stats->hits += __atomic_load_n(&fpat_stripe[i].hits,
+            __ATOMIC_RELAXED);
+        stats->misses += __atomic_load_n(&fpat_stripe[i].misses,
+            __ATOMIC_RELAXED);
+    }
+
+    fpattern_cache_lock();
+    stats->evictions = fpat_cevict;
+    stats->entries = fpat_ccount;
+    stats->bytes = fpat_cused;
+    fpattern_cache_unlock();
+#endif
+}
+
+
+#if STATS
+
+#if UNIX
+/*------------------------------------------------------------------------------
+* fpattern_stats_detach()
+*	Marks the matching counters 'arg' of a thread that is exiting as free,
+*	to be taken over by the next new thread.
+*/
+
+static void fpattern_stats_detach(void *arg)
+{
+    fpat_tstat = NULL;
+    __atomic_store_n(&((struct fpat_tstats *) arg)->free, true,
+        __ATOMIC_RELEASE);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_stats_key()
+*	Creates the thread-specific key whose destructor detaches the counters
+*	of each thread as it exits.
+*/
+
+static void fpattern_stats_key(void)
+{
+    pthread_key_create(&fpat_skey, fpattern_stats_detach);
+}
+#endif
+
+
+/*------------------------------------------------------------------------------
+* fpattern_stats_attach()
+*	Finds the matching counters for the calling thread, the first time it
+*	matches a name.  The counters of a thread that has exited are reused,
+*	keeping their counts, otherwise new ones are added to the list of
+*	counters.
+*
+* Returns
+*	A pointer to the counters of the thread.  If there is no memory for
+*	them, the counts go to counters that are never read.
+*/
+
+static fpattern_stats_t *fpattern_stats_attach(void)
+{
+    struct fpat_tstats *	ts;
+
+    /* Take over the counters of a thread that has exited */
+    for (ts = __atomic_load_n(&fpat_stats, __ATOMIC_ACQUIRE);  ts != NULL;
+        ts = ts->next)
+    {
+        if (__atomic_load_n(&ts->free, __ATOMIC_RELAXED)  &&
+            __atomic_exchange_n(&ts->free, false, __ATOMIC_ACQUIRE))
+            break;
+    }
+
+    if (ts == NULL)
+    {
+        /* Add new counters to the list, which is never shortened */
+        ts = (struct fpat_tstats *) calloc(1, sizeof(struct fpat_tstats));
+        if (ts == NULL)
+            return (&fpat_nostats);
+
+        ts->next = __atomic_load_n(&fpat_stats, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&fpat_stats, &ts->next, ts,
+            true, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+
+#if UNIX
+    pthread_once(&fpat_sonce, fpattern_stats_key);
+    pthread_setspecific(fpat_skey, ts);
+#endif
+    fpat_tstat = ts;
+    return (&ts->s);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_mystats()
+*	Returns a pointer to the matching counters of the calling thread.
+*/
+
+static fpattern_stats_t *fpattern_mystats(void)
+{
+    if (fpat_tstat != NULL)
+        return (&fpat_tstat->s);
+    return (fpattern_stats_attach());
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_stats_add()
+*	Adds 'n' to counter '*c' of the calling thread.  Since only the thread
+*	itself writes its counters, this needs no atomic read-modify-write, but
+*	only a store that cannot be torn while another thread reads it.
+*/
+
+static void fpattern_stats_add(unsigned long *c, unsigned long n)
+{
+    __atomic_store_n(c, *c + n, __ATOMIC_RELAXED);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_stats_name()
+*	Counts a name matched with result 'rc' (1 if it matched), whose cost
+*	was 'cost' steps.
+*/
+
+static void fpattern_stats_name(int rc, unsigned long cost)
+{
+    fpattern_stats_t *	st;
+    int			b;
+
+    st = fpattern_mystats();
+    fpattern_stats_add(&st->names, 1);
+    if (rc > 0)
+        fpattern_stats_add(&st->matches, 1);
+
+    /* Bucket 'b' holds costs of at least 2^(b-1), and less than 2^b */
+    b = (cost == 0 ? 0 : (int) (sizeof(cost)*CHAR_BIT) - __builtin_clzl(cost));
+    if (b >= FPAT_STATS_COST)
+        b = FPAT_STATS_COST-1;
+    fpattern_stats_add(&st->cost[b], 1);
+}
+
+#endif /* STATS */
+
+
+/*------------------------------------------------------------------------------
+* fpattern_stats_get()
+*	Retrieves the matching counters of all threads, summed, into '*stats'.
+*
+*	The cost of a name is the number of steps taken to match it by the
+*	backtracking matcher (fpattern_match() and its kin, see
+*	fpattern_match_steps()), or the number of name chars scanned by a
+*	compiled pattern (fpattern_exec() and its kin), which is zero for a
+*	name that is rejected by the prefilter of the pattern.
+*
+* Returns
+*	True (1) if the counters are kept, otherwise false (0), in which case
+*	they are all zero.
+*
+* Caveats
+*	The counters are only kept if this was built with `FPAT_STATS' defined
+*	to 1.  They are never reset, so the work done between two points is
+*	found by subtracting the counters read at each of them.
+*
+*	Each thread keeps its own counters, so matching takes no locks and
+*	shares no cache lines.  They are sampled while other threads may be
+*	updating them, so they may be slightly inconsistent with each other.
+*
+*	Names matched by fpattern_walk_t or fpattern_index_t are not counted,
+*	nor are empty names.
+*
+* See also
+*	fpattern_match_steps(), fpattern_dfa_new(), fpattern_cache_stats().
+*/
+
+int fpattern_stats_get(fpattern_stats_t *stats)
+{
+#if STATS
+    const struct fpat_tstats *	ts;
+    const unsigned long *	c;
+    unsigned long *		sum;
+    size_t			i;
+#endif
+
+    if (stats == NULL)
+        return (false);
+
+    memset(stats, 0, sizeof(*stats));
+#if STATS
+    /* Every member is an unsigned long counter */
+    sum = (unsigned long *) stats;
+    for (ts = __atomic_load_n(&fpat_stats, __ATOMIC_ACQUIRE);  ts != NULL;
+        ts = ts->next)
+    {
+        c = (const unsigned long *) &ts->s;
+        for (i = 0;  i < sizeof(*stats)/sizeof(unsigned long);  i++)
+            sum[i] += __atomic_load_n(&c[i], __ATOMIC_RELAXED);
+    }
+    return (true);
+#else
+    return (false);
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_dfa_new()
+*	Creates a lazy DFA for compiled pattern 'prog', whose states are built
+*	from the NFA state vectors of the pattern as names are matched, and
+*	are cached in no more than 'maxmem' bytes.
+*
+*	Name chars that affect the NFA identically are grouped into classes,
+*	so that each DFA state needs only one transition per class.
+*
+* Returns
+*	A pointer to the DFA, which must be released by a call to
+*	fpattern_dfa_free(), or null on error.
+*
+* Caveats
+*	If 'maxmem' is zero, a default limit of FPAT_DFA_MEM bytes is used.
+*
+*	The DFA is modified as it matches names, so it must not be used by
+*	more than one thread at a time.  Any number of DFAs may share the same
+*	compiled pattern, which must not be released before they are.
+*
+* See also
+*	fpattern_dfa_exec(), fpattern_dfa_free().
+*/
+
+fpattern_dfa_t *fpattern_dfa_new(const fpattern_t *prog, size_t maxmem)
+{
+    fpattern_dfa_t *	dfa;
+    unsigned char	rep[256];
+    size_t		cost;
+    int			words;
+    int			c, k;
+
+    /* Check args */
+    if (prog == NULL)
+        return (NULL);
+
+    if (maxmem == 0)
+        maxmem = FPAT_DFA_MEM;
+
+    words = prog->words;
+    dfa = (fpattern_dfa_t *) malloc(sizeof(fpattern_dfa_t) +
+        2*words*sizeof(fpat_word));
+    if (dfa == NULL)
+        return (NULL);
+
+    dfa->prog = prog;
+    dfa->tmp = (fpat_word *) (dfa + 1);
+    dfa->nstates = 0;
+    dfa->cap = 0;
+    dfa->hsize = 0;
+    dfa->start = -1;
+    dfa->dead = -1;
+    dfa->flushed = false;
+    dfa->next = NULL;
+    dfa->vecs = NULL;
+    dfa->hash = NULL;
+
+    /* Group the chars that have identical NFA transitions */
+    dfa->nclass = 0;
+    for (c = 0;  c < 256;  c++)
+    {
+        for (k = 0;  k < dfa->nclass;  k++)
+        {
+            if (memcmp(prog->cons + c*words, prog->cons + rep[k]*words,
+                    words*sizeof(fpat_word)) == 0  &&
+                memcmp(prog->loop + c*words, prog->loop + rep[k]*words,
+                    words*sizeof(fpat_word)) == 0)
+                break;
+        }
+
+        if (k == dfa->nclass)
+            rep[dfa->nclass++] = (unsigned char) c;
+        dfa->cls[c] = (unsigned char) k;
+    }
+
+    /* Determine how many states fit within the memory limit */
+    cost = dfa->nclass*sizeof(int) + words*sizeof(fpat_word) + 2*sizeof(int);
+    if (maxmem > sizeof(fpattern_dfa_t))
+        maxmem -= sizeof(fpattern_dfa_t);
+    else
+        maxmem = 0;
+    dfa->maxstates = (maxmem/cost > INT_MAX/4 ? INT_MAX/4 :
+        (int) (maxmem/cost));
+
+    DL(printf("fpattern_dfa_new: %d classes, %d states max\n",
+        dfa->nclass, dfa->maxstates));
+    return (dfa);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_dfa_hash()
+*	Computes the hash table slot of NFA state vector 'v' in DFA 'dfa'.
+*/
+
+static int fpattern_dfa_hash(const fpattern_dfa_t *dfa, const fpat_word *v)
+{
+    unsigned long	h;
+    int			w;
+
+    h = 0;
+    for (w = 0;  w < dfa->prog->words;  w++)
+    {
+        h = (h ^ (unsigned long) v[w]) * 0x9E3779B1UL;
+        h ^= h >> 15;
+    }
+    return ((int) (h & (unsigned long) (dfa->hsize-1)));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_dfa_state()
+*	Finds or adds the DFA state for NFA state vector 'v' in DFA 'dfa'.
+*
+* Returns
+*	The index of the DFA state, or -1 if there is no more room for it.
+*/
+
+static int fpattern_dfa_state(fpattern_dfa_t *dfa, const fpat_word *v)
+{
+    fpat_word *	vecs;
+    int *	next;
+    int *	hash;
+    size_t	vsize;
+    int		words;
+    int		cap, hsize;
+    int		h, i, s;
+
+    words = dfa->prog->words;
+    vsize = words*sizeof(fpat_word);
+
+    /* Look for an existing state */
+    if (dfa->hsize > 0)
+    {
+        for (h = fpattern_dfa_hash(dfa, v);  dfa->hash[h] != 0;
+            h = (h+1) & (dfa->hsize-1))
+        {
+            s = dfa->hash[h] - 1;
+            if (memcmp(dfa->vecs + s*words, v, vsize) == 0)
+                return (s);
+        }
+    }
+
+    /* Make room for a new state */
+    if (dfa->nstates == dfa->cap)
+    {
+        cap = (dfa->cap == 0 ? 16 : 2*dfa->cap);
+        if (cap > dfa->maxstates)
+            cap = dfa->maxstates;
+        if (cap <= dfa->cap)
+            return (-1);		/* Cache is full */
+
+        for (hsize = 32;  hsize < 2*cap;  hsize *= 2)
+            ;
+
+        next = (int *) realloc(dfa->next, cap*dfa->nclass*sizeof(int));
+        if (next == NULL)
+            return (-1);
+        dfa->next = next;
+
+        vecs = (fpat_word *) realloc(dfa->vecs, cap*vsize);
+        if (vecs == NULL)
+            return (-1);
+        dfa->vecs = vecs;
+
+        hash = (int *) realloc(dfa->hash, hsize*sizeof(int));
+        if (hash == NULL)
+            return (-1);
+        dfa->hash = hash;
+        dfa->cap = cap;
+
+        /* Rehash the existing states */
+        dfa->hsize = hsize;
+        memset(dfa->hash, 0, hsize*sizeof(int));
+        for (i = 0;  i < dfa->nstates;  i++)
+        {
+            for (h = fpattern_dfa_hash(dfa, dfa->vecs + i*words);
+                dfa->hash[h] != 0;  h = (h+1) & (hsize-1))
+                ;
+            dfa->hash[h] = i+1;
+        }
+    }
+
+    /* Add the new state */
+    s = dfa->nstates++;
+    memcpy(dfa->vecs + s*words, v, vsize);
+    for (i = 0;  i < dfa->nclass;  i++)
+        dfa->next[s*dfa->nclass + i] = -1;
+
+    for (h = fpattern_dfa_hash(dfa, v);  dfa->hash[h] != 0;
+        h = (h+1) & (dfa->hsize-1))
+        ;
+    dfa->hash[h] = s+1;
+
+    for (i = 0;  i < words  &&  v[i] == 0;  i++)
+        ;
+    if (i == words)
+        dfa->dead = s;			/* No NFA states left */
+    return (s);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_dfa_add()
+*	Builds the transition of DFA state 's' in DFA 'dfa' for name char 'ch'.
+*
+*	If the cache is full, it is flushed and refilled, but only once per
+*	name, so that a name that needs more states than will fit does not
+*	thrash the cache.
+*
+* Returns
+*	The index of the next DFA state, or -1 if it could not be cached, in
+*	which case its NFA state vector is left in 'dfa->tmp'.
+*/
+
+static int fpattern_dfa_add(fpattern_dfa_t *dfa, int s, int ch)
+{
+    int		t;
+
+    fpattern_step(dfa->prog, dfa->vecs + s*dfa->prog->words, dfa->tmp, ch);
+
+    t = fpattern_dfa_state(dfa, dfa->tmp);
+    if (t < 0)
+    {
+        if (dfa->flushed)
+            return (-1);
+
+        /* Flush the cache and start refilling it */
+        DL(printf("fpattern_dfa_add: flush %d states\n", dfa->nstates));
+        STAT_ADD(dfa_evictions, dfa->nstates);
+        dfa->nstates = 0;
+        dfa->start = -1;
+        dfa->dead = -1;
+        dfa->flushed = true;
+        if (dfa->hsize > 0)
+            memset(dfa->hash, 0, dfa->hsize*sizeof(int));
+
+        return (fpattern_dfa_state(dfa, dfa->tmp));
+    }
+
+    dfa->next[s*dfa->nclass + dfa->cls[ch]] = t;
+    return (t);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_dfa_scan()
+*	Moves the DFA 'dfa' across the name chars 'name[0...len-1]', one table
+*	lookup per char, building DFA states as they are needed.
+*
+* Returns
+*	A pointer to the NFA state vector that the name ends in, or null if no
+*	NFA states remain.
+*
+* Caveats
+*	If a DFA state cannot be cached, the rest of the name is scanned by
+*	simulating the NFA instead, and the resulting vector is only valid
+*	until the next call.
+*/
+
+static const fpat_word *fpattern_dfa_scan(fpattern_dfa_t *dfa,
+    const unsigned char *name, size_t len)
+{
+    const fpattern_t *	prog;
+    fpat_word *		st;
+    fpat_word *		nx;
+    size_t		pos;
+    size_t		built;
+    int			nclass;
+    int			s, t;
+
+    prog = dfa->prog;
+    dfa->flushed = false;
+    pos = 0;
+    built = 0;
+
+    if (dfa->start < 0)
+    {
+        /* Build the start state */
+        memcpy(dfa->tmp, prog->init, prog->words*sizeof(fpat_word));
+        dfa->start = fpattern_dfa_state(dfa, dfa->tmp);
+        if (dfa->start < 0)
+            goto nfa;
+    }
+
+    nclass = dfa->nclass;
+    s = dfa->start;
+    for ( ;  pos < len;  pos++)
+    {
+        t = dfa->next[s*nclass + dfa->cls[name[pos]]];
+        if (t < 0)
+        {
+            /* Build a new transition */
+            built++;
+            t = fpattern_dfa_add(dfa, s, name[pos]);
+            if (t < 0)
+            {
+                pos++;
+                goto nfa;
+            }
+        }
+
+        s = t;
+        if (s == dfa->dead)
+        {
+            STAT_ADD(dfa_hits, pos+1 - built);
+            STAT_ADD(dfa_misses, built);
+            return (NULL);
+        }
+    }
+
+    STAT_ADD(dfa_hits, pos - built);
+    STAT_ADD(dfa_misses, built);
+    return (dfa->vecs + s*prog->words);
+
+nfa:
+    /* Cache is full, so simulate the NFA for the rest of the name */
+    STAT_ADD(dfa_hits, pos - built);
+    STAT_ADD(dfa_misses, built);
+    st = dfa->tmp;
+    nx = dfa->tmp + prog->words;
+    for ( ;  pos < len;  pos++)
+    {
+        if (!fpattern_step(prog, st, nx, name[pos]))
+            return (NULL);
+        st = nx;
+        nx = (nx == dfa->tmp ? dfa->tmp + prog->words : dfa->tmp);
+    }
+    return (st);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_dfa_exec()
+*	Attempts to match the compiled pattern of lazy DFA 'dfa' to filename
+*	'fname'.  This operates like fpattern_exec(), except that each name
+*	char costs a single table lookup once the DFA states it passes through
+*	have been built.
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	If 'fname' is null, false (0) is returned.
+*
+*	If 'dfa' is null, false (0) is returned.
+*
+*	Patterns containing negated subpatterns are matched by fpattern_exec().
+*
+* See also
+*	fpattern_dfa_new(), fpattern_exec(), fpattern_dfa_exec_len().
+*/
+
+int fpattern_dfa_exec(fpattern_dfa_t *dfa, const char *fname)
+{
+    /* Check args */
+    if (fname == NULL)
+        return (false);
+
+    return (fpattern_dfa_exec_len(dfa, fname, strlen(fname)));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_dfa_exec_len()
+*	Attempts to match the compiled pattern of lazy DFA 'dfa' to filename
+*	'fname[0...len-1]', which need not be null-terminated.  This operates
+*	like fpattern_dfa_exec().
+*
+* Returns
+*	True (1) if the filename matches, otherwise false (0).
+*
+* Caveats
+*	If 'fname' or 'dfa' is null, false (0) is returned.
+*
+* See also
+*	fpattern_dfa_exec(), fpattern_exec_len().
+*/
+
+int fpattern_dfa_exec_len(fpattern_dfa_t *dfa, const char *fname, size_t len)
+{
+    const fpat_word *	st;
+    unsigned char	buf[256];
+    unsigned char *	cls;
+    int			rc;
+
+    /* Check args */
+    if (fname == NULL)
+        return (false);
+
+    if (dfa == NULL)
+        return (false);
+
+    /* Attempt to match pattern against filename */
+    if (len == 0)
+        return (dfa->prog->nins == 1);	/* Special case */
+
+    if (dfa->prog->engine == FPE_NOT)
+        return (fpattern_run(dfa->prog, (const unsigned char *) fname, len));
+
+    if ((dfa->prog->flags & FPAT_UTF8)  &&
+        !fpattern_ascii((const unsigned char *) fname, len))
+    {
+        /* Scan the char classes of a non-ASCII name */
+        cls = fpattern_utf8_name(dfa->prog, (const unsigned char *) fname,
+            &len, buf, sizeof(buf));
+        if (cls == NULL)
+            return (false);
+
+        rc = fpattern_prefilter(dfa->prog, cls, len);
+        if (rc)
+        {
+            st = fpattern_dfa_scan(dfa, cls, len);
+            rc = (st != NULL  &&  fpattern_final(dfa->prog, st));
+            STAT_NAME(rc, len);
+        }
+        else
+        {
+            STAT_ADD(rejects, 1);
+            STAT_NAME(false, 0);
+        }
+
+        if (cls != buf)
+            free(cls);
+        return (rc);
+    }
+
+    if (!fpattern_prefilter(dfa->prog, (const unsigned char *) fname, len))
+    {
+        STAT_ADD(rejects, 1);
+        STAT_NAME(false, 0);
+        return (false);
+    }
+
+    st = fpattern_dfa_scan(dfa, (const unsigned char *) fname, len);
+    rc = (st != NULL  &&  fpattern_final(dfa->prog, st));
+    STAT_NAME(rc, len);
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_dfa_free()
+*	Releases lazy DFA 'dfa'.
+*
+* Caveats
+*	If 'dfa' is null, nothing is done.
+*/
+
+void fpattern_dfa_free(fpattern_dfa_t *dfa)
+{
+    if (dfa == NULL)
+        return;
+
+    free(dfa->next);
+    free(dfa->vecs);
+    free(dfa->hash);
+    free(dfa);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_merge()
+*	Combines compiled patterns 'progs[0...n-1]' into a single compiled
+*	pattern whose NFA runs all of them side by side.
+*
+* Returns
+*	A pointer to the combined pattern, or null if there is no memory.
+*
+* Caveats
+*	The patterns must not contain any negated subpatterns.
+*/
+
+static fpattern_t *fpattern_merge(fpattern_t *const *progs, int n)
+{
+    fpattern_t *		prog;
+    struct fpat_ins *		ip;
+    size_t			nins, nsets;
+    int				i, pc;
+    int				op;
+
+    nins = 0;
+    nsets = 0;
+    for (i = 0;  i < n;  i++)
+    {
+        nins += progs[i]->nins;
+        nsets += progs[i]->nsets;
+    }
+
+    prog = fpattern_alloc(nins, nsets, progs[0]->flags);
+    if (prog == NULL)
+        return (NULL);
+
+    /* Append the instructions and sets of each pattern */
+    for (i = 0;  i < n;  i++)
+    {
+        ip = prog->ins + prog->nins;
+        memcpy(ip, progs[i]->ins, progs[i]->nins*sizeof(struct fpat_ins));
+        for (pc = 0;  pc < progs[i]->nins;  pc++)
+        {
+            op = ip[pc].op;
+            if (op == FPI_SET)
+                ip[pc].arg += prog->nsets;
+            else if ((op == FPI_ALT  ||  op == FPI_OR  ||  op == FPI_JMP)  &&
+                ip[pc].arg != 0)
+                ip[pc].arg += prog->nins;	/* Jump target */
+        }
+
+        memcpy(prog->sets + prog->nsets, progs[i]->sets,
+            progs[i]->nsets*sizeof(prog->sets[0]));
+        prog->nins += progs[i]->nins;
+        prog->nsets += progs[i]->nsets;
+    }
+
+    fpattern_build(prog);
+    return (prog);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_key()
+*	Extracts the prefilter key of compiled pattern 'prog', which is the
+*	last (up to) four chars of its literal suffix, or failing that, the
+*	first (up to) four chars of its literal prefix.
+*
+* Returns
+*	The length of the key stored into 'key[0...3]', plus FPAT_KEY_PRE if it
+*	is a prefix, or zero if the pattern has neither.
+*/
+
+#define FPAT_KEY_PRE	8		/* Key is a literal prefix	*/
+#define FPAT_KEY_MAX	4		/* Max key chars		*/
+
+static int fpattern_set_key(const fpattern_t *prog, unsigned char *key)
+{
+    int		pc, n;
+
+    /* Look for a literal suffix */
+    for (n = 0;  n < FPAT_KEY_MAX  &&  n+1 < prog->nins;  n++)
+    {
+        if (prog->ins[prog->nins-2 - n].op != FPI_CHAR)
+            break;
+    }
+
+    if (n > 0)
+    {
+        for (pc = 0;  pc < n;  pc++)
+            key[pc] = prog->ins[prog->nins-1 - n + pc].ch;
+        return (n);
+    }
+
+    /* Look for a literal prefix */
+    for (n = 0;  n < FPAT_KEY_MAX  &&  prog->ins[n].op == FPI_CHAR;  n++)
+        key[n] = prog->ins[n].ch;
+
+    return (n > 0 ? n + FPAT_KEY_PRE : 0);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_hash()
+*	Computes the hash table slot for prefilter key 'key[0...kind%8-1]' in
+*	pattern set 'set'.
+*/
+
+static int fpattern_set_hash(const fpattern_set_t *set,
+    const unsigned char *key, int kind)
+{
+    unsigned long	h;
+    int			i;
+
+    h = (unsigned long) kind;
+    for (i = 0;  i < kind % FPAT_KEY_PRE;  i++)
+        h = (h*31 + key[i]) * 0x9E3779B1UL;
+    h ^= h >> 15;
+    return ((int) (h & (unsigned long) (set->hsize-1)));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_find()
+*	Looks up the group of patterns with prefilter key 'key' of type 'kind'
+*	in pattern set 'set'.
+*
+* Returns
+*	The hash table slot holding the group, or of the empty slot where the
+*	group belongs.
+*/
+
+static int fpattern_set_find(const fpattern_set_t *set,
+    const unsigned char *key, int kind)
+{
+    const struct fpat_group *	g;
+    int				h;
+
+    for (h = fpattern_set_hash(set, key, kind);  set->hash[h] != 0;
+        h = (h+1) & (set->hsize-1))
+    {
+        g = &set->groups[set->hash[h]-1];
+        if (g->kind == kind  &&  memcmp(g->key, key, kind % FPAT_KEY_PRE) == 0)
+            break;
+    }
+    return (h);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_new()
+*	Compiles the 'npats' patterns 'pats[0...npats-1]' into a pattern set,
+*	which matches a filename against all of them in a single scan.
+*
+*	The patterns are grouped by the literal suffix (e.g., the extension) or
+*	prefix that a matching filename must have, and the patterns of each
+*	group are combined into a single NFA, matched through a lazy DFA
+*	limited to 'maxmem' bytes.  A filename is only scanned by the groups
+*	whose key it has, and by the group of patterns with no key.
+*
+* Returns
+*	A pointer to the pattern set, which must be released by a call to
+*	fpattern_set_free(), or null on error.
+*
+*	If a pattern is not well-formed, null is returned, and its index and
+*	the offset of its offending char are stored into '*errpat' and
+*	'*erroff'.  On any other error, both are set to -1.  Either may be null.
+*
+* Caveats
+*	If 'maxmem' is zero, a default limit of FPAT_DFA_MEM bytes is used.
+*
+*	Patterns containing negated subpatterns are matched one at a time.
+*
+*	The set is modified as it matches names, so it must not be used by
+*	more than one thread at a time.
+*
+* See also
+*	fpattern_set_match(), fpattern_set_ids(), fpattern_set_free().
+*/
+
+fpattern_set_t *fpattern_set_new(const char *const *pats, int npats,
+    size_t maxmem, int *errpat, int *erroff)
+{
+    fpattern_set_t *	set;
+    fpattern_t **	progs;
+    fpattern_t **	list;
+    struct fpat_group *	g;
+    unsigned char	key[FPAT_KEY_MAX];
+    int *		gid;
+    int			eoff, epat;
+    int			kind;
+    int			i, j, h, pc;
+
+    if (errpat == NULL)
+        errpat = &epat;
+    if (erroff == NULL)
+        erroff = &eoff;
+    *errpat = -1;
+    *erroff = -1;
+
+    /* Check args */
+    if (pats == NULL  ||  npats < 0)
+        return (NULL);
+
+    set = (fpattern_set_t *) calloc(1, sizeof(fpattern_set_t));
+    progs = (fpattern_t **) calloc(npats+1, sizeof(fpattern_t *));
+    list = (fpattern_t **) calloc(npats+1, sizeof(fpattern_t *));
+    gid = (int *) calloc(npats+1, sizeof(int));
+    if (set == NULL  ||  progs == NULL  ||  list == NULL  ||  gid == NULL)
+        goto fail;
+
+    fpattern_snap();
+
+    set->npats = npats;
+    for (i = 0;  i < 256;  i++)
+        set->fold[i] = (unsigned char) lowercase(i);
+
+    for (set->hsize = 16;  set->hsize < 2*(npats+1);  set->hsize *= 2)
+        ;
+    set->hash = (int *) calloc(set->hsize, sizeof(int));
+    set->groups = (struct fpat_group *) calloc(npats+1,
+        sizeof(struct fpat_group));
+    set->empty = (int *) calloc(npats+1, sizeof(int));
+    set->slow = (fpattern_t **) calloc(npats+1, sizeof(fpattern_t *));
+    set->slowid = (int *) calloc(npats+1, sizeof(int));
+    if (set->hash == NULL  ||  set->groups == NULL  ||  set->empty == NULL  ||
+        set->slow == NULL  ||  set->slowid == NULL)
+        goto fail;
+
+    /* Group 0 holds the patterns without a prefilter key */
+    set->ngroups = 1;
+
+    /* Compile each pattern, and assign it to a group */
+    for (i = 0;  i < npats;  i++)
+    {
+        progs[i] = fpattern_compile(pats[i], erroff);
+        if (progs[i] == NULL)
+        {
+            *errpat = (*erroff >= 0 ? i : -1);
+            goto fail;
+        }
+
+        gid[i] = -1;
+        if (progs[i]->nins == 1)
+        {
+            /* Empty pattern matches only an empty filename */
+            set->empty[set->nempty++] = i;
+        }
+        else if (progs[i]->engine == FPE_NOT)
+        {
+            /* Negated subpatterns must be matched alone */
+            set->slowid[set->nslow] = i;
+            set->slow[set->nslow++] = progs[i];
+            progs[i] = NULL;
+        }
+        else
+        {
+            kind = fpattern_set_key(progs[i], key);
+            gid[i] = 0;
+            if (kind > 0)
+            {
+                h = fpattern_set_find(set, key, kind);
+                if (set->hash[h] == 0)
+                {
+                    g = &set->groups[set->ngroups];
+                    g->kind = kind;
+                    memcpy(g->key, key, kind % FPAT_KEY_PRE);
+                    set->hash[h] = ++set->ngroups;
+                }
+                gid[i] = set->hash[h] - 1;
+            }
+            set->groups[gid[i]].n++;
+        }
+    }
+
+    /* Combine the patterns of each group into a single NFA */
+    for (j = 0;  j < set->ngroups;  j++)
+    {
+        g = &set->groups[j];
+        if (g->n == 0)
+            continue;
+
+        g->n = 0;
+        for (i = 0;  i < npats;  i++)
+        {
+            if (gid[i] == j)
+                list[g->n++] = progs[i];
+        }
+
+        g->prog = fpattern_merge(list, g->n);
+        if (g->prog == NULL)
+            goto fail;
+        g->dfa = fpattern_dfa_new(g->prog, maxmem);
+        g->pid = (int *) malloc(g->prog->nins*sizeof(int));
+        if (g->dfa == NULL  ||  g->pid == NULL)
+            goto fail;
+
+        /* Map the final state of each pattern to its index */
+        pc = 0;
+        for (i = 0;  i < npats;  i++)
+        {
+            if (gid[i] == j)
+            {
+                pc += progs[i]->nins;
+                g->pid[pc-1] = i;
+            }
+        }
+    }
+
+    for (i = 0;  i < npats;  i++)
+        fpattern_free(progs[i]);
+    free(progs);
+    free(list);
+    free(gid);
+
+    DL(printf("fpattern_set_new: %d patterns, %d groups, %d slow\n",
+        npats, set->ngroups, set->nslow));
+    return (set);
+
+fail:
+    if (progs != NULL)
+    {
+        for (i = 0;  i < npats;  i++)
+            fpattern_free(progs[i]);
+    }
+    free(progs);
+    free(list);
+    free(gid);
+    fpattern_set_free(set);
+    return (NULL);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_hit()
+*	Records that pattern 'id' matched, in 'hits'.
+*/
+
+static void fpattern_set_hit(struct fpat_hits *hits, int id)
+{
+    if (hits->bits != NULL)
+        hits->bits[id >> 3] |= (unsigned char) (1 << (id & 7));
+    if (hits->count < hits->maxids)
+        hits->ids[hits->count] = id;
+    hits->count++;
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_group()
+*	Matches the name chars 'name[0...len-1]' against the patterns of group
+*	'g', recording the ones that match in 'hits'.
+*/
+
+static void fpattern_set_group(struct fpat_group *g,
+    const unsigned char *name, size_t len, struct fpat_hits *hits)
+{
+    const fpat_word *	st;
+    fpat_word		x;
+    int			w, b;
+
+    if (g->prog == NULL)
+        return;
+
+    st = fpattern_dfa_scan(g->dfa, name, len);
+    if (st == NULL)
+        return;
+
+    for (w = 0;  w < g->prog->words;  w++)
+    {
+        x = st[w] & g->prog->fin[w];
+        for (b = 0;  x != 0;  b++, x >>= 1)
+        {
+            if (x & 1)
+                fpattern_set_hit(hits, g->pid[w*WBITS + b]);
+        }
+    }
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_run()
+*	Matches the name chars 'name[0...len-1]' against all of the patterns
+*	in pattern set 'set', recording the ones that match in 'hits'.
+*/
+
+static void fpattern_set_run(fpattern_set_t *set, const unsigned char *name,
+    size_t len, struct fpat_hits *hits)
+{
+    unsigned char	key[FPAT_KEY_MAX];
+    int			n, h, i;
+
+    if (len == 0)
+    {
+        /* Special case */
+        for (i = 0;  i < set->nempty;  i++)
+            fpattern_set_hit(hits, set->empty[i]);
+        return;
+    }
+
+    /* Patterns without a prefilter key */
+    fpattern_set_group(&set->groups[0], name, len, hits);
+
+    /* Patterns whose literal suffix or prefix the name has */
+    for (n = 1;  n <= FPAT_KEY_MAX  &&  (size_t) n <= len;  n++)
+    {
+        for (i = 0;  i < n;  i++)
+            key[i] = set->fold[name[len-n + i]];
+        h = fpattern_set_find(set, key, n);
+        if (set->hash[h] != 0)
+            fpattern_set_group(&set->groups[set->hash[h]-1], name, len, hits);
+
+        for (i = 0;  i < n;  i++)
+            key[i] = set->fold[name[i]];
+        h = fpattern_set_find(set, key, n + FPAT_KEY_PRE);
+        if (set->hash[h] != 0)
+            fpattern_set_group(&set->groups[set->hash[h]-1], name, len, hits);
+    }
+
+    /* Patterns with negated subpatterns */
+    for (i = 0;  i < set->nslow;  i++)
+    {
+        if (fpattern_run(set->slow[i], name, len))
+            fpattern_set_hit(hits, set->slowid[i]);
+    }
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_match()
+*	Attempts to match filename 'fname' against all of the patterns in
+*	pattern set 'set', setting bit 'i%8' of 'bits[i/8]' for each pattern
+*	'i' that matches, and clearing the other bits.
+*
+* Returns
+*	The number of patterns that match.
+*
+* Caveats
+*	'bits' must have room for at least one bit per pattern.
+*
+*	If 'fname' or 'set' is null, zero is returned.
+*
+* See also
+*	fpattern_set_new(), fpattern_set_ids().
+*/
+
+int fpattern_set_match(fpattern_set_t *set, const char *fname,
+    unsigned char *bits)
+{
+    /* Check args */
+    if (fname == NULL)
+        return (0);
+
+    return (fpattern_set_match_len(set, fname, strlen(fname), bits));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_match_len()
+*	Attempts to match filename 'fname[0...len-1]', which need not be
+*	null-terminated, against all of the patterns in pattern set 'set'.
+*	This operates like fpattern_set_match().
+*
+* Returns
+*	The number of patterns that match.
+*
+* See also
+*	fpattern_set_match().
+*/
+
+int fpattern_set_match_len(fpattern_set_t *set, const char *fname,
+    size_t len, unsigned char *bits)
+{
+    struct fpat_hits	hits;
+
+    /* Check args */
+    if (fname == NULL  ||  set == NULL  ||  bits == NULL)
+        return (0);
+
+    memset(bits, 0, (set->npats + 7) / 8);
+    hits.bits = bits;
+    hits.ids = NULL;
+    hits.maxids = 0;
+    hits.count = 0;
+
+    fpattern_set_run(set, (const unsigned char *) fname, len, &hits);
+    return (hits.count);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_ids()
+*	Attempts to match filename 'fname' against all of the patterns in
+*	pattern set 'set', storing the indexes of (up to 'maxids' of) the
+*	patterns that match into 'ids', in no particular order.
+*
+* Returns
+*	The number of patterns that match, which may be more than 'maxids'.
+*
+* Caveats
+*	If 'fname' or 'set' is null, zero is returned.
+*
+* See also
+*	fpattern_set_new(), fpattern_set_match().
+*/
+
+int fpattern_set_ids(fpattern_set_t *set, const char *fname, int *ids,
+    int maxids)
+{
+    /* Check args */
+    if (fname == NULL)
+        return (0);
+
+    return (fpattern_set_ids_len(set, fname, strlen(fname), ids, maxids));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_ids_len()
+*	Attempts to match filename 'fname[0...len-1]', which need not be
+*	null-terminated, against all of the patterns in pattern set 'set'.
+*	This operates like fpattern_set_ids().
+*
+* Returns
+*	The number of patterns that match, which may be more than 'maxids'.
+*
+* See also
+*	fpattern_set_ids().
+*/
+
+int fpattern_set_ids_len(fpattern_set_t *set, const char *fname, size_t len,
+    int *ids, int maxids)
+{
+    struct fpat_hits	hits;
+
+    /* Check args */
+    if (fname == NULL  ||  set == NULL)
+        return (0);
+
+    hits.bits = NULL;
+    hits.ids = ids;
+    hits.maxids = (ids != NULL ? maxids : 0);
+    hits.count = 0;
+
+    fpattern_set_run(set, (const unsigned char *) fname, len, &hits);
+    return (hits.count);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_set_free()
+*	Releases pattern set 'set'.
+*
+* Caveats
+*	If 'set' is null, nothing is done.
+*/
+
+void fpattern_set_free(fpattern_set_t *set)
+{
+    int		i;
+
+    if (set == NULL)
+        return;
+
+    if (set->groups != NULL)
+    {
+        for (i = 0;  i < set->ngroups;  i++)
+        {
+            fpattern_dfa_free(set->groups[i].dfa);
+            fpattern_free(set->groups[i].prog);
+            free(set->groups[i].pid);
+        }
+    }
+
+    if (set->slow != NULL)
+    {
+        for (i = 0;  i < set->nslow;  i++)
+            fpattern_free(set->slow[i]);
+    }
+
+    free(set->groups);
+    free(set->hash);
+    free(set->empty);
+    free(set->slow);
+    free(set->slowid);
+    free(set);
+}
+
+/*------------------------------------------------------------------------------
+* fpattern_walk_grow()
+*	Makes room in path matching state 'walk' for at least 'cap' NFA state
+*	vectors, and 'size' path chars if the whole path is kept.
+*
+* Returns
+*	True (1) on success, or false (0) if there is no memory, in which case
+*	the state is unchanged.
+*/
+
+static int fpattern_walk_grow(fpattern_walk_t *walk, int cap, size_t size)
+{
+    fpat_word *		vecs;
+    size_t *		ends;
+    char *		path;
+
+    if (cap > walk->cap)
+    {
+        cap = (cap < 2*walk->cap ? 2*walk->cap : cap);
+        vecs = (fpat_word *) realloc(walk->vecs,
+            (size_t) (cap+1)*walk->words*sizeof(fpat_word));
+        if (vecs == NULL)
+            return (false);
+        walk->vecs = vecs;
+        walk->tmp = vecs + cap*walk->words;
+
+        ends = (size_t *) realloc(walk->ends, cap*sizeof(size_t));
+        if (ends == NULL)
+            return (false);
+        walk->ends = ends;
+        walk->cap = cap;
+    }
+
+    if (walk->prog->engine == FPE_NOT  &&  size > walk->size)
+    {
+        size = (size < 2*walk->size ? 2*walk->size : size);
+        path = (char *) realloc(walk->path, size);
+        if (path == NULL)
+            return (false);
+        walk->path = path;
+        walk->size = size;
+    }
+    return (true);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_walk_new()
+*	Creates a path matching state for compiled pattern 'prog', for matching
+*	the pathnames met while walking a directory tree.  The path is built up
+*	one directory name at a time by fpattern_walk_push(), which moves the
+*	NFA of the pattern across it, and each name in the current directory
+*	is matched by fpattern_walk_match(), which moves the NFA across the
+*	name alone.  So the directory part of a path is matched only once, for
+*	all of the names beneath it.
+*
+*	    walk = fpattern_walk_new(prog);
+*	    ...
+*	    if (fpattern_walk_push(walk, dir, strlen(dir)) > 0)
+*	        (search the directory)
+*	    fpattern_walk_pop(walk);
+*
+* Returns
+*	A pointer to the path matching state, whose path is empty, which must
+*	be released by a call to fpattern_walk_free(), or null on error.
+*
+* Caveats
+*	The path matching state must not be used by more than one thread at a
+*	time, but may be copied by fpattern_walk_copy() for another thread.
+*	The compiled pattern must not be released before the state is.
+*
+*	Patterns containing negated subpatterns are matched against the whole
+*	path by fpattern_walk_match(), and never rule out a directory.
+*
+* See also
+*	fpattern_walk_push(), fpattern_walk_match(), fpattern_walk_free().
+*/
+
+fpattern_walk_t *fpattern_walk_new(const fpattern_t *prog)
+{
+    fpattern_walk_t *	walk;
+
+    /* Check args */
+    if (prog == NULL)
+        return (NULL);
+
+    walk = (fpattern_walk_t *) malloc(sizeof(fpattern_walk_t));
+    if (walk == NULL)
+        return (NULL);
+
+    walk->prog = prog;
+    walk->words = prog->words;
+    walk->depth = 0;
+    walk->cap = 0;
+    walk->vecs = NULL;
+    walk->tmp = NULL;
+    walk->path = NULL;
+    walk->ends = NULL;
+    walk->size = 0;
+
+    /* Start with the path empty */
+    if (!fpattern_walk_grow(walk, 8, 256))
+    {
+        fpattern_walk_free(walk);
+        return (NULL);
+    }
+    memcpy(walk->vecs, prog->init, walk->words*sizeof(fpat_word));
+    walk->ends[0] = 0;
+
+    return (walk);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_walk_push()
+*	Appends directory name 'dir[0...len-1]' to the path of path matching
+*	state 'walk', followed by a path delimiter ('/'), and moves the NFA of
+*	its pattern forward across them.
+*
+* Returns
+*	True (1) if some pathname beginning with the path could still match
+*	the pattern, false (0) if none can, so that the directory need not be
+*	searched, or -1 if there is no memory, in which case nothing is pushed.
+*
+* Caveats
+*	Unless -1 is returned, the name must be popped by fpattern_walk_pop(),
+*	whatever the result.
+*
+*	If 'dir' is null, -1 is returned.
+*
+* See also
+*	fpattern_walk_pop(), fpattern_walk_match().
+*/
+
+int fpattern_walk_push(fpattern_walk_t *walk, const char *dir, size_t len)
+{
+    static const unsigned char	del[1] = { DEL };
+    const fpattern_t *		prog;
+    unsigned char		buf[256];
+    unsigned char *		cls;
+    fpat_word *			st;
+    size_t			end;
+    size_t			n;
+    int				words;
+    int				rc;
+
+    /* Check args */
+    if (walk == NULL  ||  dir == NULL)
+        return (-1);
+
+    prog = walk->prog;
+    words = walk->words;
+    end = walk->ends[walk->depth];
+    if (!fpattern_walk_grow(walk, walk->depth+2, end + len+1))
+        return (-1);
+
+    if (prog->engine == FPE_NOT)
+    {
+        /* Keep the whole path, to be matched by each name */
+        memcpy(walk->path + end, dir, len);
+        walk->path[end + len] = DEL;
+        walk->depth++;
+        walk->ends[walk->depth] = end + len+1;
+        return (true);
+    }
+
+    /* Translate the chars of a non-ASCII UTF-8 name */
+    cls = (unsigned char *) dir;
+    n = len;
+    if ((prog->flags & FPAT_UTF8)  &&  !fpattern_ascii(cls, n))
+    {
+        cls = fpattern_utf8_name(prog, cls, &n, buf, sizeof(buf));
+        if (cls == NULL)
+            return (-1);
+    }
+
+    /* Move the NFA across the name and delimiter */
+    st = walk->vecs + (walk->depth+1)*words;
+    memcpy(st, st - words, words*sizeof(fpat_word));
+    rc = (fpattern_advance(prog, st, walk->tmp, cls, n)  &&
+        fpattern_advance(prog, st, walk->tmp, del, 1));
+    if (!rc)
+        memset(st, 0, words*sizeof(fpat_word));	/* Dead state */
+
+    if (cls != (const unsigned char *) dir  &&  cls != buf)
+        free(cls);
+
+    walk->depth++;
+    walk->ends[walk->depth] = end + len+1;
+
+    DL(printf("fpattern_walk_push: depth %d, return %c\n", walk->depth,
+        "FT"[rc]));
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_walk_pop()
+*	Removes the last directory name pushed onto the path of path matching
+*	state 'walk' by fpattern_walk_push().
+*
+* Caveats
+*	If the path is empty, nothing is done.
+*/
+
+void fpattern_walk_pop(fpattern_walk_t *walk)
+{
+    if (walk != NULL  &&  walk->depth > 0)
+        walk->depth--;
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_walk_depth()
+*	Determines the number of directory names in the path of path matching
+*	state 'walk'.
+*
+* Returns
+*	The number of names pushed and not yet popped, or -1 if 'walk' is null.
+*/
+
+int fpattern_walk_depth(const fpattern_walk_t *walk)
+{
+    if (walk == NULL)
+        return (-1);
+    return (walk->depth);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_walk_match()
+*	Attempts to match the pattern of path matching state 'walk' to the
+*	pathname made up of its path followed by name 'name[0...len-1]'.
+*	This operates like fpattern_exec_len() on the whole pathname, but moves
+*	the NFA of the pattern across only the name.
+*
+* Returns
+*	True (1) if the pathname matches, otherwise false (0).
+*
+* Caveats
+*	If 'walk' or 'name' is null, or there is no memory, false (0) is
+*	returned.
+*
+*	If the path is empty and 'len' is zero, the only pattern that will
+*	match is the empty string ("").
+*
+* See also
+*	fpattern_walk_push(), fpattern_exec_len().
+*/
+
+int fpattern_walk_match(fpattern_walk_t *walk, const char *name, size_t len)
+{
+    const fpattern_t *	prog;
+    unsigned char	buf[256];
+    unsigned char *	cls;
+    size_t		end;
+    int			rc;
+
+    /* Check args */
+    if (walk == NULL  ||  name == NULL)
+        return (false);
+
+    prog = walk->prog;
+    if (walk->depth == 0)
+        return (fpattern_exec_len(prog, name, len));
+
+    if (prog->engine == FPE_NOT)
+    {
+        /* Match the whole pathname */
+        end = walk->ends[walk->depth];
+        if (!fpattern_walk_grow(walk, walk->depth+1, end + len))
+            return (false);
+        memcpy(walk->path + end, name, len);
+        return (fpattern_run(prog, (const unsigned char *) walk->path,
+            end + len));
+    }
+
+    /* Translate the chars of a non-ASCII UTF-8 name */
+    cls = (unsigned char *) name;
+    if ((prog->flags & FPAT_UTF8)  &&  !fpattern_ascii(cls, len))
+    {
+        cls = fpattern_utf8_name(prog, cls, &len, buf, sizeof(buf));
+        if (cls == NULL)
+            return (false);
+    }
+
+    /* Resume the NFA from the state at the end of the path */
+    rc = fpattern_nfa(prog, walk->vecs + walk->depth*walk->words, cls, len);
+
+    if (cls != (const unsigned char *) name  &&  cls != buf)
+        free(cls);
+    return (rc);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_walk_copy()
+*	Copies path matching state 'walk', including its path.
+*
+* Returns
+*	A pointer to the copy, which must be released by a call to
+*	fpattern_walk_free(), or null on error.
+*
+* Caveats
+*	This copies one NFA state vector for each directory name in the path.
+*/
+
+fpattern_walk_t *fpattern_walk_copy(const fpattern_walk_t *walk)
+{
+    fpattern_walk_t *	copy;
+
+    /* Check args */
+    if (walk == NULL)
+        return (NULL);
+
+    copy = fpattern_walk_new(walk->prog);
+    if (copy == NULL)
+        return (NULL);
+
+    if (!fpattern_walk_grow(copy, walk->depth+1, walk->ends[walk->depth]))
+    {
+        fpattern_walk_free(copy);
+        return (NULL);
+    }
+
+    memcpy(copy->vecs, walk->vecs,
+        (walk->depth+1)*walk->words*sizeof(fpat_word));
+    memcpy(copy->ends, walk->ends, (walk->depth+1)*sizeof(size_t));
+    if (walk->path != NULL)
+        memcpy(copy->path, walk->path, walk->ends[walk->depth]);
+    copy->depth = walk->depth;
+
+    return (copy);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_walk_free()
+*	Releases path matching state 'walk'.
+*
+* Caveats
+*	If 'walk' is null, nothing is done.
+*/
+
+void fpattern_walk_free(fpattern_walk_t *walk)
+{
+    if (walk == NULL)
+        return;
+
+    free(walk->vecs);
+    free(walk->ends);
+    free(walk->path);
+    free(walk);
+}
+
+/*------------------------------------------------------------------------------
+* fpattern_index_cmp()
+*	Compares the names pointed to by 'a' and 'b', for qsort().
+*/
+
+static int fpattern_index_cmp(const void *a, const void *b)
+{
+    return (strcmp(*(const char *const *) a, *(const char *const *) b));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_index_build()
+*	Builds node 'node' of the trie of index 'index', and the nodes below
+*	it, for the sorted distinct names 'names[lo...hi-1]', which share their
+*	first 'depth' chars.  The node is labeled with the rest of the prefix
+*	they all share, and has a child for each different char following it.
+*
+* Returns
+*	The height of the subtrie, in nodes.
+*/
+
+static int fpattern_index_build(fpattern_index_t *index,
+    const char *const *names, size_t node, size_t lo, size_t hi, size_t depth)
+{
+    struct fpat_inode *	np;
+    const char *	a;
+    const char *	b;
+    size_t		lcp;
+    size_t		i, j, k;
+    int			h, height;
+
+    /* Label the node with the rest of the shared prefix */
+    a = names[lo] + depth;
+    b = names[hi-1] + depth;
+    for (lcp = 0;  a[lcp] != '\0'  &&  a[lcp] == b[lcp];  lcp++)
+        ;
+
+    np = &index->nodes[node];
+    np->lab = index->nchars;
+    np->len = (unsigned int) lcp;
+    memcpy(index->chars + index->nchars, a, lcp);
+    index->nchars += lcp;
+    depth += lcp;
+
+    /* The first name may end here */
+    np->key = (names[lo][depth] == '\0');
+    lo += np->key;
+    if (np->key  &&  depth > index->maxlen)
+        index->maxlen = depth;
+
+    /* Reserve a child for each char following the prefix */
+    np->nkids = 0;
+    for (i = lo;  i < hi;  i++)
+    {
+        if (i == lo  ||  names[i][depth] != names[i-1][depth])
+            np->nkids++;
+    }
+    np->kids = index->nnodes;
+    index->nnodes += np->nkids;
+
+    /* Build the children, in order */
+    height = 0;
+    k = np->kids;
+    for (i = lo;  i < hi;  i = j)
+    {
+        for (j = i+1;  j < hi  &&  names[j][depth] == names[i][depth];  j++)
+            ;
+        h = fpattern_index_build(index, names, k++, i, j, depth);
+        if (h > height)
+            height = h;
+    }
+    return (height + 1);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_index_new()
+*	Creates an index of the 'count' names 'names[0...count-1]', which can
+*	then be queried for the names matching a pattern.
+*
+*	The names are kept in a radix trie, in which the chars shared by names
+*	with a common prefix are stored once, along a single path.  A query
+*	moves the NFA of its pattern down the trie, abandoning each branch as
+*	soon as no name below it can match, so that its cost depends on the
+*	names that share a prefix with a match rather than on all of them.
+*
+* Returns
+*	A pointer to the index, which must be released by a call to
+*	fpattern_index_free(), or null on error.
+*
+* Caveats
+*	Duplicate names are indexed once.  The names are copied, and need not
+*	be kept by the caller.
+*
+* See also
+*	fpattern_index_query(), fpattern_index_free().
+*/
+
+fpattern_index_t *fpattern_index_new(const char *const *names, size_t count)
+{
+    fpattern_index_t *	index;
+    struct fpat_inode *	nodes;
+    const char **	sorted;
+    size_t		n, i;
+    size_t		nchars;
+
+    /* Check args */
+    if (names == NULL  &&  count > 0)
+        return (NULL);
+
+    index = (fpattern_index_t *) malloc(sizeof(fpattern_index_t));
+    if (index == NULL)
+        return (NULL);
+
+    index->nkeys = 0;
+    index->nnodes = 1;
+    index->nodes = NULL;
+    index->nchars = 0;
+    index->chars = NULL;
+    index->maxlen = 0;
+    index->height = 1;
+
+    /* Sort the names, dropping duplicates */
+    sorted = (const char **) malloc((count+1)*sizeof(const char *));
+    if (sorted == NULL)
+        goto fail;
+
+    nchars = 0;
+    for (i = 0;  i < count;  i++)
+    {
+        sorted[i] = names[i];
+        nchars += strlen(names[i]);
+    }
+    qsort((void *) sorted, count, sizeof(const char *), fpattern_index_cmp);
+
+    for (n = i = 0;  i < count;  i++)
+    {
+        if (n == 0  ||  strcmp(sorted[i], sorted[n-1]) != 0)
+            sorted[n++] = sorted[i];
+    }
+    index->nkeys = n;
+
+    /* Build the trie, which has at most two nodes per name */
+    index->nodes = (struct fpat_inode *)
+        malloc((2*n+1)*sizeof(struct fpat_inode));
+    index->chars = (char *) malloc(nchars+1);
+    if (index->nodes == NULL  ||  index->chars == NULL)
+        goto fail;
+
+    if (n == 0)
+    {
+        /* Empty index */
+        memset(index->nodes, 0, sizeof(struct fpat_inode));
+    }
+    else
+        index->height = fpattern_index_build(index, sorted, 0, 0, n, 0);
+    free((void *) sorted);
+
+    /* Release the unused room */
+    nodes = (struct fpat_inode *) realloc(index->nodes,
+        index->nnodes*sizeof(struct fpat_inode));
+    if (nodes != NULL)
+        index->nodes = nodes;
+
+    DL(printf("fpattern_index_new: %lu names, %lu nodes, %lu chars\n",
+        (unsigned long) n, (unsigned long) index->nnodes,
+        (unsigned long) index->nchars));
+    return (index);
+
+fail:
+    free((void *) sorted);
+    fpattern_index_free(index);
+    return (NULL);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_index_walk()
+*	Visits node 'node' of the trie of query 'q', which is 'depth' nodes
+*	below the root, and the nodes below it, passing each name that matches
+*	the query pattern to the query function.  The NFA state vector of the
+*	pattern for the chars above the node is the one at 'depth', unless the
+*	state is not being tracked ('live' is false), in which case each name
+*	is matched as a whole.
+*/
+
+static void fpattern_index_walk(struct fpat_iquery *q, size_t node,
+    int depth, size_t len, int live)
+{
+    const struct fpat_inode *	np;
+    const fpattern_t *		prog;
+    const unsigned char *	lab;
+    fpat_word *			st;
+    size_t			i;
+    int				words;
+    int				rc;
+
+    prog = q->prog;
+    words = prog->words;
+    np = &q->index->nodes[node];
+    lab = (const unsigned char *) q->index->chars + np->lab;
+    memcpy(q->path + len, lab, np->len);
+    len += np->len;
+
+    st = q->vecs + (depth+1)*words;
+    if (live  &&  (prog->flags & FPAT_UTF8)  &&  !fpattern_ascii(lab, np->len))
+        live = false;			/* Label may split a UTF-8 char */
+
+    if (live)
+    {
+        /* Move the NFA across the label, unless no name below can match */
+        memcpy(st, st - words, words*sizeof(fpat_word));
+        if (!fpattern_advance(prog, st, q->tmp, lab, np->len))
+            return;
+    }
+
+    if (np->key)
+    {
+        /* Match the name ending here */
+        if (len == 0)
+            rc = (prog->nins == 1);	/* Special case */
+        else if (live)
+            rc = fpattern_final(prog, st);
+        else
+            rc = fpattern_exec_len(prog, q->path, len);
+
+        if (rc)
+        {
+            q->count++;
+            q->path[len] = '\0';
+            if (q->fn != NULL  &&  q->fn(q->path, len, q->arg) != 0)
+            {
+                q->stop = true;
+                return;
+            }
+        }
+    }
+
+    /* Visit the children */
+    for (i = 0;  i < np->nkids  &&  !q->stop;  i++)
+        fpattern_index_walk(q, np->kids + i, depth+1, len, live);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_index_query()
+*	Finds the names in index 'index' that match compiled pattern 'prog'.
+*	Each matching name is passed to 'fn', along with its length and 'arg',
+*	in sorted (strcmp()) order.
+*
+* Returns
+*	The number of matching names, or -1 on error.  If 'fn' returns nonzero,
+*	the query stops, and the number of names found so far is returned.
+*
+* Caveats
+*	The name passed to 'fn' is only valid until it returns.  'fn' may be
+*	null, to count the matching names.
+*
+*	Any number of threads may query the same index at once.
+*
+*	Patterns with negated subpatterns are matched against every name.  A
+*	UTF-8 pattern is matched against the names below a non-ASCII char as
+*	a whole.
+*
+* See also
+*	fpattern_index_new(), fpattern_exec().
+*/
+
+long fpattern_index_query(const fpattern_index_t *index,
+    const fpattern_t *prog, fpattern_glob_f fn, void *arg)
+{
+    struct fpat_iquery	q;
+
+    /* Check args */
+    if (index == NULL  ||  prog == NULL)
+        return (-1);
+
+    q.index = index;
+    q.prog = prog;
+    q.fn = fn;
+    q.arg = arg;
+    q.count = 0;
+    q.stop = false;
+
+    /* Allocate an NFA state vector for each level of the trie */
+    q.vecs = (fpat_word *)
+        malloc((index->height+2)*prog->words*sizeof(fpat_word));
+    q.path = (char *) malloc(index->maxlen+1);
+    if (q.vecs == NULL  ||  q.path == NULL)
+    {
+        free(q.vecs);
+        free(q.path);
+        return (-1);
+    }
+    q.tmp = q.vecs + (index->height+1)*prog->words;
+    memcpy(q.vecs, prog->init, prog->words*sizeof(fpat_word));
+
+    /* Walk the trie from the root */
+    if (index->nkeys > 0)
+        fpattern_index_walk(&q, 0, 0, 0, prog->engine != FPE_NOT);
+
+    free(q.vecs);
+    free(q.path);
+
+    DL(printf("fpattern_index_query: return %ld\n", q.count));
+    return (q.count);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_index_free()
+*	Releases index 'index'.
+*
+* Caveats
+*	If 'index' is null, nothing is done.
+*/
+
+void fpattern_index_free(fpattern_index_t *index)
+{
+    if (index == NULL)
+        return;
+
+    free(index->nodes);
+    free(index->chars);
+    free(index);
+}
+
+
+/*----------------------------------------------------------------------------*/
+/*----------------------------------------------------------------------------*/
+/*----------------------------------------------------------------------------*/
+
+#if TEST
+
+
+/* Local variables */
+
+static int	count =	0;
+static int	fails =	0;
+static int	stop_on_fail = false;
+
+
+/*------------------------------------------------------------------------------
+* test()
+*/
+
+static void test(int expect, const char *fname, const char *pat)
+{
+    int		failed;
+    int		result;
+    int		cresult;
+    int		dresult;
+    int		lresult;
+    fpattern_t *	prog;
+    fpattern_dfa_t *	dfa;
+    char	fbuf[80+1];
+    char	pbuf[80+1];
+    char	lfbuf[80+1];
+    char	lpbuf[80+1];
+
+    count++;
+    printf("%3d. ", count);
+
+    if (fname == NULL)
+    {
+        printf("<null>\n");
+    }
+    else
+    {
+        strcpy(fbuf, fname);
+        printf("\"%s\"\n", fbuf);
+    }
+
+    if (pat == NULL)
+    {
+        printf("     <null>\n");
+    }
+    else
+    {
+        strcpy(pbuf, pat);
+        printf("     \"%s\"\n", pbuf);
+    }
+
+    result = fpattern_match(pat == NULL ? NULL : pbuf,
+                            fname == NULL ? NULL : fbuf);
+
+    prog = fpattern_compile(pat == NULL ? NULL : pbuf, NULL);
+    cresult = fpattern_exec(prog, fname == NULL ? NULL : fbuf);
+    dfa = fpattern_dfa_new(prog, 0);
+    dresult = fpattern_dfa_exec(dfa, fname == NULL ? NULL : fbuf);
+    fpattern_dfa_free(dfa);
+    fpattern_free(prog);
+
+    /* Match unterminated copies, followed by junk */
+    memset(lfbuf, '#', sizeof(lfbuf));
+    memset(lpbuf, '#', sizeof(lpbuf));
+    if (fname != NULL)
+        memcpy(lfbuf, fname, strlen(fname));
+    if (pat != NULL)
+        memcpy(lpbuf, pat, strlen(pat));
+    lresult = fpattern_match_len(pat == NULL ? NULL : lpbuf,
+        pat == NULL ? 0 : strlen(pat), fname == NULL ? NULL : lfbuf,
+        fname == NULL ? 0 : strlen(fname));
+
+    failed = (result != expect  ||  cresult != expect  ||
+        dresult != expect  ||  lresult != expect);
+    printf("    -> %c, compiled %c, dfa %c, len %c, expected %c: %s\n",
+        "FT"[!!result], "FT"[!!cresult], "FT"[!!dresult], "FT"[!!lresult],
+        "FT"[!!expect], failed ? "FAIL ***" : "pass");
+
+    if (failed)
+    {
+        fails++;
+
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
+    }
+
+    printf("\n");
+}
+
+
+/*------------------------------------------------------------------------------
+* test_compile()
+*	Checks the error offset reported for pattern 'pat' (-1 if valid).
+*/
+
+static void test_compile(int expect, const char *pat)
+{
+    int		failed;
+    int		erroff, lerroff;
+    fpattern_t *	prog;
+    fpattern_t *	lprog;
+
+    count++;
+    printf("%3d. compile \"%s\"\n", count, pat);
+
+    prog = fpattern_compile(pat, &erroff);
+    lprog = fpattern_compile_len(pat, strlen(pat), &lerroff);
+    failed = (erroff != expect  ||  (prog == NULL) != (expect >= 0)  ||
+        lerroff != erroff  ||  (lprog == NULL) != (prog == NULL));
+    fpattern_free(prog);
+    fpattern_free(lprog);
+
+    printf("    -> %d, expected %d: %s\n",
+        erroff, expect, failed ? "FAIL ***" : "pass");
+
+    if (failed)
+    {
+        fails++;
+
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
+    }
+
+    printf("\n");
+}
+
+
+/*------------------------------------------------------------------------------
+* test_dfa()
+*	Matches a list of names against pattern 'pat' with a single lazy DFA
+*	limited to 'maxmem' bytes, checking the results against fpattern_exec().
+*/
+
+static void test_dfa(const char *pat, size_t maxmem)
+{
+    static const char *	names[] =
+    {
+        "a", "ab", "abc", "a.c", "abc.txt", "abcabcabd", "foo/a.c",
+        "axx/yyy.c", "ax-yyy.c", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab",
+        "xyzzy", "a.b.c.d.e.f.g", "ab.c", NULL
+    };
+    int			failed;
+    int			i, pass;
+    fpattern_t *	prog;
+    fpattern_dfa_t *	dfa;
+
+    count++;
+    printf("%3d. dfa \"%s\", %lu bytes\n", count, pat, (unsigned long) maxmem);
+
+    prog = fpattern_compile(pat, NULL);
+    dfa = fpattern_dfa_new(prog, maxmem);
+    failed = (dfa == NULL);
+
+    for (pass = 0;  pass < 2;  pass++)
+    {
+        for (i = 0;  names[i] != NULL  &&  !failed;  i++)
+        {
+            if (fpattern_dfa_exec(dfa, names[i]) !=
+                    fpattern_exec(prog, names[i]))
+            {
+                printf("    \"%s\" differs\n", names[i]);
+                failed = true;
+            }
+        }
+    }
+
+    fpattern_dfa_free(dfa);
+    fpattern_free(prog);
+
+    printf("    -> %s\n", failed ? "FAIL ***" : "pass");
+
+    if (failed)
+    {
+        fails++;
+
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
+    }
+
+    printf("\n");
+}
+
+
+/*------------------------------------------------------------------------------
+* test_set()
+*	Matches a list of names against a set of patterns, checking the results
+*	against fpattern_exec() for each pattern.
+*/
+
+static void test_set(size_t maxmem)
+{
+    static const char *	pats[] =
+    {
+        "*.c", "*.C", "*.h", "foo*", "f*", "*a*c", "a?c", "", "!*.c",
+        "core.*", "*.tar.gz", "*.gz", "*", "?", "[a-c]*", "*/*.?", "~.c",
+        "Makefile", "*file", "a`*x",
+    };
+    static const char *	names[] =
+    {
+        "", "a", "abc", "a.c", "foo.c", "foo.h", "core.1234", "x.tar.gz",
+        "makefile", "foo/a.c", "a*x", "abc.txt", "FOO.C", NULL
+    };
+    int			npats;
+    int			failed;
+    int			i, j, n;
+    int			ids[32];
+    unsigned char	bits[4];
+    fpattern_t *	prog;
+    fpattern_set_t *	set;
+
+    count++;
+    printf("%3d. set, %lu bytes\n", count, (unsigned long) maxmem);
+
+    npats = (int) (sizeof(pats)/sizeof(pats[0]));
+    set = fpattern_set_new(pats, npats, maxmem, NULL, NULL);
+    failed = (set == NULL);
+
+    for (i = 0;  names[i] != NULL  &&  !failed;  i++)
+    {
+        n = fpattern_set_match(set, names[i], bits);
+        if (fpattern_set_ids(set, names[i], ids, 32) != n)
+            failed = true;
+
+        for (j = 0;  j < npats;  j++)
+        {
+            prog = fpattern_compile(pats[j], NULL);
+            if (fpattern_exec(prog, names[i]) != !!(bits[j/8] & (1 << j%8)))
+            {
+                printf("    \"%s\" \"%s\" differs\n", pats[j], names[i]);
+                failed = true;
+            }
+            fpattern_free(prog);
+        }
+    }
+
+    fpattern_set_free(set);
+
+    printf("    -> %s\n", failed ? "FAIL ***" : "pass");
+
+    if (failed)
+    {
+        fails++;
+
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
+    }
+
+    printf("\n");
+}
+
+
+/*------------------------------------------------------------------------------
+* test_cache()
+*	Matches a few names against a few patterns through a cache of compiled
+*	patterns of 'maxmem' bytes, checking the results against the uncached
+*	matches and the cache counters against the lookups made.
+*/
+
+static void test_cache(size_t maxmem)
+{
+    static const char *	pats[] =
+    {
+        "*.c", "a?c", "", "!*.c", "[a-c]*", "*.{c,h}", "a[", "a*b*c",
+    };
+    static const char *	names[] =
+    {
+        "", "a", "abc", "a.c", "foo.h", "a[", "aXbYc", NULL
+    };
+    int				npats;
+    int				failed;
+    int				i, j;
+    int				expect[8][8];
+    fpattern_cache_stats_t	st0;
+    fpattern_cache_stats_t	st;
+
+    count++;
+    printf("%3d. cache, %lu bytes\n", count, (unsigned long) maxmem);
+
+    npats = (int) (sizeof(pats)/sizeof(pats[0]));
+    for (j = 0;  j < npats;  j++)
+        for (i = 0;  names[i] != NULL;  i++)
+            expect[j][i] = fpattern_match(pats[j], names[i]);
+
+    failed = false;
+    fpattern_cache_stats(&st0);
+    if (fpattern_cache_size(maxmem))
+    {
+        /* Each pattern misses once, unless it is evicted */
+        for (j = 0;  j < npats;  j++)
+            for (i = 0;  names[i] != NULL;  i++)
+                if (fpattern_match(pats[j], names[i]) != expect[j][i]  ||
+                    (names[i][0] != '\0'  &&
+                    fpattern_matchn(pats[j], names[i]) != expect[j][i]))
+                {
+                    printf("    \"%s\" \"%s\" differs\n", pats[j], names[i]);
+                    failed = true;
+                }
+
+        fpattern_cache_stats(&st);
+        printf("    %lu hits, %lu misses, %lu evictions, %lu bytes\n",
+            st.hits - st0.hits, st.misses - st0.misses,
+            st.evictions - st0.evictions, (unsigned long) st.bytes);
+        if (st.bytes > maxmem)
+            failed = true;
+        if (maxmem >= FPAT_CACHE_MEM  &&
+            (st.misses - st0.misses != (unsigned long) npats  ||
+            st.entries != (size_t) npats))
+            failed = true;
+        if (maxmem < 16384  &&  st.evictions == st0.evictions)
+            failed = true;
+
+        /* Disabling the cache releases it */
+        fpattern_cache_size(0);
+        fpattern_cache_stats(&st);
+        if (st.entries != 0  ||  st.bytes != 0)
+            failed = true;
+    }
+
+    printf("    -> %s\n", failed ? "FAIL ***" : "pass");
+
+    if (failed)
+    {
+        fails++;
+
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
+    }
+
+    printf("\n");
+}
+
+
+/*------------------------------------------------------------------------------
+* test_batch()
+*	Matches a columnar list of names against pattern 'pat' in one batch,
+*	checking the results against fpattern_exec().
+*/
+
+static void test_batch(const char *pat)
+{
+    static const char *	names[] =
+    {
+        "a", "ab", "", "abc", "a.c", "abc.txt", "abcabcabd", "foo/a.c",
+        "axx/yyy.c", "ax-yyy.c", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaab",
+        "xyzzy", "a.b.c.d.e.f.g", "ab.c", NULL
+    };
+    int			failed;
+    int			i;
+    size_t		n, len;
+    size_t		offsets[20];
+    char		data[200];
+    char		fbuf[80+1];
+    unsigned char	bits[4];
+    fpattern_t *	prog;
+
+    count++;
+    printf("%3d. batch \"%s\"\n", count, pat);
+
+    /* Pack the names without terminators */
+    offsets[0] = 0;
+    for (i = 0;  names[i] != NULL;  i++)
+    {
+        len = strlen(names[i]);
+        memcpy(data + offsets[i], names[i], len);
+        offsets[i+1] = offsets[i] + len;
+    }
+
+    prog = fpattern_compile(pat, NULL);
+    n = fpattern_exec_batch(prog, data, offsets, i, bits);
+    failed = false;
+
+    for (i = 0;  names[i] != NULL;  i++)
+    {
+        strcpy(fbuf, names[i]);
+        if (fpattern_exec(prog, fbuf) != !!(bits[i/8] & (1 << i%8)))
+        {
+            printf("    \"%s\" differs\n", names[i]);
+            failed = true;
+        }
+        n -= !!(bits[i/8] & (1 << i%8));
+    }
+    failed |= (n != 0);
+    fpattern_free(prog);
+
+    printf("    -> %s\n", failed ? "FAIL ***" : "pass");
+
+    if (failed)
+    {
+        fails++;
+
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
+    }
+
+    printf("\n");
+}
+
+
+/*------------------------------------------------------------------------------
+* test_steps()
+*	Matches filename 'fname' against pattern 'pat' with a budget of
+*	'budget' steps, checking for result 'expect', and checks that an
+*	unlimited match takes no more steps than fpattern_cost() estimates.
+*/
+
+static void test_steps(int expect, const char *fname, const char *pat,
+    unsigned long budget)
+{
+    int			failed;
+    int			rc;
+    unsigned long	steps;
+    unsigned long	cost;
+
+    count++;
+    printf("%3d. steps \"%s\" \"%s\" %lu\n", count, fname, pat, budget);
+
+    rc = fpattern_match_steps(pat, fname, &budget);
+    failed = (rc != expect);
+
+    steps = ULONG_MAX;
+    cost = fpattern_cost(pat, strlen(fname));
+    if (fpattern_match_steps(pat, fname, &steps) != fpattern_match(pat, fname)
+        ||  ULONG_MAX - steps > cost)
+        failed = true;
+
+    printf("    -> %d, expected %d, took %lu of %lu steps: %s\n", rc, expect,
+        ULONG_MAX - steps, cost, failed ? "FAIL ***" : "pass");
+
+    if (failed)
+    {
+        fails++;
+
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
+    }
+
+    printf("\n");
+}
+
+
+/*------------------------------------------------------------------------------
+* test_flags()
+*	Matches filename 'fname' against pattern 'pat' with matching 'flags',
+*	checking for result 'expect', and checks that the native flags give
+*	the same result as fpattern_match().
+*/
+
+static void test_flags(int expect, const char *fname, const char *pat,
+    int flags)
+{
+    int		failed;
+    int		rc;
+
+    count++;
+    printf("%3d. flags \"%s\" \"%s\" 0x%02X\n", count, fname, pat, flags);
+
+    rc = fpattern_match_flags(pat, fname, flags);
+    failed = (rc != expect  ||
+        fpattern_match_flags(pat, fname, NATIVE) != fpattern_match(pat, fname));
+
+    printf("    -> %d, expected %d: %s\n", rc, expect,
+        failed ? "FAIL ***" : "pass");
+
+    if (failed)
+    {
+        fails++;
+
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
+    }
+
+    printf("\n");
+}
+
+
+/*------------------------------------------------------------------------------
+* test_spans()
+*	Matches filename 'fname' against pattern 'pat', checking that the spans
+*	of its wildcards, joined by '|', are 'expect' (or null if it does not
+*	match).
+*/
+
+static void test_spans(const char *expect, const char *fname, const char *pat)
+{
+    int			failed;
+    int			rc;
+    int			i;
+    char		buf[80+1];
+    fpattern_span_t	spans[8];
+
+    count++;
+    printf("%3d. spans \"%s\" \"%s\"\n", count, fname, pat);
+
+    rc = fpattern_match_spans(pat, fname, spans, 8);
+    buf[0] = '\0';
+    for (i = 0;  rc  &&  i < 8  &&  spans[i].off != FPAT_NOSPAN;  i++)
+    {
+        if (i > 0)
+            strcat(buf, "|");
+        strncat(buf, fname + spans[i].off, spans[i].len);
+    }
+
+    failed = (rc != (expect != NULL)  ||  (rc  &&  strcmp(buf, expect) != 0));
+    printf("    -> %c \"%s\", expected \"%s\": %s\n", "FT"[!!rc], buf,
+        expect != NULL ? expect : "", failed ? "FAIL ***" : "pass");
+
+    if (failed)
+    {
+        fails++;
+
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
+    }
+
+    printf("\n");
+}
+
+
+/*------------------------------------------------------------------------------
+* test_walk()
+*	Pushes the directory names of path 'dir' onto a path matching state for
+*	pattern 'pat', compiled for matching 'flags', checking that the path
+*	can still match ('push') or not, and then matches name 'name' under
+*	it, checking the result against fpattern_exec() of the whole pathname.
+*/
+
+static void test_walk(int push, int expect, const char *dir,
+    const char *name, const char *pat, int flags)
+{
+    int			failed;
+    int			rc, mrc;
+    size_t		len;
+    const char *	seg;
+    char		path[80+1];
+    fpattern_t *	prog;
+    fpattern_walk_t *	walk;
+    fpattern_walk_t *	copy;
 
-                if (*pat == '\0')
-                    break;
-                lo = *pat++;
-                hi = lo;
+    count++;
+    printf("%3d. walk \"%s\" \"%s\" \"%s\" 0x%02X\n", count, dir, name, pat,
+        flags);
 
-                if (*pat == FPAT_SET_THRU)
-                {
-                    /* Range */
-                    pat++;
+    prog = fpattern_compile_flags(pat, strlen(pat), flags, NULL);
+    walk = fpattern_walk_new(prog);
+    failed = (walk == NULL);
 
-                    if (*pat == QUOTE)
-                        pat++;	/* Quoted char */
+    /* Push each directory name */
+    rc = true;
+    for (seg = dir;  walk != NULL  &&  *seg != '\0';  seg += len)
+    {
+        seg += (*seg == '/');
+        len = strcspn(seg, "/");
+        if (fpattern_walk_push(walk, seg, len) == 0)
+            rc = false;
+    }
 
-                    if (*pat == '\0')
-                        break;
-                    hi = *pat++;
-                }
+    /* Match the name, under the path and a copy of it */
+    copy = fpattern_walk_copy(walk);
+    mrc = fpattern_walk_match(walk, name, strlen(name));
+    if (fpattern_walk_match(copy, name, strlen(name)) != mrc)
+        failed = true;
 
-                if (*pat == '\0')
-                    break;
+    sprintf(path, "%s%s%s", dir, dir[0] != '\0' ? "/" : "", name);
+    if (fpattern_exec(prog, path) != mrc)
+        failed = true;
 
-                /* Compare character to set range */
-                if (lowercase(fch) >= lowercase(lo)  &&
-                    lowercase(fch) <= lowercase(hi))
-                    match = yes;
-            }
+    printf("    -> push %d, match %d, expected %d %d: ", rc, mrc, push,
+        expect);
 
-            if (!match)
-            {
-                DL(printf("match=F\n"));
-                return (false);
-            }
+    failed = (failed  ||  rc != push  ||  mrc != expect);
 
-            if (*pat == '\0')
-                return (false);		/* Missing closing bracket */
+    /* Popping every name restores the empty path */
+    while (fpattern_walk_depth(walk) > 0)
+        fpattern_walk_pop(walk);
+    if (walk != NULL  &&  fpattern_walk_match(walk, name, strlen(name)) !=
+        fpattern_exec(prog, name))
+        failed = true;
 
-            fname++;
-            pat++;
-            break;
+    printf("%s\n", failed ? "FAIL ***" : "pass");
 
-        case FPAT_NOT:
-            /* Match only if rest of pattern does not match */
-            if (*pat == '\0')
-                return (false);		/* Missing subpattern */
-            i = fpattern_submatch(pat, fname);
-            DL(printf("submatch=%c\n", "FT"[!!i]));
-            return !i;
+    fpattern_walk_free(copy);
+    fpattern_walk_free(walk);
+    fpattern_free(prog);
 
-#if DELIM
-        case DEL:
-    #if DEL2 != DEL
-        case DEL2:
-    #endif
-            /* Match path delimiter char */
-            if (fch != DEL  &&  fch != DEL2)
-                return (false);
-            fname++;
-            break;
-#endif
+    if (failed)
+    {
+        fails++;
 
-        default:
-            /* Match a (non-null) char exactly */
-            if (lowercase(fch) != lowercase(pch))
-            {
-                DL(printf("fch:'%c' != pch:'%c'\n", fch, pch));
-                return (false);
-            }
-            fname++;
-            break;
-        }
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
     }
 
-    /* Check for complete match */
-    if (*fname != '\0')
-        return (false);
+    printf("\n");
+}
 
-    /* Successful match */
-    DL(printf("fpattern_submatch: pass\n"));
-    return (true);
+
+/*------------------------------------------------------------------------------
+* test_index_found()
+*	Appends each name found by fpattern_index_query() to the buffer 'arg',
+*	followed by a space.
+*/
+
+static int test_index_found(const char *name, size_t len, void *arg)
+{
+    strncat((char *) arg, name, len);
+    strcat((char *) arg, " ");
+    return (0);
 }
 
 
 /*------------------------------------------------------------------------------
-* fpattern_match()
-*	Attempts to match pattern 'pat' to filename 'fname'.
-*
-* Returns
-*	True (1) if the filename matches, otherwise false (0).
-*
-* Caveats
-*	If 'fname' is null, false (0) is returned.
-*
-*	If 'pat' is null, false (0) is returned.
-*
-*	If 'pat' is empty (""), the only filename it matches is the empty string
-*	("").
-*
-*	If 'fname' is empty, the only pattern that will match it is the empty
-*	string ("").
-*
-*	If 'pat' is not a well-formed pattern, false (0) is returned.
-*
-*	Upper and lower case letters are treated the same; alphabetic characters
-*	are converted to lower case before matching occurs.  Conversion to lower
-*	case is dependent upon the current locale setting.
+* test_index()
+*	Queries an index of a few names for the names matching pattern 'pat',
+*	checking that they are 'expect', each followed by a space.
 */
 
-int fpattern_match(const char *pat, const char *fname)
+static void test_index(const char *expect, const char *pat)
 {
-    int		rc;
+    static const char *	names[] =
+    {
+        "src/a.c", "src/a.h", "src/lib/b.c", "doc/a.txt", "src/a.c", "",
+        "README", "src", "src/lib/", "Makefile",
+    };
+    int			failed;
+    long		n;
+    char		buf[200+1];
+    fpattern_t *	prog;
+    fpattern_index_t *	index;
 
-    DL(printf("fpattern_match: fname=%04p:\"%s\", pat=%04p:\"%s\"\n",
-        fname, fname ? fname : "", pat, pat ? pat : ""));
+    count++;
+    printf("%3d. index \"%s\"\n", count, pat);
 
-    /* Check args */
-    if (fname == NULL)
-        return (false);
+    index = fpattern_index_new(names, sizeof(names)/sizeof(names[0]));
+    prog = fpattern_compile(pat, NULL);
+    buf[0] = '\0';
+    n = fpattern_index_query(index, prog, test_index_found, buf);
 
-    if (pat == NULL)
-        return (false);
+    failed = (n < 0  ||  strcmp(buf, expect) != 0);
+    printf("    -> %ld \"%s\", expected \"%s\": %s\n", n, buf, expect,
+        failed ? "FAIL ***" : "pass");
 
-    /* Verify that the pattern is valid, and get its length */
-    if (!fpattern_isvalid(pat))
-        return (false);
+    fpattern_free(prog);
+    fpattern_index_free(index);
 
-    /* Attempt to match pattern against filename */
-    if (fname[0] == '\0')
-        return (pat[0] == '\0');	/* Special case */
-    rc = fpattern_submatch(pat, fname);
+    if (failed)
+    {
+        fails++;
 
-    DL(printf("fpattern_match: return %c\n", "FT"[!!rc]));
-    return (rc);
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
+    }
+
+    printf("\n");
 }
 
 
 /*------------------------------------------------------------------------------
-* fpattern_matchn()
-*	Attempts to match pattern 'pat' to filename 'fname'.
-*	This operates like fpattern_match() except that it does not verify that
-*	pattern 'pat' is well-formed, assuming that it has been checked by a
-*	prior call to fpattern_isvalid().
-*
-* Returns
-*	True (1) if the filename matches, otherwise false (0).
-*
-* Caveats
-*	If 'fname' is null, false (0) is returned.
-*
-*	If 'pat' is null, false (0) is returned.
-*
-*	If 'pat' is empty (""), the only filename it matches is the empty ("")
-*	string.
-*
-*	If 'pat' is not a well-formed pattern, unpredictable results may occur.
-*
-*	Upper and lower case letters are treated the same; alphabetic characters
-*	are converted to lower case before matching occurs.  Conversion to lower
-*	case is dependent upon the current locale setting.
-*
-* See also
-*	fpattern_match().
+* test_required()
+*	Finds the runs of literal chars required by pattern 'pat', compiled with
+*	option 'flags', checking that they are 'expect', each followed by a
+*	space, and that the length of the literal prefix is 'prelen'.
 */
 
-int fpattern_matchn(const char *pat, const char *fname)
+static void test_required(const char *expect, size_t prelen, const char *pat,
+    int flags)
 {
-    int		rc;
-
-    DL(printf("fpattern_matchn: fname=%04p:\"%s\", pat=%04p:\"%s\"\n",
-        fname, fname ? fname : "", pat, pat ? pat : ""));
-
-    /* Check args */
-    if (fname == NULL)
-        return (false);
-
-    if (pat == NULL)
-        return (false);
+    int			failed;
+    int			i, n;
+    size_t		pre;
+    char		runs[80+1];
+    char		buf[80+1];
+    const char *	r;
+    fpattern_t *	prog;
 
-    /* Assume that pattern is well-formed */
-
-    /* Attempt to match pattern against filename */
-    rc = fpattern_submatch(pat, fname);
+    count++;
+    printf("%3d. required \"%s\", 0x%04X\n", count, pat, flags);
 
-    DL(printf("fpattern_matchn: return %c\n", "FT"[!!rc]));
-    return (rc);
-}
+    prog = fpattern_compile_flags(pat, strlen(pat), flags, NULL);
+    n = fpattern_required(prog, runs, sizeof(runs), &pre);
 
+    buf[0] = '\0';
+    for (i = 0, r = runs;  i < n;  i++, r += strlen(r)+1)
+    {
+        strcat(buf, r);
+        strcat(buf, " ");
+    }
 
-/*----------------------------------------------------------------------------*/
-/*----------------------------------------------------------------------------*/
-/*----------------------------------------------------------------------------*/
+    failed = (n < 0  ||  strcmp(buf, expect) != 0  ||  pre != prelen);
+    printf("    -> %d \"%s\" %lu, expected \"%s\" %lu: %s\n", n, buf,
+        (unsigned long) pre, expect, (unsigned long) prelen,
+        failed ? "FAIL ***" : "pass");
 
-#if TEST
+    fpattern_free(prog);
 
+    if (failed)
+    {
+        fails++;
 
-/* Local variables */
+        if (stop_on_fail)
+            exit(1);
+        sleep(1);
+    }
 
-static int	count =	0;
-static int	fails =	0;
-static int	stop_on_fail = false;
+    printf("\n");
+}
 
 
 /*------------------------------------------------------------------------------
-* test()
+* test_stats()
+*	Matches a few names, checking the changes in the matching counters if
+*	they are kept, or that they are all zero if not.
 */
 
-static void test(int expect, const char *fname, const char *pat)
+static void test_stats(void)
 {
-    int		failed;
-    int		result;
-    char	fbuf[80+1];
-    char	pbuf[80+1];
+    fpattern_stats_t	a, b;
+    fpattern_t *	prog;
+    fpattern_dfa_t *	dfa;
+    unsigned long	budget;
+    unsigned long	n;
+    int			kept;
+    int			failed;
+    int			i;
 
     count++;
-    printf("%3d. ", count);
+    printf("%3d. stats\n", count);
 
-    if (fname == NULL)
-    {
-        printf("<null>\n");
-    }
-    else
-    {
-        strcpy(fbuf, fname);
-        printf("\"%s\"\n", fbuf);
-    }
+    kept = fpattern_stats_get(&a);
+    prog = fpattern_compile_flags("*.c", 3, 0, NULL);
+    dfa = fpattern_dfa_new(prog, 0);
 
-    if (pat == NULL)
+    fpattern_exec(prog, "a.c");
+    fpattern_exec(prog, "a.h");			/* Rejected by prefilter */
+    fpattern_dfa_exec(dfa, "b.c");		/* Builds 3 transitions */
+    fpattern_dfa_exec(dfa, "b.c");		/* Finds them */
+    budget = 100;
+    fpattern_match_steps("*x", "abc", &budget);
+
+    fpattern_stats_get(&b);
+    fpattern_dfa_free(dfa);
+    fpattern_free(prog);
+
+    for (i = 0, n = 0;  i < FPAT_STATS_COST;  i++)
+        n += b.cost[i] - a.cost[i];
+
+    if (kept)
     {
-        printf("     <null>\n");
+        failed = (b.names - a.names != 5  ||  b.matches - a.matches != 3  ||
+            b.rejects - a.rejects != 1  ||  b.steps - a.steps != 100-budget  ||
+            b.dfa_misses - a.dfa_misses != 3  ||
+            b.dfa_hits - a.dfa_hits != 3  ||  n != 5);
     }
     else
-    {
-        strcpy(pbuf, pat);
-        printf("     \"%s\"\n", pbuf);
-    }
-
-    result = fpattern_match(pat == NULL ? NULL : pbuf,
-                            fname == NULL ? NULL : fbuf);
+        failed = (b.names != 0  ||  b.steps != 0  ||  n != 0);
 
-    failed = (result != expect);
-    printf("    -> %c, expected %c: %s\n",
-        "FT"[!!result], "FT"[!!expect], failed ? "FAIL ***" : "pass");
+    printf("    -> %s: names %lu, matches %lu, rejects %lu, steps %lu, "
+        "dfa %lu/%lu: %s\n", kept ? "kept" : "not kept", b.names - a.names,
+        b.matches - a.matches, b.rejects - a.rejects, b.steps - a.steps,
+        b.dfa_hits - a.dfa_hits, b.dfa_misses - a.dfa_misses,
+        failed ? "FAIL ***" : "pass");
 
     if (failed)
     {
@@ -624,13 +8110,10 @@ int main(int argc, char **argv)
     (void) argc;	/* Shut up lint */
     (void) argv;	/* Shut up lint */
 
-#if DEBUG
-    dbg_f = stdout;
-#endif
-
     printf("==========================================\n");
 
     setlocale(LC_CTYPE, "");
+    fpattern_locale();
 
 #if UNIX
     printf("[O/S is UNIX]\n");
@@ -694,6 +8177,25 @@ int main(int argc, char **argv)
     test(1,	"foo/abc",	"~/~");
     test(0,	"foo/a.c",	"/~/~");
     test(0,	"foo/a.c",	"~/~/");
+
+    test(1,	"src/lib/fpattern/fpattern.c",	"*/*/*/*.c");
+    test(0,	"src/lib/fpattern/fpattern.c",	"*/*/*.c");
+    test(0,	"src/lib/fpattern.c",		"*/*/*/*.c");
+
+    test(1,	"src/lib/fpattern/fpattern.c",	"**.c");
+    test(1,	"src/lib/fpattern/fpattern.c",	"src/**/*.c");
+    test(1,	"src/fpattern.c",		"src/**/*.c");
+    test(0,	"src/fpattern.h",		"src/**/*.c");
+    test(0,	"srcfpattern.c",		"src/**/*.c");
+    test(1,	"a/b",		"a/**/b");
+    test(1,	"a\\x/y\\b",	"a/**\\b");
+    test(0,	"a/xb",		"a/**/b");
+    test(0,	"ab",		"a**/b");
+    test(1,	"a/b",		"a**/b");
+    test(1,	"ax/y/b",	"a**/b");
+    test(1,	"a/xb",		"a/**b");
+    test(1,	"a/x/b",	"a/***/b");
+    test(0,	"a/b",		"a/***/b");
 #endif
 
     test(0,	"",		"*");
@@ -770,6 +8272,9 @@ int main(int argc, char **argv)
     test(0,	"azc",		"a[!bcz]c");
     test(0,	"ab",		"a[!b]c");
     test(0,	"ac",		"a[!b]c");
+    test(0,	"a",		"a[!b]");
+    test(1,	"a",		"a!!");
+    test(1,	"x",		"![ab");
     test(1,	"axc",		"a[!b]c");
     test(1,	"axc",		"a[!bcz]c");
 
@@ -809,6 +8314,187 @@ int main(int argc, char **argv)
     test(1,	"a9z",		"a[`!0`-9]z");
     test(1,	"a-z",		"a[`!0`-9]z");
 
+    test(1,	"abcabcabd",	"*a*b*d");
+    test(0,	"aaaaaaaaaaaaaaaaaaaa",	"*a*a*a*a*a*b");
+    test(1,	"aaaaaaaaaaaaaaaaaaaa",	"!*a*a*a*a*a*b");
+    test(0,	"abac",		"!*a*a*");
+    test(1,	"ab.c",		"*.!a");
+    test(1,	"abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz01234567",
+		"[a-c]*????????????????????????????????????????????????????????????????*");
+    test(0,	"abcdefghijklmnopqrstuvwxyz0123456789abcdefghijklmnopqrstuvwxyz01",
+		"[a-c]*????????????????????????????????????????????????????????????????*");
+
+    test(1,	"README.TXT",	"read*.txt");
+    test(0,	"readme.tx",	"read*.txt");
+    test(1,	"xaBCDy.c",	"x*bcd*.c");
+    test(0,	"xabcy.c",	"x*bcd*.c");
+    test(0,	"abc.c",	"abc*bc.c");
+    test(1,	"abcbc.c",	"abc*bc.c");
+    test(0,	"abcd",		"a??");
+    test(1,	"abc",		"a??");
+    test(1,	"a_long_filename_for_the_char_scanning_kernels.tar.gz",
+		"*.tar.gz");
+    test(0,	"a_long_filename_for_the_char_scanning_kernels.tar.gz",
+		"*_kernels_*.gz");
+    test(1,	"a_long_filename_for_the_char_scanning_kernels.tar.gz",
+		"*_scanning_*.gz");
+
+    test(1,	"photo.jpeg",	"*.{jpg,jpeg,png}");
+    test(1,	"photo.png",	"*.{jpg,jpeg,png}");
+    test(0,	"photo.gif",	"*.{jpg,jpeg,png}");
+    test(0,	"photo.jp",	"*.{jpg,jpeg,png}");
+    test(1,	"ac",		"a{,b}c");
+    test(1,	"abc",		"a{,b}c");
+    test(0,	"abbc",		"a{,b}c");
+    test(1,	"bdx",		"{a,b{c,d}}x");
+    test(0,	"bx",		"{a,b{c,d}}x");
+    test(1,	"x7.c",		"x{[0-9],y*}.c");
+    test(1,	"xyz.c",	"x{[0-9],y*}.c");
+    test(0,	"xz.c",		"x{[0-9],y*}.c");
+    test(1,	"ba",		"{a,ba}");
+    test(1,	"a,b}",		"a,b}");
+    test(1,	"a{b}",		"a`{b`}");
+    test(0,	"a",		"{}");
+    test(1,	"ax",		"a!{b,c}");
+    test(0,	"ac",		"a!{b,c}");
+
+    test_compile(-1,	"a[b-z]*.?");
+    test_compile(-1,	"");
+    test_compile(3,	"a[b");
+    test_compile(4,	"[a-`");
+    test_compile(1,	"`");
+    test_compile(2,	"a!");
+    test_compile(-1,	"a!!");
+    test_compile(-1,	"![ab");
+    test_compile(3,	"!{a");
+    test_compile(6,	"a!\\\\{b");
+    test_compile(-1,	"!\\");
+    test_compile(2,	"{a");
+    test_compile(1,	"{!a}");
+    test_compile(-1,	"{a,[}]}");
+
+    test_dfa("*a*c", 0);
+    test_dfa("*a*c", 1000);
+    test_dfa("*a*a*a*a*a*a*b", 1);
+    test_dfa("*a*a*a*a*a*a*b", 1200);
+    test_dfa("[a-c]*?.?", 1200);
+    test_dfa("~.?", 0);
+    test_dfa("*.{jpg,jpeg,png}", 0);
+
+    test_set(0);
+    test_set(1);
+
+    test_cache(FPAT_CACHE_MEM);
+    test_cache(12000);
+
+    test_batch("*a*c");
+    test_batch("a*");
+    test_batch("~.?");
+    test_batch("!*.c");
+    test_batch("");
+    test_batch("*.{c,h}");
+
+    test_steps(1,	"abc.c",	"*.c",		100);
+    test_steps(FPAT_EXHAUSTED, "abc.c", "*.c",	3);
+    test_steps(0,	"abc.h",	"[a-c]*.c",	100);
+    test_steps(1,	"aaaaaaaaaaaaaaaaaaaaaaaaaaaaab", "*a*a*a*a*a*b",	100000);
+    test_steps(FPAT_EXHAUSTED, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaa",
+        "*a*a*a*a*a*a*a*a*b",	100000);
+    test_steps(0,	"aaaaaaaaaaaa",	"!*a*a*a",	100000);
+    test_steps(1,	"a.b.c",	"~.~.~",	1000);
+    test_steps(1,	"ax",		"a![b",		1000);
+#if UNIX
+    test_steps(1,	"ax",		"a~!\\",		1000);
+#else
+    test_steps(1,	"ax",		"a~!`",		1000);
+#endif
+
+    test_spans("IMG|0042|e",	"IMG_0042.jpeg",	"*_*.jp?g");
+    test_spans("a_b|c",		"a_b_c",		"*_*");
+    test_spans("|",		"ab",			"*ab*");
+    test_spans("b|x|d",		"abxd.c",		"a[b-c]*[!a].c");
+    test_spans("foo|bar",		"foo.bar.c",		"~.~.c");
+    test_spans(NULL,		"foo.c",		"*.h");
+    test_spans("foo",		"foo.c",		"*.!h");
+    test_spans("a|7",		"a.7",			"*.{x,[0-9]}");
+    test_spans("",		"ab.c",			"{?x,*}.c");
+#if DELIM
+    test_spans("x/y|b",		"a/x/y/b.c",		"a/**/*.c");
+    test_spans("|b",		"a/b.c",		"a/**/*.c");
+#endif
+
+    test_flags(1,	"README.TXT",	"*.txt",	FPAT_NOCASE);
+    test_flags(0,	"README.TXT",	"*.txt",	0);
+    test_flags(1,	"a*",		"a`*",		FPAT_BQUOTE);
+    test_flags(1,	"a*",		"a\\*",		0);
+    test_flags(0,	"a/b",		"*",		FPAT_DELIM);
+    test_flags(1,	"a/b",		"*",		0);
+    test_flags(1,	"a\\b",		"*",		FPAT_DELIM);
+    test_flags(0,	"a\\b",		"*",		FPAT_DELIM|FPAT_WINSEP);
+    test_flags(1,	"A\\b",		"a/?",
+        FPAT_NOCASE|FPAT_WINSEP|FPAT_DELIM);
+    test_flags(1,	"a/b",		"[a-z]\\b",
+        FPAT_WINSEP|FPAT_BQUOTE|FPAT_DELIM);
+
+    test_flags(1,	"\xC3\xA9t\xC3\xA9",	"?t?",		FPAT_UTF8);
+    test_flags(0,	"\xC3\xA9t\xC3\xA9",	"?t?",		0);
+    test_flags(1,	"\xE6\x97\xA5\xE6\x9C\xAC", "??",	FPAT_UTF8);
+    test_flags(1,	"\xC3\xA9x",	"[\xC3\xA0-\xC3\xBF]x",	FPAT_UTF8);
+    test_flags(0,	"\xC3\xA9x",	"[!\xC3\xA9]x",	FPAT_UTF8);
+    test_flags(1,	"\xC3\xA8x",	"[!\xC3\xA9]x",	FPAT_UTF8);
+    test_flags(1,	"\xC3\x89T\xC3\x89.TXT", "\xC3\xA9t\xC3\xA9.*",
+        FPAT_UTF8|FPAT_NOCASE);
+    test_flags(0,	"\xC3\x89T\xC3\x89.TXT", "\xC3\xA9t\xC3\xA9.*",
+        FPAT_UTF8);
+    test_flags(1,	"\xCF\x82x",	"\xCE\xA3*",	FPAT_UTF8|FPAT_NOCASE);
+    test_flags(1,	"k",		"\xE2\x84\xAA",	FPAT_UTF8|FPAT_NOCASE);
+    test_flags(1,	"README.TXT",	"*.txt",	FPAT_UTF8|FPAT_NOCASE);
+    test_flags(1,	"a\xE9",	"a?",		FPAT_UTF8);
+    test_flags(0,	"a\xE9",	"a\xC3\xA9",	FPAT_UTF8);
+    test_flags(1,	"a/\xC3\xA9",	"*/?",		FPAT_UTF8|FPAT_DELIM);
+
+    test_flags(1,	"a/x/y/b",	"a/**/b",	FPAT_DELIM);
+    test_flags(1,	"a/b",		"a/**/b",	FPAT_DELIM);
+    test_flags(0,	"a/xb",		"a/**/b",	FPAT_DELIM);
+    test_flags(0,	"ab",		"a**/b",		FPAT_DELIM);
+    test_flags(1,	"SRC/A.H",	"src/*.{c,h}",	FPAT_NOCASE);
+    test_flags(1,	"a\\x/b.c",	"**\\*.c",
+        FPAT_DELIM|FPAT_WINSEP|FPAT_BQUOTE);
+    test_flags(0,	"a\\x/b.c",	"**\\*.c",	FPAT_DELIM|FPAT_WINSEP);
+
+    test_walk(1, 1,	"src/lib",	"a.c",	"src/**/*.c",	FPAT_DELIM);
+    test_walk(1, 0,	"src/lib",	"a.h",	"src/**/*.c",	FPAT_DELIM);
+    test_walk(0, 0,	"doc/lib",	"a.c",	"src/**/*.c",	FPAT_DELIM);
+    test_walk(0, 0,	"a/b",		"c",	"a/*",		FPAT_DELIM);
+    test_walk(1, 1,	"a/b",		"c",	"a/*",		0);
+    test_walk(1, 1,	"A/X",		"y.C",	"a/{x,y}/*.c",
+        FPAT_DELIM|FPAT_NOCASE);
+    test_walk(1, 1,	"\xC3\xA9",	"\xC3\xA9",	"?/?",
+        FPAT_DELIM|FPAT_UTF8);
+    test_walk(1, 1,	"a",		"b.c",	"a/!*.h",	FPAT_DELIM);
+    test_walk(1, 0,	"a",		"b.h",	"a/!*.h",	FPAT_DELIM);
+    test_walk(1, 1,	"",		"",	"",		0);
+
+    test_index("README ",		"R*");
+    test_index(" ",			"");
+    test_index("",			"*.o");
+    test_index("src/lib/ ",		"src/*/");
+#if DELIM
+    test_index("src/a.c src/a.h ",	"src/*.?");
+    test_index("src/a.c src/lib/b.c ",	"src/**/*.c");
+#else
+    test_index("src/a.c src/lib/b.c ",	"src*.c");
+#endif
+
+    test_required("report 2024 .pdf ", 0,	"*report*2024*.pdf",	0);
+    test_required("src/lib/ .c ", 8,	"src/lib/*.c",		FPAT_DELIM);
+    test_required("readme ", 0,		"README",		FPAT_NOCASE);
+    test_required("ab ", 2,		"ab{c,d}",		0);
+    test_required(". ", 0,		"*.[ch]",		0);
+    test_required("a ", 1,		"a!*.c",		0);
+
+    test_stats();
+
 done:
     printf("%d tests, %d failures\n", count, fails);
     return (fails == 0 ? 0 : 1);
@@ -17,6 +17,12 @@
 *			Matches zero or more occurences of any characters other
 *			than '/' or '\'.  Leading '*' characters are allowed.
 *
+*	    **		Deep closure.
+*			Where '/' and '\' are delimiters (DELIM), this matches
+*			zero or more occurences of any characters, including
+*			delimiters.  Between two delimiters, it also matches no
+*			directory at all.  Otherwise it is the same as '*'.
+*
 *	    SUB		Substitute (control-Z).
 *			Similar to '*', this matches zero or more occurences of
 *			any characters other than '/', '\', or '.'.  Leading
@@ -39,6 +45,12 @@
 *			If range 'R' includes the dash '-' character, the dash
 *			must immediately follow the caret '!'.
 *
+*	    {a,bc}	Alternatives.
+*			Matches any one of the comma-separated subpatterns 'a'
+*			or 'bc'.  The alternatives may contain sets, closures,
+*			and further alternatives, but not a '!'.  Outside of
+*			braces, ',' and '}' are regular characters.
+*
 *	    !		Not.
 *			Makes the following pattern (up to the next '/') match
 *			any filename except those what it would normally match.
@@ -65,7 +77,8 @@
 *
 *	Upper and lower case alphabetic characters are considered identical,
 *	i.e., 'a' and 'A' match each other.  (What constitutes a lowercase
-*	letter depends on the current locale settings.)
+*	letter depends on the current locale settings, as captured by
+*	fpattern_locale().)
 *
 *	Spaces and control characters are treated as normal characters.
 *
@@ -98,6 +111,8 @@
 *	    oh`!	oh! (only)			(anything else)
 *	    is`?it	is?it (only)			(anything else)
 *	    !a?c	a, ac, ab, abb, acb, a.foo      abc, a.c, azc
+*	    *.{c,h}	a.c, b.h, .c			a.cc, a.o
+*	    a{,b}c	ac, abc (only)			(anything else)
 *
 * History
 *	1.0, 1997-01-03, David Tribble.
@@ -144,6 +159,11 @@ static const char	drt_fpattern_h_id[] =
 #endif
 
 
+/* System includes */
+
+#include <stddef.h>
+
+
 /* Manifest constants */
 
 #define FPAT_QUOTE	'\\'		/* Quotes a special char	*/
@@ -159,6 +179,24 @@ static const char	drt_fpattern_h_id[] =
 #define FPAT_SET_R	']'		/* Set/range close bracket	*/
 #define FPAT_SET_NOT	'!'		/* Set exclusion		*/
 #define FPAT_SET_THRU	'-'		/* Set range of chars		*/
+#define FPAT_ALT_L	'{'		/* Alternatives open brace	*/
+#define FPAT_ALT_SEP	','		/* Alternatives separator	*/
+#define FPAT_ALT_R	'}'		/* Alternatives close brace	*/
+
+#define FPAT_DFA_MEM	(256*1024L)	/* Default DFA cache size	*/
+#define FPAT_CACHE_MEM	(1024*1024L)	/* Suggested pattern cache size	*/
+#define FPAT_STATS_COST	24		/* Cost histogram buckets	*/
+
+#define FPAT_GLOB_ERR	0x0001		/* Stop on unreadable dirs	*/
+
+#define FPAT_NOCASE	0x0001		/* Letters match either case	*/
+#define FPAT_WINSEP	0x0002		/* '\\' is a path delimiter too	*/
+#define FPAT_BQUOTE	0x0004		/* '`' quotes instead of '\\'	*/
+#define FPAT_DELIM	0x0008		/* Wildcards skip delimiters	*/
+#define FPAT_UTF8	0x0010		/* Match UTF-8 code points	*/
+
+#define FPAT_EXHAUSTED	(-1)		/* Step budget ran out		*/
+#define FPAT_NOSPAN	((size_t) -1)	/* Wildcard matched nothing	*/
 
 
 /* Model-dependent extern aliases */
@@ -169,26 +207,290 @@ static const char	drt_fpattern_h_id[] =
  #define fpattern_isvalid	Sfpattern_isvalid
  #define fpattern_match		Sfpattern_match
  #define fpattern_matchn	Sfpattern_matchn
+ #define fpattern_match_len	Sfpattern_match_len
+ #define fpattern_match_steps	Sfpattern_match_steps
+ #define fpattern_cost		Sfpattern_cost
+ #define fpattern_match_spans	Sfpattern_match_spans
+ #define fpattern_locale	Sfpattern_locale
+ #define fpattern_compile	Sfpattern_compile
+ #define fpattern_compile_len	Sfpattern_compile_len
+ #define fpattern_compile_flags	Sfpattern_compile_flags
+ #define fpattern_match_flags	Sfpattern_match_flags
+ #define fpattern_required	Sfpattern_required
+ #define fpattern_exec		Sfpattern_exec
+ #define fpattern_exec_len	Sfpattern_exec_len
+ #define fpattern_exec_batch	Sfpattern_exec_batch
+ #define fpattern_free		Sfpattern_free
+ #define fpattern_dfa_new	Sfpattern_dfa_new
+ #define fpattern_dfa_exec	Sfpattern_dfa_exec
+ #define fpattern_dfa_exec_len	Sfpattern_dfa_exec_len
+ #define fpattern_dfa_free	Sfpattern_dfa_free
+ #define fpattern_set_new	Sfpattern_set_new
+ #define fpattern_set_match	Sfpattern_set_match
+ #define fpattern_set_match_len	Sfpattern_set_match_len
+ #define fpattern_set_ids	Sfpattern_set_ids
+ #define fpattern_set_ids_len	Sfpattern_set_ids_len
+ #define fpattern_set_free	Sfpattern_set_free
+ #define fpattern_walk_new	Sfpattern_walk_new
+ #define fpattern_walk_push	Sfpattern_walk_push
+ #define fpattern_walk_pop	Sfpattern_walk_pop
+ #define fpattern_walk_depth	Sfpattern_walk_depth
+ #define fpattern_walk_match	Sfpattern_walk_match
+ #define fpattern_walk_copy	Sfpattern_walk_copy
+ #define fpattern_walk_free	Sfpattern_walk_free
+ #define fpattern_index_new	Sfpattern_index_new
+ #define fpattern_index_query	Sfpattern_index_query
+ #define fpattern_index_free	Sfpattern_index_free
+ #define fpattern_cache_size	Sfpattern_cache_size
+ #define fpattern_cache_stats	Sfpattern_cache_stats
+ #define fpattern_stats_get	Sfpattern_stats_get
+ #define fpattern_glob		Sfpattern_glob
+ #define fpattern_glob_mt	Sfpattern_glob_mt
+ #define fpattern_db_add	Sfpattern_db_add
+ #define fpattern_db_merge	Sfpattern_db_merge
+ #define fpattern_db_open	Sfpattern_db_open
+ #define fpattern_db_query	Sfpattern_db_query
+ #define fpattern_db_close	Sfpattern_db_close
 #elif defined(__LARGE__)
  #define fpattern_isvalid	Lfpattern_isvalid
  #define fpattern_match		Lfpattern_match
  #define fpattern_matchn	Lfpattern_matchn
+ #define fpattern_match_len	Lfpattern_match_len
+ #define fpattern_match_steps	Lfpattern_match_steps
+ #define fpattern_cost		Lfpattern_cost
+ #define fpattern_match_spans	Lfpattern_match_spans
+ #define fpattern_locale	Lfpattern_locale
+ #define fpattern_compile	Lfpattern_compile
+ #define fpattern_compile_len	Lfpattern_compile_len
+ #define fpattern_compile_flags	Lfpattern_compile_flags
+ #define fpattern_match_flags	Lfpattern_match_flags
+ #define fpattern_required	Lfpattern_required
+ #define fpattern_exec		Lfpattern_exec
+ #define fpattern_exec_len	Lfpattern_exec_len
+ #define fpattern_exec_batch	Lfpattern_exec_batch
+ #define fpattern_free		Lfpattern_free
+ #define fpattern_dfa_new	Lfpattern_dfa_new
+ #define fpattern_dfa_exec	Lfpattern_dfa_exec
+ #define fpattern_dfa_exec_len	Lfpattern_dfa_exec_len
+ #define fpattern_dfa_free	Lfpattern_dfa_free
+ #define fpattern_set_new	Lfpattern_set_new
+ #define fpattern_set_match	Lfpattern_set_match
+ #define fpattern_set_match_len	Lfpattern_set_match_len
+ #define fpattern_set_ids	Lfpattern_set_ids
+ #define fpattern_set_ids_len	Lfpattern_set_ids_len
+ #define fpattern_set_free	Lfpattern_set_free
+ #define fpattern_walk_new	Lfpattern_walk_new
+ #define fpattern_walk_push	Lfpattern_walk_push
+ #define fpattern_walk_pop	Lfpattern_walk_pop
+ #define fpattern_walk_depth	Lfpattern_walk_depth
+ #define fpattern_walk_match	Lfpattern_walk_match
+ #define fpattern_walk_copy	Lfpattern_walk_copy
+ #define fpattern_walk_free	Lfpattern_walk_free
+ #define fpattern_index_new	Lfpattern_index_new
+ #define fpattern_index_query	Lfpattern_index_query
+ #define fpattern_index_free	Lfpattern_index_free
+ #define fpattern_cache_size	Lfpattern_cache_size
+ #define fpattern_cache_stats	Lfpattern_cache_stats
+ #define fpattern_stats_get	Lfpattern_stats_get
+ #define fpattern_glob		Lfpattern_glob
+ #define fpattern_glob_mt	Lfpattern_glob_mt
+ #define fpattern_db_add	Lfpattern_db_add
+ #define fpattern_db_merge	Lfpattern_db_merge
+ #define fpattern_db_open	Lfpattern_db_open
+ #define fpattern_db_query	Lfpattern_db_query
+ #define fpattern_db_close	Lfpattern_db_close
 #elif defined(__COMPACT__)
  #define fpattern_isvalid	Cfpattern_isvalid
  #define fpattern_match		Cfpattern_match
  #define fpattern_matchn	Cfpattern_matchn
+ #define fpattern_match_len	Cfpattern_match_len
+ #define fpattern_match_steps	Cfpattern_match_steps
+ #define fpattern_cost		Cfpattern_cost
+ #define fpattern_match_spans	Cfpattern_match_spans
+ #define fpattern_locale	Cfpattern_locale
+ #define fpattern_compile	Cfpattern_compile
+ #define fpattern_compile_len	Cfpattern_compile_len
+ #define fpattern_compile_flags	Cfpattern_compile_flags
+ #define fpattern_match_flags	Cfpattern_match_flags
+ #define fpattern_required	Cfpattern_required
+ #define fpattern_exec		Cfpattern_exec
+ #define fpattern_exec_len	Cfpattern_exec_len
+ #define fpattern_exec_batch	Cfpattern_exec_batch
+ #define fpattern_free		Cfpattern_free
+ #define fpattern_dfa_new	Cfpattern_dfa_new
+ #define fpattern_dfa_exec	Cfpattern_dfa_exec
+ #define fpattern_dfa_exec_len	Cfpattern_dfa_exec_len
+ #define fpattern_dfa_free	Cfpattern_dfa_free
+ #define fpattern_set_new	Cfpattern_set_new
+ #define fpattern_set_match	Cfpattern_set_match
+ #define fpattern_set_match_len	Cfpattern_set_match_len
+ #define fpattern_set_ids	Cfpattern_set_ids
+ #define fpattern_set_ids_len	Cfpattern_set_ids_len
+ #define fpattern_set_free	Cfpattern_set_free
+ #define fpattern_walk_new	Cfpattern_walk_new
+ #define fpattern_walk_push	Cfpattern_walk_push
+ #define fpattern_walk_pop	Cfpattern_walk_pop
+ #define fpattern_walk_depth	Cfpattern_walk_depth
+ #define fpattern_walk_match	Cfpattern_walk_match
+ #define fpattern_walk_copy	Cfpattern_walk_copy
+ #define fpattern_walk_free	Cfpattern_walk_free
+ #define fpattern_index_new	Cfpattern_index_new
+ #define fpattern_index_query	Cfpattern_index_query
+ #define fpattern_index_free	Cfpattern_index_free
+ #define fpattern_cache_size	Cfpattern_cache_size
+ #define fpattern_cache_stats	Cfpattern_cache_stats
+ #define fpattern_stats_get	Cfpattern_stats_get
+ #define fpattern_glob		Cfpattern_glob
+ #define fpattern_glob_mt	Cfpattern_glob_mt
+ #define fpattern_db_add	Cfpattern_db_add
+ #define fpattern_db_merge	Cfpattern_db_merge
+ #define fpattern_db_open	Cfpattern_db_open
+ #define fpattern_db_query	Cfpattern_db_query
+ #define fpattern_db_close	Cfpattern_db_close
 #elif defined(__MEDIUM__)
  #define fpattern_isvalid	Mfpattern_isvalid
  #define fpattern_match		Mfpattern_match
  #define fpattern_matchn	Mfpattern_matchn
+ #define fpattern_match_len	Mfpattern_match_len
+ #define fpattern_match_steps	Mfpattern_match_steps
+ #define fpattern_cost		Mfpattern_cost
+ #define fpattern_match_spans	Mfpattern_match_spans
+ #define fpattern_locale	Mfpattern_locale
+ #define fpattern_compile	Mfpattern_compile
+ #define fpattern_compile_len	Mfpattern_compile_len
+ #define fpattern_compile_flags	Mfpattern_compile_flags
+ #define fpattern_match_flags	Mfpattern_match_flags
+ #define fpattern_required	Mfpattern_required
+ #define fpattern_exec		Mfpattern_exec
+ #define fpattern_exec_len	Mfpattern_exec_len
+ #define fpattern_exec_batch	Mfpattern_exec_batch
+ #define fpattern_free		Mfpattern_free
+ #define fpattern_dfa_new	Mfpattern_dfa_new
+ #define fpattern_dfa_exec	Mfpattern_dfa_exec
+ #define fpattern_dfa_exec_len	Mfpattern_dfa_exec_len
+ #define fpattern_dfa_free	Mfpattern_dfa_free
+ #define fpattern_set_new	Mfpattern_set_new
+ #define fpattern_set_match	Mfpattern_set_match
+ #define fpattern_set_match_len	Mfpattern_set_match_len
+ #define fpattern_set_ids	Mfpattern_set_ids
+ #define fpattern_set_ids_len	Mfpattern_set_ids_len
+ #define fpattern_set_free	Mfpattern_set_free
+ #define fpattern_walk_new	Mfpattern_walk_new
+ #define fpattern_walk_push	Mfpattern_walk_push
+ #define fpattern_walk_pop	Mfpattern_walk_pop
+ #define fpattern_walk_depth	Mfpattern_walk_depth
+ #define fpattern_walk_match	Mfpattern_walk_match
+ #define fpattern_walk_copy	Mfpattern_walk_copy
+ #define fpattern_walk_free	Mfpattern_walk_free
+ #define fpattern_index_new	Mfpattern_index_new
+ #define fpattern_index_query	Mfpattern_index_query
+ #define fpattern_index_free	Mfpattern_index_free
+ #define fpattern_cache_size	Mfpattern_cache_size
+ #define fpattern_cache_stats	Mfpattern_cache_stats
+ #define fpattern_stats_get	Mfpattern_stats_get
+ #define fpattern_glob		Mfpattern_glob
+ #define fpattern_glob_mt	Mfpattern_glob_mt
+ #define fpattern_db_add	Mfpattern_db_add
+ #define fpattern_db_merge	Mfpattern_db_merge
+ #define fpattern_db_open	Mfpattern_db_open
+ #define fpattern_db_query	Mfpattern_db_query
+ #define fpattern_db_close	Mfpattern_db_close
 #elif defined(__HUGE__)
  #define fpattern_isvalid	Hfpattern_isvalid
  #define fpattern_match		Hfpattern_match
  #define fpattern_matchn	Hfpattern_matchn
+ #define fpattern_match_len	Hfpattern_match_len
+ #define fpattern_match_steps	Hfpattern_match_steps
+ #define fpattern_cost		Hfpattern_cost
+ #define fpattern_match_spans	Hfpattern_match_spans
+ #define fpattern_locale	Hfpattern_locale
+ #define fpattern_compile	Hfpattern_compile
+ #define fpattern_compile_len	Hfpattern_compile_len
+ #define fpattern_compile_flags	Hfpattern_compile_flags
+ #define fpattern_match_flags	Hfpattern_match_flags
+ #define fpattern_required	Hfpattern_required
+ #define fpattern_exec		Hfpattern_exec
+ #define fpattern_exec_len	Hfpattern_exec_len
+ #define fpattern_exec_batch	Hfpattern_exec_batch
+ #define fpattern_free		Hfpattern_free
+ #define fpattern_dfa_new	Hfpattern_dfa_new
+ #define fpattern_dfa_exec	Hfpattern_dfa_exec
+ #define fpattern_dfa_exec_len	Hfpattern_dfa_exec_len
+ #define fpattern_dfa_free	Hfpattern_dfa_free
+ #define fpattern_set_new	Hfpattern_set_new
+ #define fpattern_set_match	Hfpattern_set_match
+ #define fpattern_set_match_len	Hfpattern_set_match_len
+ #define fpattern_set_ids	Hfpattern_set_ids
+ #define fpattern_set_ids_len	Hfpattern_set_ids_len
+ #define fpattern_set_free	Hfpattern_set_free
+ #define fpattern_walk_new	Hfpattern_walk_new
+ #define fpattern_walk_push	Hfpattern_walk_push
+ #define fpattern_walk_pop	Hfpattern_walk_pop
+ #define fpattern_walk_depth	Hfpattern_walk_depth
+ #define fpattern_walk_match	Hfpattern_walk_match
+ #define fpattern_walk_copy	Hfpattern_walk_copy
+ #define fpattern_walk_free	Hfpattern_walk_free
+ #define fpattern_index_new	Hfpattern_index_new
+ #define fpattern_index_query	Hfpattern_index_query
+ #define fpattern_index_free	Hfpattern_index_free
+ #define fpattern_cache_size	Hfpattern_cache_size
+ #define fpattern_cache_stats	Hfpattern_cache_stats
+ #define fpattern_stats_get	Hfpattern_stats_get
+ #define fpattern_glob		Hfpattern_glob
+ #define fpattern_glob_mt	Hfpattern_glob_mt
+ #define fpattern_db_add	Hfpattern_db_add
+ #define fpattern_db_merge	Hfpattern_db_merge
+ #define fpattern_db_open	Hfpattern_db_open
+ #define fpattern_db_query	Hfpattern_db_query
+ #define fpattern_db_close	Hfpattern_db_close
 #elif defined(__TINY__)
  #define fpattern_isvalid	Tfpattern_isvalid
  #define fpattern_match		Tfpattern_match
  #define fpattern_matchn	Tfpattern_matchn
+ #define fpattern_match_len	Tfpattern_match_len
+ #define fpattern_match_steps	Tfpattern_match_steps
+ #define fpattern_cost		Tfpattern_cost
+ #define fpattern_match_spans	Tfpattern_match_spans
+ #define fpattern_locale	Tfpattern_locale
+ #define fpattern_compile	Tfpattern_compile
+ #define fpattern_compile_len	Tfpattern_compile_len
+ #define fpattern_compile_flags	Tfpattern_compile_flags
+ #define fpattern_match_flags	Tfpattern_match_flags
+ #define fpattern_required	Tfpattern_required
+ #define fpattern_exec		Tfpattern_exec
+ #define fpattern_exec_len	Tfpattern_exec_len
+ #define fpattern_exec_batch	Tfpattern_exec_batch
+ #define fpattern_free		Tfpattern_free
+ #define fpattern_dfa_new	Tfpattern_dfa_new
+ #define fpattern_dfa_exec	Tfpattern_dfa_exec
+ #define fpattern_dfa_exec_len	Tfpattern_dfa_exec_len
+ #define fpattern_dfa_free	Tfpattern_dfa_free
+ #define fpattern_set_new	Tfpattern_set_new
+ #define fpattern_set_match	Tfpattern_set_match
+ #define fpattern_set_match_len	Tfpattern_set_match_len
+ #define fpattern_set_ids	Tfpattern_set_ids
+ #define fpattern_set_ids_len	Tfpattern_set_ids_len
+ #define fpattern_set_free	Tfpattern_set_free
+ #define fpattern_walk_new	Tfpattern_walk_new
+ #define fpattern_walk_push	Tfpattern_walk_push
+ #define fpattern_walk_pop	Tfpattern_walk_pop
+ #define fpattern_walk_depth	Tfpattern_walk_depth
+ #define fpattern_walk_match	Tfpattern_walk_match
+ #define fpattern_walk_copy	Tfpattern_walk_copy
+ #define fpattern_walk_free	Tfpattern_walk_free
+ #define fpattern_index_new	Tfpattern_index_new
+ #define fpattern_index_query	Tfpattern_index_query
+ #define fpattern_index_free	Tfpattern_index_free
+ #define fpattern_cache_size	Tfpattern_cache_size
+ #define fpattern_cache_stats	Tfpattern_cache_stats
+ #define fpattern_stats_get	Tfpattern_stats_get
+ #define fpattern_glob		Tfpattern_glob
+ #define fpattern_glob_mt	Tfpattern_glob_mt
+ #define fpattern_db_add	Tfpattern_db_add
+ #define fpattern_db_merge	Tfpattern_db_merge
+ #define fpattern_db_open	Tfpattern_db_open
+ #define fpattern_db_query	Tfpattern_db_query
+ #define fpattern_db_close	Tfpattern_db_close
 #else
  /* Memory model is not defined, use extern names as is. */
 #endif
@@ -196,6 +498,47 @@ static const char	drt_fpattern_h_id[] =
 #endif /* __MSDOS__ */
 
 
+/* Public types */
+
+typedef struct fpattern_prog	fpattern_t;	/* Compiled pattern	*/
+typedef struct fpattern_dfa	fpattern_dfa_t;	/* Lazy DFA		*/
+typedef struct fpattern_set	fpattern_set_t;	/* Pattern set		*/
+typedef struct fpattern_walk	fpattern_walk_t;	/* Path matcher */
+typedef struct fpattern_index	fpattern_index_t;	/* Name index	*/
+typedef struct fpattern_db	fpattern_db_t;	/* Name index file	*/
+
+typedef struct fpattern_span	/* Chars matched by a wildcard	*/
+{
+    size_t		off;		/* Offset of first char		*/
+    size_t		len;		/* Number of chars		*/
+} fpattern_span_t;
+
+typedef struct fpattern_cache_stats	/* Pattern cache counters	*/
+{
+    unsigned long	hits;		/* Patterns found in the cache	*/
+    unsigned long	misses;		/* Patterns compiled		*/
+    unsigned long	evictions;	/* Patterns evicted		*/
+    size_t		entries;	/* Patterns held		*/
+    size_t		bytes;		/* Memory held			*/
+} fpattern_cache_stats_t;
+
+typedef struct fpattern_stats	/* Matching counters		*/
+{
+    unsigned long	names;		/* Names matched		*/
+    unsigned long	matches;	/* Names that matched		*/
+    unsigned long	rejects;	/* Names rejected by prefilter	*/
+    unsigned long	steps;		/* Backtracking steps taken	*/
+    unsigned long	dfa_hits;	/* DFA transitions found	*/
+    unsigned long	dfa_misses;	/* DFA transitions built	*/
+    unsigned long	dfa_evictions;	/* DFA states flushed		*/
+    unsigned long	cost[FPAT_STATS_COST];
+					/* Names by cost, log2 buckets	*/
+} fpattern_stats_t;
+
+typedef int	(*fpattern_glob_f)(const char *path, size_t len, void *arg);
+					/* Glob match callback		*/
+
+
 /* Public variables */
 
 /* (None) */
@@ -206,6 +549,83 @@ static const char	drt_fpattern_h_id[] =
 extern int	fpattern_isvalid(const char *pat);
 extern int	fpattern_match(const char *pat, const char *fname);
 extern int	fpattern_matchn(const char *pat, const char *fname);
+extern int	fpattern_match_len(const char *pat, size_t patlen,
+		    const char *fname, size_t len);
+extern int	fpattern_match_steps(const char *pat, const char *fname,
+		    unsigned long *steps);
+extern unsigned long	fpattern_cost(const char *pat, size_t len);
+extern int	fpattern_match_spans(const char *pat, const char *fname,
+		    fpattern_span_t *spans, int maxspans);
+
+extern void	fpattern_locale(void);
+extern fpattern_t *	fpattern_compile(const char *pat, int *erroff);
+extern fpattern_t *	fpattern_compile_len(const char *pat, size_t patlen,
+		    int *erroff);
+extern fpattern_t *	fpattern_compile_flags(const char *pat, size_t patlen,
+		    int flags, int *erroff);
+extern int	fpattern_match_flags(const char *pat, const char *fname,
+		    int flags);
+extern int	fpattern_required(const fpattern_t *prog, char *buf,
+		    size_t size, size_t *prelen);
+extern int	fpattern_exec(const fpattern_t *prog, const char *fname);
+extern int	fpattern_exec_len(const fpattern_t *prog, const char *fname,
+		    size_t len);
+extern size_t	fpattern_exec_batch(const fpattern_t *prog, const char *data,
+		    const size_t *offsets, size_t count, unsigned char *bits);
+extern void	fpattern_free(fpattern_t *prog);
+
+extern fpattern_dfa_t *	fpattern_dfa_new(const fpattern_t *prog,
+			    size_t maxmem);
+extern int	fpattern_dfa_exec(fpattern_dfa_t *dfa, const char *fname);
+extern int	fpattern_dfa_exec_len(fpattern_dfa_t *dfa, const char *fname,
+		    size_t len);
+extern void	fpattern_dfa_free(fpattern_dfa_t *dfa);
+
+extern fpattern_set_t *	fpattern_set_new(const char *const *pats, int npats,
+			    size_t maxmem, int *errpat, int *erroff);
+extern int	fpattern_set_match(fpattern_set_t *set, const char *fname,
+		    unsigned char *bits);
+extern int	fpattern_set_match_len(fpattern_set_t *set, const char *fname,
+		    size_t len, unsigned char *bits);
+extern int	fpattern_set_ids(fpattern_set_t *set, const char *fname,
+		    int *ids, int maxids);
+extern int	fpattern_set_ids_len(fpattern_set_t *set, const char *fname,
+		    size_t len, int *ids, int maxids);
+extern void	fpattern_set_free(fpattern_set_t *set);
+
+extern fpattern_walk_t *	fpattern_walk_new(const fpattern_t *prog);
+extern int	fpattern_walk_push(fpattern_walk_t *walk, const char *dir,
+		    size_t len);
+extern void	fpattern_walk_pop(fpattern_walk_t *walk);
+extern int	fpattern_walk_depth(const fpattern_walk_t *walk);
+extern int	fpattern_walk_match(fpattern_walk_t *walk, const char *name,
+		    size_t len);
+extern fpattern_walk_t *	fpattern_walk_copy(const fpattern_walk_t *walk);
+extern void	fpattern_walk_free(fpattern_walk_t *walk);
+
+extern fpattern_index_t *	fpattern_index_new(const char *const *names,
+			    size_t count);
+extern long	fpattern_index_query(const fpattern_index_t *index,
+		    const fpattern_t *prog, fpattern_glob_f fn, void *arg);
+extern void	fpattern_index_free(fpattern_index_t *index);
+
+extern int	fpattern_cache_size(size_t maxmem);
+extern void	fpattern_cache_stats(fpattern_cache_stats_t *stats);
+
+extern int	fpattern_stats_get(fpattern_stats_t *stats);
+
+extern long	fpattern_glob(const char *pat, int flags, fpattern_glob_f fn,
+		    void *arg);
+extern long	fpattern_glob_mt(const char *pat, int flags, int nthreads,
+		    fpattern_glob_f fn, void *arg);
+
+extern int	fpattern_db_add(const char *path, const char *const *names,
+		    size_t count);
+extern int	fpattern_db_merge(const char *path);
+extern fpattern_db_t *	fpattern_db_open(const char *path);
+extern long	fpattern_db_query(const fpattern_db_t *db,
+		    const fpattern_t *prog, fpattern_glob_f fn, void *arg);
+extern void	fpattern_db_close(fpattern_db_t *db);
 
 
 #ifdef __cplusplus
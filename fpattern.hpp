@@ -0,0 +1,427 @@
+/*******************************************************************************
+* fpattern.hpp
+*	C++ interface to the filename pattern matching functions.
+*
+* Usage
+*	This header requires C++20.  It is header-only, but the functions in
+*	"fpattern.c" must still be linked in.
+*
+*	fpattern::pattern is a compiled pattern (fpattern_t) that is released
+*	automatically.
+*
+*	fpattern::static_pattern<"...">, for a pattern that is a string literal,
+*	is parsed and checked by the compiler, so a malformed pattern is a
+*	compile-time error.  Patterns made up only of literal chars and '*'
+*	closures are matched by inline code specialized for them: a plain
+*	compare for a literal, a suffix compare for "*.tar.gz", and so on.  Any
+*	other pattern is compiled by fpattern_compile_len() the first time it is
+*	matched.
+*
+*	    if (fpattern::static_pattern<"*.tar.gz">::match(name))
+*	        ...
+*
+*	`DELIM' must be defined to 1 before including this header if it was
+*	used to build "fpattern.c".
+*
+* Limitations
+*	On DOS, where letters are matched regardless of case according to the
+*	current locale, patterns containing letters are not specialized.
+*
+* See also
+*	fpattern.h.
+*/
+
+
+#ifndef drt_fpattern_hpp
+#define drt_fpattern_hpp	1
+
+
+/* System includes */
+
+#include <array>
+#include <cstddef>
+#include <string_view>
+
+
+/* Local includes */
+
+#include "fpattern.h"
+
+
+namespace fpattern
+{
+
+/* Local constants */
+
+namespace detail
+{
+
+#if defined(unix) || defined(_unix) || defined(__unix)
+inline constexpr char	quote =	FPAT_QUOTE;
+inline constexpr char	del2 =	FPAT_DEL;
+inline constexpr bool	fold =	false;
+#elif defined(__MSDOS__) || defined(_WIN32)
+inline constexpr char	quote =	FPAT_QUOTE2;
+inline constexpr char	del2 =	FPAT_DEL2;
+inline constexpr bool	fold =	true;
+#else
+ #error Cannot ascertain the O/S from predefined macros
+#endif
+
+#if defined(DELIM)
+inline constexpr bool	delim =	(DELIM != 0);
+#else
+inline constexpr bool	delim =	false;
+#endif
+
+
+/*------------------------------------------------------------------------------
+* fixed_string
+*	A string literal used as a template argument.
+*/
+
+template <std::size_t N>
+struct fixed_string
+{
+    char		str[N];		// Chars, incl terminating null
+
+    constexpr fixed_string(const char (&s)[N])
+    {
+        for (std::size_t i = 0;  i < N;  i++)
+            str[i] = s[i];
+    }
+
+    constexpr std::size_t size() const
+    {
+        return (N-1);
+    }
+};
+
+
+/*------------------------------------------------------------------------------
+* check()
+*	Checks that filename pattern 'pat' is a well-formed pattern, exactly as
+*	fpattern_isvalid() does.
+*
+* Returns
+*	-1 if the pattern is valid, otherwise the offset of the offending
+*	pattern char.
+*/
+
+constexpr int check(const char *pat)
+{
+    int		len;
+    int		depth;
+
+    depth = 0;
+    for (len = 0;  pat[len] != '\0';  len++)
+    {
+        switch (pat[len])
+        {
+        case FPAT_SET_L:
+            // Char set
+            len++;
+            if (pat[len] == FPAT_SET_NOT)
+                len++;
+
+            while (pat[len] != FPAT_SET_R)
+            {
+                if (pat[len] == quote)
+                    len++;
+                if (pat[len] == '\0')
+                    return (len);	// Missing closing bracket
+                len++;
+
+                if (pat[len] == FPAT_SET_THRU)
+                {
+                    len++;
+                    if (pat[len] == quote)
+                        len++;
+                    if (pat[len] == '\0')
+                        return (len);	// Missing closing bracket
+                    len++;
+                }
+
+                if (pat[len] == '\0')
+                    return (len);	// Missing closing bracket
+            }
+            break;
+
+        case quote:
+            // Quoted char
+            len++;
+            if (pat[len] == '\0')
+                return (len);
+            break;
+
+        case FPAT_NOT:
+            // Negated subpattern, which cannot be an alternative
+            if (depth > 0)
+                return (len);
+            if (pat[len+1] == '\0')
+                return (len+1);
+            if (pat[len+1] == quote  &&  pat[len+2] != '\0')
+                len += 2;		// Quoted char, as parsed
+            else if (pat[len+1] != FPAT_ALT_L)
+                len++;			// Char after it is not checked
+            break;
+
+        case FPAT_ALT_L:
+            // Alternatives
+            depth++;
+            break;
+
+        case FPAT_ALT_R:
+            // End of alternatives, or a regular char
+            if (depth > 0)
+                depth--;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (depth > 0)
+        return (len);			// Missing closing brace
+    return (-1);
+}
+
+
+/*------------------------------------------------------------------------------
+* shape
+*	The form of a pattern made up only of literal chars and closures, which
+*	is split into literal segments 'seg[0...nseg-1]' at each closure.  A
+*	pattern without closures has a single segment.
+*/
+
+template <std::size_t N>
+struct shape
+{
+    bool		general;	// Not specialized
+    std::size_t		nseg;		// Literal segments
+    std::size_t		minlen;		// Total literal chars
+    std::array<char, N>			chars;	// Unquoted literal chars
+    std::array<std::size_t, N+1>	start;	// Start of each segment
+};
+
+
+/*------------------------------------------------------------------------------
+* analyze()
+*	Determines the shape of (valid) pattern 'pat' of 'len' chars.
+*/
+
+template <std::size_t N>
+constexpr shape<N> analyze(const char *pat, std::size_t len)
+{
+    shape<N>	s{};
+    std::size_t	i;
+    char	ch;
+    bool	star;
+
+    s.general = false;
+    s.nseg = 1;
+    s.minlen = 0;
+    s.start[0] = 0;
+    star = false;
+
+    for (i = 0;  i < len;  i++)
+    {
+        ch = pat[i];
+
+        if (ch == FPAT_CLOS)
+        {
+            // Closure, where several in a row are the same as one
+            if (!star)
+                s.start[s.nseg++] = s.minlen;
+            else if (delim)
+                s.general = true;	// "**" matches across delimiters
+            star = true;
+            continue;
+        }
+
+        if (ch == FPAT_ANY  ||  ch == FPAT_CLOSP  ||  ch == FPAT_SET_L  ||
+            ch == FPAT_NOT  ||  ch == FPAT_ALT_L)
+            s.general = true;
+
+        // Literal char
+        if (ch == quote)
+            ch = pat[++i];
+        if (delim  &&  (ch == FPAT_DEL  ||  ch == del2))
+            s.general = true;		// Closures must skip over it
+        if (fold  &&  ((ch >= 'A'  &&  ch <= 'Z')  ||
+            (ch >= 'a'  &&  ch <= 'z')  ||  (unsigned char) ch >= 0x80))
+            s.general = true;		// Case folding depends on locale
+
+        s.chars[s.minlen++] = ch;
+        star = false;
+    }
+
+    s.start[s.nseg] = s.minlen;
+    return (s);
+}
+
+} // namespace detail
+
+
+/*------------------------------------------------------------------------------
+* pattern
+*	A compiled pattern, released when it is destroyed.
+*/
+
+class pattern
+{
+public:
+    explicit pattern(std::string_view pat)
+        : prog(fpattern_compile_len(pat.data() != nullptr ? pat.data() : "",
+            pat.size(), &off))
+    {
+    }
+
+    pattern(pattern &&p) noexcept
+        : off(p.off), prog(p.prog)
+    {
+        p.prog = nullptr;
+    }
+
+    pattern &operator =(pattern &&p) noexcept
+    {
+        if (this != &p)
+        {
+            fpattern_free(prog);
+            prog = p.prog;
+            off = p.off;
+            p.prog = nullptr;
+        }
+        return (*this);
+    }
+
+    pattern(const pattern &) = delete;
+    pattern &operator =(const pattern &) = delete;
+
+    ~pattern()
+    {
+        fpattern_free(prog);
+    }
+
+    // True if the pattern compiled
+    explicit operator bool() const noexcept
+    {
+        return (prog != nullptr);
+    }
+
+    // Offset of the offending pattern char, or -1
+    int error_offset() const noexcept
+    {
+        return (off);
+    }
+
+    // The compiled pattern, or null
+    const fpattern_t *get() const noexcept
+    {
+        return (prog);
+    }
+
+    bool match(std::string_view name) const noexcept
+    {
+        return (fpattern_exec_len(prog, name.data() != nullptr ?
+            name.data() : "", name.size()) != 0);
+    }
+
+    bool operator ()(std::string_view name) const noexcept
+    {
+        return (match(name));
+    }
+
+private:
+    int			off;		// Error offset, or -1
+    fpattern_t *	prog;		// Compiled pattern, or null
+};
+
+
+/*------------------------------------------------------------------------------
+* static_pattern
+*	A pattern given as a string literal, which is checked and analyzed at
+*	compile time.
+*/
+
+template <detail::fixed_string Pat>
+class static_pattern
+{
+public:
+    static_assert(detail::check(Pat.str) < 0,
+        "fpattern: malformed filename pattern");
+
+    static bool match(std::string_view name) noexcept
+    {
+        if (name.empty())
+            return (Pat.size() == 0);	// Special case
+
+        if constexpr (info.general)
+        {
+            static const pattern	prog(std::string_view(Pat.str,
+                                            Pat.size()));
+
+            return (prog.match(name));
+        }
+        else if constexpr (info.nseg == 1)
+        {
+            // Literal
+            return (name == segment(0));
+        }
+        else
+        {
+            // Literal prefix and suffix, with literals between closures
+            constexpr std::string_view	pre = segment(0);
+            constexpr std::string_view	suf = segment(info.nseg-1);
+            std::string_view		mid;
+            std::size_t			i, pos;
+
+            if (name.size() < info.minlen)
+                return (false);
+            if (!name.starts_with(pre)  ||  !name.ends_with(suf))
+                return (false);
+
+            mid = name.substr(pre.size(),
+                name.size() - pre.size() - suf.size());
+            if constexpr (detail::delim)
+            {
+                constexpr char	dels[] = { FPAT_DEL, detail::del2, '\0' };
+
+                if (mid.find_first_of(dels) != std::string_view::npos)
+                    return (false);	// Closures skip no delimiters
+            }
+
+            // Find the leftmost occurrence of each inner literal in turn
+            for (i = 1;  i+1 < info.nseg;  i++)
+            {
+                pos = mid.find(segment(i));
+                if (pos == std::string_view::npos)
+                    return (false);
+                mid.remove_prefix(pos + segment(i).size());
+            }
+            return (true);
+        }
+    }
+
+    bool operator ()(std::string_view name) const noexcept
+    {
+        return (match(name));
+    }
+
+private:
+    static constexpr detail::shape<sizeof(Pat.str)>	info =
+        detail::analyze<sizeof(Pat.str)>(Pat.str, Pat.size());
+
+    static constexpr std::string_view segment(std::size_t i)
+    {
+        return (std::string_view(info.chars.data() + info.start[i],
+            info.start[i+1] - info.start[i]));
+    }
+};
+
+} // namespace fpattern
+
+#endif /* drt_fpattern_hpp */
+
+/* End fpattern.hpp */
@@ -0,0 +1,639 @@
+/*******************************************************************************
+* fpbench.c
+*	Benchmark for the filename pattern matching functions.
+*
+* Usage
+*	fpattern-bench [-n names] [-r repeats] [-s seed] [-p] [-e engine]
+*	    [pattern]...
+*
+*	Matches each pattern (by default, a built-in list of typical and
+*	pathological patterns) against a generated corpus of filenames with
+*	each matching engine, and reports for each:
+*
+*	    ns/name	Average time per filename, the best of 'repeats' passes
+*	    names/s	Filenames matched per second at that rate
+*	    p99		99th percentile time of a single match
+*	    hits	Number of filenames that matched
+*
+*	The engines are:
+*
+*	    match	fpattern_match(), which interprets the pattern
+*	    exec	fpattern_exec(), with the pattern compiled beforehand
+*	    dfa		fpattern_dfa_exec(), through a lazy DFA
+*	    fnmatch	The system fnmatch(3), as a baseline
+*
+*	    -n names	Number of filenames in the corpus (default 100000)
+*	    -r repeats	Number of timed passes (default 5)
+*	    -s seed	Seed for the corpus (default 1)
+*	    -p		Also count CPU cycles, branch misses and cache misses
+*			with perf_event_open(2), where available
+*	    -e engine	Run only the named engine (may be repeated)
+*
+*	The corpus depends only on the seed and the number of names, so runs
+*	on different machines or builds match the same names.
+*
+*	Build with:
+*
+*	    cc -O2 -o fpattern-bench fpbench.c fpattern.c
+*
+* Notes
+*	The corpus is made of pathnames whose depths, directory names and
+*	extensions follow weighted tables drawn from real source and media
+*	trees.  Patterns marked "(a)" are matched instead against a corpus of
+*	long runs of 'a', which drive backtracking matchers to their worst
+*	case.  An engine that takes more than FPB_LIMIT to match a corpus once
+*	is reported only with its average time over the names it did match.
+*
+*	Patterns that fnmatch() does not understand (negated subpatterns, and
+*	the ^Z closure) are not run through it.
+*
+*	This requires a POSIX system.
+*/
+
+
+/* System includes */
+
+#ifndef _POSIX_C_SOURCE
+ #define _POSIX_C_SOURCE	200809L		/* strdup(), clock_gettime() */
+#endif
+#if defined(__linux__)  &&  !defined(_DEFAULT_SOURCE)
+ #define _DEFAULT_SOURCE	1		/* syscall() */
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fnmatch.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+ #include <linux/perf_event.h>
+ #include <sys/ioctl.h>
+ #include <sys/syscall.h>
+ #define PERF	1
+#else
+ #define PERF	0
+#endif
+
+
+/* Local includes */
+
+#include "fpattern.h"
+
+
+/* Local constants */
+
+#ifndef false
+ #define false		0
+#endif
+
+#ifndef true
+ #define true		1
+#endif
+
+#define FPB_NAMES	100000L		/* Default corpus size		*/
+#define FPB_REPEATS	5		/* Default timed passes		*/
+#define FPB_ENGINES	4		/* Matching engines		*/
+#define FPB_EVENTS	3		/* Perf counters		*/
+#define FPB_LIMIT	2e9		/* Warm-up time limit (nsec)	*/
+
+
+/* Local types */
+
+struct fpb_weight
+{
+    const char *	str;		/* Choice			*/
+    int			weight;		/* Relative frequency		*/
+};
+
+struct fpb_case
+{
+    const char *	pat;		/* Pattern			*/
+    int			adverse;	/* Match against runs of 'a'	*/
+};
+
+struct fpb_ctx
+{
+    const char *	pat;		/* Pattern			*/
+    fpattern_t *	prog;		/* Compiled pattern		*/
+    fpattern_dfa_t *	dfa;		/* Lazy DFA			*/
+};
+
+typedef int	(*fpb_engine_f)(struct fpb_ctx *c, const char *name);
+
+struct fpb_engine
+{
+    const char *	name;		/* Engine name			*/
+    fpb_engine_f	fn;		/* Matches one filename		*/
+    int			on;		/* Engine is selected		*/
+};
+
+
+/* Local variables */
+
+static const char *	prog_name =	"fpattern-bench";
+
+static unsigned long	fpb_seed =	1;	/* Corpus generator seed */
+
+/* Directory depths */
+static const int	fpb_depths[] =	{ 6, 14, 22, 20, 15, 10, 6, 4, 3 };
+
+/* Directory names */
+static const struct fpb_weight	fpb_dirs[] =
+{
+    { "src", 30 },	{ "lib", 15 },	{ "include", 10 },  { "test", 12 },
+    { "tests", 8 },	{ "docs", 6 },	{ "build", 10 },    { "obj", 6 },
+    { "bin", 5 },	{ "assets", 6 }, { "images", 8 },   { "photos", 5 },
+    { "2023", 4 },	{ "2024", 5 },	{ "node_modules", 9 }, { ".git", 4 },
+    { "objects", 3 },	{ "vendor", 4 }, { "internal", 4 }, { "util", 6 },
+    { "net", 3 },	{ "core", 5 },	{ "backup", 2 },    { "tmp", 3 },
+    { NULL, 0 }
+};
+
+/* File extensions */
+static const struct fpb_weight	fpb_exts[] =
+{
+    { ".c", 14 },	{ ".h", 12 },	{ ".o", 8 },	{ ".js", 14 },
+    { ".json", 6 },	{ ".py", 8 },	{ ".md", 4 },	{ ".txt", 5 },
+    { ".html", 4 },	{ ".css", 3 },	{ ".go", 3 },	{ ".rs", 2 },
+    { ".java", 3 },	{ ".xml", 2 },	{ ".log", 3 },	{ ".jpg", 7 },
+    { ".jpeg", 2 },	{ ".png", 6 },	{ ".gif", 1 },	{ ".tar.gz", 2 },
+    { ".zip", 1 },	{ ".pdf", 2 },	{ ".so", 1 },	{ "", 4 },
+    { NULL, 0 }
+};
+
+/* Filename stems */
+static const struct fpb_weight	fpb_stems[] =
+{
+    { "index", 6 },	{ "main", 5 },	{ "util", 4 },	{ "test_", 5 },
+    { "README", 2 },	{ "config", 3 }, { "IMG_", 6 },	{ "report", 2 },
+    { "data", 3 },	{ "file", 3 },	{ "Makefile", 1 }, { "mod", 3 },
+    { "a", 2 },		{ "parse", 2 },	{ "x", 1 },	{ "tmp", 2 },
+    { NULL, 0 }
+};
+
+/* Default patterns */
+static const struct fpb_case	fpb_cases[] =
+{
+    { "*.c", false },
+    { "*.tar.gz", false },
+    { "src/*", false },
+    { "*.[ch]", false },
+    { "*test*", false },
+    { "*/IMG_????.jpg", false },
+    { "*.?s", false },
+    { "*.{jpg,jpeg,png,gif}", false },
+    { "*report*2024*.pdf", false },
+    { "!*.o", false },
+    { "*a*b*c*d*e*", false },
+    { "*a*a*a*a*a*a*b", true },
+    { "*a*a*a*a*a*a*a*a*a*a*a*a*", true },
+    { "a*a*a*a*a*a*a*a*a*a*b", true },
+    { "*?*?*?*?*?*?*?*?*!a", true },
+    { NULL, false }
+};
+
+
+/*------------------------------------------------------------------------------
+* fpb_rand()
+*	Returns the next value of the corpus generator, a 64-bit LCG whose high
+*	bits are used, so that the corpus is the same on every system.
+*/
+
+static unsigned long fpb_rand(void)
+{
+    static unsigned long long	x;
+    static int			init =	false;
+
+    if (!init)
+    {
+        x = fpb_seed;
+        init = true;
+    }
+    x = x*6364136223846793005ULL + 1442695040888963407ULL;
+    return ((unsigned long) (x >> 33));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpb_pick()
+*	Picks one of the choices in weighted table 't' at random.
+*/
+
+static const char *fpb_pick(const struct fpb_weight *t)
+{
+    long	total;
+    long	r;
+    int		i;
+
+    for (total = 0, i = 0;  t[i].str != NULL;  i++)
+        total += t[i].weight;
+
+    r = (long) (fpb_rand() % (unsigned long) total);
+    for (i = 0;  r >= t[i].weight;  i++)
+        r -= t[i].weight;
+    return (t[i].str);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpb_corpus()
+*	Generates a corpus of 'n' filenames, either typical pathnames or, if
+*	'adverse' is true, runs of 8 to 40 'a' chars.
+*
+* Returns
+*	A null-terminated array of filenames.
+*/
+
+static char **fpb_corpus(long n, int adverse)
+{
+    char **	names;
+    char	buf[512];
+    size_t	len;
+    long	i;
+    int		d, depth, total;
+
+    names = (char **) calloc(n+1, sizeof(char *));
+    if (names == NULL)
+        return (NULL);
+
+    for (i = 0;  i < n;  i++)
+    {
+        if (adverse)
+        {
+            len = 8 + fpb_rand() % 33;
+            memset(buf, 'a', len);
+            buf[len] = '\0';
+        }
+        else
+        {
+            /* Choose a depth, then a name for each directory level */
+            for (total = 0, d = 0;  d < (int) (sizeof(fpb_depths)/sizeof(int));
+                d++)
+                total += fpb_depths[d];
+            total = (int) (fpb_rand() % (unsigned long) total);
+            for (depth = 0;  total >= fpb_depths[depth];  depth++)
+                total -= fpb_depths[depth];
+
+            buf[0] = '\0';
+            for (d = 0;  d < depth;  d++)
+            {
+                strcat(buf, fpb_pick(fpb_dirs));
+                strcat(buf, "/");
+            }
+
+            /* Add a filename, a number, and an extension */
+            strcat(buf, fpb_pick(fpb_stems));
+            len = strlen(buf);
+            if (fpb_rand() % 3 != 0)
+                sprintf(buf + len, "%lu", fpb_rand() % 10000);
+            strcat(buf, fpb_pick(fpb_exts));
+        }
+
+        names[i] = strdup(buf);
+        if (names[i] == NULL)
+            return (NULL);
+    }
+    return (names);
+}
+
+
+/*------------------------------------------------------------------------------
+* Matching engines
+*/
+
+static int fpb_match(struct fpb_ctx *c, const char *name)
+{
+    return (fpattern_match(c->pat, name));
+}
+
+static int fpb_exec(struct fpb_ctx *c, const char *name)
+{
+    return (fpattern_exec(c->prog, name));
+}
+
+static int fpb_dfa(struct fpb_ctx *c, const char *name)
+{
+    return (fpattern_dfa_exec(c->dfa, name));
+}
+
+static int fpb_fnmatch(struct fpb_ctx *c, const char *name)
+{
+    return (fnmatch(c->pat, name, 0) == 0);
+}
+
+static struct fpb_engine	fpb_engines[FPB_ENGINES] =
+{
+    { "match",		fpb_match,	true },
+    { "exec",		fpb_exec,	true },
+    { "dfa",		fpb_dfa,	true },
+    { "fnmatch",	fpb_fnmatch,	true },
+};
+
+
+/*------------------------------------------------------------------------------
+* fpb_now()
+*	Returns the current time, in nanoseconds.
+*/
+
+static double fpb_now(void)
+{
+    struct timespec	ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec*1e9 + ts.tv_nsec);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpb_cmp()
+*	Compares two times, for qsort().
+*/
+
+static int fpb_cmp(const void *a, const void *b)
+{
+    double	x = *(const double *) a;
+    double	y = *(const double *) b;
+
+    return (x < y ? -1 : x > y ? 1 : 0);
+}
+
+
+#if PERF
+
+/*------------------------------------------------------------------------------
+* fpb_perf_open()
+*	Opens a group of perf counters for CPU cycles, branch misses and cache
+*	misses of the calling thread, storing their descriptors into 'fds'.
+*
+* Returns
+*	True on success, otherwise false (typically if the system does not
+*	allow it).
+*/
+
+static int fpb_perf_open(int fds[FPB_EVENTS])
+{
+    static const unsigned long long	events[FPB_EVENTS] =
+    {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_MISSES,
+    };
+    struct perf_event_attr	attr;
+    int				i;
+
+    for (i = 0;  i < FPB_EVENTS;  i++)
+    {
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = events[i];
+        attr.disabled = (i == 0);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1,
+            i == 0 ? -1 : fds[0], 0);
+        if (fds[i] < 0)
+        {
+            while (--i >= 0)
+                close(fds[i]);
+            return (false);
+        }
+    }
+    return (true);
+}
+
+#endif /*PERF*/
+
+
+/*------------------------------------------------------------------------------
+* fpb_run()
+*	Times engine 'e' matching context 'c' against filenames 'names[0...n-1]'
+*	and prints the results, using 'lat[0...n-1]' to hold the time of each
+*	match.  If 'perf' is true, the perf counters are read as well.
+*/
+
+static void fpb_run(struct fpb_engine *e, struct fpb_ctx *c, char **names,
+    long n, int repeats, int perf, double *lat)
+{
+    double	t, best, p99, tick;
+    long	hits;
+    long	i;
+    int		r;
+#if PERF
+    long long	counts[FPB_EVENTS];
+    int		fds[FPB_EVENTS];
+#endif
+
+    /* Warm up, giving up on engines that take far too long */
+    hits = 0;
+    t = fpb_now();
+    for (i = 0;  i < n;  i++)
+    {
+        hits += e->fn(c, names[i]);
+        if (fpb_now() - t > FPB_LIMIT)
+        {
+            printf("  %-8s %9.0f  (gave up after %ld names)\n", e->name,
+                (fpb_now() - t)/(i+1), i+1);
+            return;
+        }
+    }
+
+    /* Time whole passes, keeping the best */
+    best = 0.0;
+    for (r = 0;  r < repeats;  r++)
+    {
+        t = fpb_now();
+        for (i = 0;  i < n;  i++)
+            e->fn(c, names[i]);
+        t = fpb_now() - t;
+        if (r == 0  ||  t < best)
+            best = t;
+    }
+
+    /* Time each match alone, less the cost of reading the clock */
+    tick = fpb_now();
+    tick = fpb_now() - tick;
+    for (i = 0;  i < n;  i++)
+    {
+        t = fpb_now();
+        e->fn(c, names[i]);
+        lat[i] = fpb_now() - t - tick;
+    }
+    qsort(lat, n, sizeof(double), fpb_cmp);
+    p99 = lat[n*99/100];
+
+    printf("  %-8s %9.1f %12.0f %9.1f %8ld", e->name, best/n,
+        best > 0.0 ? n/(best*1e-9) : 0.0, p99 < 0.0 ? 0.0 : p99, hits);
+
+#if PERF
+    if (perf)
+    {
+        if (fpb_perf_open(fds))
+        {
+            ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+            for (i = 0;  i < n;  i++)
+                e->fn(c, names[i]);
+            ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+            for (r = 0;  r < FPB_EVENTS;  r++)
+            {
+                if (read(fds[r], &counts[r], sizeof(counts[r])) !=
+                    (long) sizeof(counts[r]))
+                    counts[r] = 0;
+                close(fds[r]);
+            }
+            printf(" %9.1f %8.3f %8.3f", (double) counts[0]/n,
+                (double) counts[1]/n, (double) counts[2]/n);
+        }
+        else
+            printf("  (perf counters unavailable)");
+    }
+#else
+    (void) perf;
+#endif
+    printf("\n");
+}
+
+
+/*------------------------------------------------------------------------------
+* usage()
+*	Prints a usage message and exits.
+*/
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: %s [-n names] [-r repeats] [-s seed] [-p] [-e engine] "
+        "[pattern]...\n", prog_name);
+    exit(2);
+}
+
+
+/*------------------------------------------------------------------------------
+* main()
+*	Runs the benchmark.
+*/
+
+int main(int argc, char **argv)
+{
+    struct fpb_case *	cases;
+    struct fpb_ctx	c;
+    char **		corpus[2];
+    double *		lat;
+    long		n;
+    int			repeats;
+    int			perf;
+    int			only;
+    int			erroff;
+    int			i, k;
+
+    n = FPB_NAMES;
+    repeats = FPB_REPEATS;
+    perf = false;
+    only = false;
+
+    /* Parse the options */
+    for (i = 1;  i < argc  &&  argv[i][0] == '-';  i++)
+    {
+        if (strcmp(argv[i], "-n") == 0  &&  i+1 < argc)
+            n = atol(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0  &&  i+1 < argc)
+            repeats = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0  &&  i+1 < argc)
+            fpb_seed = strtoul(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-p") == 0)
+            perf = true;
+        else if (strcmp(argv[i], "-e") == 0  &&  i+1 < argc)
+        {
+            /* Select an engine, deselecting the others the first time */
+            i++;
+            for (k = 0;  k < FPB_ENGINES;  k++)
+            {
+                if (!only)
+                    fpb_engines[k].on = false;
+                if (strcmp(argv[i], fpb_engines[k].name) == 0)
+                    fpb_engines[k].on = true;
+            }
+            only = true;
+        }
+        else
+            usage();
+    }
+    if (n < 1  ||  repeats < 1)
+        usage();
+
+    /* Use the patterns given, or the default ones */
+    cases = (struct fpb_case *) fpb_cases;
+    if (i < argc)
+    {
+        cases = (struct fpb_case *) calloc(argc - i + 1,
+            sizeof(struct fpb_case));
+        if (cases == NULL)
+            return (2);
+        for (k = 0;  i < argc;  i++, k++)
+            cases[k].pat = argv[i];
+    }
+
+    /* Generate the corpora */
+    fpattern_locale();
+    corpus[0] = fpb_corpus(n, false);
+    corpus[1] = fpb_corpus(n, true);
+    lat = (double *) malloc(n*sizeof(double));
+    if (corpus[0] == NULL  ||  corpus[1] == NULL  ||  lat == NULL)
+    {
+        fprintf(stderr, "%s: %s\n", prog_name, strerror(ENOMEM));
+        return (2);
+    }
+
+    printf("%ld names, seed %lu, best of %d\n\n", n, fpb_seed, repeats);
+    printf("  %-8s %9s %12s %9s %8s", "engine", "ns/name", "names/s",
+        "p99 ns", "hits");
+    if (perf)
+        printf(" %9s %8s %8s", "cycles", "br-miss", "c-miss");
+    printf("\n");
+
+    /* Run each pattern through each engine */
+    for (k = 0;  cases[k].pat != NULL;  k++)
+    {
+        c.pat = cases[k].pat;
+        c.prog = fpattern_compile(c.pat, &erroff);
+        if (c.prog == NULL)
+        {
+            fprintf(stderr, "%s: bad pattern \"%s\" at offset %d\n",
+                prog_name, c.pat, erroff);
+            continue;
+        }
+        c.dfa = fpattern_dfa_new(c.prog, 0);
+
+        printf("\n\"%s\"%s\n", c.pat, cases[k].adverse ? " (a)" : "");
+        for (i = 0;  i < FPB_ENGINES;  i++)
+        {
+            if (!fpb_engines[i].on)
+                continue;
+            if (fpb_engines[i].fn == fpb_dfa  &&  c.dfa == NULL)
+                continue;
+            if (fpb_engines[i].fn == fpb_fnmatch  &&
+                (strchr(c.pat, FPAT_NOT) != NULL  ||
+                strchr(c.pat, FPAT_CLOSP) != NULL  ||
+                strchr(c.pat, FPAT_ALT_L) != NULL))
+                continue;	/* Not understood by fnmatch() */
+
+            fpb_run(&fpb_engines[i], &c, corpus[cases[k].adverse], n,
+                repeats, perf, lat);
+        }
+
+        fpattern_dfa_free(c.dfa);
+        fpattern_free(c.prog);
+    }
+
+    return (0);
+}
+
+/* End fpbench.c */
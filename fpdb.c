@@ -0,0 +1,1510 @@
+/*******************************************************************************
+* fpdb.c
+*	Functions for keeping a list of names in an index file, and for finding
+*	the names in it that match a filename pattern.
+*
+* Usage
+*	(See "fpattern.h".)
+*
+* Notes
+*	An index file is a sequence of segments, each of which holds a sorted
+*	list of distinct names.  fpattern_db_add() appends a new segment to the
+*	end of the file, and fpattern_db_merge() rewrites all of the segments
+*	as one.  A segment is laid out so that it is used directly from a
+*	read-only mapping of the file, without being read or decoded first:
+*
+*	    header	struct fpat_dbhdr
+*	    names	blocks of up to FPDB_BLOCK names each
+*	    blocks	[nblocks+1] offsets of the blocks of names
+*	    grams	[ngrams] struct fpat_dbgram, sorted by trigram
+*	    postings	[...] block numbers, sorted, for each trigram
+*
+*	Within a block, each name is stored as the number of leading chars it
+*	shares with the name before it (zero for the first name), the number
+*	of chars that follow, and then those chars, the counts being varints
+*	of 7 bits per byte.
+*
+*	Every trigram (three consecutive chars, with ASCII letters folded to
+*	lowercase) found in the names of a block lists that block among its
+*	postings.  A query takes the runs of literal chars that every matching
+*	name must contain (see fpattern_required()), intersects the postings of
+*	all of their trigrams, and matches only the names in the blocks that
+*	remain.  A literal prefix narrows the blocks further, by a binary search
+*	of their first names.
+*
+*	The integers in the file are in the byte order of the machine that
+*	wrote it, which is checked when it is opened.  A segment left
+*	incomplete by a crash while it was being appended is ignored, and is
+*	overwritten by the next segment appended.
+*
+*	This requires a POSIX system; elsewhere the functions fail with 'errno'
+*	set to ENOSYS.
+*/
+
+
+/* System includes */
+
+#ifndef _POSIX_C_SOURCE
+ #define _POSIX_C_SOURCE	200809L		/* pwrite(), ftruncate() */
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if TEST
+ #include <stdio.h>
+#endif
+
+#if defined(unix) || defined(_unix) || defined(__unix)
+ #define UNIX	1
+#else
+ #define UNIX	0
+#endif
+
+#if UNIX
+ #include <fcntl.h>
+ #include <stdint.h>
+ #include <stdio.h>
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+
+
+/* Local includes */
+
+#include "debug.h"
+
+#include "fpattern.h"
+
+
+/* Local constants */
+
+#ifndef NULL
+ #define NULL		((void *) 0)
+#endif
+
+#ifndef false
+ #define false		0
+#endif
+
+#ifndef true
+ #define true		1
+#endif
+
+#define FPDB_MAGIC	"FPATDB1\n"	/* Segment header magic		*/
+#define FPDB_ORDER	0x01020304UL	/* Byte order mark		*/
+#define FPDB_BLOCK	32		/* Names per block		*/
+#define FPDB_RUNS	256		/* Initial required runs buffer	*/
+#define FPDB_MAXRUNS	(64*1024)	/* Max required runs buffer	*/
+
+#ifndef O_CLOEXEC
+ #define O_CLOEXEC	0
+#endif
+
+
+#if UNIX
+
+/* Local types */
+
+struct fpat_dbhdr
+{
+    char		magic[8];	/* FPDB_MAGIC			*/
+    uint32_t		order;		/* FPDB_ORDER			*/
+    uint32_t		block;		/* Names per block		*/
+    uint64_t		size;		/* Segment size, incl header	*/
+    uint64_t		nnames;		/* Number of names		*/
+    uint64_t		nblocks;	/* Number of blocks of names	*/
+    uint64_t		ngrams;		/* Number of distinct trigrams	*/
+    uint64_t		blocks;		/* Offset of block offsets	*/
+    uint64_t		grams;		/* Offset of trigrams		*/
+    uint64_t		maxlen;		/* Longest name			*/
+};
+
+struct fpat_dbgram
+{
+    uint32_t		gram;		/* Trigram, first char highest	*/
+    uint32_t		count;		/* Number of postings		*/
+    uint64_t		post;		/* Offset of postings		*/
+};
+
+struct fpat_dbseg
+{
+    const unsigned char *	base;	/* Start of segment		*/
+    const struct fpat_dbhdr *	hdr;	/* Segment header		*/
+    const uint64_t *		blocks;	/* Block offsets		*/
+    const struct fpat_dbgram *	grams;	/* Trigrams			*/
+};
+
+struct fpattern_db
+{
+    void *		map;		/* File mapping			*/
+    size_t		len;		/* File mapping size		*/
+    int			nsegs;		/* Number of segments		*/
+    struct fpat_dbseg *	segs;	/* Segments			*/
+    size_t		end;		/* End of last segment		*/
+    size_t		maxlen;		/* Longest name			*/
+};
+
+struct fpat_dbbuf
+{
+    unsigned char *	data;		/* Bytes written		*/
+    size_t		len;		/* Number of bytes		*/
+    size_t		cap;		/* Size of 'data'		*/
+    int			err;		/* Out of memory		*/
+};
+
+struct fpat_dbpost
+{
+    const uint32_t *	p;		/* Postings			*/
+    size_t		n;		/* Number of postings		*/
+    size_t		at;		/* Next posting to check	*/
+};
+
+struct fpat_dbquery
+{
+    const fpattern_t *	prog;		/* Compiled pattern		*/
+    fpattern_glob_f	fn;		/* Callback			*/
+    void *		arg;		/* Callback arg			*/
+    const char *	runs;		/* Required runs		*/
+    int			nruns;		/* Number of runs		*/
+    size_t		prelen;		/* Length of literal prefix	*/
+    struct fpat_dbpost *	posts;	/* Postings of each trigram	*/
+    char *		name;		/* Decoded name			*/
+    size_t		maxlen;		/* Size of 'name', less one	*/
+    long		count;		/* Matching names		*/
+    int			stop;		/* Callback asked to stop	*/
+    int			err;		/* Corrupt segment		*/
+};
+
+
+/*------------------------------------------------------------------------------
+* fpdb_fold()
+*	Folds char 'ch' to lowercase, if it is an ASCII letter.
+*/
+
+static unsigned int fpdb_fold(int ch)
+{
+    ch &= 0xFF;
+    if (ch >= 'A'  &&  ch <= 'Z')
+        ch += 'a' - 'A';
+    return ((unsigned int) ch);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_gram()
+*	Returns the trigram of the three chars at 's'.
+*/
+
+static uint32_t fpdb_gram(const char *s)
+{
+    return ((uint32_t) (fpdb_fold(s[0]) << 16 | fpdb_fold(s[1]) << 8 |
+        fpdb_fold(s[2])));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_put()
+*	Appends 'len' bytes 'p' to buffer 'b'.  If 'p' is null, zero bytes are
+*	appended.
+*/
+
+static void fpdb_put(struct fpat_dbbuf *b, const void *p, size_t len)
+{
+    unsigned char *	d;
+    size_t		cap;
+
+    if (b->err)
+        return;
+
+    if (b->len + len > b->cap)
+    {
+        cap = (b->cap > 0 ? b->cap : 4096);
+        while (cap < b->len + len)
+            cap *= 2;
+        d = (unsigned char *) realloc(b->data, cap);
+        if (d == NULL)
+        {
+            b->err = true;
+            return;
+        }
+        b->data = d;
+        b->cap = cap;
+    }
+
+    if (p != NULL)
+        memcpy(b->data + b->len, p, len);
+    else
+        memset(b->data + b->len, 0, len);
+    b->len += len;
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_putv()
+*	Appends varint 'v' to buffer 'b'.
+*/
+
+static void fpdb_putv(struct fpat_dbbuf *b, uint64_t v)
+{
+    unsigned char	buf[10];
+    int			n;
+
+    for (n = 0;  v >= 0x80;  v >>= 7)
+        buf[n++] = (unsigned char) (v | 0x80);
+    buf[n++] = (unsigned char) v;
+    fpdb_put(b, buf, n);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_getv()
+*	Reads a varint from '*pp', which must end before 'end', into '*v'.
+*
+* Returns
+*	True if successful, otherwise false.
+*/
+
+static int fpdb_getv(const unsigned char **pp, const unsigned char *end,
+    uint64_t *v)
+{
+    const unsigned char *	p;
+    int				shift;
+
+    *v = 0;
+    for (p = *pp, shift = 0;  p < end  &&  shift < 64;  p++, shift += 7)
+    {
+        *v |= (uint64_t) (*p & 0x7F) << shift;
+        if ((*p & 0x80) == 0)
+        {
+            *pp = p+1;
+            return (true);
+        }
+    }
+    return (false);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_cmpname()
+*	Compares two names, for qsort().
+*/
+
+static int fpdb_cmpname(const void *a, const void *b)
+{
+    return (strcmp(*(const char *const *) a, *(const char *const *) b));
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_sort()
+*	Sorts the (trigram, block) pairs 'keys[0...n-1]' by trigram, using
+*	'tmp[0...n-1]' as scratch space.  Pairs with the same trigram are kept
+*	in the order they were in, so that their blocks stay sorted.
+*
+* Returns
+*	The sorted pairs, which are in either 'keys' or 'tmp'.
+*/
+
+static uint64_t *fpdb_sort(uint64_t *keys, uint64_t *tmp, size_t n)
+{
+    size_t	counts[256];
+    size_t	i, sum, c;
+    uint64_t *	t;
+    int		shift;
+
+    /* Radix sort each byte of the trigrams, lowest first */
+    for (shift = 32;  shift < 56;  shift += 8)
+    {
+        memset(counts, 0, sizeof(counts));
+        for (i = 0;  i < n;  i++)
+            counts[(keys[i] >> shift) & 0xFF]++;
+
+        for (i = 0, sum = 0;  i < 256;  i++)
+        {
+            c = counts[i];
+            counts[i] = sum;
+            sum += c;
+        }
+
+        for (i = 0;  i < n;  i++)
+            tmp[counts[(keys[i] >> shift) & 0xFF]++] = keys[i];
+
+        t = keys;
+        keys = tmp;
+        tmp = t;
+    }
+    return (keys);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_build()
+*	Builds a segment holding sorted, distinct names 'names[0...n-1]' into
+*	buffer 'b'.
+*
+* Returns
+*	Zero if successful, otherwise an 'errno' code.
+*/
+
+static int fpdb_build(struct fpat_dbbuf *b, const char *const *names,
+    size_t n)
+{
+    struct fpat_dbhdr	hdr;
+    struct fpat_dbgram	g;
+    uint64_t *		offs;
+    uint64_t *		keys;
+    uint64_t *		seen;
+    uint64_t *		p;
+    uint64_t		key;
+    size_t		nkeys, cap;
+    size_t		nseen, chars;
+    size_t		nblocks, ngrams;
+    size_t		maxlen;
+    size_t		len, prev, shared;
+    size_t		i, j, k, m, h;
+    uint32_t		blk;
+    uint64_t		post;
+
+    nblocks = (n + FPDB_BLOCK-1) / FPDB_BLOCK;
+    if (nblocks >= 0xFFFFFFFFUL)
+        return (EFBIG);
+
+    offs = (uint64_t *) malloc((nblocks+1) * sizeof(uint64_t));
+    keys = NULL;
+    seen = NULL;
+    nkeys = 0;
+    cap = 0;
+    nseen = 0;
+    maxlen = 0;
+    if (offs == NULL)
+        return (ENOMEM);
+
+    /* Write the names, front coded, a block at a time */
+    memset(&hdr, 0, sizeof(hdr));
+    fpdb_put(b, &hdr, sizeof(hdr));
+
+    for (i = 0;  i < n  &&  !b->err;  i += FPDB_BLOCK)
+    {
+        blk = (uint32_t) (i / FPDB_BLOCK);
+        offs[blk] = b->len;
+        prev = 0;
+
+        /* Size the set of trigrams seen in the block, and the pair list */
+        for (j = i, chars = 0;  j < n  &&  j < i + FPDB_BLOCK;  j++)
+            chars += strlen(names[j]);
+
+        if (nseen < chars*2)
+        {
+            for (nseen = (nseen > 0 ? nseen : 1024);  nseen < chars*2;  )
+                nseen *= 2;
+            free(seen);
+            seen = (uint64_t *) calloc(nseen, sizeof(uint64_t));
+        }
+        if (cap < nkeys + chars)
+        {
+            cap = (cap > 0 ? cap*2 : 4096);
+            if (cap < nkeys + chars)
+                cap = nkeys + chars;
+            p = (uint64_t *) realloc(keys, cap*sizeof(uint64_t));
+            if (p == NULL)
+            {
+                b->err = true;
+                break;
+            }
+            keys = p;
+        }
+        if (seen == NULL)
+        {
+            b->err = true;
+            break;
+        }
+
+        for (j = i;  j < n  &&  j < i + FPDB_BLOCK;  j++)
+        {
+            len = strlen(names[j]);
+            if (len > maxlen)
+                maxlen = len;
+
+            shared = 0;
+            if (j > i)
+            {
+                while (shared < len  &&  shared < prev  &&
+                        names[j][shared] == names[j-1][shared])
+                    shared++;
+            }
+            fpdb_putv(b, shared);
+            fpdb_putv(b, len - shared);
+            fpdb_put(b, names[j] + shared, len - shared);
+            prev = len;
+
+            /* Add each trigram not yet seen in the block to the list */
+            for (k = 0;  k+3 <= len;  k++)
+            {
+                key = (uint64_t) fpdb_gram(names[j] + k) << 32 | blk;
+                h = (size_t) (((key >> 32) * 0x9E3779B1UL) >> 12) & (nseen-1);
+                while (seen[h] != 0  &&  (uint32_t) (seen[h]-1) == blk  &&
+                        seen[h]-1 != key)
+                    h = (h+1) & (nseen-1);
+
+                if (seen[h] == 0  ||  (uint32_t) (seen[h]-1) != blk)
+                {
+                    seen[h] = key+1;
+                    keys[nkeys++] = key;
+                }
+            }
+        }
+    }
+    offs[nblocks] = b->len;
+    free(seen);
+
+    /* Write the block offsets */
+    fpdb_put(b, NULL, (8 - b->len % 8) % 8);
+    hdr.blocks = b->len;
+    fpdb_put(b, offs, (nblocks+1) * sizeof(uint64_t));
+    free(offs);
+
+    /* Sort the pairs by trigram */
+    p = (uint64_t *) malloc((nkeys > 0 ? nkeys : 1)*sizeof(uint64_t));
+    if (p == NULL)
+        b->err = true;
+    else if (fpdb_sort(keys, p, nkeys) == p)
+    {
+        free(keys);
+        keys = p;
+    }
+    else
+        free(p);
+
+    /* Write the trigrams, then their postings */
+    ngrams = 0;
+    for (k = 0;  k < nkeys  &&  !b->err;  k++)
+    {
+        if (k == 0  ||  keys[k] >> 32 != keys[k-1] >> 32)
+            ngrams++;
+    }
+
+    hdr.grams = b->len;
+    post = b->len + ngrams * sizeof(struct fpat_dbgram);
+    for (k = 0;  k < nkeys  &&  !b->err;  k = m)
+    {
+        for (m = k+1;  m < nkeys  &&  keys[m] >> 32 == keys[k] >> 32;  m++)
+            ;
+        g.gram = (uint32_t) (keys[k] >> 32);
+        g.count = (uint32_t) (m - k);
+        g.post = post;
+        fpdb_put(b, &g, sizeof(g));
+        post += (m - k) * sizeof(uint32_t);
+    }
+
+    for (k = 0;  k < nkeys  &&  !b->err;  k++)
+    {
+        blk = (uint32_t) keys[k];
+        fpdb_put(b, &blk, sizeof(blk));
+    }
+    free(keys);
+    fpdb_put(b, NULL, (8 - b->len % 8) % 8);
+
+    if (b->err)
+        return (ENOMEM);
+
+    /* Fill in the header */
+    memcpy(hdr.magic, FPDB_MAGIC, sizeof(hdr.magic));
+    hdr.order = FPDB_ORDER;
+    hdr.block = FPDB_BLOCK;
+    hdr.size = b->len;
+    hdr.nnames = n;
+    hdr.nblocks = nblocks;
+    hdr.ngrams = ngrams;
+    hdr.maxlen = maxlen;
+    memcpy(b->data, &hdr, sizeof(hdr));
+
+    DL(printf("fpdb_build: names=%lu, blocks=%lu, grams=%lu, size=%lu\n",
+        (unsigned long) n, (unsigned long) nblocks, (unsigned long) ngrams,
+        (unsigned long) b->len));
+    return (0);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_segment()
+*	Checks the segment at 'base', within the 'avail' bytes that remain in
+*	the file, and sets up 'sp' to refer to it.  'base' must be aligned on
+*	an 8-byte boundary.
+*
+* Returns
+*	The size of the segment, or zero if it is incomplete or malformed.
+*/
+
+static size_t fpdb_segment(const unsigned char *base, size_t avail,
+    struct fpat_dbseg *sp)
+{
+    const struct fpat_dbhdr *	hdr;
+    const uint64_t *		blocks;
+    uint64_t			i;
+
+    hdr = (const struct fpat_dbhdr *) base;
+    if (avail < sizeof(*hdr)  ||
+            memcmp(hdr->magic, FPDB_MAGIC, sizeof(hdr->magic)) != 0  ||
+            hdr->order != FPDB_ORDER  ||  hdr->block == 0)
+        return (0);
+
+    /* Check that the parts of the segment lie within it, in order */
+    if (hdr->size > avail  ||  hdr->size % 8 != 0  ||
+            hdr->nblocks != hdr->nnames/hdr->block +
+                (hdr->nnames%hdr->block != 0)  ||
+            hdr->blocks % 8 != 0  ||  hdr->blocks < sizeof(*hdr)  ||
+            hdr->blocks > hdr->size  ||
+            hdr->nblocks >= (hdr->size - hdr->blocks)/8  ||
+            hdr->grams % 8 != 0  ||
+            hdr->grams < hdr->blocks + (hdr->nblocks+1)*8  ||
+            hdr->grams > hdr->size  ||
+            hdr->ngrams > (hdr->size - hdr->grams) /
+                sizeof(struct fpat_dbgram))
+        return (0);
+
+    blocks = (const uint64_t *) (base + hdr->blocks);
+    for (i = 0;  i <= hdr->nblocks;  i++)
+    {
+        if (blocks[i] < (i == 0 ? sizeof(*hdr) : blocks[i-1])  ||
+                blocks[i] > hdr->blocks)
+            return (0);
+    }
+
+    sp->base = base;
+    sp->hdr = hdr;
+    sp->blocks = blocks;
+    sp->grams = (const struct fpat_dbgram *) (base + hdr->grams);
+    return ((size_t) hdr->size);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_first()
+*	Compares the first name of block 'blk' of segment 'sp' with the literal
+*	prefix of query 'q'.
+*
+* Returns
+*	Less than zero if the name comes before every name with the prefix,
+*	zero if it has the prefix, or greater than zero if it comes after them.
+*/
+
+static int fpdb_first(const struct fpat_dbseg *sp, uint64_t blk,
+    const struct fpat_dbquery *q)
+{
+    const unsigned char *	p;
+    const unsigned char *	end;
+    uint64_t			shared, len;
+    int				cmp;
+
+    p = sp->base + sp->blocks[blk];
+    end = sp->base + sp->blocks[blk+1];
+    if (!fpdb_getv(&p, end, &shared)  ||  !fpdb_getv(&p, end, &len)  ||
+            len > (uint64_t) (end - p))
+        return (0);
+
+    cmp = memcmp(p, q->runs, len < q->prelen ? (size_t) len : q->prelen);
+    if (cmp == 0  &&  len < q->prelen)
+        cmp = -1;
+    return (cmp);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_block()
+*	Matches the names in block 'blk' of segment 'sp' for query 'q'.
+*/
+
+static void fpdb_block(struct fpat_dbquery *q, const struct fpat_dbseg *sp,
+    uint64_t blk)
+{
+    const unsigned char *	p;
+    const unsigned char *	end;
+    uint64_t			shared, rest;
+    uint64_t			i, n;
+    size_t			len;
+
+    p = sp->base + sp->blocks[blk];
+    end = sp->base + sp->blocks[blk+1];
+    n = sp->hdr->nnames - blk*sp->hdr->block;
+    if (n > sp->hdr->block)
+        n = sp->hdr->block;
+
+    len = 0;
+    for (i = 0;  i < n;  i++)
+    {
+        /* Decode the next name */
+        if (!fpdb_getv(&p, end, &shared)  ||  !fpdb_getv(&p, end, &rest)  ||
+                shared > len  ||  rest > (uint64_t) (end - p)  ||
+                rest > q->maxlen - shared)
+        {
+            q->err = EINVAL;
+            return;
+        }
+        memcpy(q->name + shared, p, (size_t) rest);
+        p += rest;
+        len = (size_t) (shared + rest);
+
+        if (q->prog == NULL  ||  fpattern_exec_len(q->prog, q->name, len))
+        {
+            q->count++;
+            q->name[len] = '\0';
+            if (q->fn != NULL  &&  q->fn(q->name, len, q->arg) != 0)
+            {
+                q->stop = true;
+                return;
+            }
+        }
+    }
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_find()
+*	Finds trigram 'gram' in segment 'sp', and sets up 'pp' to refer to its
+*	postings.
+*
+* Returns
+*	True if the trigram is found, otherwise false.
+*/
+
+static int fpdb_find(const struct fpat_dbseg *sp, uint32_t gram,
+    struct fpat_dbpost *pp)
+{
+    const struct fpat_dbgram *	g;
+    uint64_t			lo, hi, mid;
+
+    lo = 0;
+    hi = sp->hdr->ngrams;
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo)/2;
+        if (sp->grams[mid].gram < gram)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    if (lo == sp->hdr->ngrams  ||  sp->grams[lo].gram != gram)
+        return (false);
+
+    g = &sp->grams[lo];
+    if (g->post % 4 != 0  ||  g->post > sp->hdr->size  ||
+            g->count > (sp->hdr->size - g->post)/4)
+        return (false);
+
+    pp->p = (const uint32_t *) (sp->base + g->post);
+    pp->n = g->count;
+    pp->at = 0;
+    return (true);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_has()
+*	Determines whether postings 'pp' contain block 'blk', which must not be
+*	less than any block asked about before.
+*/
+
+static int fpdb_has(struct fpat_dbpost *pp, uint32_t blk)
+{
+    size_t	lo, hi, mid;
+
+    lo = pp->at;
+    hi = pp->n;
+    while (lo < hi)
+    {
+        mid = lo + (hi - lo)/2;
+        if (pp->p[mid] < blk)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    pp->at = lo;
+    return (lo < pp->n  &&  pp->p[lo] == blk);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_search()
+*	Matches the names in segment 'sp' for query 'q'.
+*/
+
+static void fpdb_search(struct fpat_dbquery *q, const struct fpat_dbseg *sp)
+{
+    const char *	r;
+    uint64_t		lo, hi, mid;
+    uint64_t		blk;
+    size_t		len;
+    size_t		nposts;
+    size_t		i, j, best;
+    int			k;
+
+    /* Narrow the blocks to those that may hold names with the prefix */
+    lo = 0;
+    hi = sp->hdr->nblocks;
+    if (q->prelen > 0)
+    {
+        uint64_t	a, b;
+
+        /* The first block whose first name is not before the prefix */
+        for (a = 0, b = hi;  a < b;  )
+        {
+            mid = a + (b - a)/2;
+            if (fpdb_first(sp, mid, q) < 0)
+                a = mid+1;
+            else
+                b = mid;
+        }
+        lo = (a > 0 ? a-1 : 0);
+
+        /* The first block whose first name is after the prefix */
+        for (b = hi;  a < b;  )
+        {
+            mid = a + (b - a)/2;
+            if (fpdb_first(sp, mid, q) <= 0)
+                a = mid+1;
+            else
+                b = mid;
+        }
+        hi = a;
+    }
+
+    /* Find the postings of every trigram of the required runs */
+    nposts = 0;
+    for (r = q->runs, k = 0;  k < q->nruns;  k++, r += len+1)
+    {
+        len = strlen(r);
+        for (i = 0;  i+3 <= len;  i++)
+        {
+            if (!fpdb_find(sp, fpdb_gram(r + i), &q->posts[nposts]))
+                return;			/* No name has the trigram */
+            nposts++;
+        }
+    }
+
+    if (nposts == 0)
+    {
+        /* Match every name in the blocks */
+        for (blk = lo;  blk < hi  &&  !q->stop  &&  !q->err;  blk++)
+            fpdb_block(q, sp, blk);
+        return;
+    }
+
+    /* Intersect the postings, starting from the shortest */
+    best = 0;
+    for (i = 1;  i < nposts;  i++)
+    {
+        if (q->posts[i].n < q->posts[best].n)
+            best = i;
+    }
+
+    for (i = 0;  i < q->posts[best].n  &&  !q->stop  &&  !q->err;  i++)
+    {
+        blk = q->posts[best].p[i];
+        if (blk < lo)
+            continue;
+        if (blk >= hi)
+            break;
+
+        for (j = 0;  j < nposts;  j++)
+        {
+            if (j != best  &&  !fpdb_has(&q->posts[j], (uint32_t) blk))
+                break;
+        }
+        if (j == nposts)
+            fpdb_block(q, sp, blk);
+    }
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_load()
+*	Maps the index file open as 'fd' into 'db', and finds its segments.
+*
+* Returns
+*	Zero if successful, otherwise an 'errno' code.
+*/
+
+static int fpdb_load(fpattern_db_t *db, int fd)
+{
+    struct fpat_dbseg	seg;
+    struct fpat_dbseg *	segs;
+    struct stat		st;
+    size_t		size;
+
+    /* Map the file */
+    if (fstat(fd, &st) < 0)
+        return (errno);
+    if (st.st_size == 0)
+        return (0);
+
+    db->len = (size_t) st.st_size;
+    db->map = mmap(NULL, db->len, PROT_READ, MAP_SHARED, fd, 0);
+    if (db->map == MAP_FAILED)
+    {
+        db->map = NULL;
+        return (errno);
+    }
+
+    /* Find the segments, up to any incomplete one */
+    for (db->end = 0;  db->end < db->len;  db->end += size)
+    {
+        size = fpdb_segment((const unsigned char *) db->map + db->end,
+            db->len - db->end, &seg);
+        if (size == 0)
+        {
+            if (db->end == 0  &&  db->len >= sizeof(struct fpat_dbhdr))
+                return (EINVAL);	/* Not an index file */
+            break;
+        }
+
+        segs = (struct fpat_dbseg *)
+            realloc(db->segs, (db->nsegs+1)*sizeof(struct fpat_dbseg));
+        if (segs == NULL)
+            return (ENOMEM);
+        db->segs = segs;
+        db->segs[db->nsegs++] = seg;
+        if (seg.hdr->maxlen > db->maxlen)
+            db->maxlen = (size_t) seg.hdr->maxlen;
+    }
+    return (0);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_run()
+*	Matches the names in every segment of index 'db' for query 'q', whose
+*	required runs are already set.
+*
+* Returns
+*	Zero if successful, otherwise an 'errno' code.
+*/
+
+static int fpdb_run(const fpattern_db_t *db, struct fpat_dbquery *q,
+    size_t size)
+{
+    int		i;
+
+    q->maxlen = db->maxlen;
+    q->posts = (struct fpat_dbpost *) malloc((size+1)*sizeof(*q->posts));
+    q->name = (char *) malloc(q->maxlen+1);
+    if (q->posts == NULL  ||  q->name == NULL)
+        q->err = ENOMEM;
+
+    /* Search each segment in turn */
+    for (i = 0;  i < db->nsegs  &&  !q->stop  &&  q->err == 0;  i++)
+        fpdb_search(q, &db->segs[i]);
+
+    free(q->posts);
+    free(q->name);
+    return (q->err);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpdb_write()
+*	Writes 'len' bytes 'p' to file 'fd' at offset 'off'.
+*
+* Returns
+*	Zero if successful, otherwise an 'errno' code.
+*/
+
+static int fpdb_write(int fd, const unsigned char *p, size_t len, off_t off)
+{
+    ssize_t	n;
+
+    while (len > 0)
+    {
+        n = pwrite(fd, p, len, off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return (errno);
+        }
+        p += n;
+        len -= n;
+        off += n;
+    }
+    return (0);
+}
+
+#endif /* UNIX */
+
+
+/*------------------------------------------------------------------------------
+* fpattern_db_add()
+*	Adds names 'names[0...count-1]' to the index file 'path', which is
+*	created if it does not exist, as a new segment at the end of it.
+*
+* Returns
+*	Zero if successful, otherwise -1, in which case 'errno' is set.
+*
+* Caveats
+*	A name that is already in another segment is stored again, and is
+*	found once for each segment holding it until the file is merged.
+*
+*	Only one process may add to or merge a file at a time, but any number
+*	may have it open.  They do not see the new segment until they open the
+*	file again.
+*
+* See also
+*	fpattern_db_merge(), fpattern_db_open().
+*/
+
+int fpattern_db_add(const char *path, const char *const *names, size_t count)
+{
+#if UNIX
+    fpattern_db_t *	db;
+    struct fpat_dbbuf	b;
+    const char **	sorted;
+    size_t		end, size;
+    size_t		i, n;
+    int			fd;
+    int			err;
+
+    DL(printf("fpattern_db_add: path=%p:\"%s\", count=%lu\n",
+        path, path ? path : "", (unsigned long) count));
+
+    /* Check args */
+    if (path == NULL  ||  (names == NULL  &&  count > 0))
+    {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    /* Sort the names, dropping duplicates */
+    sorted = (const char **) malloc((count > 0 ? count : 1)*sizeof(char *));
+    if (sorted == NULL)
+    {
+        errno = ENOMEM;
+        return (-1);
+    }
+    memcpy(sorted, names, count*sizeof(char *));
+    qsort(sorted, count, sizeof(char *), fpdb_cmpname);
+    for (i = 0, n = 0;  i < count;  i++)
+    {
+        if (n == 0  ||  strcmp(sorted[i], sorted[n-1]) != 0)
+            sorted[n++] = sorted[i];
+    }
+
+    memset(&b, 0, sizeof(b));
+    err = fpdb_build(&b, sorted, n);
+    free(sorted);
+
+    /* Find the end of the last complete segment */
+    fd = -1;
+    end = 0;
+    size = 0;
+    if (err == 0)
+    {
+        fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0666);
+        db = (fpattern_db_t *) calloc(1, sizeof(fpattern_db_t));
+        if (fd < 0)
+            err = errno;
+        else if (db == NULL)
+            err = ENOMEM;
+        else
+            err = fpdb_load(db, fd);
+
+        if (db != NULL)
+        {
+            end = db->end;
+            size = db->len;
+        }
+        fpattern_db_close(db);
+    }
+
+    /* Write the new segment over any incomplete one left there */
+    if (err == 0  &&  end < size  &&  ftruncate(fd, (off_t) end) < 0)
+        err = errno;
+    if (err == 0)
+        err = fpdb_write(fd, b.data, b.len, (off_t) end);
+    if (err == 0  &&  fsync(fd) < 0)
+        err = errno;
+
+    if (fd >= 0)
+        close(fd);
+    free(b.data);
+
+    if (err != 0)
+    {
+        errno = err;
+        return (-1);
+    }
+    return (0);
+#else
+    (void) path;
+    (void) names;
+    (void) count;
+
+    errno = ENOSYS;
+    return (-1);
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_db_open()
+*	Opens the index file 'path', mapping it into memory.
+*
+* Returns
+*	The open index, or null on error, in which case 'errno' is set.  This
+*	must be released by fpattern_db_close().
+*
+* Caveats
+*	Any segment following an incomplete or malformed one is ignored.
+*
+* See also
+*	fpattern_db_add(), fpattern_db_query(), fpattern_db_close().
+*/
+
+fpattern_db_t *fpattern_db_open(const char *path)
+{
+#if UNIX
+    fpattern_db_t *	db;
+    int			fd;
+    int			err;
+
+    DL(printf("fpattern_db_open: path=%p:\"%s\"\n", path, path ? path : ""));
+
+    /* Check args */
+    if (path == NULL)
+    {
+        errno = EINVAL;
+        return (NULL);
+    }
+
+    db = (fpattern_db_t *) calloc(1, sizeof(fpattern_db_t));
+    if (db == NULL)
+    {
+        errno = ENOMEM;
+        return (NULL);
+    }
+
+    /* Map the file and find its segments */
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        err = errno;
+    else
+    {
+        err = fpdb_load(db, fd);
+        close(fd);
+    }
+
+    if (err != 0)
+    {
+        fpattern_db_close(db);
+        errno = err;
+        return (NULL);
+    }
+
+    DL(printf("fpattern_db_open: segs=%d\n", db->nsegs));
+    return (db);
+#else
+    (void) path;
+
+    errno = ENOSYS;
+    return (NULL);
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_db_query()
+*	Finds the names in open index 'db' that match compiled pattern 'prog'.
+*	Each matching name is passed to 'fn', along with its length and 'arg',
+*	in sorted (strcmp()) order within each segment.
+*
+* Returns
+*	The number of matching names, or -1 on error, in which case 'errno' is
+*	set.  If 'fn' returns nonzero, the query stops, and the number of names
+*	found so far is returned.
+*
+* Caveats
+*	The name passed to 'fn' is only valid until it returns.  'fn' may be
+*	null, to count the matching names.
+*
+*	Any number of threads may query the same index at once.
+*
+*	A pattern without a literal run of three or more chars, as found by
+*	fpattern_required(), or a literal prefix, is matched against every name.
+*
+* See also
+*	fpattern_db_open(), fpattern_required(), fpattern_exec().
+*/
+
+long fpattern_db_query(const fpattern_db_t *db, const fpattern_t *prog,
+    fpattern_glob_f fn, void *arg)
+{
+#if UNIX
+    struct fpat_dbquery	q;
+    char *		runs;
+    size_t		size;
+    int			err;
+
+    /* Check args */
+    if (db == NULL  ||  prog == NULL)
+    {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    memset(&q, 0, sizeof(q));
+    q.prog = prog;
+    q.fn = fn;
+    q.arg = arg;
+
+    /* Find the runs of literal chars that every matching name contains */
+    runs = NULL;
+    for (size = FPDB_RUNS;  size <= FPDB_MAXRUNS;  size *= 2)
+    {
+        free(runs);
+        runs = (char *) malloc(size);
+        if (runs == NULL)
+            break;
+        q.nruns = fpattern_required(prog, runs, size, &q.prelen);
+        if (q.nruns >= 0)
+            break;
+    }
+    if (q.nruns < 0)
+    {
+        q.nruns = 0;			/* Too many, so do without */
+        q.prelen = 0;
+    }
+    q.runs = runs;
+
+    err = (runs != NULL ? fpdb_run(db, &q, size) : ENOMEM);
+    free(runs);
+
+    if (err != 0)
+    {
+        errno = err;
+        return (-1);
+    }
+
+    DL(printf("fpattern_db_query: return %ld\n", q.count));
+    return (q.count);
+#else
+    (void) db;
+    (void) prog;
+    (void) fn;
+    (void) arg;
+
+    errno = ENOSYS;
+    return (-1);
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_db_close()
+*	Closes open index 'db'.
+*
+* Caveats
+*	If 'db' is null, nothing is done.
+*/
+
+void fpattern_db_close(fpattern_db_t *db)
+{
+#if UNIX
+    if (db == NULL)
+        return;
+
+    if (db->map != NULL)
+        munmap(db->map, db->len);
+    free(db->segs);
+    free(db);
+#else
+    (void) db;
+#endif
+}
+
+
+#if UNIX
+
+/*------------------------------------------------------------------------------
+* fpdb_collect()
+*	Adds a name to the list of names being merged.
+*/
+
+static int fpdb_collect(const char *name, size_t len, void *arg)
+{
+    struct fpat_dbbuf *	b;
+
+    b = (struct fpat_dbbuf *) arg;
+    fpdb_put(b, name, len+1);
+    return (b->err);
+}
+
+#endif /* UNIX */
+
+
+/*------------------------------------------------------------------------------
+* fpattern_db_merge()
+*	Rewrites the index file 'path' with all of the names in its segments
+*	merged into a single segment.
+*
+* Returns
+*	Zero if successful, otherwise -1, in which case 'errno' is set.
+*
+* Caveats
+*	The merged file is written to "'path'.tmp" and then renamed over
+*	'path', so processes that have the file open keep seeing the old one
+*	until they open it again.
+*
+*	Every name is held in memory while the file is merged.
+*
+* See also
+*	fpattern_db_add().
+*/
+
+int fpattern_db_merge(const char *path)
+{
+#if UNIX
+    fpattern_db_t *	db;
+    struct fpat_dbquery	q;
+    struct fpat_dbbuf	b;
+    const char **	names;
+    char *		tmp;
+    char *		p;
+    long		n;
+    size_t		i;
+    int			err;
+
+    DL(printf("fpattern_db_merge: path=%p:\"%s\"\n", path, path ? path : ""));
+
+    /* Check args */
+    if (path == NULL)
+    {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    /* Collect every name */
+    db = fpattern_db_open(path);
+    if (db == NULL)
+        return (-1);
+
+    memset(&b, 0, sizeof(b));
+    memset(&q, 0, sizeof(q));
+    q.fn = fpdb_collect;
+    q.arg = &b;
+    err = fpdb_run(db, &q, 0);
+    if (err == 0  &&  b.err)
+        err = ENOMEM;
+    n = q.count;
+    fpattern_db_close(db);
+
+    /* Write them out as a single segment */
+    names = NULL;
+    tmp = NULL;
+    if (err == 0)
+    {
+        names = (const char **) malloc((n > 0 ? n : 1)*sizeof(char *));
+        tmp = (char *) malloc(strlen(path) + 5);
+        if (names == NULL  ||  tmp == NULL)
+            err = ENOMEM;
+    }
+
+    if (err == 0)
+    {
+        for (i = 0, p = (char *) b.data;  i < (size_t) n;  i++)
+        {
+            names[i] = p;
+            p += strlen(p)+1;
+        }
+
+        sprintf(tmp, "%s.tmp", path);
+        unlink(tmp);
+        if (fpattern_db_add(tmp, names, (size_t) n) < 0)
+            err = errno;
+        else if (rename(tmp, path) < 0)
+        {
+            err = errno;
+            unlink(tmp);
+        }
+    }
+
+    free(names);
+    free(tmp);
+    free(b.data);
+
+    if (err != 0)
+    {
+        errno = err;
+        return (-1);
+    }
+    return (0);
+#else
+    (void) path;
+
+    errno = ENOSYS;
+    return (-1);
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+*/
+/*------------------------------------------------------------------------------
+*/
+/*------------------------------------------------------------------------------
+*/
+
+
+#if TEST
+
+/* Local variables */
+
+static int	count =	0;
+static int	fails =	0;
+
+
+/*------------------------------------------------------------------------------
+* found()
+*	Prints a matching name.
+*/
+
+static int found(const char *name, size_t len, void *arg)
+{
+    (void) arg;
+
+    printf("    %.*s\n", (int) len, name);
+    return (0);
+}
+
+
+/*------------------------------------------------------------------------------
+* test()
+*	Queries the index file 'path' with pattern 'pat', compiled with option
+*	'flags', and checks that 'expect' names match.
+*/
+
+static void test(const char *path, long expect, int flags, const char *pat)
+{
+    fpattern_db_t *	db;
+    fpattern_t *	prog;
+    long		n;
+
+    count++;
+    printf("%3d. \"%s\"\n", count, pat);
+
+    n = -1;
+    db = fpattern_db_open(path);
+    prog = fpattern_compile_flags(pat, strlen(pat), flags, NULL);
+    if (db != NULL  &&  prog != NULL)
+        n = fpattern_db_query(db, prog, found, NULL);
+    fpattern_free(prog);
+    fpattern_db_close(db);
+
+    printf("    -> %ld, expected %ld: %s\n\n", n, expect,
+        n == expect ? "pass" : "FAIL ***");
+
+    if (n != expect)
+        fails++;
+}
+
+
+/*------------------------------------------------------------------------------
+* main()
+*	Test driver.
+*/
+
+int main(int argc, char **argv)
+{
+    static const char *	names1[] =
+    {
+        "report-2024-q1.pdf", "report-2023.pdf", "src/lib/fpattern.c",
+        "src/lib/fpattern.h", "src/fpdb.c", "notes.txt", "notes.txt",
+        "README.md", "2024/report.pdf", "a"
+    };
+    static const char *	names2[] =
+    {
+        "report-2024-q2.pdf", "src/lib/fpdb.h", "notes.txt", "zz"
+    };
+    char	path[] = "/tmp/fpdbXXXXXX";
+    char	buf[300];
+    const char *	names[200];
+    char	store[200][12];
+    FILE *	fp;
+    int		fd;
+    int		i;
+
+    (void) argc;	/* Shut up lint */
+    (void) argv;	/* Shut up lint */
+
+    printf("==========================================\n");
+
+    fd = mkstemp(path);
+    if (fd < 0)
+    {
+        perror(path);
+        return (1);
+    }
+    close(fd);
+    unlink(path);
+
+    /* Build an index of two segments */
+    if (fpattern_db_add(path, names1, 10) < 0  ||
+            fpattern_db_add(path, names2, 4) < 0)
+    {
+        perror(path);
+        return (1);
+    }
+
+    test(path, 2,	0, "*report*2024*.pdf");
+    test(path, 3,	0, "*2024*");
+    test(path, 3,	0, "src/lib/*");
+    test(path, 2,	0, "notes.txt");
+    test(path, 1,	0, "a");
+    test(path, 13,	0, "*");
+    test(path, 0,	0, "*xyzzy*");
+    test(path, 0,	0, "*.PDFX");
+
+    /* Merge the segments */
+    count++;
+    i = fpattern_db_merge(path);
+    printf("%3d. merge -> %d: %s\n\n", count, i, i == 0 ? "pass" : "FAIL ***");
+    if (i != 0)
+        fails++;
+
+    test(path, 2,	0, "*report*2024*.pdf");
+    test(path, 1,	0, "notes.txt");
+    test(path, 3,	0, "src/lib/*");
+    test(path, 4,	FPAT_NOCASE, "*REPORT*.PDF");
+    test(path, 1,	FPAT_DELIM, "src/*");
+
+    /* Many names, with an incomplete segment appended after them */
+    for (i = 0;  i < 200;  i++)
+    {
+        sprintf(store[i], "f%03d.%s", i, i%3 == 0 ? "txt" : "dat");
+        names[i] = store[i];
+    }
+    fpattern_db_add(path, names, 200);
+    fp = fopen(path, "ab");
+    if (fp != NULL)
+    {
+        memset(buf, 0, sizeof(buf));
+        memcpy(buf, FPDB_MAGIC, 8);
+        fwrite(buf, 1, sizeof(buf), fp);
+        fclose(fp);
+    }
+
+    test(path, 67,	0, "f*.txt");
+    test(path, 10,	0, "f19?.*");
+    test(path, 1,	0, "f124.dat");
+
+    fpattern_db_add(path, names2, 1);
+    test(path, 3,	0, "*2024-q?.pdf");
+
+    unlink(path);
+
+    printf("%d tests, %d failures\n", count, fails);
+    return (fails == 0 ? 0 : 1);
+}
+
+#endif /* TEST */
@@ -0,0 +1,788 @@
+/*******************************************************************************
+* fpfilter.c
+*	Command line tool that filters a list of filenames through one or more
+*	filename patterns.
+*
+* Usage
+*	fpattern-filter [-0] [-c] [-v] [-j threads] [-e pattern]... [pattern]
+*	    [file]...
+*
+*	Reads a list of filenames, one per line (or, with -0, separated by null
+*	chars, as written by "find -print0"), from each 'file' or from the
+*	standard input, and writes the ones that match any of the patterns to
+*	the standard output, in the same order and with the same separators.
+*
+*	    -0		Names are separated by null chars instead of newlines.
+*	    -c		Write only the number of matching names.
+*	    -e pattern	Match 'pattern' (may be repeated).  Without -e, the
+*			first argument is the pattern.
+*	    -j threads	Match with 'threads' threads (default is one per CPU).
+*	    -v		Write the names that do not match instead.
+*
+*	The exit status is 0 if any names were written, 1 if none were, and 2
+*	on error.
+*
+*	Build with:
+*
+*	    cc -O2 -o fpattern-filter fpfilter.c fpattern.c -lpthread
+*
+* Notes
+*	Regular files are mapped into memory; other input is read in large
+*	blocks.  The input is split into chunks of about FLT_CHUNK bytes, each
+*	ending at a separator, which are matched by a pool of threads and
+*	written out strictly in input order as they are completed.  Each chunk
+*	passes through one of a ring of slots, so that the memory in use stays
+*	bounded however large the input is.
+*
+*	A single pattern is compiled once and shared by the threads; several
+*	patterns are matched as a pattern set, of which each thread has its
+*	own.
+*
+*	Memory mapping and threads require a POSIX system; elsewhere the input
+*	is read and matched by a single thread.
+*/
+
+
+/* System includes */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(unix) || defined(_unix) || defined(__unix)
+ #define UNIX	1
+#else
+ #define UNIX	0
+#endif
+
+#if UNIX
+ #include <sys/mman.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#else
+ #include <io.h>
+#endif
+
+#if UNIX  &&  defined(__GNUC__)
+ #include <pthread.h>
+ #define THREADS	1
+#else
+ #define THREADS	0
+#endif
+
+
+/* Local includes */
+
+#include "fpattern.h"
+
+
+/* Local constants */
+
+#ifndef false
+ #define false		0
+#endif
+
+#ifndef true
+ #define true		1
+#endif
+
+#ifndef O_BINARY
+ #define O_BINARY	0
+#endif
+
+#define FLT_CHUNK	(1024L*1024)	/* Chunk size			*/
+#define FLT_MAXT	256		/* Max matching threads		*/
+
+#define FLT_FREE	0		/* Slot is free			*/
+#define FLT_BUSY	1		/* Slot is being matched	*/
+#define FLT_DONE	2		/* Slot is ready to write	*/
+
+
+/* Local types */
+
+struct flt_slot
+{
+    const char *	data;		/* Chunk of records		*/
+    size_t		len;		/* Chunk length			*/
+    char *		buf;		/* Chunk read buffer		*/
+    size_t		bufcap;		/* Allocated read buffer size	*/
+    char *		out;		/* Matching records		*/
+    size_t		outlen;		/* Matching records length	*/
+    size_t		outcap;		/* Allocated output size	*/
+    long		matches;	/* Matching records		*/
+    long		seq;		/* Chunk number			*/
+    int			state;		/* FLT_XXX			*/
+};
+
+struct flt_job
+{
+    const char *const *	pats;		/* [npats] patterns		*/
+    int			npats;		/* Patterns			*/
+    fpattern_t *	prog;		/* Single compiled pattern	*/
+    int			sep;		/* Record separator		*/
+    int			count;		/* Count only			*/
+    int			invert;		/* Write non-matching records	*/
+
+    int			fd;		/* Input file			*/
+    const char *	map;		/* Mapped input, or null	*/
+    size_t		mapsize;	/* Mapped input size		*/
+    size_t		pos;		/* Next mapped input offset	*/
+    char *		carry;		/* Partial record read ahead	*/
+    size_t		carrylen;	/* Partial record length	*/
+    size_t		carrycap;	/* Allocated partial record size */
+    int			eof;		/* No more chunks		*/
+    int			err;		/* Error code, or 0		*/
+
+    struct flt_slot *	slots;		/* [nslots] chunk slots		*/
+    int			nslots;		/* Chunk slots			*/
+    long		next;		/* Next chunk number		*/
+    long		matches;	/* Matching records written	*/
+#if THREADS
+    pthread_mutex_t	lock;		/* Job lock			*/
+    pthread_cond_t	cond;		/* Slot state change		*/
+#endif
+};
+
+
+/* Local variables */
+
+static const char *	prog_name =	"fpattern-filter";
+
+
+/*------------------------------------------------------------------------------
+* flt_reserve()
+*	Ensures that buffer '*buf' of '*cap' bytes holds at least 'len' bytes.
+*
+* Returns
+*	True on success, otherwise false.
+*/
+
+static int flt_reserve(char **buf, size_t *cap, size_t len)
+{
+    char *	p;
+    size_t	n;
+
+    if (len <= *cap)
+        return (true);
+
+    n = (*cap > 0 ? *cap : 4096);
+    while (n < len)
+        n *= 2;
+    p = (char *) realloc(*buf, n);
+    if (p == NULL)
+        return (false);
+    *buf = p;
+    *cap = n;
+    return (true);
+}
+
+
+/*------------------------------------------------------------------------------
+* flt_fill()
+*	Fills slot 's' with the next chunk of input records of job 'j'.  A chunk
+*	ends at a separator, unless it is the end of the input.
+*
+* Returns
+*	True on success, otherwise false if there is no more input, or on
+*	error, in which case 'j->err' is set.
+*
+* Caveats
+*	This must be called with the job locked.
+*/
+
+static int flt_fill(struct flt_job *j, struct flt_slot *s)
+{
+    const char *	p;
+    size_t		end;
+    size_t		len;
+    size_t		i;
+    long		n;
+
+    if (j->eof)
+        return (false);
+
+    if (j->map != NULL)
+    {
+        /* Take the next chunk of the mapped input, up to a separator */
+        if (j->pos >= j->mapsize)
+        {
+            j->eof = true;
+            return (false);
+        }
+
+        end = j->pos + FLT_CHUNK;
+        if (end >= j->mapsize)
+            end = j->mapsize;
+        else
+        {
+            p = (const char *) memchr(j->map + end, j->sep, j->mapsize - end);
+            end = (p != NULL ? (size_t) (p - j->map) + 1 : j->mapsize);
+        }
+
+        s->data = j->map + j->pos;
+        s->len = end - j->pos;
+        j->pos = end;
+        return (true);
+    }
+
+    /* Start with the partial record left over from the last chunk */
+    if (!flt_reserve(&s->buf, &s->bufcap, j->carrylen + FLT_CHUNK))
+        goto nomem;
+    if (j->carrylen > 0)
+        memcpy(s->buf, j->carry, j->carrylen);
+    len = j->carrylen;
+    j->carrylen = 0;
+
+    for (;;)
+    {
+        /* Read until the buffer is full or the input ends */
+        while (len < s->bufcap)
+        {
+            n = (long) read(j->fd, s->buf + len, s->bufcap - len);
+            if (n < 0  &&  errno == EINTR)
+                continue;
+            if (n < 0)
+            {
+                j->err = errno;
+                j->eof = true;
+                return (false);
+            }
+            if (n == 0)
+            {
+                j->eof = true;
+                break;
+            }
+            len += (size_t) n;
+        }
+
+        if (j->eof)
+        {
+            /* The last record need not end with a separator */
+            s->data = s->buf;
+            s->len = len;
+            return (len > 0);
+        }
+
+        /* End the chunk after its last separator */
+        for (i = len;  i > 0  &&  s->buf[i-1] != (char) j->sep;  i--)
+            ;
+        if (i > 0)
+            break;
+
+        /* A single record longer than the buffer */
+        if (!flt_reserve(&s->buf, &s->bufcap, s->bufcap*2))
+            goto nomem;
+    }
+
+    /* Keep the partial record for the next chunk */
+    if (!flt_reserve(&j->carry, &j->carrycap, len - i))
+        goto nomem;
+    memcpy(j->carry, s->buf + i, len - i);
+    j->carrylen = len - i;
+
+    s->data = s->buf;
+    s->len = i;
+    return (true);
+
+nomem:
+    j->err = ENOMEM;
+    j->eof = true;
+    return (false);
+}
+
+
+/*------------------------------------------------------------------------------
+* flt_match()
+*	Matches each record in slot 's' of job 'j', using pattern set 'set' if
+*	there are several patterns, and copies the selected records, each with
+*	a separator, to the slot output.
+*
+* Returns
+*	True on success, otherwise false.
+*/
+
+static int flt_match(struct flt_job *j, struct flt_slot *s,
+    fpattern_set_t *set)
+{
+    const char *	p;
+    const char *	q;
+    const char *	end;
+    const char *	run;
+    size_t		len;
+    int			m;
+
+    s->outlen = 0;
+    s->matches = 0;
+    if (!j->count  &&  !flt_reserve(&s->out, &s->outcap, s->len+1))
+        return (false);
+
+    /* Copy each run of consecutive selected records at once */
+    run = NULL;
+    end = s->data + s->len;
+    for (p = s->data;  p < end;  p = q+1)
+    {
+        q = (const char *) memchr(p, j->sep, end - p);
+        if (q == NULL)
+            q = end;
+        len = q - p;
+
+        if (set != NULL)
+            m = (fpattern_set_ids_len(set, p, len, NULL, 0) > 0);
+        else
+            m = fpattern_exec_len(j->prog, p, len);
+
+        if (m != j->invert)
+        {
+            s->matches++;
+            if (run == NULL)
+                run = p;
+        }
+        else if (run != NULL)
+        {
+            if (!j->count)
+            {
+                memcpy(s->out + s->outlen, run, p - run);
+                s->outlen += p - run;
+            }
+            run = NULL;
+        }
+    }
+
+    if (run != NULL  &&  !j->count)
+    {
+        memcpy(s->out + s->outlen, run, end - run);
+        s->outlen += end - run;
+        if (end[-1] != (char) j->sep)
+            s->out[s->outlen++] = (char) j->sep;
+    }
+    return (true);
+}
+
+
+/*------------------------------------------------------------------------------
+* flt_write()
+*	Writes the selected records of slot 's' of job 'j' to the standard
+*	output.
+*
+* Returns
+*	Zero on success, otherwise an error code.
+*/
+
+static int flt_write(struct flt_job *j, struct flt_slot *s)
+{
+    const char *	p;
+    size_t		len;
+    long		n;
+
+    j->matches += s->matches;
+
+    for (p = s->out, len = s->outlen;  len > 0;  )
+    {
+        n = (long) write(1, p, len);
+        if (n < 0  &&  errno == EINTR)
+            continue;
+        if (n < 0)
+            return (errno);
+        p += n;
+        len -= (size_t) n;
+    }
+    return (0);
+}
+
+
+#if THREADS
+
+/*------------------------------------------------------------------------------
+* flt_worker()
+*	Matching thread for job 'arg', which fills the next free slot with a
+*	chunk of input, matches its records, and marks it ready to be written,
+*	until the input runs out.
+*/
+
+static void *flt_worker(void *arg)
+{
+    struct flt_job *	j;
+    struct flt_slot *	s;
+    fpattern_set_t *	set;
+    int			ok;
+
+    j = (struct flt_job *) arg;
+
+    /* Each thread needs its own pattern set */
+    set = NULL;
+    if (j->npats > 1)
+        set = fpattern_set_new(j->pats, j->npats, 0, NULL, NULL);
+
+    pthread_mutex_lock(&j->lock);
+    if (j->npats > 1  &&  set == NULL)
+    {
+        j->err = ENOMEM;
+        j->eof = true;
+        pthread_cond_broadcast(&j->cond);
+    }
+
+    for (;;)
+    {
+        /* Wait for the slot of the next chunk to be written out */
+        for (;;)
+        {
+            s = &j->slots[j->next % j->nslots];
+            if (s->state == FLT_FREE  ||  j->eof)
+                break;
+            pthread_cond_wait(&j->cond, &j->lock);
+        }
+
+        if (!flt_fill(j, s))
+        {
+            pthread_cond_broadcast(&j->cond);
+            break;
+        }
+        s->seq = j->next++;
+        s->state = FLT_BUSY;
+
+        /* Match the chunk while other threads fill and match others */
+        pthread_mutex_unlock(&j->lock);
+        ok = flt_match(j, s, set);
+        pthread_mutex_lock(&j->lock);
+
+        if (!ok)
+        {
+            j->err = ENOMEM;
+            j->eof = true;
+        }
+        s->state = FLT_DONE;
+        pthread_cond_broadcast(&j->cond);
+    }
+
+    pthread_mutex_unlock(&j->lock);
+    fpattern_set_free(set);
+    return (NULL);
+}
+
+
+/*------------------------------------------------------------------------------
+* flt_run_mt()
+*	Filters the input of job 'j' with 'nthreads' matching threads, while
+*	the calling thread writes the chunks out in order.
+*
+* Returns
+*	True on success, otherwise false.
+*/
+
+static int flt_run_mt(struct flt_job *j, int nthreads)
+{
+    pthread_t		tids[FLT_MAXT];
+    struct flt_slot *	s;
+    long		seq;
+    int			started;
+    int			err;
+
+    pthread_mutex_init(&j->lock, NULL);
+    pthread_cond_init(&j->cond, NULL);
+
+    for (started = 0;  started < nthreads;  started++)
+    {
+        if (pthread_create(&tids[started], NULL, flt_worker, j) != 0)
+            break;
+    }
+    if (started == 0)
+        j->err = EAGAIN;
+
+    /* Write each chunk as soon as it and all of those before it are done */
+    pthread_mutex_lock(&j->lock);
+    for (seq = 0;  started > 0;  seq++)
+    {
+        s = &j->slots[seq % j->nslots];
+        while (!(s->state == FLT_DONE  &&  s->seq == seq)  &&
+            !(j->eof  &&  seq >= j->next))
+            pthread_cond_wait(&j->cond, &j->lock);
+        if (s->state != FLT_DONE  ||  s->seq != seq)
+            break;			/* No more chunks */
+
+        err = j->err;
+        pthread_mutex_unlock(&j->lock);
+        if (err == 0)
+            err = flt_write(j, s);
+        pthread_mutex_lock(&j->lock);
+
+        if (err != 0  &&  j->err == 0)
+        {
+            j->err = err;
+            j->eof = true;
+        }
+        s->state = FLT_FREE;
+        pthread_cond_broadcast(&j->cond);
+    }
+    pthread_mutex_unlock(&j->lock);
+
+    while (started > 0)
+        pthread_join(tids[--started], NULL);
+
+    pthread_cond_destroy(&j->cond);
+    pthread_mutex_destroy(&j->lock);
+    return (j->err == 0);
+}
+
+#endif /*THREADS*/
+
+
+/*------------------------------------------------------------------------------
+* flt_run()
+*	Filters the input of job 'j' with the calling thread alone.
+*
+* Returns
+*	True on success, otherwise false.
+*/
+
+static int flt_run(struct flt_job *j)
+{
+    fpattern_set_t *	set;
+
+    set = NULL;
+    if (j->npats > 1)
+    {
+        set = fpattern_set_new(j->pats, j->npats, 0, NULL, NULL);
+        if (set == NULL)
+            j->err = ENOMEM;
+    }
+
+    while (j->err == 0  &&  flt_fill(j, &j->slots[0]))
+    {
+        if (!flt_match(j, &j->slots[0], set))
+            j->err = ENOMEM;
+        else
+            j->err = flt_write(j, &j->slots[0]);
+    }
+
+    fpattern_set_free(set);
+    return (j->err == 0);
+}
+
+
+/*------------------------------------------------------------------------------
+* flt_file()
+*	Filters input file 'fname' ("-" for the standard input) through the
+*	patterns of job 'j', using 'nthreads' threads.
+*
+* Returns
+*	True on success, otherwise false.
+*/
+
+static int flt_file(struct flt_job *j, const char *fname, int nthreads)
+{
+    int			i;
+    int			ok;
+#if UNIX
+    struct stat		st;
+#endif
+
+    /* Open the input */
+    if (strcmp(fname, "-") == 0)
+        j->fd = 0;
+    else
+    {
+        j->fd = open(fname, O_RDONLY | O_BINARY);
+        if (j->fd < 0)
+        {
+            fprintf(stderr, "%s: %s: %s\n", prog_name, fname, strerror(errno));
+            return (false);
+        }
+    }
+
+    j->map = NULL;
+    j->mapsize = 0;
+    j->pos = 0;
+    j->carrylen = 0;
+    j->eof = false;
+    j->err = 0;
+    j->next = 0;
+
+#if UNIX
+    /* Map a regular file into memory */
+    if (fstat(j->fd, &st) == 0  &&  S_ISREG(st.st_mode)  &&  st.st_size > 0
+        &&  (unsigned long long) st.st_size == (size_t) st.st_size)
+    {
+        void *	m;
+
+        m = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, j->fd, 0);
+        if (m != MAP_FAILED)
+        {
+            j->map = (const char *) m;
+            j->mapsize = (size_t) st.st_size;
+ #if defined(MADV_SEQUENTIAL)
+            madvise(m, j->mapsize, MADV_SEQUENTIAL);
+ #endif
+        }
+    }
+#endif
+
+    /* Filter the records */
+    for (i = 0;  i < j->nslots;  i++)
+        j->slots[i].state = FLT_FREE;
+
+#if THREADS
+    if (nthreads > 1)
+        ok = flt_run_mt(j, nthreads);
+    else
+#else
+    (void) nthreads;
+#endif
+        ok = flt_run(j);
+
+    if (!ok)
+        fprintf(stderr, "%s: %s: %s\n", prog_name, fname, strerror(j->err));
+
+    /* Clean up */
+#if UNIX
+    if (j->map != NULL)
+        munmap((void *) j->map, j->mapsize);
+#endif
+    if (j->fd != 0)
+        close(j->fd);
+    return (ok);
+}
+
+
+/*------------------------------------------------------------------------------
+* usage()
+*	Prints a usage message and exits.
+*/
+
+static void usage(void)
+{
+    fprintf(stderr,
+        "usage: %s [-0] [-c] [-v] [-j threads] [-e pattern]... [pattern] "
+        "[file]...\n", prog_name);
+    exit(2);
+}
+
+
+/*------------------------------------------------------------------------------
+* main()
+*	Filters lists of filenames through filename patterns.
+*/
+
+int main(int argc, char **argv)
+{
+    struct flt_job	j;
+    fpattern_set_t *	set;
+    const char **	pats;
+    int			npats;
+    int			nthreads;
+    int			erroff;
+    int			errpat;
+    int			ok;
+    int			i;
+
+    memset(&j, 0, sizeof(j));
+    j.sep = '\n';
+    nthreads = 0;
+
+    pats = (const char **) calloc(argc+1, sizeof(const char *));
+    if (pats == NULL)
+        return (2);
+    npats = 0;
+
+    /* Parse the options */
+    for (i = 1;  i < argc  &&  argv[i][0] == '-'  &&  argv[i][1] != '\0';  i++)
+    {
+        if (strcmp(argv[i], "--") == 0)
+        {
+            i++;
+            break;
+        }
+        else if (strcmp(argv[i], "-0") == 0)
+            j.sep = '\0';
+        else if (strcmp(argv[i], "-c") == 0)
+            j.count = true;
+        else if (strcmp(argv[i], "-v") == 0)
+            j.invert = true;
+        else if (strcmp(argv[i], "-e") == 0  &&  i+1 < argc)
+            pats[npats++] = argv[++i];
+        else if (strcmp(argv[i], "-j") == 0  &&  i+1 < argc)
+            nthreads = atoi(argv[++i]);
+        else if (strncmp(argv[i], "-j", 2) == 0)
+            nthreads = atoi(argv[i]+2);
+        else
+            usage();
+    }
+
+    if (npats == 0)
+    {
+        if (i >= argc)
+            usage();
+        pats[npats++] = argv[i++];
+    }
+
+    /* Compile the patterns */
+    fpattern_locale();
+    errpat = 0;
+    set = NULL;
+    if (npats == 1)
+        j.prog = fpattern_compile(pats[0], &erroff);
+    else
+    {
+        /* Check them all before each thread compiles its own set */
+        set = fpattern_set_new(pats, npats, 0, &errpat, &erroff);
+        fpattern_set_free(set);
+    }
+
+    if (j.prog == NULL  &&  set == NULL)
+    {
+        if (erroff >= 0)
+            fprintf(stderr, "%s: bad pattern \"%s\" at offset %d\n",
+                prog_name, pats[errpat], erroff);
+        else
+            fprintf(stderr, "%s: %s\n", prog_name, strerror(ENOMEM));
+        return (2);
+    }
+    j.pats = pats;
+    j.npats = npats;
+
+    /* Set up the matching threads and their chunk slots */
+#if THREADS
+    if (nthreads <= 0)
+        nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > FLT_MAXT)
+        nthreads = FLT_MAXT;
+#else
+    nthreads = 1;
+#endif
+
+    j.nslots = 2*nthreads + 2;
+    j.slots = (struct flt_slot *) calloc(j.nslots, sizeof(struct flt_slot));
+    if (j.slots == NULL)
+        return (2);
+
+    /* Filter each input file */
+    ok = true;
+    if (i >= argc)
+        ok = flt_file(&j, "-", nthreads);
+    for (  ;  i < argc;  i++)
+        ok &= flt_file(&j, argv[i], nthreads);
+
+    if (j.count)
+        printf("%ld\n", j.matches);
+
+    /* Clean up */
+    for (i = 0;  i < j.nslots;  i++)
+    {
+        free(j.slots[i].buf);
+        free(j.slots[i].out);
+    }
+    free(j.slots);
+    free(j.carry);
+    fpattern_free(j.prog);
+    free((void *) pats);
+
+    if (!ok)
+        return (2);
+    return (j.matches > 0 ? 0 : 1);
+}
+
+/* End fpfilter.c */
@@ -0,0 +1,1474 @@
+/*******************************************************************************
+* fpglob.c
+*	Functions for finding the files whose pathnames match a filename
+*	pattern.
+*
+* Usage
+*	(See "fpattern.h".)
+*
+* Notes
+*	The pattern is split at each '/' into segments, each of which is
+*	matched against the entries of one directory level, so that only the
+*	directories whose names match a segment are ever read.  A segment
+*	without special chars is opened directly instead of being searched for.
+*
+*	A "**" segment matches zero or more directory levels.  The segments
+*	after it are matched in its own directory, and then in each directory
+*	below it in turn, without following symbolic links.  A directory is
+*	only read further down while the segments before it still match, so
+*	the walk is pruned just as it is for the other segments.
+*
+*	Since the segments after a "**" may match at several depths at once,
+*	each directory is searched for a set of active segments rather than
+*	for just one.  The directory is read once, each entry is matched
+*	against every segment in the set, and the segments that its own
+*	entries must match in turn are collected into the set of the entry.
+*	So each pathname is found only once, however many ways there are of
+*	matching its "**" segments.
+*
+*	Since each segment is compiled on its own, the alternatives of a
+*	"{...}" group cannot contain a '/'.
+*
+*	On Linux, directories are read in bulk by getdents64(), elsewhere by
+*	readdir().  The entry type in 'd_type' is used to avoid stat() calls.
+*
+*	fpattern_glob_mt() searches with several threads, each of which keeps
+*	a deque of the directories it has yet to read, and steals from the
+*	others when its own runs out.  Matching pathnames are passed back to the
+*	calling thread through a lock-free queue.
+*
+*	This requires a POSIX system; elsewhere fpattern_glob() fails with
+*	'errno' set to ENOSYS.
+*/
+
+
+/* System includes */
+
+#ifndef _POSIX_C_SOURCE
+ #define _POSIX_C_SOURCE	200809L		/* openat(), fstatat(), nanosleep() */
+#endif
+#if defined(__linux__)  &&  !defined(_DEFAULT_SOURCE)
+ #define _DEFAULT_SOURCE	1		/* syscall(), 'd_type' */
+#endif
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if TEST
+ #include <stdio.h>
+#endif
+
+#if defined(unix) || defined(_unix) || defined(__unix)
+ #define UNIX	1
+#else
+ #define UNIX	0
+#endif
+
+#if UNIX
+ #include <dirent.h>
+ #include <fcntl.h>
+ #include <sys/stat.h>
+ #include <unistd.h>
+#endif
+
+#if UNIX  &&  defined(__linux__)
+ #include <sys/syscall.h>
+ #define GETDENTS	1
+#else
+ #define GETDENTS	0
+#endif
+
+#if UNIX  &&  defined(__GNUC__)
+ #include <pthread.h>
+ #include <sched.h>
+ #include <time.h>
+ #define THREADS	1
+#else
+ #define THREADS	0
+#endif
+
+
+/* Local includes */
+
+#include "debug.h"
+
+#include "fpattern.h"
+
+
+/* Local constants */
+
+#ifndef NULL
+ #define NULL		((void *) 0)
+#endif
+
+#ifndef false
+ #define false		0
+#endif
+
+#ifndef true
+ #define true		1
+#endif
+
+#define DEL		FPAT_DEL
+#define QUOTE		FPAT_QUOTE
+
+#define FPGLOB_BUF	(32*1024)	/* Directory read buffer size	*/
+#define FPGLOB_MAXT	256		/* Max search threads		*/
+#define FPGLOB_IDLE	50000L		/* Idle wait (nsec)		*/
+
+#ifndef O_CLOEXEC
+ #define O_CLOEXEC	0
+#endif
+
+#ifndef O_DIRECTORY
+ #define O_DIRECTORY	0
+#endif
+
+#ifndef O_NOFOLLOW
+ #define O_NOFOLLOW	0
+#endif
+
+#if UNIX  &&  defined(DT_DIR)
+ #define HAVE_DTYPE	1
+#else
+ #define HAVE_DTYPE	0
+ #define DT_UNKNOWN	0		/* Unknown entry type		*/
+ #define DT_DIR		4		/* Directory			*/
+ #define DT_REG		8		/* Regular file			*/
+ #define DT_LNK		10		/* Symbolic link		*/
+#endif
+
+
+#if UNIX
+
+/* Local types */
+
+#if GETDENTS
+struct fpat_dirent64
+{
+    unsigned long long	d_ino;		/* Inode number			*/
+    long long		d_off;		/* Offset of next entry		*/
+    unsigned short	d_reclen;	/* Size of this entry		*/
+    unsigned char	d_type;		/* Entry type, DT_XXX		*/
+    char		d_name[1];	/* Null-terminated name		*/
+};
+#endif
+
+struct fpat_seg
+{
+    fpattern_t *	prog;		/* Compiled segment, or null	*/
+    char *		lit;		/* Unquoted literal segment	*/
+    int			deep;		/* "**", any directory levels	*/
+};
+
+struct fpat_glob
+{
+    int			nsegs;		/* Pattern segments		*/
+    struct fpat_seg *	segs;		/* [nsegs] segments		*/
+    char **		bufs;		/* [nsegs] directory read buffers */
+    int			dirs;		/* Match only directories	*/
+    int			flags;		/* FPAT_GLOB_XXX flags		*/
+    fpattern_glob_f	fn;		/* Match callback		*/
+    void *		arg;		/* Callback argument		*/
+    char *		path;		/* Current pathname		*/
+    size_t		len;		/* Current pathname length	*/
+    size_t		cap;		/* Allocated pathname size	*/
+    long		count;		/* Matching pathnames		*/
+    int			stop;		/* Stop the search		*/
+    int			err;		/* Error code, or 0		*/
+#if THREADS
+    struct fpat_walk *	w;		/* Parallel search, or null	*/
+    int			id;		/* Search thread		*/
+    pthread_t		tid;		/* Search thread id		*/
+#endif
+};
+
+#if THREADS
+struct fpat_work
+{
+    size_t		len;		/* Directory pathname length	*/
+    char *		path;		/* Directory pathname		*/
+    int			nact;		/* Active segments		*/
+    int			act[1];		/* [nact] active segments	*/
+};
+
+struct fpat_deque
+{
+    pthread_mutex_t	lock;		/* Deque lock			*/
+    struct fpat_work **	items;		/* [cap] pending directories	*/
+    size_t		head;		/* Oldest item, stolen first	*/
+    size_t		tail;		/* Past newest item, taken first */
+    size_t		cap;		/* Allocated items		*/
+};
+
+struct fpat_result
+{
+    struct fpat_result *	next;	/* Next result in queue		*/
+    size_t		len;		/* Pathname length		*/
+    char		path[1];	/* Matching pathname		*/
+};
+
+struct fpat_walk
+{
+    int			nthreads;	/* Search threads		*/
+    struct fpat_deque *	deques;		/* [nthreads] pending dirs	*/
+    long		pending;	/* Pending and active dirs	*/
+    int			done;		/* Finished threads		*/
+    int			stop;		/* Stop the search		*/
+    int			err;		/* First error code, or 0	*/
+    struct fpat_result *	head;	/* Result queue, consumer end	*/
+    struct fpat_result *	tail;	/* Result queue, producer end	*/
+    struct fpat_result	stub;		/* Result queue placeholder	*/
+};
+#endif
+
+
+/*------------------------------------------------------------------------------
+* fpglob_split()
+*	Splits pattern 'pat' into the segments of glob 'g', compiling each one
+*	that contains special chars and unquoting each one that does not.
+*
+* Returns
+*	Zero on success, otherwise an error code.
+*/
+
+static int fpglob_split(struct fpat_glob *g, const char *pat)
+{
+    struct fpat_seg *	sp;
+    const char *	p;
+    const char *	end;
+    char *		lp;
+    size_t		len;
+    int			lit;
+    int			i, n;
+
+    /* Count the segments, for each run of non-delimiters */
+    g->nsegs = 0;
+    for (p = pat;  *p != '\0';  )
+    {
+        while (*p == DEL)
+            p++;
+        if (*p == '\0')
+            break;
+        g->nsegs++;
+        while (*p != DEL  &&  *p != '\0')
+        {
+            if (*p == QUOTE  &&  p[1] != '\0')
+                p++;
+            p++;
+        }
+    }
+
+    g->segs = (struct fpat_seg *) calloc(g->nsegs+1, sizeof(struct fpat_seg));
+    g->bufs = (char **) calloc(g->nsegs+1, sizeof(char *));
+    if (g->segs == NULL  ||  g->bufs == NULL)
+        return (ENOMEM);
+
+    for (p = pat, sp = g->segs;  sp < g->segs + g->nsegs;  sp++)
+    {
+        while (*p == DEL)
+            p++;
+
+        /* Find the end of the segment, noting any special chars */
+        lit = true;
+        for (end = p;  *end != DEL  &&  *end != '\0';  end++)
+        {
+            switch (*end)
+            {
+            case QUOTE:
+                if (end[1] != '\0')
+                    end++;
+                break;
+
+            case FPAT_ANY:
+            case FPAT_CLOS:
+            case FPAT_CLOSP:
+            case FPAT_SET_L:
+            case FPAT_NOT:
+            case FPAT_ALT_L:
+                lit = false;
+                break;
+            }
+        }
+        len = end - p;
+
+        if (len == 2  &&  p[0] == FPAT_CLOS  &&  p[1] == FPAT_CLOS)
+        {
+            /* Match any number of directory levels */
+            sp->deep = true;
+        }
+        else if (!lit)
+        {
+            /* Compile the segment */
+            sp->prog = fpattern_compile_len(p, len, NULL);
+            if (sp->prog == NULL)
+                return (EINVAL);
+        }
+        else
+        {
+            /* Unquote the segment */
+            sp->lit = (char *) malloc(len+1);
+            if (sp->lit == NULL)
+                return (ENOMEM);
+            for (lp = sp->lit;  p < end;  p++)
+            {
+                if (*p == QUOTE)
+                {
+                    if (++p == end)
+                        return (EINVAL);	/* Missing quoted char */
+                }
+                *lp++ = *p;
+            }
+            *lp = '\0';
+        }
+        p = end;
+    }
+
+    /* Drop each "**" that follows another, which would only repeat it */
+    for (i = n = 0;  i < g->nsegs;  i++)
+    {
+        if (!g->segs[i].deep  ||  n == 0  ||  !g->segs[n-1].deep)
+            g->segs[n++] = g->segs[i];
+    }
+    g->nsegs = n;
+
+    return (0);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpglob_push()
+*	Appends name 'name[0...len-1]' to the current pathname of glob 'g'.
+*
+* Returns
+*	The previous length of the pathname, or (size_t)-1 if there is no
+*	memory.
+*/
+
+static size_t fpglob_push(struct fpat_glob *g, const char *name, size_t len)
+{
+    size_t	old;
+    size_t	need;
+    char *	path;
+
+    old = g->len;
+    need = old + len + 2;
+    if (need > g->cap)
+    {
+        path = (char *) realloc(g->path, need*2);
+        if (path == NULL)
+            return ((size_t) -1);
+        g->path = path;
+        g->cap = need*2;
+    }
+
+    if (old > 0  &&  g->path[old-1] != DEL)
+        g->path[g->len++] = DEL;
+    memcpy(g->path + g->len, name, len);
+    g->len += len;
+    g->path[g->len] = '\0';
+    return (old);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpglob_add()
+*	Adds segment 'seg' of glob 'g' to the 'n' active segments 'act', which
+*	are kept in ascending order.  If it is a "**" segment, the segment
+*	after it is added too, since "**" may match no directory levels.
+*
+* Returns
+*	The new number of active segments.
+*/
+
+static int fpglob_add(struct fpat_glob *g, int *act, int n, int seg)
+{
+    int		i, j;
+
+    for (;;)
+    {
+        for (i = 0;  i < n  &&  act[i] < seg;  i++)
+            ;
+        if (i < n  &&  act[i] == seg)
+            break;			/* Already active */
+
+        for (j = n;  j > i;  j--)
+            act[j] = act[j-1];
+        act[i] = seg;
+        n++;
+
+        if (!g->segs[seg].deep  ||  seg+1 == g->nsegs)
+            break;
+        seg++;
+    }
+    return (n);
+}
+
+
+static void	fpglob_dir(struct fpat_glob *g, int fd, const int *act,
+		    int nact);
+
+#if THREADS
+static void	fpglob_result(struct fpat_glob *g);
+static void	fpglob_give(struct fpat_glob *g, const int *act, int nact);
+#endif
+
+
+/*------------------------------------------------------------------------------
+* fpglob_found()
+*	Reports the current pathname of glob 'g' as a match.
+*/
+
+static void fpglob_found(struct fpat_glob *g)
+{
+#if THREADS
+    if (g->w != NULL)
+    {
+        fpglob_result(g);
+        return;
+    }
+#endif
+
+    g->count++;
+    if (g->fn != NULL  &&  g->fn(g->path, g->len, g->arg) != 0)
+        g->stop = true;
+}
+
+
+/*------------------------------------------------------------------------------
+* fpglob_name()
+*	Matches entry 'name' of the directory open as 'fd' against each of the
+*	'nact' active segments 'act' of glob 'g'.  'type' is the entry type
+*	(DT_XXX), or DT_UNKNOWN if the type is not known.  'next' has room for
+*	the active segments of the entry, one per segment of 'g'.
+*
+*	If the entry matches a last segment, its pathname is passed to the
+*	callback.  If any segments remain to be matched below it, the entry is
+*	opened as a directory and searched for them.  Symbolic links are not
+*	followed for the segments left by a "**" segment, so that a link to a
+*	parent directory cannot make the search endless.
+*/
+
+static void fpglob_name(struct fpat_glob *g, int fd, const char *name,
+    int type, const int *act, int nact, int *next)
+{
+    const struct fpat_seg *	sp;
+    struct stat		st;
+    size_t		len;
+    size_t		old;
+    int			dot;
+    int			last;
+    int			follow;
+    int			n;
+    int			i;
+    int			sub;
+
+    /* The "." and ".." entries are only matched by literal segments */
+    dot = (name[0] == '.'  &&
+        (name[1] == '\0'  ||  (name[1] == '.'  &&  name[2] == '\0')));
+    len = strlen(name);
+
+    /* Find out whether the entry is a link, if "**" needs to know */
+    for (i = 0;  i < nact  &&  type == DT_UNKNOWN;  i++)
+    {
+        if (g->segs[act[i]].deep)
+        {
+            if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) < 0)
+                return;
+            type = (S_ISDIR(st.st_mode) ? DT_DIR :
+                S_ISLNK(st.st_mode) ? DT_LNK : DT_REG);
+        }
+    }
+
+    /* Match the entry against each active segment */
+    n = 0;
+    last = false;
+    follow = false;
+    for (i = 0;  i < nact;  i++)
+    {
+        sp = &g->segs[act[i]];
+        if (sp->deep)
+        {
+            /* Match one more directory level */
+            if (dot)
+                continue;
+            if (act[i]+1 == g->nsegs)
+                last = true;
+            if (type == DT_DIR)
+                n = fpglob_add(g, next, n, act[i]);
+        }
+        else if (sp->lit != NULL ? strcmp(name, sp->lit) == 0 :
+            !dot  &&  fpattern_exec_len(sp->prog, name, len))
+        {
+            if (act[i]+1 == g->nsegs)
+                last = follow = true;
+            else
+            {
+                /* A final "**" before a '/' may match no directory levels */
+                if (g->dirs  &&  act[i]+2 == g->nsegs  &&
+                    g->segs[act[i]+1].deep)
+                    last = follow = true;
+                if (type == DT_DIR  ||  type == DT_LNK  ||
+                    type == DT_UNKNOWN)
+                    n = fpglob_add(g, next, n, act[i]+1);
+            }
+        }
+    }
+
+    /* Report only directories for a pattern ending with '/' */
+    if (last  &&  g->dirs  &&  type != DT_DIR)
+    {
+        last = (type != DT_REG  &&  follow  &&
+            fstatat(fd, name, &st, 0) == 0  &&  S_ISDIR(st.st_mode));
+    }
+
+    if (!last  &&  n == 0)
+        return;
+
+    old = fpglob_push(g, name, len);
+    if (old == (size_t) -1)
+    {
+        g->err = ENOMEM;
+        g->stop = true;
+        return;
+    }
+
+    if (last)
+    {
+        /* Report a matching pathname */
+        fpglob_found(g);
+    }
+
+    if (n > 0  &&  !g->stop)
+    {
+#if THREADS
+        if (g->w != NULL)
+            fpglob_give(g, next, n);	/* Left to be searched by any thread */
+        else
+#endif
+        {
+            /* Search the subdirectory, if it is one */
+            sub = openat(fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (sub >= 0)
+            {
+                fpglob_dir(g, sub, next, n);
+                close(sub);
+            }
+            else if (errno != ENOTDIR  &&  errno != ENOENT  &&
+                (g->flags & FPAT_GLOB_ERR))
+            {
+                g->err = errno;
+                g->stop = true;
+            }
+        }
+    }
+
+    g->len = old;
+    g->path[old] = '\0';
+}
+
+
+/*------------------------------------------------------------------------------
+* fpglob_dir()
+*	Searches the directory open as 'fd' for the entries matching any of the
+*	'nact' active segments 'act' of glob 'g', which are in ascending order.
+*
+*	The buffers of a directory are kept for reuse by the next directory
+*	with the same first active segment, since the segments active below it
+*	all come after that one.  The exception is a "**" segment, which stays
+*	active below its own directory, and so needs buffers of its own.
+*/
+
+static void fpglob_dir(struct fpat_glob *g, int fd, const int *act, int nact)
+{
+    struct fpat_seg *	sp;
+    struct stat		st;
+    char *		mem;
+    int *		next;
+    int			one[2];
+    int			deep;
+    int			i;
+#if GETDENTS
+    const struct fpat_dirent64 *	d;
+    long		n, off;
+#else
+    struct dirent *	d;
+    DIR *		dir;
+    int			dfd;
+#endif
+
+    sp = &g->segs[act[0]];
+
+    if (nact == 1  &&  sp->lit != NULL)
+    {
+        /* Look up a lone literal segment directly */
+        if (fstatat(fd, sp->lit, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        {
+            fpglob_name(g, fd, sp->lit,
+                S_ISDIR(st.st_mode) ? DT_DIR :
+                S_ISLNK(st.st_mode) ? DT_LNK : DT_REG, act, nact, one);
+        }
+        return;
+    }
+
+    /* Get the buffers for reading the directory and matching its entries */
+    deep = false;
+    for (i = 0;  i < nact;  i++)
+        deep |= g->segs[act[i]].deep;
+
+    if (deep)
+        mem = (char *) malloc(FPGLOB_BUF + g->nsegs*sizeof(int));
+    else
+    {
+        if (g->bufs[act[0]] == NULL)
+            g->bufs[act[0]] = (char *) malloc(FPGLOB_BUF +
+                g->nsegs*sizeof(int));
+        mem = g->bufs[act[0]];
+    }
+
+    if (mem == NULL)
+    {
+        g->err = ENOMEM;
+        g->stop = true;
+        return;
+    }
+    next = (int *) (mem + FPGLOB_BUF);
+
+#if GETDENTS
+    /* Read the directory entries in bulk */
+    while (!g->stop)
+    {
+        n = syscall(SYS_getdents64, fd, mem, FPGLOB_BUF);
+        if (n <= 0)
+        {
+            if (n < 0  &&  (g->flags & FPAT_GLOB_ERR))
+            {
+                g->err = errno;
+                g->stop = true;
+            }
+            break;
+        }
+
+        for (off = 0;  off < n  &&  !g->stop;  off += d->d_reclen)
+        {
+            d = (const struct fpat_dirent64 *) (mem + off);
+            fpglob_name(g, fd, d->d_name, d->d_type, act, nact, next);
+        }
+    }
+#else
+    /* Read the directory entries one at a time */
+    dfd = dup(fd);
+    dir = (dfd >= 0 ? fdopendir(dfd) : NULL);
+    if (dir == NULL)
+    {
+        if (dfd >= 0)
+            close(dfd);
+        if (g->flags & FPAT_GLOB_ERR)
+        {
+            g->err = errno;
+            g->stop = true;
+        }
+    }
+    else
+    {
+        while (!g->stop  &&  (d = readdir(dir)) != NULL)
+        {
+ #if HAVE_DTYPE
+            fpglob_name(g, fd, d->d_name, d->d_type, act, nact, next);
+ #else
+            fpglob_name(g, fd, d->d_name, DT_UNKNOWN, act, nact, next);
+ #endif
+        }
+        closedir(dir);
+    }
+#endif
+
+    if (deep)
+        free(mem);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpglob_free()
+*	Releases the segments and buffers of glob 'g'.
+*/
+
+static void fpglob_free(struct fpat_glob *g)
+{
+    int		i;
+
+    for (i = 0;  i < g->nsegs;  i++)
+    {
+        if (g->segs != NULL)
+        {
+            fpattern_free(g->segs[i].prog);
+            free(g->segs[i].lit);
+        }
+        if (g->bufs != NULL)
+            free(g->bufs[i]);
+    }
+    free(g->segs);
+    free(g->bufs);
+    free(g->path);
+}
+
+#if THREADS
+
+/*------------------------------------------------------------------------------
+* fpglob_idle()
+*	Waits briefly while the other search threads make progress.
+*/
+
+static void fpglob_idle(void)
+{
+    struct timespec	ts;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = FPGLOB_IDLE;
+    nanosleep(&ts, NULL);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpglob_enqueue()
+*	Adds result 'r' to the result queue of parallel search 'w'.  Any number
+*	of threads may add results at once, without locking.
+*
+*	This is Vyukov's intrusive multiple-producer single-consumer queue:
+*	each producer swaps itself in as the tail, then links the previous tail
+*	to itself.
+*/
+
+static void fpglob_enqueue(struct fpat_walk *w, struct fpat_result *r)
+{
+    struct fpat_result *	prev;
+
+    r->next = NULL;
+    prev = __atomic_exchange_n(&w->tail, r, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, r, __ATOMIC_RELEASE);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpglob_dequeue()
+*	Removes the oldest result from the result queue of parallel search 'w'.
+*	Only the thread that started the search may call this.
+*
+* Returns
+*	The result, or null if there is none yet.
+*/
+
+static struct fpat_result *fpglob_dequeue(struct fpat_walk *w)
+{
+    struct fpat_result *	head;
+    struct fpat_result *	next;
+
+    head = w->head;
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (head == &w->stub)
+    {
+        /* Skip over the placeholder */
+        if (next == NULL)
+            return (NULL);
+        w->head = next;
+        head = next;
+        next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next != NULL)
+    {
+        w->head = next;
+        return (head);
+    }
+
+    /* The last result can only be removed once something follows it */
+    if (head != __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE))
+        return (NULL);		/* Another result is being added */
+
+    fpglob_enqueue(w, &w->stub);
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next != NULL)
+    {
+        w->head = next;
+        return (head);
+    }
+    return (NULL);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpglob_result()
+*	Passes the current pathname of search thread 'g' back to the thread
+*	that started the parallel search.
+*/
+
+static void fpglob_result(struct fpat_glob *g)
+{
+    struct fpat_result *	r;
+
+    if (__atomic_load_n(&g->w->stop, __ATOMIC_ACQUIRE))
+    {
+        g->stop = true;
+        return;
+    }
+
+    r = (struct fpat_result *) malloc(sizeof(struct fpat_result) + g->len);
+    if (r == NULL)
+    {
+        g->err = ENOMEM;
+        g->stop = true;
+        return;
+    }
+
+    r->len = g->len;
+    memcpy(r->path, g->path, g->len+1);
+    fpglob_enqueue(g->w, r);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpglob_give()
+*	Adds the current pathname of search thread 'g', which is a directory to
+*	be searched for the 'nact' active segments 'act', to the deque of the
+*	thread.
+*/
+
+static void fpglob_give(struct fpat_glob *g, const int *act, int nact)
+{
+    struct fpat_deque *	dq;
+    struct fpat_work *	item;
+    struct fpat_work **	items;
+    size_t		cap;
+
+    item = (struct fpat_work *) malloc(sizeof(struct fpat_work) +
+        nact*sizeof(int) + g->len);
+    if (item == NULL)
+        goto nomem;
+    item->nact = nact;
+    memcpy(item->act, act, nact*sizeof(int));
+    item->path = (char *) (item->act + nact);
+    item->len = g->len;
+    if (g->len > 0)
+        memcpy(item->path, g->path, g->len);
+    item->path[g->len] = '\0';
+
+    /* Count the directory as pending before any thread can take it */
+    __atomic_add_fetch(&g->w->pending, 1, __ATOMIC_ACQ_REL);
+
+    dq = &g->w->deques[g->id];
+    pthread_mutex_lock(&dq->lock);
+    if (dq->tail == dq->cap)
+    {
+        if (dq->head > 0)
+        {
+            /* Reuse the space of stolen items */
+            memmove(dq->items, dq->items + dq->head,
+                (dq->tail - dq->head)*sizeof(struct fpat_work *));
+            dq->tail -= dq->head;
+            dq->head = 0;
+        }
+        else
+        {
+            cap = (dq->cap > 0 ? dq->cap*2 : 64);
+            items = (struct fpat_work **) realloc(dq->items,
+                cap*sizeof(struct fpat_work *));
+            if (items == NULL)
+            {
+                pthread_mutex_unlock(&dq->lock);
+                __atomic_sub_fetch(&g->w->pending, 1, __ATOMIC_ACQ_REL);
+                free(item);
+                goto nomem;
+            }
+            dq->items = items;
+            dq->cap = cap;
+        }
+    }
+    dq->items[dq->tail++] = item;
+    pthread_mutex_unlock(&dq->lock);
+    return;
+
+nomem:
+    g->err = ENOMEM;
+    g->stop = true;
+}
+
+
+/*------------------------------------------------------------------------------
+* fpglob_take()
+*	Takes the next directory to be searched by search thread 'g', which is
+*	the newest one in its own deque, or failing that, the oldest one in the
+*	deque of another thread.
+*
+* Returns
+*	The directory, or null if there are none.
+*/
+
+static struct fpat_work *fpglob_take(struct fpat_glob *g)
+{
+    struct fpat_deque *	dq;
+    struct fpat_work *	item;
+    int			i;
+
+    item = NULL;
+    for (i = 0;  i < g->w->nthreads  &&  item == NULL;  i++)
+    {
+        dq = &g->w->deques[(g->id + i) % g->w->nthreads];
+        pthread_mutex_lock(&dq->lock);
+        if (dq->tail > dq->head)
+        {
+            if (i == 0)
+                item = dq->items[--dq->tail];	/* Own, newest */
+            else
+                item = dq->items[dq->head++];	/* Stolen, oldest */
+            if (dq->head == dq->tail)
+                dq->head = dq->tail = 0;
+        }
+        pthread_mutex_unlock(&dq->lock);
+    }
+    return (item);
+}
+
+
+/*------------------------------------------------------------------------------
+* fpglob_worker()
+*	Search thread 'arg' of a parallel search, which takes directories and
+*	searches them until there are none left to search anywhere.
+*/
+
+static void *fpglob_worker(void *arg)
+{
+    struct fpat_glob *	g;
+    struct fpat_walk *	w;
+    struct fpat_work *	item;
+    int			fd;
+    int			none;
+
+    g = (struct fpat_glob *) arg;
+    w = g->w;
+
+    while (!__atomic_load_n(&w->stop, __ATOMIC_ACQUIRE))
+    {
+        item = fpglob_take(g);
+        if (item == NULL)
+        {
+            if (__atomic_load_n(&w->pending, __ATOMIC_ACQUIRE) == 0)
+                break;			/* Search is finished */
+            fpglob_idle();
+            continue;
+        }
+
+        /* Search the directory */
+        fd = open(item->len > 0 ? item->path : ".",
+            O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            g->len = 0;
+            if (fpglob_push(g, item->path, item->len) == (size_t) -1)
+            {
+                g->err = ENOMEM;
+                g->stop = true;
+            }
+            else
+                fpglob_dir(g, fd, item->act, item->nact);
+            close(fd);
+        }
+        else if (errno != ENOTDIR  &&  errno != ENOENT  &&
+            (g->flags & FPAT_GLOB_ERR))
+        {
+            g->err = errno;
+            g->stop = true;
+        }
+
+        free(item);
+        __atomic_sub_fetch(&w->pending, 1, __ATOMIC_ACQ_REL);
+
+        if (g->stop)
+        {
+            /* Keep the first error, and stop all of the threads */
+            none = 0;
+            if (g->err != 0)
+                __atomic_compare_exchange_n(&w->err, &none, g->err, false,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+            __atomic_store_n(&w->stop, true, __ATOMIC_RELEASE);
+        }
+    }
+
+    __atomic_add_fetch(&w->done, 1, __ATOMIC_ACQ_REL);
+    return (NULL);
+}
+
+#endif /*THREADS*/
+
+
+#endif /*UNIX*/
+
+
+/*------------------------------------------------------------------------------
+* fpattern_glob()
+*	Finds the pathnames that match pattern 'pat', in which each '/'
+*	separates a pattern for a directory name from the pattern for the names
+*	within it.  Each matching pathname is passed to 'fn', along with its
+*	length and 'arg'.
+*
+*	A pattern starting with '/' is an absolute pathname, otherwise it is
+*	relative to the current directory.  A pattern ending with '/' matches
+*	only directories.  The "." and ".." entries are only matched by literal
+*	"." and ".." segments.
+*
+*	A segment of just "**" matches zero or more directory levels, so that
+*	a "**" segment between "src" and "*.c" finds the ".c" files anywhere
+*	within "src", and a final "**" matches every pathname within its
+*	directory.  A final "**" followed by '/' matches its directory as well
+*	as every directory within it, as fpattern_match_flags() does with
+*	FPAT_DELIM.
+*
+*	'flags' is zero or FPAT_GLOB_ERR, which stops the search at the first
+*	directory that cannot be read, instead of skipping it.
+*
+* Returns
+*	The number of matching pathnames, or -1 on error, in which case 'errno'
+*	is set.  If 'fn' returns nonzero, the search stops, and the number of
+*	pathnames found so far is returned.
+*
+* Caveats
+*	Pathnames are found in directory order, not sorted.  The pathname passed
+*	to 'fn' is only valid until it returns.  'fn' may be null.
+*
+*	A set may not contain a '/', since it would split the pattern.
+*
+*	Symbolic links to directories are not followed below a "**" segment.
+*	A "**" within a longer segment matches like '*'.
+*
+*	This requires a POSIX system.
+*
+* See also
+*	fpattern_match().
+*/
+
+long fpattern_glob(const char *pat, int flags, fpattern_glob_f fn, void *arg)
+{
+#if UNIX
+    struct fpat_glob	g;
+    size_t		len;
+    int			act[2];
+    int			fd;
+
+    DL(printf("fpattern_glob: pat=%p:\"%s\"\n", pat, pat ? pat : ""));
+
+    /* Check args */
+    if (pat == NULL)
+    {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    memset(&g, 0, sizeof(g));
+    g.flags = flags;
+    g.fn = fn;
+    g.arg = arg;
+
+    len = strlen(pat);
+    g.dirs = (len > 0  &&  pat[len-1] == DEL);
+
+    /* Split the pattern into segments */
+    g.err = fpglob_split(&g, pat);
+    if (g.err == 0)
+    {
+        /* Search from the root or current directory */
+        fd = open(pat[0] == DEL ? "/" : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+            g.err = errno;
+        else
+        {
+            if (pat[0] == DEL  &&  fpglob_push(&g, "/", 1) == (size_t) -1)
+                g.err = ENOMEM;
+            else if (g.nsegs > 0)
+                fpglob_dir(&g, fd, act, fpglob_add(&g, act, 0, 0));
+            close(fd);
+        }
+    }
+
+    /* Clean up */
+    fpglob_free(&g);
+
+    if (g.err != 0)
+    {
+        errno = g.err;
+        return (-1);
+    }
+    return (g.count);
+#else
+    (void) pat;
+    (void) flags;
+    (void) fn;
+    (void) arg;
+
+    errno = ENOSYS;
+    return (-1);
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+* fpattern_glob_mt()
+*	Finds the pathnames that match pattern 'pat', as fpattern_glob() does,
+*	but reads the directories with 'nthreads' threads at once.  If
+*	'nthreads' is zero or less, one thread per online CPU is used.
+*
+*	Each thread keeps its own deque of directories to be searched, taking
+*	the newest of them first, and steals the oldest directory of another
+*	thread when its own deque is empty.
+*
+* Returns
+*	The number of matching pathnames passed to 'fn', or -1 on error, in
+*	which case 'errno' is set.  If 'fn' returns nonzero, the search stops.
+*
+* Caveats
+*	'fn' is only ever called by the calling thread, one pathname at a time,
+*	while the search threads keep running.  The pathnames arrive in no
+*	particular order.
+*
+*	Without threads (or without POSIX), this is the same as fpattern_glob().
+*
+* See also
+*	fpattern_glob().
+*/
+
+long fpattern_glob_mt(const char *pat, int flags, int nthreads,
+    fpattern_glob_f fn, void *arg)
+{
+#if THREADS
+    struct fpat_glob	g;
+    struct fpat_glob *	gs;
+    struct fpat_walk	w;
+    struct fpat_result *	r;
+    struct fpat_deque *	dq;
+    size_t		len;
+    long		count;
+    int			act[2];
+    int			started;
+    int			i, j;
+
+    DL(printf("fpattern_glob_mt: pat=%p:\"%s\", nthreads=%d\n",
+        pat, pat ? pat : "", nthreads));
+
+    /* Check args */
+    if (pat == NULL)
+    {
+        errno = EINVAL;
+        return (-1);
+    }
+
+    if (nthreads <= 0)
+        nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > FPGLOB_MAXT)
+        nthreads = FPGLOB_MAXT;
+
+    /* Split the pattern into segments, shared by all of the threads */
+    count = 0;
+    memset(&g, 0, sizeof(g));
+    len = strlen(pat);
+    g.dirs = (len > 0  &&  pat[len-1] == DEL);
+    g.err = fpglob_split(&g, pat);
+    if (g.err != 0  ||  g.nsegs == 0)
+        goto done;
+
+    memset(&w, 0, sizeof(w));
+    w.nthreads = nthreads;
+    w.head = &w.stub;
+    w.tail = &w.stub;
+    w.deques = (struct fpat_deque *) calloc(nthreads, sizeof(struct fpat_deque));
+    gs = (struct fpat_glob *) calloc(nthreads, sizeof(struct fpat_glob));
+    if (w.deques == NULL  ||  gs == NULL)
+    {
+        free(w.deques);
+        free(gs);
+        g.err = ENOMEM;
+        goto done;
+    }
+
+    for (i = 0;  i < nthreads;  i++)
+    {
+        pthread_mutex_init(&w.deques[i].lock, NULL);
+        gs[i].nsegs = g.nsegs;
+        gs[i].segs = g.segs;
+        gs[i].bufs = (char **) calloc(g.nsegs, sizeof(char *));
+        gs[i].dirs = g.dirs;
+        gs[i].flags = flags;
+        gs[i].w = &w;
+        gs[i].id = i;
+        if (gs[i].bufs == NULL)
+            w.err = ENOMEM;
+    }
+
+    /* Start from the root or current directory */
+    if (w.err == 0)
+    {
+        if (pat[0] == DEL  &&  fpglob_push(&gs[0], "/", 1) == (size_t) -1)
+            w.err = ENOMEM;
+        else
+            fpglob_give(&gs[0], act, fpglob_add(&g, act, 0, 0));
+        if (gs[0].err != 0)
+            w.err = gs[0].err;
+    }
+
+    /* Start the search threads */
+    for (started = 0;  started < nthreads  &&  w.err == 0;  started++)
+    {
+        if (pthread_create(&gs[started].tid, NULL, fpglob_worker,
+            &gs[started]) != 0)
+            break;
+    }
+    if (started == 0  &&  w.err == 0)
+        w.err = EAGAIN;
+
+    /* Threads that did not start are finished; the others steal their work */
+    __atomic_add_fetch(&w.done, nthreads - started, __ATOMIC_ACQ_REL);
+
+    /* Pass the matching pathnames to the callback as they arrive */
+    count = 0;
+    for (;;)
+    {
+        r = fpglob_dequeue(&w);
+        if (r == NULL)
+        {
+            if (__atomic_load_n(&w.done, __ATOMIC_ACQUIRE) < nthreads)
+            {
+                fpglob_idle();
+                continue;
+            }
+
+            /* All threads are finished, so take any last results */
+            r = fpglob_dequeue(&w);
+            if (r == NULL)
+                break;
+        }
+
+        if (!__atomic_load_n(&w.stop, __ATOMIC_ACQUIRE))
+        {
+            count++;
+            if (fn != NULL  &&  fn(r->path, r->len, arg) != 0)
+                __atomic_store_n(&w.stop, true, __ATOMIC_RELEASE);
+        }
+        free(r);
+    }
+
+    /* Clean up */
+    for (i = 0;  i < started;  i++)
+        pthread_join(gs[i].tid, NULL);
+
+    for (i = 0;  i < nthreads;  i++)
+    {
+        dq = &w.deques[i];
+        for (j = (int) dq->head;  j < (int) dq->tail;  j++)
+            free(dq->items[j]);
+        free(dq->items);
+        pthread_mutex_destroy(&dq->lock);
+
+        gs[i].segs = NULL;
+        gs[i].nsegs = (gs[i].bufs != NULL ? g.nsegs : 0);
+        fpglob_free(&gs[i]);
+    }
+    free(w.deques);
+    free(gs);
+    g.err = w.err;
+
+done:
+    fpglob_free(&g);
+
+    if (g.err != 0)
+    {
+        errno = g.err;
+        return (-1);
+    }
+    return (g.nsegs == 0 ? 0 : count);
+#else
+    (void) nthreads;
+
+    return (fpattern_glob(pat, flags, fn, arg));
+#endif
+}
+
+
+/*------------------------------------------------------------------------------
+*/
+/*------------------------------------------------------------------------------
+*/
+/*------------------------------------------------------------------------------
+*/
+
+
+#if TEST
+
+/* Local variables */
+
+static int	count =	0;
+static int	fails =	0;
+
+
+/*------------------------------------------------------------------------------
+* found()
+*	Prints a matching pathname.
+*/
+
+static int found(const char *path, size_t len, void *arg)
+{
+    (void) arg;
+
+    printf("    %.*s\n", (int) len, path);
+    return (0);
+}
+
+
+/*------------------------------------------------------------------------------
+* test()
+*	Globs pattern 'pat' within the test tree, and checks that 'expect'
+*	pathnames match.
+*/
+
+static void test(long expect, const char *pat)
+{
+    long	n;
+
+    count++;
+    printf("%3d. \"%s\"\n", count, pat);
+
+    n = fpattern_glob(pat, 0, found, NULL);
+    printf("    -> %ld, expected %ld: %s\n", n, expect,
+        n == expect ? "pass" : "FAIL ***");
+
+    if (n != expect)
+        fails++;
+
+    /* Check the parallel search too */
+    n = fpattern_glob_mt(pat, 0, 4, NULL, NULL);
+    printf("    -> %ld in parallel: %s\n\n", n,
+        n == expect ? "pass" : "FAIL ***");
+
+    if (n != expect)
+        fails++;
+}
+
+
+/*------------------------------------------------------------------------------
+* first()
+*	Stops a search at the first matching pathname.
+*/
+
+static int first(const char *path, size_t len, void *arg)
+{
+    (void) path;
+    (void) len;
+    (void) arg;
+
+    return (1);
+}
+
+
+/*------------------------------------------------------------------------------
+* main()
+*	Test driver.
+*/
+
+int main(int argc, char **argv)
+{
+    static const char *	files[] =
+    {
+        "a/b/c.txt", "a/b/d.c", "a/x/e.c", "a/.h.c", "b.c", "a/x/*", NULL
+    };
+    char	dir[] = "/tmp/fpglobXXXXXX";
+    char	buf[80];
+    char *	p;
+    int		fd;
+    int		i;
+
+    (void) argc;	/* Shut up lint */
+    (void) argv;	/* Shut up lint */
+
+    printf("==========================================\n");
+
+    /* Build a tree of test files */
+    if (mkdtemp(dir) == NULL  ||  chdir(dir) < 0)
+    {
+        perror(dir);
+        return (1);
+    }
+
+    for (i = 0;  files[i] != NULL;  i++)
+    {
+        strcpy(buf, files[i]);
+        for (p = buf;  (p = strchr(p, DEL)) != NULL;  p++)
+        {
+            *p = '\0';
+            mkdir(buf, 0777);
+            *p = DEL;
+        }
+        fd = open(buf, O_WRONLY | O_CREAT, 0666);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    test(2,	"a/*/*.c");
+    test(4,	"a/?/*");
+    test(1,	"a/x/\\*");
+    test(2,	"a/*/");
+    test(1,	"a/*.c");
+    test(1,	"a/b/c.txt");
+    test(1,	"a//b/c.txt");
+    test(0,	"a/b/c.txt/");
+    test(0,	"a/nope/*");
+    test(2,	"a/[bx]/*.c");
+    test(1,	"a/!b/e.c");
+    test(1,	"*.c");
+    test(2,	"*");
+    test(0,	"");
+    test(-1,	"a/[b");
+
+    test(4,	"**/*.c");
+    test(3,	"a/**/*.c");
+    test(1,	"a/**/**/e.c");
+    test(3,	"**/?/**/*.c");
+    test(2,	"**/a/**/?/*.c");
+    test(2,	"**/b/*");
+    test(7,	"a/**");
+    test(3,	"**/");
+    test(3,	"a/**/");
+    test(1,	"a/b/**/");
+    test(0,	"b.c/**/");
+
+    test(2,	"a/{b,x}/*.c");
+    test(2,	"a/*/{c.txt,d.c}");
+    test(-1,	"a/{b/c,x}.txt");
+
+    /* Stop at the first match */
+    count++;
+    i = (int) fpattern_glob_mt("a/*/*", 0, 0, first, NULL);
+    printf("%3d. stop -> %d: %s\n\n", count, i, i == 1 ? "pass" : "FAIL ***");
+    if (i != 1)
+        fails++;
+
+    /* Remove the test files */
+    for (i = 0;  files[i] != NULL;  i++)
+    {
+        strcpy(buf, files[i]);
+        unlink(buf);
+        while ((p = strrchr(buf, DEL)) != NULL)
+        {
+            *p = '\0';
+            rmdir(buf);
+        }
+    }
+    chdir("/");
+    rmdir(dir);
+
+    printf("%d tests, %d failures\n", count, fails);
+    return (fails == 0 ? 0 : 1);
+}
+
+#endif /* TEST */
+
+/* End fpglob.c */